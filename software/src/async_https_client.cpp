@@ -24,17 +24,130 @@
 #include "event_log_prefix.h"
 #include "main_dependencies.h"
 
+#include <esp_idf_version.h>
+
 #define ASYNC_HTTPS_CLIENT_TIMEOUT 15000
+#define ASYNC_HTTPS_CLIENT_IDLE_TIMEOUT 30000
 
 extern "C" esp_err_t esp_crt_bundle_attach(void *conf);
 
+struct IdleConnection {
+    esp_http_client_handle_t http_client = nullptr;
+    std::unique_ptr<unsigned char[]> cert;
+    std::vector<String> header_keys;
+    String host;
+    int cert_id = -1;
+    uint32_t idle_since = 0;
+};
+
+static IdleConnection idle_connections[ASYNC_HTTPS_CLIENT_MAX_IDLE_CONNECTIONS];
+static uint64_t idle_connections_task_id = 0;
+
+static void close_connection(esp_http_client_handle_t http_client)
+{
+    esp_http_client_close(http_client);
+    esp_http_client_cleanup(http_client);
+}
+
+static void close_idle_connection(IdleConnection &connection)
+{
+    close_connection(connection.http_client);
+
+    connection.http_client = nullptr;
+    connection.cert.reset();
+    connection.header_keys = std::vector<String>();
+    connection.host = String();
+}
+
+static void expire_idle_connections()
+{
+    bool connections_left = false;
+
+    for (IdleConnection &connection : idle_connections) {
+        if (connection.http_client == nullptr) {
+            continue;
+        }
+
+        if (deadline_elapsed(connection.idle_since + ASYNC_HTTPS_CLIENT_IDLE_TIMEOUT)) {
+            close_idle_connection(connection);
+        }
+        else {
+            connections_left = true;
+        }
+    }
+
+    if (!connections_left) {
+        task_scheduler.cancel(idle_connections_task_id);
+        idle_connections_task_id = 0;
+    }
+}
+
+static IdleConnection *find_idle_connection(const String &host, int cert_id)
+{
+    for (IdleConnection &connection : idle_connections) {
+        if (connection.http_client != nullptr && connection.cert_id == cert_id && connection.host == host) {
+            return &connection;
+        }
+    }
+
+    return nullptr;
+}
+
+static void park_connection(esp_http_client_handle_t http_client, std::unique_ptr<unsigned char[]> &&cert, std::vector<String> &&header_keys, const String &host, int cert_id)
+{
+    IdleConnection *slot = nullptr;
+
+    for (IdleConnection &connection : idle_connections) {
+        if (connection.http_client == nullptr) {
+            slot = &connection;
+            break;
+        }
+
+        // Replace the connection that is idle for the longest time if all slots are used.
+        if (slot == nullptr || millis() - connection.idle_since > millis() - slot->idle_since) {
+            slot = &connection;
+        }
+    }
+
+    if (slot->http_client != nullptr) {
+        close_idle_connection(*slot);
+    }
+
+    // The client that used the connection might be destroyed while it is idle.
+    esp_http_client_set_user_data(http_client, nullptr);
+
+    slot->http_client = http_client;
+    slot->cert = std::move(cert);
+    slot->header_keys = std::move(header_keys);
+    slot->host = host;
+    slot->cert_id = cert_id;
+    slot->idle_since = millis();
+
+    if (idle_connections_task_id == 0) {
+        idle_connections_task_id = task_scheduler.scheduleWithFixedDelay([]() {
+            expire_idle_connections();
+        }, 5_s);
+    }
+}
+
+static void report_error(std::function<void(AsyncHTTPSClientEvent *event)> &callback, AsyncHTTPSClientError error)
+{
+    AsyncHTTPSClientEvent async_event;
+
+    async_event.type = AsyncHTTPSClientEventType::Error;
+    async_event.error = error;
+    async_event.error_http_client = ESP_OK;
+    async_event.error_http_status = -1;
+
+    callback(&async_event);
+}
+
 AsyncHTTPSClient::~AsyncHTTPSClient()  {
     if (task_id != 0) {
         task_scheduler.cancel(task_id);
     }
     if (http_client != nullptr) {
-        esp_http_client_close(http_client);
-        esp_http_client_cleanup(http_client);
+        close_connection(http_client);
     }
 }
 
@@ -44,6 +157,10 @@ esp_err_t AsyncHTTPSClient::event_handler(esp_http_client_event_t *event)
     AsyncHTTPSClientEvent async_event;
     int http_status;
 
+    if (that == nullptr) {
+        return ESP_OK;
+    }
+
     switch (event->event_id) {
     case HTTP_EVENT_ERROR:
         async_event.type = AsyncHTTPSClientEventType::Error;
@@ -55,6 +172,8 @@ esp_err_t AsyncHTTPSClient::event_handler(esp_http_client_event_t *event)
         break;
 
     case HTTP_EVENT_ON_HEADER:
+        that->response_started = true;
+
         if (that->use_cookies) {
             for (int i = 0; event->header_key[i] != 0; i++) {
                 event->header_key[i] = tolower(event->header_key[i]);
@@ -63,9 +182,19 @@ esp_err_t AsyncHTTPSClient::event_handler(esp_http_client_event_t *event)
                 that->parse_cookie(event->header_value);
             }
         }
+
+        if (that->use_conditional_get) {
+            if (strcasecmp("etag", event->header_key) == 0) {
+                that->response_etag = event->header_value;
+            }
+            else if (strcasecmp("last-modified", event->header_key) == 0) {
+                that->response_last_modified = event->header_value;
+            }
+        }
         break;
 
     case HTTP_EVENT_ON_DATA:
+        that->response_started = true;
         that->last_async_alive = millis();
         http_status = esp_http_client_get_status_code(that->http_client);
 
@@ -103,67 +232,147 @@ esp_err_t AsyncHTTPSClient::event_handler(esp_http_client_event_t *event)
 static const char *https_prefix = "https://";
 static const size_t https_prefix_len = strlen(https_prefix);
 
+// Returns host and port of an HTTPS URL, used to look up idle connections.
+static String get_host(const char *url)
+{
+    const char *host = url + https_prefix_len;
+
+    return String(host, strcspn(host, "/?#"));
+}
+
 void AsyncHTTPSClient::fetch(const char *url, int cert_id, esp_http_client_method_t method, const char *body, int body_size, std::function<void(AsyncHTTPSClientEvent *event)> &&callback) {
+    Request request;
+
+    request.callback = std::move(callback);
+
+    // Headers set before this call belong to this request, even if it is queued.
+    request.headers = std::move(headers);
+    headers = std::vector<std::pair<String, String>>();
+
     if (strncmp(url, https_prefix, https_prefix_len) != 0) {
-        error_abort(AsyncHTTPSClientError::NoHTTPSURL);
+        report_error(request.callback, AsyncHTTPSClientError::NoHTTPSURL);
         return;
     }
 
     if (in_progress) {
-        error_abort(AsyncHTTPSClientError::Busy);
+        if (queued_requests.size() >= ASYNC_HTTPS_CLIENT_MAX_QUEUED_REQUESTS) {
+            report_error(request.callback, AsyncHTTPSClientError::Busy);
+            return;
+        }
+    }
+
+    request.url = url;
+    request.cert_id = cert_id;
+    request.method = method;
+
+    if (body != nullptr) {
+        request.body = String(body, body_size);
+    }
+
+    if (in_progress) {
+        queued_requests.push_back(std::move(request));
         return;
     }
 
-    this->callback = std::move(callback);
+    start(std::move(request));
+}
+
+void AsyncHTTPSClient::start(Request &&request)
+{
+    this->callback = std::move(request.callback);
     in_progress = true;
     abort_requested = false;
     received_len = 0;
+    response_started = false;
+    response_etag = String();
+    response_last_modified = String();
+    url = std::move(request.url);
+    host = get_host(url.c_str());
+    cert_id = request.cert_id;
+    owned_body = std::move(request.body);
+
+    IdleConnection *idle_connection = find_idle_connection(host, cert_id);
+
+    if (idle_connection != nullptr) {
+        http_client = idle_connection->http_client;
+        cert = std::move(idle_connection->cert);
+        http_client_header_keys = std::move(idle_connection->header_keys);
+
+        idle_connection->http_client = nullptr;
+        idle_connection->header_keys = std::vector<String>();
+        idle_connection->host = String();
+
+        connection_reused = true;
+        // Only idempotent requests may be sent again if the reused connection turns out to be dead.
+        resend_allowed = request.method == HTTP_METHOD_GET || request.method == HTTP_METHOD_HEAD;
+
+        for (const String &key : http_client_header_keys) {
+            esp_http_client_delete_header(http_client, key.c_str());
+        }
 
-    if (body != nullptr) {
-        owned_body = String(body, body_size);
-    }
-
-    esp_http_client_config_t http_config = {};
+        http_client_header_keys.clear();
 
-    http_config.method = method;
-    http_config.url = url;
-    http_config.event_handler = event_handler;
-    http_config.user_data = this;
-    http_config.is_async = true;
-    http_config.timeout_ms = 50;
-    http_config.buffer_size = 1024;
-    http_config.buffer_size_tx = 1024;
+        // Also removes the Content-Type header set for the body of the previous request.
+        esp_http_client_set_post_field(http_client, nullptr, 0);
 
-    if (cert_id < 0) {
-        http_config.crt_bundle_attach = esp_crt_bundle_attach;
+        if (esp_http_client_set_url(http_client, url.c_str()) != ESP_OK
+         || esp_http_client_set_method(http_client, request.method) != ESP_OK
+         || esp_http_client_set_user_data(http_client, this) != ESP_OK) {
+            error_abort(AsyncHTTPSClientError::HTTPClientInitFailed);
+            return;
+        }
     }
     else {
-#if MODULE_CERTS_AVAILABLE()
-        size_t cert_len = 0;
-        cert = certs.get_cert(static_cast<uint8_t>(cert_id), &cert_len);
+        connection_reused = false;
+
+        esp_http_client_config_t http_config = {};
+
+        http_config.method = request.method;
+        http_config.url = url.c_str();
+        http_config.event_handler = event_handler;
+        http_config.user_data = this;
+        http_config.is_async = true;
+        http_config.timeout_ms = 50;
+        http_config.buffer_size = 1024;
+        http_config.buffer_size_tx = 1024;
+
+#if defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS) && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        // Resume the TLS session if the connection has to be reestablished
+        // after the server closed it while it was idle.
+        http_config.save_client_session = true;
+#endif
 
-        if (cert == nullptr) {
-            error_abort(AsyncHTTPSClientError::NoCert);
-            return;
+        if (cert_id < 0) {
+            http_config.crt_bundle_attach = esp_crt_bundle_attach;
         }
+        else {
+#if MODULE_CERTS_AVAILABLE()
+            size_t cert_len = 0;
+            cert = certs.get_cert(static_cast<uint8_t>(cert_id), &cert_len);
 
-        http_config.cert_pem = (const char *)cert.get();
-        // http_config.skip_cert_common_name_check = true;
+            if (cert == nullptr) {
+                error_abort(AsyncHTTPSClientError::NoCert);
+                return;
+            }
+
+            http_config.cert_pem = (const char *)cert.get();
+            // http_config.skip_cert_common_name_check = true;
 #else
-        // defense in depth: it should not be possible to arrive here because in case
-        // that the certs module is not available the cert_id should always be -1
-        logger.printfln("Can't use custom certificate: certs module is not built into this firmware!");
+            // defense in depth: it should not be possible to arrive here because in case
+            // that the certs module is not available the cert_id should always be -1
+            logger.printfln("Can't use custom certificate: certs module is not built into this firmware!");
 
-        error_abort(AsyncHTTPSClientError::NoCert);
-        return;
+            error_abort(AsyncHTTPSClientError::NoCert);
+            return;
 #endif
-    }
+        }
 
-    http_client = esp_http_client_init(&http_config);
+        http_client = esp_http_client_init(&http_config);
 
-    if (http_client == nullptr) {
-        error_abort(AsyncHTTPSClientError::HTTPClientInitFailed);
-        return;
+        if (http_client == nullptr) {
+            error_abort(AsyncHTTPSClientError::HTTPClientInitFailed);
+            return;
+        }
     }
 
     if (owned_body.length() > 0 && esp_http_client_set_post_field(http_client, owned_body.c_str(), owned_body.length())) {
@@ -172,17 +381,27 @@ void AsyncHTTPSClient::fetch(const char *url, int cert_id, esp_http_client_metho
     }
 
     if (cookies.length() > 0) {
-        if (esp_http_client_set_header(http_client, "cookie", cookies.c_str()) != ESP_OK) {
+        if (!set_request_header("cookie", cookies.c_str())) {
             error_abort(AsyncHTTPSClientError::HTTPClientSetCookieFailed);
             return;
         }
     }
-    if (headers.size() > 0) {
-        for (std::pair<String, String> header : headers) {
-            if (esp_http_client_set_header(http_client, header.first.c_str(), header.second.c_str()) != ESP_OK) {
-                error_abort(AsyncHTTPSClientError::HTTPClientSetCookieFailed);
-                return;
-            }
+    for (const std::pair<String, String> &header : request.headers) {
+        if (!set_request_header(header.first.c_str(), header.second.c_str())) {
+            error_abort(AsyncHTTPSClientError::HTTPClientSetHeaderFailed);
+            return;
+        }
+    }
+
+    if (use_conditional_get && request.method == HTTP_METHOD_GET && url == validators_url) {
+        if (etag.length() > 0 && !set_request_header("If-None-Match", etag.c_str())) {
+            error_abort(AsyncHTTPSClientError::HTTPClientSetHeaderFailed);
+            return;
+        }
+
+        if (last_modified.length() > 0 && !set_request_header("If-Modified-Since", last_modified.c_str())) {
+            error_abort(AsyncHTTPSClientError::HTTPClientSetHeaderFailed);
+            return;
         }
     }
 
@@ -191,6 +410,7 @@ void AsyncHTTPSClient::fetch(const char *url, int cert_id, esp_http_client_metho
     task_id = task_scheduler.scheduleWithFixedDelay([this]() {
         bool no_response = false;
         bool short_read = false;
+        bool not_modified = false;
         esp_err_t err = ESP_OK;
 
         if (!abort_requested && in_progress) {
@@ -205,13 +425,27 @@ void AsyncHTTPSClient::fetch(const char *url, int cert_id, esp_http_client_metho
                         return;
                     }
 
-                    if (err == ESP_OK && !esp_http_client_is_complete_data_received(http_client)) {
+                    if (err == ESP_ERR_HTTP_WRITE_DATA && connection_reused && resend_allowed && !response_started) {
+                        // The server reset the idle connection before the request could be written.
+                        // Closing the connection resets the client, the next perform connects again and sends the request.
+                        esp_http_client_close(http_client);
+                        connection_reused = false;
+                        last_async_alive = millis();
+                        return;
+                    }
+
+                    if (err == ESP_OK && use_conditional_get && esp_http_client_get_status_code(http_client) == 304) {
+                        not_modified = true;
+                    }
+                    else if (err == ESP_OK && !esp_http_client_is_complete_data_received(http_client)) {
                         short_read = true;
                     }
                 }
             }
         }
 
+        bool keep_connection = false;
+
         if (abort_requested) {
             AsyncHTTPSClientEvent async_event;
             async_event.type = AsyncHTTPSClientEventType::Aborted;
@@ -227,18 +461,59 @@ void AsyncHTTPSClient::fetch(const char *url, int cert_id, esp_http_client_metho
             error_abort(AsyncHTTPSClientError::HTTPClientError, err);
         }
         else if (in_progress) {
+            if (use_conditional_get && !not_modified && esp_http_client_get_status_code(http_client) == 200) {
+                validators_url = url;
+                etag = std::move(response_etag);
+                last_modified = std::move(response_last_modified);
+            }
+
+            keep_connection = true;
+
             AsyncHTTPSClientEvent async_event;
             async_event.type = AsyncHTTPSClientEventType::Finished;
+            async_event.not_modified = not_modified;
             this->callback(&async_event);
         }
 
-        clear();
+        clear(keep_connection);
 
         task_scheduler.cancel(task_scheduler.currentTaskId());
         task_id = 0;
+
+        start_next();
     }, 200_ms);
 }
 
+void AsyncHTTPSClient::start_next()
+{
+    while (!in_progress && !queued_requests.empty()) {
+        Request request = std::move(queued_requests.front());
+        queued_requests.pop_front();
+
+        if (queued_aborts > 0) {
+            --queued_aborts;
+
+            AsyncHTTPSClientEvent async_event;
+            async_event.type = AsyncHTTPSClientEventType::Aborted;
+            request.callback(&async_event);
+            continue;
+        }
+
+        start(std::move(request));
+    }
+}
+
+bool AsyncHTTPSClient::set_request_header(const char *key, const char *value)
+{
+    if (esp_http_client_set_header(http_client, key, value) != ESP_OK) {
+        return false;
+    }
+
+    http_client_header_keys.push_back(key);
+
+    return true;
+}
+
 void AsyncHTTPSClient::download_async(const char *url, int cert_id, std::function<void(AsyncHTTPSClientEvent *event)> &&callback)
 {
     fetch(url, cert_id, HTTP_METHOD_GET, nullptr, 0, std::move(callback));
@@ -283,17 +558,24 @@ void AsyncHTTPSClient::error_abort(AsyncHTTPSClientError error, esp_err_t error_
     callback(&async_event);
 }
 
-void AsyncHTTPSClient::clear()
+void AsyncHTTPSClient::clear(bool keep_connection)
 {
     if (http_client != nullptr) {
-        esp_http_client_close(http_client);
-        esp_http_client_cleanup(http_client);
+        if (keep_connection) {
+            park_connection(http_client, std::move(cert), std::move(http_client_header_keys), host, cert_id);
+        }
+        else {
+            close_connection(http_client);
+        }
+
         http_client = nullptr;
     }
 
     cert.reset();
-    headers = std::vector<std::pair<String, String>>();
+    http_client_header_keys = std::vector<String>();
     owned_body = String();
+    url = String();
+    host = String();
     in_progress = false;
 }
 
@@ -308,4 +590,7 @@ void AsyncHTTPSClient::parse_cookie(const char *cookie) {
 void AsyncHTTPSClient::abort_async()
 {
     abort_requested = true;
+
+    // Requests queued until now are aborted as well, requests queued later are still started.
+    queued_aborts = queued_requests.size();
 }
@@ -22,8 +22,14 @@
 #include <stdlib.h>
 #include <FS.h> // FIXME: without this include here there is a problem with the IPADDR_NONE define in <lwip/ip4_addr.h>
 #include <esp_http_client.h>
+#include <deque>
 #include <vector>
 
+// Finished connections are kept open for reuse by the next request to the same host.
+#define ASYNC_HTTPS_CLIENT_MAX_IDLE_CONNECTIONS 2
+// Requests started while another one is in progress are queued up to this limit, then Busy is reported.
+#define ASYNC_HTTPS_CLIENT_MAX_QUEUED_REQUESTS 4
+
 enum class AsyncHTTPSClientError
 {
     NoHTTPSURL,
@@ -68,6 +74,13 @@ struct AsyncHTTPSClientEvent
             ssize_t data_complete_len; // -1 if chunked response
             bool data_is_complete;
         };
+
+        // AsyncHTTPSClientEventType::Finished
+        struct {
+            // Only set if conditional GETs are enabled: The server answered 304,
+            // the resource did not change since the last download. No data was received.
+            bool not_modified;
+        };
     };
 };
 
@@ -83,25 +96,57 @@ public:
     void delete_async(const char *url, int cert_id, const char *body, int body_size, std::function<void(AsyncHTTPSClientEvent *event)> &&callback);
     void abort_async();
     void set_header(const char *key, const char *value);
-    bool is_busy() const { return in_progress; }
+    // Send the ETag and Last-Modified validators of the previous download of
+    // the same URL. Unchanged resources are then reported as a Finished
+    // event with not_modified set, without any Data events.
+    void set_conditional_get(bool enable) { use_conditional_get = enable; }
+    bool is_busy() const { return in_progress || !queued_requests.empty(); }
     void fetch(const char *url, int cert_id, esp_http_client_method_t method, const char *body, int body_size, std::function<void(AsyncHTTPSClientEvent *event)> &&callback);
 
 private:
+    struct Request {
+        String url;
+        int cert_id;
+        esp_http_client_method_t method;
+        String body;
+        std::vector<std::pair<String, String>> headers;
+        std::function<void(AsyncHTTPSClientEvent *event)> callback;
+    };
+
+    void start(Request &&request);
+    void start_next();
+    bool set_request_header(const char *key, const char *value);
     void error_abort(AsyncHTTPSClientError error, esp_err_t error_http_client = ESP_OK, int error_http_status = -1);
-    void clear();
+    void clear(bool keep_connection = false);
     void parse_cookie(const char *cookie);
     static esp_err_t event_handler(esp_http_client_event_t *event);
 
     std::unique_ptr<unsigned char[]> cert = nullptr;
     std::function<void(AsyncHTTPSClientEvent *event)> callback;
     std::vector<std::pair<String, String>> headers;
+    std::deque<Request> queued_requests;
+    size_t queued_aborts = 0;
     String cookies = "";
     String owned_body;
+    String url;
+    String host;
+    int cert_id = -1;
     bool in_progress = false;
     bool abort_requested = false;
     esp_http_client_handle_t http_client = nullptr;
+    // Names of the headers set on http_client, they have to be removed before it is reused.
+    std::vector<String> http_client_header_keys;
+    bool connection_reused = false;
+    bool resend_allowed = false;
+    bool response_started = false;
     uint32_t last_async_alive = 0;
     size_t received_len = 0;
     bool use_cookies;
+    bool use_conditional_get = false;
+    String validators_url;
+    String etag;
+    String last_modified;
+    String response_etag;
+    String response_last_modified;
     uint64_t task_id = 0;
 };
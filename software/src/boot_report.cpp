@@ -0,0 +1,190 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "boot_report.h"
+
+#include "event_log_prefix.h"
+#include "main_dependencies.h"
+#include "tools/malloc.h"
+
+BootReport boot_report;
+
+static const char *const stage_names[BOOT_REPORT_STAGES] = {
+    "pre_init_us",
+    "pre_setup_us",
+    "setup_us",
+    "register_urls_us",
+    "register_events_us",
+};
+
+size_t BootReport::current_stage_index() const
+{
+    size_t index = static_cast<size_t>(boot_stage) - static_cast<size_t>(BootStage::PRE_INIT);
+    return index < BOOT_REPORT_STAGES ? index : SIZE_MAX;
+}
+
+void BootReport::set_module_count(size_t count)
+{
+    module_durations_us = static_cast<uint32_t (*)[BOOT_REPORT_STAGES]>(calloc_psram_or_dram(count, sizeof(*module_durations_us)));
+    module_count = module_durations_us == nullptr ? 0 : count;
+}
+
+void BootReport::record_module(size_t index, micros_t start)
+{
+    size_t stage = current_stage_index();
+
+    if (index < module_count && stage != SIZE_MAX) {
+        module_durations_us[index][stage] = (now_us() - start).as<uint32_t>();
+    }
+}
+
+void BootReport::record_stage(micros_t start)
+{
+    size_t stage = current_stage_index();
+
+    if (stage != SIZE_MAX) {
+        stage_durations_us[stage] = (now_us() - start).as<uint32_t>();
+    }
+}
+
+void BootReport::setup()
+{
+    module_prototype = Config::Object({
+        {"name",               Config::Str("", 0, 32)},
+        {"total_us",           Config::Uint32(0)},
+        {"pre_init_us",        Config::Uint32(0)},
+        {"pre_setup_us",       Config::Uint32(0)},
+        {"setup_us",           Config::Uint32(0)},
+        {"register_urls_us",   Config::Uint32(0)},
+        {"register_events_us", Config::Uint32(0)},
+    });
+
+    milestone_prototype = Config::Object({
+        {"name",      Config::Str("", 0, 32)},
+        {"uptime_ms", Config::Uint32(0)},
+    });
+
+    state = Config::Object({
+        {"boot_ms", Config::Uint32(0)},
+        {"stages", Config::Object({
+            {"pre_init_us",        Config::Uint32(0)},
+            {"pre_setup_us",       Config::Uint32(0)},
+            {"setup_us",           Config::Uint32(0)},
+            {"register_urls_us",   Config::Uint32(0)},
+            {"register_events_us", Config::Uint32(0)},
+        })},
+        {"modules", Config::Array({},
+            &module_prototype,
+            0, BOOT_REPORT_MAX_MODULES, Config::type_id<Config::ConfObject>()
+        )},
+        {"other_modules_us", Config::Uint32(0)},
+        {"milestones", Config::Array({},
+            &milestone_prototype,
+            0, BOOT_REPORT_MAX_MILESTONES, Config::type_id<Config::ConfObject>()
+        )},
+    });
+}
+
+void BootReport::finish(const char *const *module_names)
+{
+    state.get("boot_ms")->updateUint(now_us().to<millis_t>().as<uint32_t>());
+
+    for (size_t stage = 0; stage < BOOT_REPORT_STAGES; ++stage) {
+        state.get("stages")->get(stage_names[stage])->updateUint(stage_durations_us[stage]);
+    }
+
+    // Select the slowest modules. The others are only reported as a sum.
+    size_t slowest[BOOT_REPORT_MAX_MODULES];
+    uint32_t slowest_total[BOOT_REPORT_MAX_MODULES];
+    size_t slowest_count = 0;
+    uint32_t other_modules_us = 0;
+
+    for (size_t module = 0; module < module_count; ++module) {
+        uint32_t total = 0;
+        for (size_t stage = 0; stage < BOOT_REPORT_STAGES; ++stage) {
+            total += module_durations_us[module][stage];
+        }
+
+        size_t i = slowest_count;
+        if (i == BOOT_REPORT_MAX_MODULES) {
+            if (slowest_total[i - 1] >= total) {
+                other_modules_us += total;
+                continue;
+            }
+
+            other_modules_us += slowest_total[i - 1];
+            --i;
+        }
+        else {
+            ++slowest_count;
+        }
+
+        while (i > 0 && slowest_total[i - 1] < total) {
+            slowest[i] = slowest[i - 1];
+            slowest_total[i] = slowest_total[i - 1];
+            --i;
+        }
+
+        slowest[i] = module;
+        slowest_total[i] = total;
+    }
+
+    Config *modules = static_cast<Config *>(state.get("modules"));
+    for (size_t i = 0; i < slowest_count; ++i) {
+        Config *conf = static_cast<Config *>(modules->add());
+        conf->get("name")->updateString(module_names[slowest[i]]);
+        conf->get("total_us")->updateUint(slowest_total[i]);
+
+        for (size_t stage = 0; stage < BOOT_REPORT_STAGES; ++stage) {
+            conf->get(stage_names[stage])->updateUint(module_durations_us[slowest[i]][stage]);
+        }
+    }
+
+    state.get("other_modules_us")->updateUint(other_modules_us);
+
+    free_any(module_durations_us);
+    module_durations_us = nullptr;
+    module_count = 0;
+}
+
+void BootReport::add_milestone(const char *name)
+{
+    // The state is created in the register URLs stage.
+    if (boot_stage < BootStage::REGISTER_URLS || boot_stage == BootStage::PRE_REBOOT) {
+        return;
+    }
+
+    Config *milestones = static_cast<Config *>(state.get("milestones"));
+    size_t count = milestones->count();
+
+    for (size_t i = 0; i < count; ++i) {
+        if (milestones->get(i)->get("name")->asString() == name) {
+            return;
+        }
+    }
+
+    if (count >= BOOT_REPORT_MAX_MILESTONES) {
+        logger.printfln("Too many boot milestones, dropping %s", name);
+        return;
+    }
+
+    Config *conf = static_cast<Config *>(milestones->add());
+    conf->get("name")->updateString(name);
+    conf->get("uptime_ms")->updateUint(now_us().to<millis_t>().as<uint32_t>());
+}
@@ -0,0 +1,71 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "tools.h"
+
+#define BOOT_REPORT_STAGES 5 // PRE_INIT to REGISTER_EVENTS
+#define BOOT_REPORT_MAX_MODULES 16
+#define BOOT_REPORT_MAX_MILESTONES 8
+
+// Records how long each module needs in each boot stage and exposes the
+// slowest modules as info/boot_report. Milestones after the boot, for example
+// the first current allocation of the charge manager, are added to the same
+// report. Only used by the main task.
+//
+// The module setup itself stays sequential. Hardware probing can't overlap
+// yet: All Bricklets share one tf_hal on one SPI bus and tf_hal is not thread
+// safe, and the Ethernet setup depends on Arduino's lazy TCP/IP initialization
+// that the Wi-Fi setup also triggers.
+class BootReport final
+{
+public:
+    BootReport() {}
+
+    void set_module_count(size_t count);
+    void record_module(size_t index, micros_t start);
+    void record_stage(micros_t start);
+
+    // Creates the state. Call before registering it.
+    void setup();
+    // Fills the state at the end of the boot.
+    void finish(const char *const *module_names);
+
+    // Records the uptime when the milestone was reached for the first time.
+    void add_milestone(const char *name);
+
+    ConfigRoot state;
+
+private:
+    size_t current_stage_index() const;
+
+    uint32_t (*module_durations_us)[BOOT_REPORT_STAGES] = nullptr;
+    size_t module_count = 0;
+    uint32_t stage_durations_us[BOOT_REPORT_STAGES] = {};
+
+    Config module_prototype;
+    Config milestone_prototype;
+};
+
+extern BootReport boot_report;
@@ -100,6 +100,41 @@ bool Config::is_null() const
     return value.tag == ConfVariant::Tag::EMPTY;
 }
 
+Config::Config(ConfVariant &&val) : value(std::move(val)) {}
+
+Config::Config(const Config &cpy) : value(cpy.value) {}
+
+// Moving relocates the Config, for example when a slot buffer grows.
+Config::Config(Config &&cpy) : value(std::move(cpy.value)), owner(cpy.owner) {}
+
+Config &Config::operator=(const Config &cpy)
+{
+    this->value = cpy.value;
+
+    if (this->owner != 0) {
+        // The new value's children don't know their owner yet.
+        this->set_owner(this->owner);
+        ConfigRoot::set_dirty(this->owner);
+    }
+
+    return *this;
+}
+
+Config &Config::operator=(Config &&cpy)
+{
+    this->value = std::move(cpy.value);
+
+    if (this->owner == 0) {
+        this->owner = cpy.owner;
+    }
+    else {
+        this->set_owner(this->owner);
+        ConfigRoot::set_dirty(this->owner);
+    }
+
+    return *this;
+}
+
 Config Config::Str(const char *s, uint16_t minChars, uint16_t maxChars)
 {
     if (boot_stage < BootStage::PRE_SETUP)
@@ -370,7 +405,19 @@ Config::Wrap Config::add()
     // when ConfArray slots are moved, so asArray() must be called again.
     children = this->asArray();
 
+    size_t capacity = children.capacity();
     children.push_back(std::move(copy));
+
+    if (this->owner != 0) {
+        if (children.capacity() != capacity) {
+            // Growing the vector copied all children. The copies are untracked.
+            this->set_owner(this->owner);
+        }
+        else {
+            children.back().set_owner(this->owner);
+        }
+    }
+
     this->set_updated(0xFF);
     return Wrap(&children.back());
 }
@@ -548,7 +595,7 @@ inline bool Config::update_value<float, Config::ConfFloat>(float value, const ch
     conf->setVal(value);
 
     if (old_value != value)
-        this->value.updated = 0xFF;
+        this->set_updated(0xFF);
 
     return old_value != value;
 }
@@ -799,6 +846,24 @@ void Config::to_string_except(const char *const *keys_to_censor, size_t keys_to_
     }
 }
 
+size_t Config::cbor_length() const
+{
+    // Asserts checked in ::apply_visitor.
+    return Config::apply_visitor(cbor_length_visitor{}, value);
+}
+
+// Returns false if the StringWriter was too small.
+bool Config::to_cbor_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringWriter *sw) const
+{
+    // Asserts checked in ::apply_visitor.
+    if (sw->getRemainingLength() < cbor_length()) {
+        return false;
+    }
+
+    Config::apply_visitor(::to_cbor{sw, keys_to_censor, keys_to_censor_len}, value);
+    return true;
+}
+
 uint8_t Config::was_updated(uint8_t api_backend_flag)
 {
     ASSERT_MAIN_THREAD();
@@ -816,6 +881,15 @@ void Config::set_updated(uint8_t api_backend_flag)
 {
     ASSERT_MAIN_THREAD();
     value.updated |= api_backend_flag;
+
+    if (owner != 0 && api_backend_flag != 0)
+        ConfigRoot::set_dirty(owner);
+}
+
+void Config::set_owner(uint16_t owner)
+{
+    this->owner = owner;
+    Config::apply_visitor(set_children_owner{owner}, value);
 }
 
 void config_pre_init()
@@ -47,6 +47,7 @@ struct Config;
 #endif
 
 class StringBuilder;
+class StringWriter;
 
 void config_pre_init();
 void config_post_setup();
@@ -429,10 +430,25 @@ struct Config {
 
     ConfVariant value;
 
+    // Tracked ConfigRoot this Config belongs to, 0 if none. See ConfigRoot::track_updates.
+    // The owner belongs to the position in the tree, not to the value:
+    // Copies start untracked, assigning a new value keeps the owner.
+    uint16_t owner = 0;
+
+    Config() = default;
+    explicit Config(ConfVariant &&val);
+    Config(const Config &cpy);
+    Config(Config &&cpy);
+    Config &operator=(const Config &cpy);
+    Config &operator=(Config &&cpy);
+
     uint8_t was_updated(uint8_t api_backend_flag);
     void clear_updated(uint8_t api_backend_flag);
+    // Also marks the owning ConfigRoot as dirty.
     void set_updated(uint8_t api_backend_flag);
 
+    void set_owner(uint16_t owner);
+
     template<typename T>
     static int type_id()
     {
@@ -697,7 +713,7 @@ private:
         *target = value;
 
         if (old_value != value)
-            this->value.updated = 0xFF;
+            this->set_updated(0xFF);
 
         return old_value != value;
     }
@@ -780,6 +796,10 @@ public:
     String to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len) const;
     void to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const;
 
+    // Binary encoding for the web socket protocol. cbor_length is an upper bound.
+    size_t cbor_length() const;
+    bool to_cbor_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringWriter *sw) const;
+
     [[gnu::const]] static const Config *get_prototype_float_nan();
     [[gnu::const]] static const Config *get_prototype_int16_0();
     [[gnu::const]] static const Config *get_prototype_int32_0();
@@ -789,7 +809,7 @@ public:
     [[gnu::const]] static const Config *get_prototype_bool_false();
 };
 
-static_assert(sizeof(Config) == 4, "Config size unexpected!");
+static_assert(sizeof(Config) == 6, "Config size unexpected!");
 
 struct ConfigRoot : public Config {
 public:
@@ -814,6 +834,16 @@ public:
     void set_permit_null_updates(bool permit_null_updates);
     bool get_permit_null_updates();
 
+    // Assigns a dirty bit to this root that is set whenever the root or one
+    // of its children is updated. Untracked roots are always dirty.
+    void track_updates();
+    bool is_dirty() const;
+    void set_dirty();
+    void clear_dirty();
+
+    // Marks the root with the given Config::owner as dirty.
+    static void set_dirty(uint16_t owner);
+
     void update_from_copy(Config *copy);
 
     String update_from_file(File &&file);
@@ -857,7 +887,7 @@ struct ConfUnionPrototype {
     }
 };
 
-static_assert(sizeof(ConfigRoot) == 8, "Config size unexpected!");
+static_assert(sizeof(ConfigRoot) == 12, "Config size unexpected!");
 
 struct ConfUnionPrototypeInternal {
     uint8_t tag;
@@ -92,6 +92,8 @@ Config::ConfUnion::~ConfUnion()
         return;
 
     auto *slot = this->getSlot();
+    // The slot is reused by the next union, which might not be tracked.
+    slot->val.owner = 0;
     slot->val = *Config::Null();
     slot->tag = 0;
     slot->prototypes_len = 0;
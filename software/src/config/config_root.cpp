@@ -18,6 +18,9 @@
  */
 
 #include "config/private.h"
+
+#include <limits>
+
 #include "config/visitors.h"
 
 ConfigRoot::ConfigRoot() : validator(nullptr) {}
@@ -154,6 +157,11 @@ void ConfigRoot::update_from_copy(Config *copy)
 {
     ASSERT_MAIN_THREAD();
     this->value = copy->value;
+
+    if (this->owner != 0) {
+        this->set_owner(this->owner);
+        ConfigRoot::set_dirty(this->owner);
+    }
 }
 
 OwnedConfig ConfigRoot::get_owned_copy()
@@ -175,6 +183,43 @@ bool ConfigRoot::get_permit_null_updates() {
     return (((std::uintptr_t)this->validator) & 0x01) == 0;
 }
 
+// Indexed by Config::owner. Index 0 stands for untracked Configs.
+static std::vector<bool> dirty_roots(1, false);
+
+void ConfigRoot::track_updates() {
+    ASSERT_MAIN_THREAD();
+
+    if (this->owner == 0) {
+        if (dirty_roots.size() > std::numeric_limits<uint16_t>::max())
+            esp_system_abort("Too many tracked ConfigRoots!");
+
+        this->owner = static_cast<uint16_t>(dirty_roots.size());
+        dirty_roots.push_back(false);
+    }
+
+    this->set_owner(this->owner);
+    this->set_dirty();
+}
+
+bool ConfigRoot::is_dirty() const {
+    ASSERT_MAIN_THREAD();
+    return this->owner == 0 || dirty_roots[this->owner];
+}
+
+void ConfigRoot::set_dirty() {
+    ConfigRoot::set_dirty(this->owner);
+}
+
+void ConfigRoot::clear_dirty() {
+    ASSERT_MAIN_THREAD();
+    dirty_roots[this->owner] = false;
+}
+
+void ConfigRoot::set_dirty(uint16_t owner) {
+    ASSERT_MAIN_THREAD();
+    dirty_roots[owner] = true;
+}
+
 #ifdef DEBUG_FS_ENABLE
 void ConfigRoot::print_api_info(char *buf, size_t buf_size, size_t &written) {
     Config::apply_visitor(api_info{buf, buf_size, written}, this->value);
@@ -24,6 +24,8 @@
 #include "header_logger.h"
 
 #include "tools.h"
+#include "string_builder.h"
+#include "tools/cbor.h"
 
 struct default_validator {
     String operator()(const Config::ConfString &x) const
@@ -396,6 +398,142 @@ struct string_length_visitor {
     }
 };
 
+// Exact length of the encoding without censored keys, so an upper bound with censored keys.
+struct cbor_length_visitor {
+    size_t operator()(const Config::ConfString &x)
+    {
+        size_t len = x.getVal()->length();
+        return cbor_head_length(len) + len;
+    }
+    size_t operator()(const Config::ConfFloat &x)
+    {
+        return cbor_float_length(x.getVal());
+    }
+    size_t operator()(const Config::ConfInt &x)
+    {
+        return cbor_int_length(*x.getVal());
+    }
+    size_t operator()(const Config::ConfUint &x)
+    {
+        return cbor_head_length(*x.getVal());
+    }
+    size_t operator()(const Config::ConfBool &x)
+    {
+        return 1;
+    }
+    size_t operator()(const Config::ConfVariant::Empty &x)
+    {
+        return 1;
+    }
+    size_t operator()(const Config::ConfArray &x)
+    {
+        const auto *val = x.getVal();
+        const auto size = val->size();
+
+        size_t sum = cbor_head_length(size);
+        for (size_t i = 0; i < size; ++i) {
+            sum += Config::apply_visitor(cbor_length_visitor{}, (*val)[i].value);
+        }
+
+        return sum;
+    }
+    size_t operator()(const Config::ConfObject &x)
+    {
+        const auto *slot = x.getSlot();
+        const auto *schema = slot->schema;
+        const auto size = schema->length;
+
+        size_t sum = cbor_head_length(size);
+        for (size_t i = 0; i < size; ++i) {
+            sum += cbor_head_length(schema->keys[i].length) + schema->keys[i].length;
+            sum += Config::apply_visitor(cbor_length_visitor{}, slot->values[i].value);
+        }
+        return sum;
+    }
+    size_t operator()(const Config::ConfUnion &x)
+    {
+        return 1 + cbor_head_length(x.getTag()) + Config::apply_visitor(cbor_length_visitor{}, x.getVal()->value);
+    }
+};
+
+struct to_cbor {
+    void operator()(const Config::ConfString &x)
+    {
+        const CoolString *val = x.getVal();
+        cbor_put_text(sw, val->c_str(), val->length());
+    }
+    void operator()(const Config::ConfFloat &x)
+    {
+        cbor_put_float(sw, x.getVal());
+    }
+    void operator()(const Config::ConfInt &x)
+    {
+        cbor_put_int(sw, *x.getVal());
+    }
+    void operator()(const Config::ConfUint &x)
+    {
+        cbor_put_head(sw, CBOR_MAJOR_UINT, *x.getVal());
+    }
+    void operator()(const Config::ConfBool &x)
+    {
+        sw->putc(static_cast<char>(*x.getVal() ? CBOR_TRUE : CBOR_FALSE));
+    }
+    void operator()(const Config::ConfVariant::Empty &x)
+    {
+        sw->putc(static_cast<char>(CBOR_NULL));
+    }
+    void operator()(const Config::ConfArray &x)
+    {
+        const auto *val = x.getVal();
+        const auto size = val->size();
+
+        cbor_put_head(sw, CBOR_MAJOR_ARRAY, size);
+        for (size_t i = 0; i < size; ++i) {
+            Config::apply_visitor(to_cbor{sw, keys_to_censor, keys_to_censor_len}, (*val)[i].value);
+        }
+    }
+    void operator()(const Config::ConfObject &x)
+    {
+        const auto *slot = x.getSlot();
+        const auto *schema = slot->schema;
+        const auto size = schema->length;
+
+        cbor_put_head(sw, CBOR_MAJOR_MAP, size);
+        for (size_t i = 0; i < size; ++i) {
+            const char *key = schema->keys[i].val;
+            const Config &child = slot->values[i];
+
+            cbor_put_text(sw, key, schema->keys[i].length);
+
+            bool censored = false;
+            for (size_t ktc = 0; ktc < keys_to_censor_len; ++ktc) {
+                // Same as in to_json: Comparing the pointers is enough.
+                if (key == keys_to_censor[ktc] && !(child.is<Config::ConfString>() && child.asString().length() == 0)) {
+                    censored = true;
+                    break;
+                }
+            }
+
+            if (censored) {
+                sw->putc(static_cast<char>(CBOR_NULL));
+                continue;
+            }
+
+            Config::apply_visitor(to_cbor{sw, keys_to_censor, keys_to_censor_len}, child.value);
+        }
+    }
+    void operator()(const Config::ConfUnion &x)
+    {
+        cbor_put_head(sw, CBOR_MAJOR_ARRAY, 2);
+        cbor_put_head(sw, CBOR_MAJOR_UINT, x.getTag());
+        Config::apply_visitor(to_cbor{sw, keys_to_censor, keys_to_censor_len}, x.getVal()->value);
+    }
+
+    StringWriter *sw;
+    const char *const *keys_to_censor;
+    size_t keys_to_censor_len;
+};
+
 struct json_length_visitor {
     size_t operator()(const Config::ConfString &x)
     {
@@ -1011,6 +1149,47 @@ struct set_updated_false {
     uint8_t api_backend_flag;
 };
 
+struct set_children_owner {
+    void operator()(Config::ConfString &x)
+    {
+    }
+    void operator()(Config::ConfFloat &x)
+    {
+    }
+    void operator()(Config::ConfInt &x)
+    {
+    }
+    void operator()(Config::ConfUint &x)
+    {
+    }
+    void operator()(Config::ConfBool &x)
+    {
+    }
+    void operator()(const Config::ConfVariant::Empty &x)
+    {
+    }
+    void operator()(Config::ConfArray &x)
+    {
+        for (Config &c : *x.getVal()) {
+            c.set_owner(owner);
+        }
+    }
+    void operator()(Config::ConfObject &x)
+    {
+        const auto *slot = x.getSlot();
+        const auto size = slot->schema->length;
+
+        for (size_t i = 0; i < size; ++i) {
+            slot->values[i].set_owner(owner);
+        }
+    }
+    void operator()(Config::ConfUnion &x)
+    {
+        x.getVal()->set_owner(owner);
+    }
+    uint16_t owner;
+};
+
 struct to_owned {
     OwnedConfig operator()(const Config::ConfString &x)
     {
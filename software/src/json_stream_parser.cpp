@@ -0,0 +1,542 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "json_stream_parser.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+void JsonStreamParser::reset()
+{
+    state = State::Value;
+    error = nullptr;
+    depth = 0;
+    token_len = 0;
+    token_overflow = false;
+    high_surrogate = 0;
+}
+
+bool JsonStreamParser::fail(const char *message)
+{
+    state = State::Error;
+    error = message;
+
+    return false;
+}
+
+bool JsonStreamParser::begin_container(bool array)
+{
+    if (depth >= JSON_STREAM_PARSER_MAX_DEPTH) {
+        return fail("Maximum nesting depth exceeded");
+    }
+
+    Frame &frame = frames[depth++];
+
+    frame.array = array;
+    frame.index = 0;
+    frame.key[0] = '\0';
+
+    state = array ? State::ValueOrArrayEnd : State::KeyOrObjectEnd;
+
+    return true;
+}
+
+bool JsonStreamParser::end_container(bool array)
+{
+    if (depth == 0 || frames[depth - 1].array != array) {
+        return fail(array ? "Unexpected ']'" : "Unexpected '}'");
+    }
+
+    --depth;
+    end_value();
+
+    return true;
+}
+
+// Called after a complete value, including objects and arrays.
+void JsonStreamParser::end_value()
+{
+    if (depth == 0) {
+        state = State::Done;
+        return;
+    }
+
+    if (frames[depth - 1].array) {
+        ++frames[depth - 1].index;
+    }
+
+    state = State::CommaOrEnd;
+}
+
+bool JsonStreamParser::end_string()
+{
+    if (high_surrogate != 0) {
+        append_codepoint(0xFFFD);
+        high_surrogate = 0;
+    }
+
+    token[token_len] = '\0';
+
+    if (string_is_key) {
+        Frame &frame = frames[depth - 1];
+        size_t key_len = token_len < JSON_STREAM_PARSER_MAX_KEY_LENGTH ? token_len : JSON_STREAM_PARSER_MAX_KEY_LENGTH;
+
+        memcpy(frame.key, token, key_len);
+        frame.key[key_len] = '\0';
+
+        state = State::Colon;
+        return true;
+    }
+
+    value_callback(*this, JsonStreamValueType::String, token, token_len);
+    end_value();
+
+    return true;
+}
+
+bool JsonStreamParser::end_number()
+{
+    if (token_overflow) {
+        return fail("Number too long");
+    }
+
+    token[token_len] = '\0';
+
+    // strtod accepts more than JSON allows (for example hex, inf and a leading '+'),
+    // but the number chars were already restricted while reading the token.
+    char *end = nullptr;
+    const char *start = token[0] == '-' ? token + 1 : token;
+
+    if (*start < '0' || *start > '9') {
+        return fail("Invalid number");
+    }
+
+    strtod(token, &end);
+
+    if (end != token + token_len) {
+        return fail("Invalid number");
+    }
+
+    value_callback(*this, JsonStreamValueType::Number, token, token_len);
+    end_value();
+
+    return true;
+}
+
+void JsonStreamParser::append_token(char c)
+{
+    if (!token_overflow && token_len < JSON_STREAM_PARSER_MAX_TOKEN_LENGTH) {
+        token[token_len++] = c;
+    }
+    else {
+        token_overflow = true;
+    }
+}
+
+void JsonStreamParser::append_codepoint(uint32_t codepoint)
+{
+    char buf[4];
+    size_t len;
+
+    if (codepoint < 0x80) {
+        buf[0] = static_cast<char>(codepoint);
+        len = 1;
+    }
+    else if (codepoint < 0x800) {
+        buf[0] = static_cast<char>(0xC0 | (codepoint >> 6));
+        buf[1] = static_cast<char>(0x80 | (codepoint & 0x3F));
+        len = 2;
+    }
+    else if (codepoint < 0x10000) {
+        buf[0] = static_cast<char>(0xE0 | (codepoint >> 12));
+        buf[1] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        buf[2] = static_cast<char>(0x80 | (codepoint & 0x3F));
+        len = 3;
+    }
+    else {
+        buf[0] = static_cast<char>(0xF0 | (codepoint >> 18));
+        buf[1] = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+        buf[2] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+        buf[3] = static_cast<char>(0x80 | (codepoint & 0x3F));
+        len = 4;
+    }
+
+    // Don't store partial UTF-8 sequences when truncating.
+    if (token_overflow || token_len + len > JSON_STREAM_PARSER_MAX_TOKEN_LENGTH) {
+        token_overflow = true;
+        return;
+    }
+
+    memcpy(token + token_len, buf, len);
+    token_len += len;
+}
+
+bool JsonStreamParser::parse(const char *data, size_t data_len)
+{
+    size_t i = 0;
+
+    while (i < data_len) {
+        char c = data[i];
+
+        switch (state) {
+        case State::Error:
+            return false;
+
+        case State::Done:
+            if (!is_whitespace(c)) {
+                return fail("Trailing characters after JSON value");
+            }
+            break;
+
+        case State::ValueOrArrayEnd:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c == ']') {
+                if (!end_container(true)) {
+                    return false;
+                }
+                break;
+            }
+
+            state = State::Value;
+            continue; // Parse c as value
+
+        case State::Value:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c == '{' || c == '[') {
+                if (!begin_container(c == '[')) {
+                    return false;
+                }
+            }
+            else if (c == '"') {
+                string_is_key = false;
+                token_len = 0;
+                token_overflow = false;
+                state = State::String;
+            }
+            else if (c == '-' || (c >= '0' && c <= '9')) {
+                token_len = 0;
+                token_overflow = false;
+                state = State::Number;
+                continue; // Parse c as part of the number
+            }
+            else if (c == 't' || c == 'f' || c == 'n') {
+                literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+                literal_type = c == 'n' ? JsonStreamValueType::Null : JsonStreamValueType::Bool;
+                literal_pos = 0;
+                state = State::Literal;
+                continue; // Parse c as part of the literal
+            }
+            else {
+                return fail("Unexpected character, expected value");
+            }
+            break;
+
+        case State::KeyOrObjectEnd:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c == '}') {
+                if (!end_container(false)) {
+                    return false;
+                }
+                break;
+            }
+
+            state = State::Key;
+            continue; // Parse c as key
+
+        case State::Key:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c != '"') {
+                return fail("Unexpected character, expected key");
+            }
+
+            string_is_key = true;
+            token_len = 0;
+            token_overflow = false;
+            state = State::String;
+            break;
+
+        case State::Colon:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c != ':') {
+                return fail("Unexpected character, expected ':'");
+            }
+
+            state = State::Value;
+            break;
+
+        case State::CommaOrEnd:
+            if (is_whitespace(c)) {
+                break;
+            }
+
+            if (c == ',') {
+                state = frames[depth - 1].array ? State::Value : State::Key;
+            }
+            else if (c == ']' || c == '}') {
+                if (!end_container(c == ']')) {
+                    return false;
+                }
+            }
+            else {
+                return fail("Unexpected character, expected ',' or end of object or array");
+            }
+            break;
+
+        case State::String: {
+            // Copy runs of plain characters at once.
+            size_t run = i;
+
+            while (run < data_len && data[run] != '"' && data[run] != '\\' && static_cast<uint8_t>(data[run]) >= 0x20) {
+                ++run;
+            }
+
+            if (run > i) {
+                if (high_surrogate != 0) {
+                    append_codepoint(0xFFFD);
+                    high_surrogate = 0;
+                }
+
+                size_t len = run - i;
+                size_t space = token_overflow ? 0 : JSON_STREAM_PARSER_MAX_TOKEN_LENGTH - token_len;
+
+                if (len > space) {
+                    // Don't cut a UTF-8 sequence in half.
+                    while (space > 0 && (static_cast<uint8_t>(data[i + space]) & 0xC0) == 0x80) {
+                        --space;
+                    }
+
+                    len = space;
+                    token_overflow = true;
+                }
+
+                memcpy(token + token_len, data + i, len);
+                token_len += len;
+                i = run;
+                continue;
+            }
+
+            if (c == '"') {
+                if (!end_string()) {
+                    return false;
+                }
+            }
+            else if (c == '\\') {
+                state = State::StringEscape;
+            }
+            else {
+                return fail("Control character in string");
+            }
+            break;
+        }
+
+        case State::StringEscape:
+            state = State::String;
+
+            if (c == 'u') {
+                unicode_codepoint = 0;
+                unicode_digits = 0;
+                state = State::StringUnicode;
+                break;
+            }
+
+            if (high_surrogate != 0) {
+                append_codepoint(0xFFFD);
+                high_surrogate = 0;
+            }
+
+            switch (c) {
+            case '"':  append_token('"');  break;
+            case '\\': append_token('\\'); break;
+            case '/':  append_token('/');  break;
+            case 'b':  append_token('\b'); break;
+            case 'f':  append_token('\f'); break;
+            case 'n':  append_token('\n'); break;
+            case 'r':  append_token('\r'); break;
+            case 't':  append_token('\t'); break;
+            default:
+                return fail("Invalid escape sequence");
+            }
+            break;
+
+        case State::StringUnicode: {
+            uint32_t digit;
+
+            if (c >= '0' && c <= '9') {
+                digit = static_cast<uint32_t>(c - '0');
+            }
+            else if (c >= 'a' && c <= 'f') {
+                digit = static_cast<uint32_t>(c - 'a' + 10);
+            }
+            else if (c >= 'A' && c <= 'F') {
+                digit = static_cast<uint32_t>(c - 'A' + 10);
+            }
+            else {
+                return fail("Invalid unicode escape sequence");
+            }
+
+            unicode_codepoint = (unicode_codepoint << 4) | digit;
+
+            if (++unicode_digits < 4) {
+                break;
+            }
+
+            state = State::String;
+
+            if (unicode_codepoint >= 0xD800 && unicode_codepoint <= 0xDBFF) {
+                if (high_surrogate != 0) {
+                    append_codepoint(0xFFFD);
+                }
+
+                high_surrogate = unicode_codepoint;
+            }
+            else if (unicode_codepoint >= 0xDC00 && unicode_codepoint <= 0xDFFF) {
+                if (high_surrogate != 0) {
+                    append_codepoint(0x10000 + ((high_surrogate - 0xD800) << 10) + (unicode_codepoint - 0xDC00));
+                    high_surrogate = 0;
+                }
+                else {
+                    append_codepoint(0xFFFD);
+                }
+            }
+            else {
+                if (high_surrogate != 0) {
+                    append_codepoint(0xFFFD);
+                    high_surrogate = 0;
+                }
+
+                append_codepoint(unicode_codepoint);
+            }
+            break;
+        }
+
+        case State::Number:
+            if (is_number_char(c)) {
+                append_token(c);
+                break;
+            }
+
+            if (!end_number()) {
+                return false;
+            }
+
+            continue; // c terminated the number, parse it in the new state
+
+        case State::Literal:
+            if (c != literal[literal_pos]) {
+                return fail("Invalid literal");
+            }
+
+            if (literal[++literal_pos] == '\0') {
+                value_callback(*this, literal_type, literal, literal_pos);
+                end_value();
+            }
+            break;
+        }
+
+        ++i;
+    }
+
+    return state != State::Error;
+}
+
+bool JsonStreamParser::finish()
+{
+    // A number at the top level is only terminated by the end of the data.
+    if (state == State::Number && depth == 0) {
+        if (!end_number()) {
+            return false;
+        }
+    }
+
+    if (state == State::Error) {
+        return false;
+    }
+
+    if (state != State::Done) {
+        return fail("Unexpected end of data");
+    }
+
+    return true;
+}
+
+bool JsonStreamParser::path_is(std::initializer_list<const char *> path) const
+{
+    if (path.size() != depth) {
+        return false;
+    }
+
+    size_t level = 0;
+
+    for (const char *key : path) {
+        const Frame &frame = frames[level++];
+
+        if (frame.array) {
+            if (key != nullptr) {
+                return false;
+            }
+        }
+        else if (key == nullptr || strcmp(frame.key, key) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool JsonStreamParser::to_int32(const char *value, int32_t *result)
+{
+    char *end = nullptr;
+
+    errno = 0;
+    long long parsed = strtoll(value, &end, 10);
+
+    if (errno != 0 || end == value || *end != '\0' || parsed < INT32_MIN || parsed > INT32_MAX) {
+        return false;
+    }
+
+    *result = static_cast<int32_t>(parsed);
+
+    return true;
+}
@@ -0,0 +1,137 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum nesting of objects and arrays.
+#define JSON_STREAM_PARSER_MAX_DEPTH 8
+// Longer keys are truncated.
+#define JSON_STREAM_PARSER_MAX_KEY_LENGTH 32
+// Longer strings are truncated, longer numbers are an error.
+#define JSON_STREAM_PARSER_MAX_TOKEN_LENGTH 128
+
+enum class JsonStreamValueType : uint8_t {
+    String,
+    Number,
+    Bool,
+    Null,
+};
+
+// Incremental JSON parser that can be fed with arbitrarily split chunks, for
+// example the data events of an AsyncHTTPSClient. Instead of building a
+// document, the callback is called for every scalar value. The position of the
+// value in the document can be queried from the parser passed to the callback.
+//
+// Memory usage is constant: Only the current key of each nesting level and the
+// current value are stored.
+class JsonStreamParser final
+{
+public:
+    // value is NUL-terminated. Bools are passed as "true" or "false", null as "null".
+    typedef std::function<void(const JsonStreamParser &parser, JsonStreamValueType type, const char *value, size_t value_len)> ValueCallback;
+
+    JsonStreamParser(ValueCallback &&value_callback) : value_callback(std::move(value_callback)) {}
+
+    void reset();
+
+    // Returns false if the data is not valid JSON. The parser then stays in the
+    // error state until reset is called.
+    bool parse(const char *data, size_t data_len);
+
+    // Returns true if exactly one complete JSON value was parsed.
+    bool finish();
+
+    const char *get_error() const { return error; }
+
+    // Number of objects and arrays that contain the current value.
+    size_t get_depth() const { return depth; }
+
+    bool is_array(size_t level) const { return frames[level].array; }
+
+    // Key of the current value in the object at the given level.
+    const char *get_key(size_t level) const { return frames[level].key; }
+
+    // Index of the current value in the array at the given level.
+    size_t get_index(size_t level) const { return frames[level].index; }
+
+    // Checks if the current value is located at the given path. Each entry
+    // matches the key in an object. nullptr matches any index in an array.
+    bool path_is(std::initializer_list<const char *> path) const;
+
+    // Parses value as an integer. Returns false on trailing characters or overflow.
+    static bool to_int32(const char *value, int32_t *result);
+
+private:
+    enum class State : uint8_t {
+        Value,
+        ValueOrArrayEnd,
+        KeyOrObjectEnd,
+        Key,
+        Colon,
+        CommaOrEnd,
+        String,
+        StringEscape,
+        StringUnicode,
+        Number,
+        Literal,
+        Done,
+        Error,
+    };
+
+    struct Frame {
+        bool array;
+        uint32_t index;
+        char key[JSON_STREAM_PARSER_MAX_KEY_LENGTH + 1];
+    };
+
+    bool fail(const char *message);
+    bool begin_container(bool array);
+    bool end_container(bool array);
+    void end_value();
+    bool end_string();
+    bool end_number();
+    void append_token(char c);
+    void append_codepoint(uint32_t codepoint);
+
+    ValueCallback value_callback;
+
+    State state = State::Value;
+    const char *error = nullptr;
+
+    Frame frames[JSON_STREAM_PARSER_MAX_DEPTH];
+    size_t depth = 0;
+
+    bool string_is_key = false;
+    char token[JSON_STREAM_PARSER_MAX_TOKEN_LENGTH + 1];
+    size_t token_len = 0;
+    bool token_overflow = false;
+
+    uint32_t unicode_codepoint = 0;
+    uint8_t unicode_digits = 0;
+    uint32_t high_surrogate = 0;
+
+    const char *literal = nullptr;
+    size_t literal_pos = 0;
+    JsonStreamValueType literal_type = JsonStreamValueType::Null;
+};
@@ -32,6 +32,9 @@
 #include "build.h"
 #include "tools.h"
 #include "tools/memory.h"
+#include "tools/heap_attribution.h"
+#include "tools/loop_profiler.h"
+#include "boot_report.h"
 
 #include "gcc_warnings.h"
 
@@ -40,6 +43,36 @@ BootStage boot_stage = BootStage::STATIC_INITIALIZATION;
 static IModule **loop_chain = nullptr;
 static size_t loop_chain_size = 0;
 static size_t loop_chain_head = 0;
+static const char **loop_chain_names = nullptr;
+
+#ifdef HEAP_ATTRIBUTION
+static std::vector<std::pair<const IModule *, uint8_t>> module_heap_tags;
+static uint8_t *loop_chain_heap_tags = nullptr;
+
+static void init_module_heap_tags(const std::vector<IModule *> &imodules, const std::vector<const char *> &names)
+{
+    module_heap_tags.reserve(imodules.size());
+    for (size_t i = 0; i < imodules.size() && i < names.size(); ++i) {
+        module_heap_tags.emplace_back(imodules[i], heap_attribution_get_tag(names[i]));
+    }
+}
+
+static uint8_t get_module_heap_tag(const IModule *imodule)
+{
+    for (const auto &entry : module_heap_tags) {
+        if (entry.first == imodule) {
+            return entry.second;
+        }
+    }
+
+    return HEAP_ATTRIBUTION_TAG_UNTAGGED;
+}
+
+// Attributes allocations until the end of the enclosing block to the module.
+#define MODULE_HEAP_SCOPE(imodule) HeapAttributionScope heap_scope{get_module_heap_tag(imodule)}
+#else
+#define MODULE_HEAP_SCOPE(imodule) do {} while (0)
+#endif
 
 static bool is_module_loop_overridden(const IModule *imodule) {
 #if defined(__GNUC__)
@@ -138,6 +171,9 @@ static void pre_reboot()
 {
     boot_stage = BootStage::PRE_REBOOT;
 
+    // The sink task might not run anymore before the reboot.
+    logger.begin_sync_serial();
+
     if (running_in_main_task()) {
 #if MODULE_WATCHDOG_AVAILABLE()
         watchdog.add("pre_reboot", pre_reboot_message, PRE_REBOOT_MAX_DURATION, 0, true);
@@ -184,6 +220,7 @@ static void register_default_urls() {
     }, true);
 
     api.addState("info/modules", &modules);
+    api.addState("info/boot_report", &boot_report.state);
 
     server.on_HTTPThread("/force_reboot", HTTP_GET, [](WebServerRequest request) {
         esp_unregister_shutdown_handler(pre_reboot);
@@ -311,6 +348,10 @@ void setup()
 {
     set_main_task_handle();
 
+#ifdef HEAP_ATTRIBUTION
+    heap_attribution_init();
+#endif
+
     boot_stage = BootStage::PRE_INIT;
 
     // Technically the serial console is already active, because the ESP's ROM bootloader prints some messages.
@@ -319,11 +360,25 @@ void setup()
 
     config_pre_init();
 
+    micros_t stage_start = now_us();
+
     std::vector<IModule *> imodules;
     modules_get_imodules(&imodules);
 
-    for (IModule *imodule : imodules) {
-        imodule->pre_init();
+    std::vector<const char *> imodule_names;
+    modules_get_imodule_names(&imodule_names);
+
+    boot_report.set_module_count(imodules.size());
+
+#ifdef HEAP_ATTRIBUTION
+    init_module_heap_tags(imodules, imodule_names);
+#endif
+
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        MODULE_HEAP_SCOPE(imodules[i]);
+        micros_t start = now_us();
+        imodules[i]->pre_init();
+        boot_report.record_module(i, start);
     }
 
     print_app_partitions();
@@ -334,16 +389,26 @@ void setup()
 
     check_memory_assumptions();
 
+    boot_report.record_stage(stage_start);
     boot_stage = BootStage::PRE_SETUP;
+    stage_start = now_us();
 
-    for (IModule *imodule : imodules) {
-        imodule->pre_setup();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        MODULE_HEAP_SCOPE(imodules[i]);
+        micros_t start = now_us();
+        imodules[i]->pre_setup();
+        boot_report.record_module(i, start);
     }
 
+    boot_report.record_stage(stage_start);
     boot_stage = BootStage::SETUP;
+    stage_start = now_us();
 
-    for (IModule *imodule : imodules) {
-        imodule->setup();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        MODULE_HEAP_SCOPE(imodules[i]);
+        micros_t start = now_us();
+        imodules[i]->setup();
+        boot_report.record_module(i, start);
     }
 
     modules = modules_get_init_config();
@@ -352,20 +417,33 @@ void setup()
     config_post_setup();
     server.post_setup();
 
+    boot_report.record_stage(stage_start);
     boot_stage = BootStage::REGISTER_URLS;
+    stage_start = now_us();
 
+    boot_report.setup();
     register_default_urls();
 
-    for (IModule *imodule : imodules) {
-        imodule->register_urls();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        MODULE_HEAP_SCOPE(imodules[i]);
+        micros_t start = now_us();
+        imodules[i]->register_urls();
+        boot_report.record_module(i, start);
     }
 
+    boot_report.record_stage(stage_start);
     boot_stage = BootStage::REGISTER_EVENTS;
+    stage_start = now_us();
 
-    for (IModule *imodule : imodules) {
-        imodule->register_events();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        MODULE_HEAP_SCOPE(imodules[i]);
+        micros_t start = now_us();
+        imodules[i]->register_events();
+        boot_report.record_module(i, start);
     }
 
+    boot_report.record_stage(stage_start);
+
     // Ignore non-overridden empty loop functions.
     for (IModule *imodule : imodules) {
         if (is_module_loop_overridden(imodule)) {
@@ -376,13 +454,24 @@ void setup()
     // Add all overridden loop functions to a circular list for round-robin execution.
     if (loop_chain_size > 0) {
         loop_chain = static_cast<IModule **>(malloc(sizeof(IModule*) * loop_chain_size));
+        loop_chain_names = static_cast<const char **>(malloc(sizeof(const char *) * loop_chain_size));
         size_t loop_chain_used = 0;
-        for (IModule *imodule : imodules) {
-            if (is_module_loop_overridden(imodule)) {
-                loop_chain[loop_chain_used] = imodule;
+        for (size_t i = 0; i < imodules.size(); ++i) {
+            if (is_module_loop_overridden(imodules[i])) {
+                loop_chain[loop_chain_used] = imodules[i];
+                loop_chain_names[loop_chain_used] = i < imodule_names.size() ? imodule_names[i] : "?";
                 ++loop_chain_used;
             }
         }
+
+        loop_profiler.set_module_names(loop_chain_names, loop_chain_size);
+
+#ifdef HEAP_ATTRIBUTION
+        loop_chain_heap_tags = static_cast<uint8_t *>(malloc(loop_chain_size));
+        for (size_t i = 0; i < loop_chain_size; ++i) {
+            loop_chain_heap_tags[i] = get_module_heap_tag(loop_chain[i]);
+        }
+#endif
     }
 
 #if MODULE_WATCHDOG_AVAILABLE()
@@ -393,6 +482,8 @@ void setup()
         logger.printfln("Failed to register reboot handler");
     }
 
+    boot_report.finish(imodule_names.data());
+
     boot_stage = BootStage::LOOP;
 }
 
@@ -406,7 +497,12 @@ void loop() {
 
     // Round-robin for modules' loop functions, to prioritize HAL ticks and scheduler.
     if (loop_chain != nullptr) {
+#ifdef HEAP_ATTRIBUTION
+        HeapAttributionScope heap_scope{loop_chain_heap_tags[loop_chain_head]};
+#endif
+        micros_t loop_start = loop_profiler.begin();
         loop_chain[loop_chain_head]->loop();
+        loop_profiler.record_module(loop_chain_head, loop_start);
         loop_chain_head = loop_chain_head + 1;
         if (loop_chain_head >= loop_chain_size) {
             loop_chain_head = 0;
@@ -19,6 +19,7 @@
 
 #include "api.h"
 
+#include <algorithm>
 #include <esp_task.h>
 #include <LittleFS.h>
 
@@ -90,58 +91,121 @@ void API::setup()
         bool skip_high_latency_states = state_update_counter % 4 != 0;
         ++state_update_counter;
 
-        for (size_t state_idx = 0; state_idx < states.size(); ++state_idx) {
-            auto &reg = states[state_idx];
+        update_states(skip_high_latency_states);
+    }, 250_ms, 250_ms);
 
-            if (skip_high_latency_states && !reg.low_latency)
-                continue;
+    initialized = true;
+}
 
-            size_t backend_count = this->backends.size();
+// Returns true if the state has to be checked again,
+// because not all backends accepted the update.
+bool API::update_state(size_t state_idx)
+{
+    auto &reg = states[state_idx];
 
-            uint8_t to_send = reg.config->was_updated((1 << backend_count) - 1);
-            // If the config was not updated for any API, we don't have to serialize the payload.
-            if (to_send == 0) {
-                continue;
-            }
+    size_t backend_count = this->backends.size();
 
-            auto wsu = IAPIBackend::WantsStateUpdate::No;
-            for (size_t backend_idx = 0; backend_idx < this->backends.size(); ++backend_idx) {
-                auto backend_wsu = this->backends[backend_idx]->wantsStateUpdate(state_idx);
-                if ((int) wsu < (int) backend_wsu) {
-                    wsu = backend_wsu;
-                }
-            }
-            // If no backend wants the state update because (for example)
-            // - this backend does not push state updates (HTTP)
-            // - there is no active connection (WS, MQTT)
-            // - there is no registration for this state index (MQTT)
-            // we don't have to do anything.
-            if (wsu == IAPIBackend::WantsStateUpdate::No) {
-                reg.config->clear_updated(0xFF);
-                continue;
-            }
+    uint8_t to_send = reg.config->was_updated((1 << backend_count) - 1);
+    // If the config was not updated for any API, we don't have to serialize the payload.
+    if (to_send == 0) {
+        return false;
+    }
 
-            String payload = "";
-            // If no backend wants the state update as string
-            // don't serialize the payload.
-            if (wsu == IAPIBackend::WantsStateUpdate::AsString)
-                payload = reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len);
+    auto wsu = IAPIBackend::WantsStateUpdate::No;
+    for (size_t backend_idx = 0; backend_idx < this->backends.size(); ++backend_idx) {
+        auto backend_wsu = this->backends[backend_idx]->wantsStateUpdate(state_idx);
+        if ((int) wsu < (int) backend_wsu) {
+            wsu = backend_wsu;
+        }
+    }
+    // If no backend wants the state update because (for example)
+    // - this backend does not push state updates (HTTP)
+    // - there is no active connection (WS, MQTT)
+    // - there is no registration for this state index (MQTT)
+    // we don't have to do anything.
+    if (wsu == IAPIBackend::WantsStateUpdate::No) {
+        reg.config->clear_updated(0xFF);
+        return false;
+    }
 
-            uint8_t sent = 0;
+    // A backend that holds the update back clears its flag in wantsStateUpdate.
+    to_send = reg.config->was_updated(to_send);
+    if (to_send == 0) {
+        return false;
+    }
+
+    String payload = "";
+    // If no backend wants the state update as string
+    // don't serialize the payload.
+    if (wsu == IAPIBackend::WantsStateUpdate::AsString)
+        payload = reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len);
+
+    uint8_t sent = 0;
 
-            for (size_t backend_idx = 0; backend_idx < this->backends.size(); ++backend_idx) {
-                if ((to_send & (1 << backend_idx)) == 0)
-                    continue;
+    for (size_t backend_idx = 0; backend_idx < this->backends.size(); ++backend_idx) {
+        if ((to_send & (1 << backend_idx)) == 0)
+            continue;
+
+        if (this->backends[backend_idx]->pushStateUpdate(state_idx, payload, reg.path))
+            sent |= 1 << backend_idx;
+    }
 
-                if (this->backends[backend_idx]->pushStateUpdate(state_idx, payload, reg.path))
-                    sent |= 1 << backend_idx;
+    reg.config->clear_updated(sent);
+
+    return (to_send & ~sent) != 0;
+}
+
+void API::update_states(bool skip_high_latency_states)
+{
+    for (size_t state_idx = 0; state_idx < states.size(); ++state_idx) {
+        auto &reg = states[state_idx];
+
+        if (skip_high_latency_states && !reg.low_latency)
+            continue;
+
+        // Only states that were updated since they were last checked.
+        if (!reg.config->is_dirty())
+            continue;
+
+        // Stays dirty if a backend did not accept the update, for example because of a send interval.
+        if (update_state(state_idx))
+            reg.config->set_dirty();
+        else
+            reg.config->clear_dirty();
+    }
+}
+
+void API::flushState(ConfigRoot *config)
+{
+    for (size_t state_idx = 0; state_idx < states.size(); ++state_idx) {
+        if (states[state_idx].config != config)
+            continue;
+
+        if (std::find(states_to_flush.begin(), states_to_flush.end(), state_idx) != states_to_flush.end())
+            return;
+
+        states_to_flush.push_back(state_idx);
+
+        if (states_to_flush.size() > 1)
+            return;
+
+        task_scheduler.scheduleOnce([this]() {
+            for (size_t flush_idx : states_to_flush) {
+                auto &reg = states[flush_idx];
+
+                if (update_state(flush_idx))
+                    reg.config->set_dirty();
+                else
+                    reg.config->clear_dirty();
             }
 
-            reg.config->clear_updated(sent);
-        }
-    }, 250_ms, 250_ms);
+            states_to_flush.clear();
+        });
 
-    initialized = true;
+        return;
+    }
+
+    logger.printfln("Can't flush unregistered state");
 }
 
 String API::getLittleFSConfigPath(const String &path, bool tmp) {
@@ -282,6 +346,9 @@ void API::addState(const char * const path, ConfigRoot *config, const std::vecto
 
     auto stateIdx = states.size() - 1;
 
+    // Also marks the state as dirty: The initial value was not sent yet.
+    config->track_updates();
+
     for (auto *backend : this->backends) {
         backend->addState(stateIdx, states[stateIdx]);
     }
@@ -767,6 +834,11 @@ size_t API::registerBackend(IAPIBackend *backend)
 
     backends.push_back(backend);
 
+    // Updates of states registered earlier were not yet sent to this backend.
+    for (auto &reg : states) {
+        reg.config->set_dirty();
+    }
+
     return backendIdx;
 }
 
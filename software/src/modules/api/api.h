@@ -133,6 +133,10 @@ public:
 
     size_t registerBackend(IAPIBackend *backend);
 
+    // Pushes the state with the next iteration of the main loop
+    // instead of waiting for the next state update check.
+    void flushState(ConfigRoot *config);
+
     std::vector<StateRegistration, IRAMAlloc<StateRegistration>> states;
     std::vector<CommandRegistration, IRAMAlloc<CommandRegistration>> commands;
     std::vector<ResponseRegistration, IRAMAlloc<ResponseRegistration>> responses;
@@ -149,6 +153,11 @@ private:
 
     void executeCommand(const CommandRegistration &reg, Config::ConfUpdate payload);
 
+    bool update_state(size_t state_idx);
+    void update_states(bool skip_high_latency_states);
+
+    std::vector<size_t> states_to_flush;
+
     Config features_prototype;
     Config modified_prototype;
 };
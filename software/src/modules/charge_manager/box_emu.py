@@ -6,6 +6,8 @@ import sys
 import time
 import ipaddress
 import math
+import random
+import argparse
 from dataclasses import dataclass, field
 
 """
@@ -21,6 +23,8 @@ from dataclasses import dataclass, field
         uint16_t allocated_current;
         /* command_flags
         bit 6    - control pilot permanently disconnected
+        bit 5    - change-driven: commands are only sent on change and as heartbeat
+        bit 4    - ack requested: answer with a state packet
         */
         uint8_t command_flags;
         uint8_t _padding;
@@ -32,12 +36,26 @@ from dataclasses import dataclass, field
         int8_t allocated_phases; // Was padding in CM_COMMAND_VERSION 1
     };
 
+    struct cm_command_v3 {
+        uint16_t last_seen_state_seq_num;
+        uint16_t _padding;
+    };
+
+    struct cm_command_v4 {
+        int32_t granted_raw[4];
+        int32_t granted_min[4];
+        int32_t granted_spread[4];
+        int32_t granted_max_pv;
+    };
+
     struct cm_command_packet {
         cm_packet_header header;
         union {
             cm_command_v1 v1;
             cm_command_v2 v2;
         };
+        cm_command_v3 v3;
+        cm_command_v4 v4;
     };
 
     struct cm_state_v1 {
@@ -92,25 +110,76 @@ from dataclasses import dataclass, field
         uint8_t padding[3];
     };
 
+    struct cm_state_v4 {
+        uint16_t last_seen_command_seq_num;
+        /* flags
+        bit 0 - ack requested: answer with a command packet
+        */
+        uint8_t flags;
+        uint8_t padding;
+    };
+
+    struct cm_state_v5 {
+        /* flags
+        bit 0 - sub-manager
+        */
+        uint8_t flags;
+        uint8_t padding;
+        uint16_t charger_count;
+        int32_t min_current[4];
+        int32_t requested_current[4];
+        int32_t max_current[4];
+    };
+
     struct cm_state_packet {
         cm_packet_header header;
         cm_state_v1 v1;
         cm_state_v2 v2;
         cm_state_v3 v3;
+        cm_state_v4 v4;
+        cm_state_v5 v5;
     } __attribute__((packed));
 """
 
 header_format = "<HHHBx"
-command_format = header_format + "HBb"
-COMMAND_VERSION = 2
-state_format = header_format + "IIIIHHBBBBffffffffffff" + "I" + "Bxxx"
-STATE_VERSION = 3
-
+command_format_v2 = header_format + "HBb"
+command_format_v3 = command_format_v2 + "Hxx"
+command_format = command_format_v3 + "13i"
+COMMAND_VERSION = 4
+state_format_v3 = header_format + "IIIIHHBBBBffffffffffff" + "I" + "Bxxx"
+state_format_v4 = state_format_v3 + "HBx"
+state_format = state_format_v4 + "BxH12i"
+STATE_VERSION = 5
+# Chargers don't send the sub-manager fields of version 5.
+STATE_VERSION_CHARGER = 4
+
+command_len_v2 = struct.calcsize(command_format_v2)
+command_len_v3 = struct.calcsize(command_format_v3)
 command_len = struct.calcsize(command_format)
+state_len_v3 = struct.calcsize(state_format_v3)
+state_len_v4 = struct.calcsize(state_format_v4)
 state_len = struct.calcsize(state_format)
 
-assert(command_len == 12)
-assert(state_len == 88)
+assert(command_len_v2 == 12)
+assert(command_len_v3 == 16)
+assert(command_len == 68)
+assert(state_len_v3 == 88)
+assert(state_len_v4 == 92)
+assert(state_len == 144)
+
+COMMAND_FLAGS_CPDISC = 0x40
+COMMAND_FLAGS_CHANGE_DRIVEN = 0x20
+COMMAND_FLAGS_ACK_REQUESTED = 0x10
+STATE_V4_FLAGS_ACK_REQUESTED = 0x01
+
+# Change-driven mode timing, see cm_networking.h
+STATE_HEARTBEAT_INTERVAL = 5
+STATE_MIN_INTERVAL = 0.5
+STATE_REPLY_DELAY = 0.3
+RETRANSMIT_TIMEOUT = 1
+
+def seq_num_acked(last_seen, sent):
+    return ((last_seen - sent) & 0xFFFF) < 0x8000
 
 @dataclass
 class Charger:
@@ -121,8 +190,10 @@ class Charger:
     # API
     uptime_blocked: bool = False
     seq_num_blocked: bool = False
-    expected_command_version = COMMAND_VERSION
-    state_version = STATE_VERSION
+    state_version = STATE_VERSION_CHARGER
+
+    # Probability to drop a sent or received packet
+    loss: float = 0
 
     managed: bool = True
     supported_current: int = 0
@@ -159,6 +230,21 @@ class Charger:
     req_allocated_current: int = 0
     req_allocated_phases: int = 0
     req_should_disconnect_cp: bool = False
+    req_last_seen_state_seq_num: int = 0
+
+    # Change-driven mode. Negotiated by sending version 4 states.
+    change_driven: bool = False
+    reply_pending: bool = False
+    reply_deadline: float = 0
+    state_ack_pending: bool = False
+    unacked_state_seq_num: int = 0
+    last_send: float = 0
+    last_sent_state: tuple = None
+
+    # Statistics
+    commands_received: int = 0
+    states_sent: int = 0
+    packets_dropped: int = 0
 
     # Internal
     _start: float = field(default_factory=lambda: time.time())
@@ -171,7 +257,20 @@ class Charger:
 
     def reset(self):
         self._sock.close()
-        self.__init__(self.uid, self.listen_addr, self.auto_mode)
+        self.__init__(self.uid, self.listen_addr, self.auto_mode, loss=self.loss)
+
+    # Values that make the firmware send a state immediately in the change-driven mode.
+    def relevant_state(self):
+        return (self.allowed_charging_current,
+                self.supported_current,
+                self.iec61851_state,
+                self.charger_state,
+                self.error_state,
+                self.managed,
+                self.cp_disconnect,
+                self.charging_time == 0,
+                self.allocated_phases,
+                tuple(self.line_currents))
 
     def tick(self):
         if self.auto_mode:
@@ -212,7 +311,28 @@ class Charger:
             self.time_since_state_change = time.time()
             self._last_iec61851_state = self.iec61851_state
 
-    def send(self):
+    # Sends a state if the change-driven mode requires one. Returns True if a state was sent.
+    def poll(self):
+        if self.manager_addr is None or not self.change_driven:
+            return False
+
+        now = time.monotonic()
+
+        if now - self.last_send < STATE_MIN_INTERVAL:
+            return False
+
+        changed = self.relevant_state() != self.last_sent_state
+        retransmit = self.state_ack_pending and now - self.last_send >= RETRANSMIT_TIMEOUT
+        reply = self.reply_pending and now >= self.reply_deadline
+        heartbeat = now - self.last_send >= STATE_HEARTBEAT_INTERVAL
+
+        if not (changed or retransmit or reply or heartbeat):
+            return False
+
+        self.send(request_ack=changed or self.state_ack_pending)
+        return True
+
+    def send(self, request_ack=False):
         if self.manager_addr is None:
             return
 
@@ -220,9 +340,8 @@ class Charger:
         flags |= 0x80 if self.managed else 0
         flags |= 0x40 if self.cp_disconnect else 0
 
-        b = struct.pack(state_format,
-                        34127, # magic
-                        state_len,
+        values = [34127, # magic
+                        state_len if self.state_version >= 5 else state_len_v4 if self.state_version >= 4 else state_len_v3,
                         self.next_seq_num,
                         self.state_version,
                         0xFF,  # features
@@ -242,13 +361,35 @@ class Charger:
                         self.energy_rel,  # energy_rel
                         self.energy_abs,  # energy_abs
                         int(1000 * (time.time() - self.time_since_state_change)),
-                        self.allocated_phases
-        )
+                        self.allocated_phases]
+
+        v4_values = [self.req_seq_num, STATE_V4_FLAGS_ACK_REQUESTED if request_ack else 0]
+
+        if self.state_version >= 5:
+            # A charger reports no aggregated state.
+            b = struct.pack(state_format, *values, *v4_values, 0, 0, *([0] * 12))
+        elif self.state_version >= 4:
+            b = struct.pack(state_format_v4, *values, *v4_values)
+        else:
+            b = struct.pack(state_format_v3, *values)
+
+        if request_ack:
+            self.state_ack_pending = True
+            self.unacked_state_seq_num = self.next_seq_num
 
         if not self.seq_num_blocked:
             self.next_seq_num += 1
             self.next_seq_num %= 65536
 
+        self.last_send = time.monotonic()
+        self.last_sent_state = self.relevant_state()
+        self.reply_pending = False
+        self.states_sent += 1
+
+        if random.random() < self.loss:
+            self.packets_dropped += 1
+            return
+
         self._sock.sendto(b, self.manager_addr)
 
     def recv(self):
@@ -256,22 +397,118 @@ class Charger:
             data, self.manager_addr = self._sock.recvfrom(command_len)
         except BlockingIOError:
             return False
-        if len(data) != command_len:
+
+        if random.random() < self.loss:
+            self.packets_dropped += 1
             return False
 
-        magic, length, seq_num, version, allocated_current, command_flags, allocated_phases = struct.unpack(command_format, data)
+        if len(data) == command_len:
+            magic, length, seq_num, version, allocated_current, command_flags, allocated_phases, last_seen_state_seq_num, *_grant = struct.unpack(command_format, data)
+        elif len(data) == command_len_v3:
+            magic, length, seq_num, version, allocated_current, command_flags, allocated_phases, last_seen_state_seq_num = struct.unpack(command_format_v3, data)
+        elif len(data) == command_len_v2:
+            magic, length, seq_num, version, allocated_current, command_flags, allocated_phases = struct.unpack(command_format_v2, data)
+            last_seen_state_seq_num = 0
+        else:
+            return False
 
-        if version != self.expected_command_version:
+        if version < 2 or version > COMMAND_VERSION:
             return False
 
+        self.commands_received += 1
+
+        change_driven = version >= 3 and self.state_version >= 4 and (command_flags & COMMAND_FLAGS_CHANGE_DRIVEN) != 0
+
+        if change_driven != self.change_driven:
+            self.change_driven = change_driven
+            self.state_ack_pending = False
+            self.reply_pending = False
+
+        if change_driven:
+            if self.state_ack_pending and seq_num_acked(last_seen_state_seq_num, self.unacked_state_seq_num):
+                self.state_ack_pending = False
+
+            if (command_flags & COMMAND_FLAGS_ACK_REQUESTED) != 0 and not self.reply_pending:
+                self.reply_pending = True
+                self.reply_deadline = time.monotonic() + STATE_REPLY_DELAY
+
+        self.req_last_seen_state_seq_num = last_seen_state_seq_num
         self.req_seq_num = seq_num
         self.req_version = version
         self.req_allocated_current = allocated_current
-        self.req_should_disconnect_cp = ((command_flags & 0x40) >> 6) == 1
+        self.req_should_disconnect_cp = (command_flags & COMMAND_FLAGS_CPDISC) != 0
         self.req_allocated_phases = allocated_phases
         return True
 
+def charger_for(listen_addr, loss, legacy):
+    charger = Charger(uid=struct.unpack('>I', ipaddress.ip_address(listen_addr).packed)[0], listen_addr=listen_addr, auto_mode=True, loss=loss)
+
+    if legacy:
+        charger.state_version = 3
+
+    return charger
+
+# Emulates the chargers without UI and prints the packet rates.
+# Use this to compare the legacy and the change-driven mode with many chargers.
+def run_headless(args):
+    chargers = [charger_for(addr, args.loss, args.legacy) for addr in args.listen_addrs]
+
+    next_legacy_send = [time.monotonic() + 2.5 * i / len(chargers) for i in range(len(chargers))]
+    next_report = time.monotonic() + args.report_interval
+    last_commands = 0
+    last_states = 0
+
+    while True:
+        now = time.monotonic()
+
+        for i, c in enumerate(chargers):
+            while c.recv():
+                # Legacy mode: Answer every command after the EVSE applied it.
+                if not c.change_driven:
+                    next_legacy_send[i] = min(next_legacy_send[i], now + STATE_REPLY_DELAY)
+
+            c.tick()
+
+            if c.change_driven:
+                c.poll()
+            elif now >= next_legacy_send[i]:
+                c.send()
+                next_legacy_send[i] = now + 2.5
+
+        if now >= next_report:
+            commands = sum(c.commands_received for c in chargers)
+            states = sum(c.states_sent for c in chargers)
+            change_driven = sum(1 for c in chargers if c.change_driven)
+            dropped = sum(c.packets_dropped for c in chargers)
+
+            print("{} chargers ({} change-driven): {:6.1f} commands/s, {:6.1f} states/s, {} packets dropped".format(
+                len(chargers), change_driven,
+                (commands - last_commands) / args.report_interval,
+                (states - last_states) / args.report_interval,
+                dropped))
+
+            last_commands = commands
+            last_states = states
+            next_report = now + args.report_interval
+
+        time.sleep(0.01)
+
 if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument('listen_addrs', nargs='+', help='one address per emulated charger')
+    parser.add_argument('--no-gui', action='store_true', help='run without UI and print packet rates')
+    parser.add_argument('--legacy', action='store_true', help='send version 3 states: don\'t negotiate the change-driven mode')
+    parser.add_argument('--loss', type=float, default=0, help='probability to drop a packet')
+    parser.add_argument('--report-interval', type=float, default=10)
+    args = parser.parse_args()
+
+    if args.no_gui:
+        try:
+            run_headless(args)
+        except KeyboardInterrupt:
+            pass
+        sys.exit(0)
+
     from PyQt5.QtWidgets import *
     from PyQt5.QtCore import QTimer, Qt
 
@@ -279,7 +516,7 @@ if __name__ == "__main__":
         def __init__(self, layout, row, col, listen_addr):
             self.hide_on_auto = True
 
-            self.state = Charger(uid=struct.unpack('>I', ipaddress.ip_address(listen_addr).packed)[0], listen_addr=listen_addr, auto_mode=True)
+            self.state = charger_for(listen_addr, args.loss, args.legacy)
 
             self.layout = layout
             self.row = row
@@ -298,6 +535,10 @@ if __name__ == "__main__":
             self.send_timer.timeout.connect(lambda: self.send())
             self.send_timer.start(2500)
 
+            self.poll_timer = QTimer()
+            self.poll_timer.timeout.connect(lambda: self.poll())
+            self.poll_timer.start(100)
+
         def addRow(self, title_or_widget, widget=None):
             if widget is None:
                 widget = title_or_widget
@@ -419,7 +660,7 @@ if __name__ == "__main__":
             self.resp_block_seq_num.stateChanged.connect(lambda x: setattr(self.state, "seq_num_blocked", x == Qt.CheckState.Checked))
             self.resp_charger_state.currentIndexChanged.connect(lambda x: setattr(self.state, "charger_state", x))
             self.resp_managed.stateChanged.connect(lambda x: setattr(self.state, "managed", x == Qt.CheckState.Checked))
-            self.resp_wrong_proto_version.stateChanged.connect(lambda x: setattr(self.state, "state_version", 0 if x == Qt.CheckState.Checked else STATE_VERSION))
+            self.resp_wrong_proto_version.stateChanged.connect(lambda x: setattr(self.state, "state_version", 0 if x == Qt.CheckState.Checked else STATE_VERSION_CHARGER))
 
             self.resp_supported_current.valueChanged.connect(lambda x: setattr(self.state, "supported_current", x * 1000))
             self.resp_error_state.valueChanged.connect(lambda x: setattr(self.state, "error_state", x))
@@ -450,11 +691,23 @@ if __name__ == "__main__":
             self.resp_iec61851_state.setCurrentIndex(self.state.iec61851_state)
 
         def receive(self):
-            if self.state.recv():
+            if self.state.recv() and not self.state.change_driven:
                 self.send_timer.start(2500)
                 self.send()
 
+        # Change-driven mode: States are sent on change and as heartbeat.
+        def poll(self):
+            if not self.state.change_driven:
+                return
+
+            self.state.tick()
+            if self.state.poll():
+                self.update_ui_from_state()
+
         def send(self):
+            if self.state.change_driven:
+                return
+
             self.state.tick()
             self.update_ui_from_state()
             self.state.send()
@@ -472,9 +725,9 @@ if __name__ == "__main__":
 
         window.setWidget(widget)
 
-        top_level.setWindowTitle(",".join(sys.argv[1:]))
+        top_level.setWindowTitle(",".join(args.listen_addrs))
 
-        charger_count = len(sys.argv) - 1
+        charger_count = len(args.listen_addrs)
         cols = math.ceil(charger_count / 13)
         rows = math.ceil(charger_count / cols)
 
@@ -484,7 +737,7 @@ if __name__ == "__main__":
 
         chargers = []
 
-        for i, listen_addr in enumerate(sys.argv[1:]):
+        for i, listen_addr in enumerate(args.listen_addrs):
             col = int(i % rows)
             row = int(i / rows) + last_row_counter
 
@@ -0,0 +1,134 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "cascade.h"
+
+void cascade_add_charger(CascadeDemand *demand, Cost phase_factors, int32_t min_current, int32_t requested_current, int32_t max_current, bool active, bool wants_to_charge)
+{
+    ++demand->chargers;
+
+    if (active)
+        demand->min += phase_factors * static_cast<int>(min_current);
+
+    if (!active && !wants_to_charge)
+        return;
+
+    // An active charger keeps at least its minimum current.
+    demand->requested += phase_factors * static_cast<int>(std::max(requested_current, active ? min_current : 0));
+    demand->max       += phase_factors * static_cast<int>(std::max({max_current, requested_current, active ? min_current : 0}));
+}
+
+// Adds up to want(i) to the grant of every demand on phase c.
+// Splits the budget proportionally if it is not sufficient. Returns the budget left over.
+template <typename WantFn>
+static int64_t distribute_step(int64_t budget, size_t c, CurrentLimits *grants, size_t count, WantFn want)
+{
+    int64_t total = 0;
+
+    for (size_t i = 0; i < count; ++i)
+        total += want(i);
+
+    if (total <= 0 || budget <= 0)
+        return budget;
+
+    if (total <= budget) {
+        for (size_t i = 0; i < count; ++i)
+            grants[i].raw[c] += static_cast<int>(want(i));
+
+        return budget - total;
+    }
+
+    // Rounding down makes sure the sum does not exceed the budget.
+    int64_t spent = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        int64_t share = want(i) * budget / total;
+        grants[i].raw[c] += static_cast<int>(share);
+        spent += share;
+    }
+
+    return budget - spent;
+}
+
+// Splits value in the same ratio as raw was split.
+static int scale(int value, int grant_raw, int limit_raw)
+{
+    if (limit_raw == 0)
+        return 0;
+
+    return static_cast<int>(static_cast<int64_t>(value) * grant_raw / limit_raw);
+}
+
+void cascade_distribute(const CurrentLimits *limits, const CascadeDemand *demands, size_t demand_count, CurrentLimits *grants)
+{
+    if (demand_count == 0)
+        return;
+
+    for (size_t c = 0; c < 4; ++c) {
+        int64_t budget = limits->raw[c];
+
+        for (size_t i = 0; i < demand_count; ++i)
+            grants[i].raw[c] = 0;
+
+        if (budget < 0) {
+            // Overloaded: The groups that currently use current have to shed the load.
+            int64_t total_min = 0;
+
+            for (size_t i = 0; i < demand_count; ++i)
+                total_min += std::max(0, demands[i].min[c]);
+
+            for (size_t i = 0; i < demand_count; ++i) {
+                int64_t share = total_min > 0 ? budget * std::max(0, demands[i].min[c]) / total_min : budget / static_cast<int64_t>(demand_count);
+                grants[i].raw[c] = static_cast<int>(share);
+            }
+        } else {
+            budget = distribute_step(budget, c, grants, demand_count, [demands, c](size_t i) {
+                return static_cast<int64_t>(std::max(0, demands[i].min[c]));
+            });
+
+            budget = distribute_step(budget, c, grants, demand_count, [demands, grants, c](size_t i) {
+                return static_cast<int64_t>(std::max(0, demands[i].requested[c] - grants[i].raw[c]));
+            });
+
+            distribute_step(budget, c, grants, demand_count, [demands, grants, c](size_t i) {
+                return static_cast<int64_t>(std::max(0, demands[i].max[c] - grants[i].raw[c]));
+            });
+        }
+
+        for (size_t i = 0; i < demand_count; ++i) {
+            grants[i].min[c]    = scale(limits->min[c],    grants[i].raw[c], limits->raw[c]);
+            grants[i].spread[c] = scale(limits->spread[c], grants[i].raw[c], limits->raw[c]);
+        }
+    }
+
+    for (size_t i = 0; i < demand_count; ++i)
+        grants[i].max_pv = scale(limits->max_pv, grants[i].raw.pv, limits->raw.pv);
+}
+
+void cascade_apply_grant(CurrentLimits *limits, const CurrentLimits *grant)
+{
+    for (size_t c = 0; c < 4; ++c) {
+        limits->raw[c]    = std::min(limits->raw[c],    grant->raw[c]);
+        limits->min[c]    = std::min(limits->min[c],    grant->min[c]);
+        limits->spread[c] = std::min(limits->spread[c], grant->spread[c]);
+    }
+
+    limits->max_pv = std::min(limits->max_pv, grant->max_pv);
+}
@@ -0,0 +1,53 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "current_limits.h"
+
+// Cascaded charge management: A sub-manager reports the demand of its chargers
+// to an upstream manager as one virtual charger. The upstream manager splits
+// its limits between the sub-managers and its own chargers, every sub-manager
+// then distributes its grant with the normal current allocator.
+//
+// All currents are in mA per grid phase. As in Cost, the PV "phase" is
+// the sum of all phases a charger uses.
+struct CascadeDemand {
+    Cost min;       // Keeps the active chargers running at their minimum current
+    Cost requested; // Current the chargers that want to charge can use now
+    Cost max;       // Current the chargers that want to charge can use at most
+    uint16_t chargers = 0;
+};
+
+void cascade_add_charger(CascadeDemand *demand, Cost phase_factors, int32_t min_current, int32_t requested_current, int32_t max_current, bool active, bool wants_to_charge);
+
+// Splits limits into one grant per demand.
+// Per phase every demand first gets its minimum, then its requested and then
+// its maximum current. If the limit is not sufficient for a step, the remaining
+// current is split proportionally. The sum of all grants does not exceed limits.
+// min, spread and max_pv are split in the same ratio as raw.
+void cascade_distribute(const CurrentLimits *limits, const CascadeDemand *demands, size_t demand_count, CurrentLimits *grants);
+
+// Limits the own limits of a sub-manager to the grant of its upstream manager.
+void cascade_apply_grant(CurrentLimits *limits, const CurrentLimits *grant);
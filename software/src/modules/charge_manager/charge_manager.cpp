@@ -24,17 +24,32 @@
 #include <esp_http_client.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <string.h> // For memcmp
 #include <time.h>
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "current_allocator.h"
+#include "cascade.h"
 #include "build.h"
 #include "tools.h"
 #include "cm_phase_rotation.enum.h"
+#include "boot_report.h"
 
 #define WATCHDOG_TIMEOUT_MS 30000
 
+// A sub-manager blocks its chargers if the upstream manager did not send a grant for this time.
+#define SUB_MANAGER_GRANT_TIMEOUT 30_s
+#define SUB_MANAGER_SEND_INTERVAL 250_ms
+
+// Run all stages of the allocator at least this often, even if no input changed.
+#define ALLOCATION_FORCE_INTERVAL 1_m
+
+extern uint32_t local_uid_num;
+
+#define CM_SEND_INTERVAL 50_ms
+#define CM_MAX_COMMANDS_PER_RUN 8
+
 // If this is an energy manager, we have exactly one charger and the margin is still the default,
 // double it to react faster if more current is available.
 #define REQUESTED_CURRENT_MARGIN_DEFAULT 3000
@@ -72,12 +87,14 @@ void ChargeManager::pre_setup()
     config_chargers_prototype = Config::Object({
         {"host", Config::Str("", 0, 64)},
         {"name", Config::Str("", 0, 32)},
-        {"rot", Config::Enum(CMPhaseRotation::Unknown)}
+        {"rot", Config::Enum(CMPhaseRotation::Unknown)},
+        {"sub_manager", Config::Bool(false)}
     });
 
     config = ConfigRoot{Config::Object({
         {"enable_charge_manager", Config::Bool(false)},
         {"enable_watchdog", Config::Bool(false)},
+        {"enable_sub_manager", Config::Bool(false)},
         {"default_available_current", Config::Uint32(0)},
         {"maximum_available_current", Config::Uint(0, 0, 32000 * MAX_CONTROLLED_CHARGERS)},
         {"minimum_current_auto", Config::Bool(true)},
@@ -225,6 +242,9 @@ void ChargeManager::pre_setup()
 
     low_level_state = Config::Object({
         {"last_hyst_reset", Config::Uint32(0)},
+        {"alloc_us", Config::Uint32(0)},      // Run time of the last allocation cycle
+        {"alloc_max_us", Config::Uint32(0)},  // Longest run time of an allocation cycle
+        {"alloc_skipped", Config::Uint32(0)}, // Allocation cycles that kept the last allocation because no input changed
         {"wnd_min", Config::Array({
                 Config::Int32(0),
                 Config::Int32(0),
@@ -307,8 +327,11 @@ void ChargeManager::start_manager_task()
 
     auto get_charger_name_fn = [this](uint8_t i){ return this->get_charger_name(i);};
 
-    cm_networking.register_manager(this->hosts.get(), config.get("chargers")->count(), [this, get_charger_name_fn](uint8_t client_id, cm_state_v1 *v1, cm_state_v2 *v2, cm_state_v3 *v3) mutable {
-            if (update_from_client_packet(
+    cm_networking.register_manager(this->hosts.get(), config.get("chargers")->count(), [this, get_charger_name_fn](uint8_t client_id, cm_state_v1 *v1, cm_state_v2 *v2, cm_state_v3 *v3, cm_state_v5 *v5) mutable {
+            const ChargerState old_state = this->charger_state[client_id];
+            const ChargerAllocationState old_alloc = this->charger_allocation_state[client_id];
+
+            bool updated = update_from_client_packet(
                     client_id,
                     v1,
                     v2,
@@ -318,29 +341,175 @@ void ChargeManager::start_manager_task()
                     this->charger_allocation_state,
                     this->hosts.get(),
                     get_charger_name_fn
-                    ))
+                    );
+
+            // A stale packet can still set the charger's error.
+            if (allocation_input_changed(&old_state, &old_alloc, &this->charger_state[client_id], &this->charger_allocation_state[client_id]))
+                this->allocation_inputs_dirty = true;
+
+            if (updated) {
+                update_sub_manager_demand(client_id, v5);
                 update_charger_state_config(client_id);
+            }
     }, [this](uint8_t client_id, uint8_t error){
         //TODO bounds check
         auto &target_alloc = this->charger_allocation_state[client_id];
         target_alloc.state = 5;
         target_alloc.error = error;
+        this->allocation_inputs_dirty = true;
         //TODO: should we call update_charger_state_config(client_id); here? This is currently missing but smells weird.
     });
 
-    millis_t cm_send_delay = 1000_ms / millis_t{charger_count};
+    for (size_t slot = 0; slot < this->sub_manager_count; ++slot)
+        cm_networking.set_sub_manager(this->sub_manager_chargers[slot]);
 
+    // cm_networking decides per charger whether a command is due:
+    // Once per second for legacy chargers, on change or as heartbeat for change-driven chargers.
     task_scheduler.scheduleWithFixedDelay([this, charger_count]() mutable {
         static int i = 0;
+        int sent = 0;
+
+        for (int checked = 0; checked < charger_count; ++checked) {
+            if (i >= charger_count)
+                i = 0;
+
+            auto &charger_alloc = this->charger_allocation_state[i];
+            int slot = this->get_sub_manager_slot(i);
+            const cm_command_v4 *grant = slot < 0 ? nullptr : &this->sub_manager_grants[slot];
+            CMSendResult result = cm_networking.send_manager_update(i, charger_alloc.allocated_current, charger_alloc.cp_disconnect, charger_alloc.allocated_phases, grant);
 
-        if (i >= charger_count)
-            i = 0;
+            // Resend to this charger next time.
+            if (result == CMSendResult::Retry)
+                return;
 
-        auto &charger_alloc = this->charger_allocation_state[i];
-        if(cm_networking.send_manager_update(i, charger_alloc.allocated_current, charger_alloc.cp_disconnect, charger_alloc.allocated_phases))
             ++i;
 
-    }, cm_send_delay);
+            // Spread bursts of allocation changes over multiple runs.
+            if (result == CMSendResult::Sent && ++sent >= CM_MAX_COMMANDS_PER_RUN)
+                return;
+        }
+    }, CM_SEND_INTERVAL);
+}
+
+int ChargeManager::get_sub_manager_slot(uint8_t idx)
+{
+    for (size_t slot = 0; slot < this->sub_manager_count; ++slot)
+        if (this->sub_manager_chargers[slot] == idx)
+            return static_cast<int>(slot);
+
+    return -1;
+}
+
+void ChargeManager::update_sub_manager_demand(uint8_t idx, const cm_state_v5 *v5)
+{
+    int slot = get_sub_manager_slot(idx);
+    if (slot < 0)
+        return;
+
+    CascadeDemand &demand = this->cascade_demands[1 + slot];
+
+    if (v5 == nullptr || !CM_STATE_V5_FLAGS_SUB_MANAGER_IS_SET(v5->flags)) {
+        if (demand.chargers != 0) {
+            logger.printfln("%s is configured as sub-manager but does not report aggregated chargers.", get_charger_name(idx));
+            this->allocation_inputs_dirty = true;
+        }
+
+        demand = CascadeDemand{};
+        return;
+    }
+
+    for (size_t i = 0; i < 4; ++i) {
+        if (demand.min[i] != v5->min_current[i] || demand.requested[i] != v5->requested_current[i] || demand.max[i] != v5->max_current[i])
+            this->allocation_inputs_dirty = true;
+
+        demand.min[i]       = v5->min_current[i];
+        demand.requested[i] = v5->requested_current[i];
+        demand.max[i]       = v5->max_current[i];
+    }
+
+    if (demand.chargers != v5->charger_count)
+        this->allocation_inputs_dirty = true;
+
+    demand.chargers = v5->charger_count;
+}
+
+// Splits limits between the sub-managers and the local chargers.
+// Returns the local chargers' share in limits.
+void ChargeManager::distribute_to_sub_managers(CurrentLimits *limits)
+{
+    aggregate_chargers(this->ca_config, this->charger_state, this->charger_allocation_state, &this->cascade_demands[0]);
+
+    cascade_distribute(limits, this->cascade_demands, this->sub_manager_count + 1, this->cascade_grants);
+
+    *limits = this->cascade_grants[0];
+
+    for (size_t slot = 0; slot < this->sub_manager_count; ++slot) {
+        const CurrentLimits &src = this->cascade_grants[1 + slot];
+        cm_command_v4 &dst = this->sub_manager_grants[slot];
+
+        for (size_t i = 0; i < 4; ++i) {
+            dst.granted_raw[i]    = src.raw[i];
+            dst.granted_min[i]    = src.min[i];
+            dst.granted_spread[i] = src.spread[i];
+        }
+        dst.granted_max_pv = src.max_pv;
+    }
+}
+
+void ChargeManager::start_sub_manager_task()
+{
+    cm_networking.register_sub_manager([this](const cm_command_v4 *command_grant) {
+        CurrentLimits new_grant = {};
+
+        if (command_grant != nullptr) {
+            for (size_t i = 0; i < 4; ++i) {
+                new_grant.raw[i]    = command_grant->granted_raw[i];
+                new_grant.min[i]    = command_grant->granted_min[i];
+                new_grant.spread[i] = command_grant->granted_spread[i];
+            }
+            new_grant.max_pv = command_grant->granted_max_pv;
+        }
+
+        // Shed load immediately, use more current with the next regular allocation.
+        for (size_t i = 0; i < 4; ++i) {
+            if (new_grant.raw[i] < this->grant.raw[i])
+                this->trigger_allocator_run();
+        }
+
+        this->grant = new_grant;
+        this->last_grant = now_us();
+    });
+
+    // Reports the local chargers and those of the own sub-managers as one virtual charger.
+    task_scheduler.scheduleWithFixedDelay([this]() {
+        static micros_t last_send = 0_us;
+
+        // The upstream manager always uses the change-driven mode with sub-managers. Pace the legacy mode anyway.
+        if (!cm_networking.is_sub_manager_change_driven() && !deadline_elapsed(last_send + 1_s))
+            return;
+
+        CascadeDemand demand;
+        aggregate_chargers(this->ca_config, this->charger_state, this->charger_allocation_state, &demand);
+
+        for (size_t slot = 0; slot < this->sub_manager_count; ++slot) {
+            const CascadeDemand &sub_demand = this->cascade_demands[1 + slot];
+            demand.min       += sub_demand.min;
+            demand.requested += sub_demand.requested;
+            demand.max       += sub_demand.max;
+            demand.chargers  += sub_demand.chargers;
+        }
+
+        cm_state_v5 v5 = {};
+        v5.charger_count = demand.chargers;
+        for (size_t i = 0; i < 4; ++i) {
+            v5.min_current[i]       = demand.min[i];
+            v5.requested_current[i] = demand.requested[i];
+            v5.max_current[i]       = demand.max[i];
+        }
+
+        if (cm_networking.send_sub_manager_update(local_uid_num, &v5))
+            last_send = now_us();
+    }, SUB_MANAGER_SEND_INTERVAL);
 }
 
 // This is a separate function to simplify the control flow.
@@ -458,8 +627,27 @@ void ChargeManager::setup()
         charger_state[i].phase_rotation = convert_phase_rotation(config.get("chargers")->get(i)->get("rot")->asEnum<CMPhaseRotation>());
         charger_state[i].last_phase_switch = -ca_config->global_hysteresis;
         charger_state[i].charge_mode = ChargeMode::PV;
+        charger_state[i].is_sub_manager = config.get("chargers")->get(i)->get("sub_manager")->asBool();
+
+        if (charger_state[i].is_sub_manager)
+            ++this->sub_manager_count;
+    }
+
+    if (this->sub_manager_count > 0) {
+        this->sub_manager_chargers = static_cast<uint8_t *>(calloc_psram_or_dram(this->sub_manager_count, sizeof(uint8_t)));
+        this->sub_manager_grants = static_cast<cm_command_v4 *>(calloc_psram_or_dram(this->sub_manager_count, sizeof(cm_command_v4)));
+        this->cascade_demands = new CascadeDemand[this->sub_manager_count + 1];
+        this->cascade_grants = new CurrentLimits[this->sub_manager_count + 1]();
+
+        size_t slot = 0;
+        for (size_t i = 0; i < this->charger_count; ++i) {
+            if (charger_state[i].is_sub_manager)
+                this->sub_manager_chargers[slot++] = static_cast<uint8_t>(i);
+        }
     }
 
+    this->sub_manager_enabled = config.get("enable_sub_manager")->asBool();
+
     // TODO: Change all currents everywhere to int32_t or int16_t.
     int def_cur = (int) default_current;
     this->limits.raw = {3 * def_cur, def_cur, def_cur, def_cur};
@@ -469,6 +657,9 @@ void ChargeManager::setup()
 
     start_manager_task();
 
+    if (this->sub_manager_enabled)
+        start_sub_manager_task();
+
     auto get_charger_name_fn = [this](uint8_t i){ return this->get_charger_name(i);};
     auto clear_dns_cache_entry_fn = [this](uint8_t i){ return cm_networking.clear_dns_cache_entry(i);};
 
@@ -478,13 +669,15 @@ void ChargeManager::setup()
             if (!deadline_elapsed(this->next_allocation))
                 return;
 
-            this->next_allocation = now_us() + ca_config->allocation_interval;
+            micros_t start = now_us();
+            this->next_allocation = start + ca_config->allocation_interval;
 
             uint32_t allocated_current = 0;
 
             // Use copy to not zero static limits forever.
             CurrentLimits tmp_limits;
-            if (!seen_all_chargers()) {
+            bool all_chargers_seen = seen_all_chargers();
+            if (!all_chargers_seen) {
                 tmp_limits.raw = Cost{0, 0, 0, 0};
                 tmp_limits.min = Cost{0, 0, 0, 0};
                 tmp_limits.max_pv = 0;
@@ -492,16 +685,75 @@ void ChargeManager::setup()
                 tmp_limits = this->limits;
             }
 
-            this->limits_post_allocation = tmp_limits;
+            if (this->sub_manager_enabled) {
+                bool valid = this->last_grant != 0_us && !deadline_elapsed(this->last_grant + SUB_MANAGER_GRANT_TIMEOUT);
+                if (valid != this->grant_valid) {
+                    this->grant_valid = valid;
+                    if (valid)
+                        logger.printfln("Receiving grants of upstream manager.");
+                    else
+                        logger.printfln("Received no grant of upstream manager for 30 seconds. Blocking all chargers.");
+                }
+
+                if (!valid)
+                    this->grant = CurrentLimits{};
+
+                cascade_apply_grant(&tmp_limits, &this->grant);
+            }
+
+            bool dirty = this->allocation_inputs_dirty;
+            this->allocation_inputs_dirty = false;
+
+            if (memcmp(&tmp_limits, &this->last_allocation_limits, sizeof(tmp_limits)) != 0) {
+                this->last_allocation_limits = tmp_limits;
+                dirty = true;
+            }
+
+            bool cp_disconnect = this->control_pilot_disconnect.get("disconnect")->asBool();
+            if (cp_disconnect != this->last_allocation_cp_disconnect) {
+                this->last_allocation_cp_disconnect = cp_disconnect;
+                dirty = true;
+            }
 
             for(size_t i = 0; i < charger_count; ++i) {
-                update_charger_state_from_mode(&charger_state[i], i);
+                auto &charger = charger_state[i];
+                bool off = charger.off;
+                bool use_pv_current = charger.use_pv_current;
+                bool observe_pv_limit = charger.observe_pv_limit;
+
+                update_charger_state_from_mode(&charger, i);
+
+                if (charger.off != off || charger.use_pv_current != use_pv_current || charger.observe_pv_limit != observe_pv_limit)
+                    dirty = true;
             }
 
+            // Keep the last allocation if neither the limits nor a charger changed and no timer of the allocator is pending.
+            if (!dirty
+             && !deadline_elapsed(this->last_full_allocation + ALLOCATION_FORCE_INTERVAL)
+             && allocation_is_stable(this->ca_config, this->charger_state, this->ca_state, this->charger_allocation_state)) {
+                continue_allocation(this->ca_config, this->charger_state, this->charger_allocation_state);
+
+                for (int i = 0; i < this->charger_count; ++i) {
+                    update_charger_allocation_config(i);
+                }
+
+                auto skipped = this->low_level_state.get("alloc_skipped");
+                skipped->updateUint(skipped->asUint() + 1);
+
+                update_allocation_time(start);
+                return;
+            }
+
+            this->last_full_allocation = start;
+            this->limits_post_allocation = tmp_limits;
+
+            if (this->sub_manager_count > 0)
+                distribute_to_sub_managers(&this->limits_post_allocation);
+
             int result = allocate_current(
                 this->ca_config,
                 &this->limits_post_allocation,
-                this->control_pilot_disconnect.get("disconnect")->asBool(),
+                cp_disconnect,
                 this->charger_state,
                 this->hosts.get(),
                 get_charger_name_fn,
@@ -529,6 +781,14 @@ void ChargeManager::setup()
             }
 
             this->state.get("state")->updateUint(result);
+
+            // Before all chargers were seen, the allocator only blocks them.
+            if (all_chargers_seen && !this->first_allocation_reported) {
+                this->first_allocation_reported = true;
+                boot_report.add_milestone("charge_manager_first_allocation");
+            }
+
+            update_allocation_time(start);
         }, 1_s);
 
     if (config.get("verbose")->asBool()) {
@@ -719,6 +979,26 @@ void ChargeManager::update_charger_state_config(uint8_t idx) {
     ll_charger_cfg->get("ip")->updateUint(charger.use_supported_current.to<millis_t>().as<uint32_t>());
 }
 
+// Only the values that continue_allocation changes.
+void ChargeManager::update_charger_allocation_config(uint8_t idx) {
+    auto &charger = charger_state[idx];
+    auto *ll_charger_cfg = (Config *)this->low_level_state.get("chargers")->get(idx);
+    ll_charger_cfg->get("ae")->updateUint(charger.allocated_energy * 1000);
+    ll_charger_cfg->get("ar")->updateUint(charger.allocated_energy_this_rotation * 1000);
+    ll_charger_cfg->get("ip")->updateUint(charger.use_supported_current.to<millis_t>().as<uint32_t>());
+}
+
+void ChargeManager::update_allocation_time(micros_t start)
+{
+    uint32_t us = (now_us() - start).as<uint32_t>();
+
+    this->low_level_state.get("alloc_us")->updateUint(us);
+
+    auto max_us = this->low_level_state.get("alloc_max_us");
+    if (us > max_us->asUint())
+        max_us->updateUint(us);
+}
+
 uint32_t ChargeManager::get_maximum_available_current()
 {
     return config.get("maximum_available_current")->asUint();
@@ -33,6 +33,9 @@ struct CurrentAllocatorConfig;
 struct CurrentAllocatorState;
 struct ChargerState;
 struct ChargerAllocationState;
+struct CascadeDemand;
+struct cm_command_v4;
+struct cm_state_v5;
 
 class ChargeManager final : public IModule
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -77,6 +80,7 @@ public:
 
     uint32_t last_available_current_update = 0;
     bool watchdog_triggered = false;
+    bool first_allocation_reported = false;
 
     size_t charger_count = 0;
     ChargerState *charger_state = nullptr;
@@ -92,7 +96,7 @@ public:
     }
     const Cost *get_allocated_currents() {return &allocated_currents;}
 
-    void trigger_allocator_run() {next_allocation = 0_us;}
+    void trigger_allocator_run() {next_allocation = 0_us; allocation_inputs_dirty = true;}
     void skip_global_hysteresis();
     void enable_fast_single_charger_mode();
     bool is_static_cm() {return static_cm;}
@@ -100,6 +104,13 @@ public:
     const ChargerState *get_charger_state(uint8_t idx);
 
 private:
+    void start_sub_manager_task();
+    void update_sub_manager_demand(uint8_t idx, const cm_state_v5 *v5);
+    void distribute_to_sub_managers(CurrentLimits *limits);
+    int get_sub_manager_slot(uint8_t idx);
+    void update_charger_allocation_config(uint8_t idx);
+    void update_allocation_time(micros_t start);
+
     Config config_chargers_prototype;
     Config state_chargers_prototype;
     Config low_level_state_chargers_prototype;
@@ -108,6 +119,12 @@ private:
     Cost allocated_currents;
 
     micros_t next_allocation = 0_us;
+
+    // Inputs of the last allocation. The allocator only runs all stages if one of them changed.
+    bool allocation_inputs_dirty = true;
+    CurrentLimits last_allocation_limits = {};
+    bool last_allocation_cp_disconnect = false;
+    micros_t last_full_allocation = 0_us;
     bool static_cm = true;
 
     bool all_chargers_seen = false;
@@ -119,6 +136,20 @@ private:
     ChargerAllocationState *charger_allocation_state = nullptr;
     CurrentAllocatorConfig *ca_config = nullptr;
     CurrentAllocatorState *ca_state = nullptr;
+
+    // Cascaded charge management, see cascade.h
+    // Sub-manager mode: Grant of the upstream manager.
+    bool sub_manager_enabled = false;
+    bool grant_valid = false;
+    micros_t last_grant = 0_us;
+    CurrentLimits grant = {};
+
+    // Upstream manager: Configured sub-managers.
+    size_t sub_manager_count = 0;
+    uint8_t *sub_manager_chargers = nullptr;     // Charger index of every sub-manager
+    CascadeDemand *cascade_demands = nullptr;    // [0] is the local chargers, [1 + slot] the sub-manager in this slot
+    CurrentLimits *cascade_grants = nullptr;
+    cm_command_v4 *sub_manager_grants = nullptr; // Sent to the sub-managers with the commands
 };
 
 #include "module_available_end.h"
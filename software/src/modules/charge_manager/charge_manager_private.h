@@ -58,6 +58,9 @@ struct CurrentAllocatorState {
 
     micros_t next_rotation = 0_us;
 
+    // Set if the last allocation changed a charger's allocation or found an error.
+    bool last_allocation_changed = true;
+
     Cost control_window_min = {0, 0, 0, 0};
     Cost control_window_max = {0, 0, 0, 0};
 };
@@ -111,6 +114,9 @@ struct ChargerState {
 
     bool phase_switch_supported;
 
+    // This "charger" is a sub-manager that reports the aggregated demand of its chargers.
+    bool is_sub_manager;
+
     // TODO move everything below into charger allocation state.
 
     // Phases that are currently used or will be used if current is allocated.
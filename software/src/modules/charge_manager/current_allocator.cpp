@@ -1366,6 +1366,42 @@ static void stage_9(StageContext &sc) {
     }
 }
 
+// Per-charger bookkeeping after every allocation interval.
+// Also done by continue_allocation if the stages were skipped.
+static void account_allocation(const CurrentAllocatorConfig *cfg, ChargerState *charger, uint16_t allocated_current, int8_t allocated_phases, micros_t now) {
+    // If we can't allocate the requested current,
+    // ignore the requested current for some time.
+    // If there is more current available in the next iteration,
+    // use the supported current for a faster ramp up.
+    // The requested current will be the last allocation + margin until we can fulfill it.
+    if (allocated_current < charger->requested_current) {
+        //trace("charger %d: requested current not fulfilled. Will use supported current for 1 min.", i);
+        charger->use_supported_current = now;
+    }
+
+    auto charging_time = (now - charger->last_plug_in).as<float>();
+
+    if (allocated_phases == 0) {
+        charger->allocated_energy_this_rotation = 0;
+    } else {
+        auto amps = (float)allocated_current * allocated_phases / 1000.0f;
+
+        auto alloc_time = !deadline_elapsed(charger->last_plug_in + cfg->allocation_interval) ? charging_time : cfg->allocation_interval.as<float>();
+
+        auto amp_hours = amps * (alloc_time / ((micros_t)1_h).as<float>());
+        auto watt_hours = amp_hours * 230.0f;
+        auto allocated_energy = watt_hours / 1000.0f;
+        charger->allocated_energy_this_rotation += allocated_energy;
+        charger->allocated_energy += allocated_energy;
+    }
+
+    charging_time /= 1000.0 * 1000.0 * 60.0 * 60.0;
+    charger->allocated_average_power = charger->allocated_energy / (float)charging_time;
+    if (allocated_phases != 0 && charger->charger_state == 3) {
+        charger->time_in_state_c += cfg->allocation_interval;
+    }
+}
+
 int allocate_current(
     const CurrentAllocatorConfig *cfg,
     CurrentLimits *limits,
@@ -1540,6 +1576,7 @@ int allocate_current(
     //logger.printfln("Took %u µs", end - start);
 
     auto now = now_us();
+    bool changed = false;
 
     // Apply current limits.
     {
@@ -1576,16 +1613,6 @@ int allocate_current(
                 charger.last_wakeup = now;
             }
 
-            // If we can't allocate the requested current,
-            // ignore the requested current for some time.
-            // If there is more current available in the next iteration,
-            // use the supported current for a faster ramp up.
-            // The requested current will be the last allocation + margin until we can fulfill it.
-            if (current_to_set < charger.requested_current) {
-                //trace("charger %d: requested current not fulfilled. Will use supported current for 1 min.", i);
-                charger.use_supported_current = now;
-            }
-
             // The charger was just plugged in. If we've allocated phases to it for PLUG_IN_TIME, clear the timestamp
             // to reduce its priority.
             if (charger.just_plugged_in_timestamp != 0_us && phases_to_set > 0 && deadline_elapsed(charger.last_switch_on + cfg->plug_in_time)) {
@@ -1606,29 +1633,11 @@ int allocate_current(
             charger_alloc.allocated_current = current_to_set;
             charger_alloc.allocated_phases = phases_to_set;
 
-            auto charging_time = (now - charger.last_plug_in).as<float>();
-
-            if (phases_to_set == 0) {
-                charger.allocated_energy_this_rotation = 0;
-            } else {
-                auto amps = (float)current_to_set * phases_to_set / 1000.0f;
-
-                auto alloc_time = !deadline_elapsed(charger.last_plug_in + cfg->allocation_interval) ? charging_time : cfg->allocation_interval.as<float>();
-
-                auto amp_hours = amps * (alloc_time / ((micros_t)1_h).as<float>());
-                auto watt_hours = amp_hours * 230.0f;
-                auto allocated_energy = watt_hours / 1000.0f;
-                charger.allocated_energy_this_rotation += allocated_energy;
-                charger.allocated_energy += allocated_energy;
-            }
-
-            charging_time /= 1000.0 * 1000.0 * 60.0 * 60.0;
-            charger.allocated_average_power = charger.allocated_energy / (float)charging_time;
-            if (phases_to_set != 0 && charger.charger_state == 3) {
-                charger.time_in_state_c += cfg->allocation_interval;
-            }
+            account_allocation(cfg, &charger, current_to_set, phases_to_set, now);
 
             if (change) {
+                changed = true;
+
                 LOCAL_LOG("Allocated %d mA @ %dp to %s (%s).",
                       current_to_set,
                       phases_to_set,
@@ -1642,6 +1651,9 @@ int allocate_current(
         }
     }
 
+    // Only an allocation without errors and changes can be continued by continue_allocation.
+    ca_state->last_allocation_changed = changed || result != 1;
+
     if (print_local_log) {
         local_log = cfg->distribution_log.get();
         if (local_log) {
@@ -1677,6 +1689,133 @@ int allocate_current(
     return result;
 }
 
+void aggregate_chargers(
+    const CurrentAllocatorConfig *cfg,
+    const ChargerState *charger_state,
+    const ChargerAllocationState *charger_allocation_state,
+    CascadeDemand *demand)
+{
+    *demand = CascadeDemand{};
+
+    for (int i = 0; i < cfg->charger_count; ++i) {
+        const auto &state = charger_state[i];
+
+        if (state.is_sub_manager)
+            continue;
+
+        uint8_t allocated_phases = charger_allocation_state[i].allocated_phases;
+        bool active = is_active(allocated_phases, &state);
+        bool wants_to_charge = !state.off && (state.wants_to_charge || state.is_charging);
+
+        // Inactive chargers will be activated with the phases they report.
+        uint8_t phases = allocated_phases != 0 ? allocated_phases : (state.phases == 1 ? 1 : 3);
+        int32_t minimum_current = phases == 3 ? cfg->minimum_current_3p : cfg->minimum_current_1p;
+
+        cascade_add_charger(demand,
+                            get_phase_factors(phases, state.phase_rotation),
+                            minimum_current,
+                            get_requested_current(&state, cfg),
+                            state.supported_current,
+                            active,
+                            wants_to_charge);
+    }
+}
+
+// Changes of the requested current smaller than this don't trigger an allocation.
+// The requested current follows the measured line currents and fluctuates while charging.
+static constexpr int32_t REQUESTED_CURRENT_CHANGE_THRESHOLD = 1000; /* mA */
+
+bool allocation_input_changed(
+    const ChargerState *old_state,
+    const ChargerAllocationState *old_alloc,
+    const ChargerState *new_state,
+    const ChargerAllocationState *new_alloc)
+{
+    return old_state->supported_current != new_state->supported_current
+        || old_state->allowed_current != new_state->allowed_current
+        || abs((int32_t)old_state->requested_current - (int32_t)new_state->requested_current) >= REQUESTED_CURRENT_CHANGE_THRESHOLD
+        || old_state->charger_state != new_state->charger_state
+        || old_state->wants_to_charge != new_state->wants_to_charge
+        || old_state->wants_to_charge_low_priority != new_state->wants_to_charge_low_priority
+        || old_state->is_charging != new_state->is_charging
+        || old_state->cp_disconnect_supported != new_state->cp_disconnect_supported
+        || old_state->cp_disconnect_state != new_state->cp_disconnect_state
+        || old_state->phase_switch_supported != new_state->phase_switch_supported
+        || old_state->phases != new_state->phases
+        || old_state->just_plugged_in_timestamp != new_state->just_plugged_in_timestamp
+        || old_state->last_plug_in != new_state->last_plug_in
+        || old_state->last_wakeup != new_state->last_wakeup
+        || old_state->last_phase_switch != new_state->last_phase_switch
+        || old_alloc->allocated_current != new_alloc->allocated_current
+        || old_alloc->allocated_phases != new_alloc->allocated_phases
+        || old_alloc->error != new_alloc->error
+        || old_alloc->state != new_alloc->state;
+}
+
+bool allocation_is_stable(
+    const CurrentAllocatorConfig *cfg,
+    const ChargerState *charger_state,
+    const CurrentAllocatorState *ca_state,
+    const ChargerAllocationState *charger_allocation_state)
+{
+    if (ca_state->last_allocation_changed || !ca_state->global_hysteresis_elapsed)
+        return false;
+
+    // Stage 1 could rotate chargers.
+    if (cfg->rotation_interval > 0_s && deadline_elapsed(ca_state->next_rotation))
+        return false;
+
+    for (int i = 0; i < cfg->charger_count; ++i) {
+        const auto &charger = charger_state[i];
+        const auto &charger_alloc = charger_allocation_state[i];
+
+        // The checks for unreachable and non-reactive chargers are time-dependent.
+        if (deadline_elapsed(charger.last_update + TIMEOUT_MS))
+            return false;
+
+        if (charger_alloc.allocated_current < charger.allowed_current
+         || (charger_alloc.allocated_phases != 0 && charger_alloc.allocated_phases != charger.phases)
+         || (charger_alloc.allocated_phases == 0 && charger.is_charging))
+            return false;
+
+        // Plug-in, wake-up and phase switch timers change the priorities of the stages.
+        if (charger.just_plugged_in_timestamp != 0_us)
+            return false;
+
+        if (charger.last_wakeup != 0_us && !deadline_elapsed(charger.last_wakeup + cfg->wakeup_time))
+            return false;
+
+        if (charger.wants_to_charge_low_priority && charger_alloc.allocated_phases != 0)
+            return false;
+
+        if (!deadline_elapsed(charger.last_phase_switch + cfg->global_hysteresis))
+            return false;
+
+        if (charger_alloc.allocated_phases != 0 && !deadline_elapsed(charger.last_switch_on + cfg->minimum_active_time))
+            return false;
+
+        // get_requested_current switches from the supported to the requested current
+        // once this timer elapses, unless continue_allocation refreshes it.
+        if (charger_alloc.allocated_current >= charger.requested_current
+         && !deadline_elapsed(charger.use_supported_current + seconds_t{cfg->requested_current_threshold}))
+            return false;
+    }
+
+    return true;
+}
+
+void continue_allocation(
+    const CurrentAllocatorConfig *cfg,
+    ChargerState *charger_state,
+    const ChargerAllocationState *charger_allocation_state)
+{
+    auto now = now_us();
+
+    for (int i = 0; i < cfg->charger_count; ++i) {
+        const auto &charger_alloc = charger_allocation_state[i];
+        account_allocation(cfg, &charger_state[i], charger_alloc.allocated_current, charger_alloc.allocated_phases, now);
+    }
+}
 
 static uint8_t get_charge_state(uint8_t charger_state, uint16_t supported_current, uint32_t car_stopped_charging, uint16_t target_allocated_current)
 {
@@ -22,6 +22,7 @@
 #include <functional>
 
 #include "charge_manager_private.h"
+#include "cascade.h"
 
 struct cm_state_v1;
 struct cm_state_v2;
@@ -50,3 +51,31 @@ bool update_from_client_packet(
     ChargerAllocationState *charger_allocation_state,
     const char * const *hosts,
     const std::function<const char *(uint8_t)> &get_charger_name);
+
+// Aggregates the demand of all chargers that are not sub-managers.
+void aggregate_chargers(
+    const CurrentAllocatorConfig *cfg,
+    const ChargerState *charger_state,
+    const ChargerAllocationState *charger_allocation_state,
+    CascadeDemand *demand);
+
+// Returns whether a state update of a charger changed an input of allocate_current.
+bool allocation_input_changed(
+    const ChargerState *old_state,
+    const ChargerAllocationState *old_alloc,
+    const ChargerState *new_state,
+    const ChargerAllocationState *new_alloc);
+
+// Returns whether allocate_current would repeat its last allocation if no input changed.
+bool allocation_is_stable(
+    const CurrentAllocatorConfig *cfg,
+    const ChargerState *charger_state,
+    const CurrentAllocatorState *ca_state,
+    const ChargerAllocationState *charger_allocation_state);
+
+// Keeps the last allocation without running the stages.
+// Only does the per-charger bookkeeping (allocated energy, timers) of allocate_current.
+void continue_allocation(
+    const CurrentAllocatorConfig *cfg,
+    ChargerState *charger_state,
+    const ChargerAllocationState *charger_allocation_state);
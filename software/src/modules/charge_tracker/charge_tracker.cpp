@@ -198,8 +198,9 @@ bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, u
     current_charge.get("evse_uptime_start")->updateUint(evse_uptime);
     current_charge.get("timestamp_minutes")->updateUint(timestamp_minutes);
     current_charge.get("authorization_type")->updateUint(auth_type);
-    current_charge.get("authorization_info")->value = auth_info;
-    current_charge.get("authorization_info")->value.updated = 0xFF;
+    Config *authorization_info = static_cast<Config *>(current_charge.get("authorization_info"));
+    *authorization_info = Config{std::move(auth_info)};
+    authorization_info->set_updated(0xFF);
     return true;
 }
 
@@ -241,7 +242,7 @@ void ChargeTracker::endCharge(uint32_t charge_duration_seconds, float meter_end)
     current_charge.get("evse_uptime_start")->updateUint(0);
     current_charge.get("timestamp_minutes")->updateUint(0);
     current_charge.get("authorization_type")->updateUint(0);
-    current_charge.get("authorization_info")->value = Config::ConfVariant{};
+    *static_cast<Config *>(current_charge.get("authorization_info")) = Config{Config::ConfVariant{}};
 
     updateState();
 }
@@ -36,6 +36,26 @@
 struct cm_state_v1;
 struct cm_state_v2;
 struct cm_state_v3;
+struct cm_state_v5;
+
+// Legacy mode: The manager sends a command to every charger each second.
+#define CM_COMMAND_LEGACY_INTERVAL 1_s
+
+// Change-driven mode, see cm_networking_defs.h
+#define CM_COMMAND_HEARTBEAT_INTERVAL 5_s
+#define CM_STATE_HEARTBEAT_INTERVAL 5_s
+#define CM_STATE_MIN_INTERVAL 500_ms
+#define CM_STATE_REPLY_DELAY 300_ms
+#define CM_RETRANSMIT_TIMEOUT 1_s
+
+// A line current has to change by this amount to be sent immediately.
+#define CM_STATE_LINE_CURRENT_THRESHOLD 1.0f
+
+enum class CMSendResult {
+    NotDue,
+    Sent,
+    Retry, // Socket buffer is full, try again later.
+};
 
 class CMNetworking final : public IModule
 {
@@ -49,10 +69,15 @@ public:
 
     void register_manager(const char *const *const hosts,
                           int charger_count,
-                          const std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *)> &manager_callback,
+                          const std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *, cm_state_v5 *)> &manager_callback,
                           const std::function<void(uint8_t, uint8_t)> &manager_error_callback);
 
-    bool send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested, int8_t allocated_phases);
+    // Sends commands of this charger to the cascade port of a sub-manager.
+    void set_sub_manager(uint8_t client_id);
+
+    // Sends a command if the charger's protocol mode requires one now.
+    // grant is only sent to sub-managers, nullptr for chargers.
+    CMSendResult send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested, int8_t allocated_phases, const cm_command_v4 *grant = nullptr);
 
     void register_client(const std::function<void(uint16_t, bool, int8_t)> &client_callback);
     bool send_client_update(uint32_t esp32_uid,
@@ -69,6 +94,15 @@ public:
                             int8_t phases,
                             bool can_switch_phases_now);
 
+    // If true, send_client_update should be called periodically: States are only sent on change or as heartbeat.
+    bool is_client_change_driven() const { return client.change_driven; }
+
+    // Sub-manager: Receives the grant of the upstream manager on CM_CASCADE_PORT.
+    // grant_callback is called with nullptr if the upstream manager is gone or can't grant a budget.
+    void register_sub_manager(const std::function<void(const cm_command_v4 *)> &grant_callback);
+    bool send_sub_manager_update(uint32_t esp32_uid, const cm_state_v5 *aggregate);
+    bool is_sub_manager_change_driven() const { return cascade_client.change_driven; }
+
     bool get_scan_results(CoolString &result);
 
     void resolve_hostname(uint8_t charger_idx);
@@ -87,11 +121,56 @@ public:
     mdns_result_t *scan_results = nullptr;
 
 private:
+    // Connection of a charger (or sub-manager) to its manager.
+    struct ClientConnection {
+        int sock = -1;
+        bool manager_addr_valid = false;
+        struct sockaddr_storage manager_addr;
+        micros_t last_manager_addr_change = -1_m;
+        uint32_t last_successful_recv = 0;
+
+        // The manager sets CM_COMMAND_FLAGS_CHANGE_DRIVEN.
+        bool change_driven = false;
+        bool state_reply_pending = false;
+        bool state_ack_pending = false;
+        uint16_t last_seen_command_seq_num = 255;
+        uint16_t next_state_seq_num = 0;
+        uint16_t unacked_state_seq_num = 0;
+        micros_t state_reply_deadline = 0_us;
+        micros_t last_state_send = 0_us;
+        cm_state_packet last_sent_state = {};
+    };
+
+    void register_client_connection(ClientConnection *conn, uint16_t port, const std::function<void(cm_command_packet *)> &command_callback);
+    bool send_client_state(ClientConnection *conn, cm_state_packet *state_pkt);
     bool send_command_packet(uint8_t charger_idx, cm_command_packet *command_pkt);
-    bool send_state_packet(const cm_state_packet *state_pkt);
+    bool send_state_packet(ClientConnection *conn, const cm_state_packet *state_pkt);
+    void handle_state_packet_ack(uint8_t charger_idx, const cm_state_packet *state_pkt);
+    void handle_command_packet_ack(ClientConnection *conn, const cm_command_packet *command_pkt);
+    bool client_state_changed(const ClientConnection *conn, const cm_state_packet *state_pkt);
 
     int manager_sock;
 
+    struct ManagerPeer {
+        micros_t last_send;
+        uint16_t last_seen_state_seq_num;
+        uint16_t unacked_command_seq_num;
+        // Last sent allocation
+        uint16_t allocated_current;
+        int8_t allocated_phases;
+        bool cp_disconnect_requested;
+        cm_command_v4 grant;
+        bool command_sent;
+        // The charger sends version 4 state packets.
+        bool change_driven;
+        // Commands carry the grant of cm_command_v4.
+        bool sub_manager;
+        bool command_ack_pending;
+        bool state_ack_requested;
+    };
+
+    ManagerPeer *manager_peers = nullptr;
+
     #define RESOLVE_STATE_UNKNOWN 0
     #define RESOLVE_STATE_NOT_RESOLVED 1
     #define RESOLVE_STATE_RESOLVED 2
@@ -104,10 +183,8 @@ private:
     uint64_t needs_mdns = 0;
     static_assert(MAX_CONTROLLED_CHARGERS <= 64);
 
-    micros_t last_manager_addr_change = -1_m;
-    int client_sock;
-    bool manager_addr_valid = false;
-    struct sockaddr_storage manager_addr;
+    ClientConnection client;
+    ClientConnection cascade_client;
 
     void start_scan();
     bool mdns_result_is_charger(mdns_result_t *entry, const char **ret_version, const char **ret_enabled, const char **ret_display_name, const char **ret_proxy_of);
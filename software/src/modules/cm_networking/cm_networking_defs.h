@@ -30,10 +30,17 @@
 
 #define CHARGE_MANAGER_PORT 34127
 #define CHARGE_MANAGEMENT_PORT (CHARGE_MANAGER_PORT + 1)
+// A sub-manager receives the commands of its upstream manager on this port.
+#define CM_CASCADE_PORT (CHARGE_MANAGER_PORT + 2)
 
 // Increment when changing packet structs
-#define CM_COMMAND_VERSION 2
-#define CM_STATE_VERSION 3
+#define CM_COMMAND_VERSION 4
+#define CM_STATE_VERSION 5
+
+// Versions used with chargers. The cascade fields of command version 4 and
+// state version 5 are only exchanged between a manager and its sub-managers.
+#define CM_COMMAND_VERSION_CHARGER 3
+#define CM_STATE_VERSION_CHARGER 4
 
 // Minimum protocol version supported
 #define CM_COMMAND_VERSION_MIN 1
@@ -60,11 +67,19 @@ static_assert(CM_PACKET_HEADER_LENGTH == 8, "Unexpected CM_PACKET_HEADER_LENGTH"
 #define CM_COMMAND_FLAGS_CPDISC_BIT_POS 6
 #define CM_COMMAND_FLAGS_CPDISC_MASK (1u << CM_COMMAND_FLAGS_CPDISC_BIT_POS)
 #define CM_COMMAND_FLAGS_CPDISC_IS_SET(FLAGS) (((FLAGS) & CM_COMMAND_FLAGS_CPDISC_MASK) != 0)
+#define CM_COMMAND_FLAGS_CHANGE_DRIVEN_BIT_POS 5
+#define CM_COMMAND_FLAGS_CHANGE_DRIVEN_MASK (1u << CM_COMMAND_FLAGS_CHANGE_DRIVEN_BIT_POS)
+#define CM_COMMAND_FLAGS_CHANGE_DRIVEN_IS_SET(FLAGS) (((FLAGS) & CM_COMMAND_FLAGS_CHANGE_DRIVEN_MASK) != 0)
+#define CM_COMMAND_FLAGS_ACK_REQUESTED_BIT_POS 4
+#define CM_COMMAND_FLAGS_ACK_REQUESTED_MASK (1u << CM_COMMAND_FLAGS_ACK_REQUESTED_BIT_POS)
+#define CM_COMMAND_FLAGS_ACK_REQUESTED_IS_SET(FLAGS) (((FLAGS) & CM_COMMAND_FLAGS_ACK_REQUESTED_MASK) != 0)
 
 struct cm_command_v1 {
     uint16_t allocated_current;
     /* command_flags
     bit 6    - control pilot permanently disconnected
+    bit 5    - change-driven: commands are only sent on change and as heartbeat (CM_COMMAND_VERSION 3)
+    bit 4    - ack requested: answer with a state packet (CM_COMMAND_VERSION 3)
     */
     uint8_t command_flags;
     uint8_t _padding;
@@ -76,6 +91,18 @@ struct cm_command_v2 {
     int8_t allocated_phases; // Was padding in CM_COMMAND_VERSION 1
 };
 
+// Change-driven mode (negotiated with CM_STATE_VERSION 4):
+// The manager sends a command immediately if the allocation changes and a heartbeat otherwise.
+// The charger sends a state if a relevant value changes and a heartbeat otherwise.
+// Packets sent because of a change request an ack. The peer then answers with
+// a packet that reports the sequence number of the last packet seen.
+// Unacknowledged packets are sent again after a timeout.
+
+struct cm_command_v3 {
+    uint16_t last_seen_state_seq_num;
+    uint16_t _padding;
+};
+
 #define CM_COMMAND_V1_LENGTH (sizeof(cm_command_v1))
 static_assert(CM_COMMAND_V1_LENGTH == 4, "Unexpected CM_COMMAND_V1_LENGTH");
 
@@ -84,16 +111,36 @@ static_assert(CM_COMMAND_V2_LENGTH == 4, "Unexpected CM_COMMAND_V2_LENGTH");
 static_assert(sizeof(cm_command_v1::_padding) == sizeof(cm_command_v2::allocated_phases), "Unexpected size of cm_command_v2.phases");
 static_assert(offsetof(cm_command_v1, _padding) == offsetof(cm_command_v2, allocated_phases), "Unexpected offset of cm_command_v2.phases");
 
+#define CM_COMMAND_V3_LENGTH (sizeof(cm_command_v3))
+static_assert(CM_COMMAND_V3_LENGTH == 4, "Unexpected CM_COMMAND_V3_LENGTH");
+
+// Budget granted to a sub-manager. All zero for chargers.
+// Currents in mA, indexed PV, L1, L2, L3 like the charge manager's current limits.
+struct cm_command_v4 {
+    int32_t granted_raw[4];
+    int32_t granted_min[4];
+    int32_t granted_spread[4];
+    int32_t granted_max_pv;
+};
+
+#define CM_COMMAND_V4_LENGTH (sizeof(cm_command_v4))
+static_assert(CM_COMMAND_V4_LENGTH == 52, "Unexpected CM_COMMAND_V4_LENGTH");
+
 struct cm_command_packet {
     cm_packet_header header;
     union {
         cm_command_v1 v1;
         cm_command_v2 v2;
     };
+    cm_command_v3 v3;
+    cm_command_v4 v4;
 };
 
 #define CM_COMMAND_PACKET_LENGTH (sizeof(cm_command_packet))
-static_assert(CM_COMMAND_PACKET_LENGTH == 12, "Unexpected CM_COMMAND_PACKET_LENGTH");
+static_assert(CM_COMMAND_PACKET_LENGTH == 68, "Unexpected CM_COMMAND_PACKET_LENGTH");
+
+#define CM_COMMAND_CHARGER_PACKET_LENGTH (offsetof(cm_command_packet, v4))
+static_assert(CM_COMMAND_CHARGER_PACKET_LENGTH == 16, "Unexpected CM_COMMAND_CHARGER_PACKET_LENGTH");
 
 #define CM_FEATURE_FLAGS_PHASE_SWITCH_BIT_POS 7
 #define CM_FEATURE_FLAGS_PHASE_SWITCH_MASK (1u << CM_FEATURE_FLAGS_PHASE_SWITCH_BIT_POS)
@@ -218,12 +265,55 @@ struct cm_state_v3 {
 #define CM_STATE_V3_LENGTH (sizeof(cm_state_v3))
 static_assert(CM_STATE_V3_LENGTH == 4, "Unexpected CM_STATE_V3_LENGTH");
 
+#define CM_STATE_V4_FLAGS_ACK_REQUESTED_BIT_POS 0
+#define CM_STATE_V4_FLAGS_ACK_REQUESTED_MASK (1u << CM_STATE_V4_FLAGS_ACK_REQUESTED_BIT_POS)
+#define CM_STATE_V4_FLAGS_ACK_REQUESTED_IS_SET(FLAGS) (((FLAGS) & CM_STATE_V4_FLAGS_ACK_REQUESTED_MASK) != 0)
+
+// Sending version 4 announces support for the change-driven mode.
+struct cm_state_v4 {
+    uint16_t last_seen_command_seq_num;
+    /* flags
+    bit 0 - ack requested: answer with a command packet
+    */
+    uint8_t flags;
+    uint8_t padding;
+};
+
+#define CM_STATE_V4_LENGTH (sizeof(cm_state_v4))
+static_assert(CM_STATE_V4_LENGTH == 4, "Unexpected CM_STATE_V4_LENGTH");
+
+#define CM_STATE_V5_FLAGS_SUB_MANAGER_BIT_POS 0
+#define CM_STATE_V5_FLAGS_SUB_MANAGER_MASK (1u << CM_STATE_V5_FLAGS_SUB_MANAGER_BIT_POS)
+#define CM_STATE_V5_FLAGS_SUB_MANAGER_IS_SET(FLAGS) (((FLAGS) & CM_STATE_V5_FLAGS_SUB_MANAGER_MASK) != 0)
+
+// Aggregated state of a sub-manager's chargers. All zero for chargers.
+// Currents in mA, indexed PV, L1, L2, L3 like the charge manager's current limits.
+struct cm_state_v5 {
+    /* flags
+    bit 0 - sub-manager: v1 to v3 describe the sub-manager, not a charger
+    */
+    uint8_t flags;
+    uint8_t padding;
+    uint16_t charger_count;
+    int32_t min_current[4];       // Minimum current of the active chargers
+    int32_t requested_current[4]; // Requested current of the chargers that want to charge
+    int32_t max_current[4];       // Supported current of the chargers with a vehicle
+};
+
+#define CM_STATE_V5_LENGTH (sizeof(cm_state_v5))
+static_assert(CM_STATE_V5_LENGTH == 52, "Unexpected CM_STATE_V5_LENGTH");
+
 struct cm_state_packet {
     cm_packet_header header;
     cm_state_v1 v1;
     cm_state_v2 v2;
     cm_state_v3 v3;
+    cm_state_v4 v4;
+    cm_state_v5 v5;
 };
 
 #define CM_STATE_PACKET_LENGTH (sizeof(cm_state_packet))
-static_assert(CM_STATE_PACKET_LENGTH == 88, "Unexpected CM_STATE_PACKET_LENGTH");
+static_assert(CM_STATE_PACKET_LENGTH == 144, "Unexpected CM_STATE_PACKET_LENGTH");
+
+#define CM_STATE_CHARGER_PACKET_LENGTH (offsetof(cm_state_packet, v5))
+static_assert(CM_STATE_CHARGER_PACKET_LENGTH == 92, "Unexpected CM_STATE_CHARGER_PACKET_LENGTH");
@@ -19,12 +19,14 @@
 
 #include "cm_networking.h"
 
+#include <algorithm>
 #include <Arduino.h>
 #include <ESPmDNS.h>
 #include <lwip/ip_addr.h>
 #include <lwip/opt.h>
 #include <lwip/dns.h>
 #include <cstring>
+#include <math.h>
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
@@ -75,6 +77,8 @@ static const uint8_t cm_command_packet_length_versions[] = {
     sizeof(struct cm_packet_header),
     sizeof(struct cm_packet_header) + sizeof(struct cm_command_v1),
     sizeof(struct cm_packet_header) + sizeof(struct cm_command_v2), // cm_command_v2 redefined v1._padding to v2.allocated_phases. Size is still the same and cm_command_packet holds a union of v1 or v2.
+    sizeof(struct cm_packet_header) + sizeof(struct cm_command_v2) + sizeof(struct cm_command_v3),
+    sizeof(struct cm_packet_header) + sizeof(struct cm_command_v2) + sizeof(struct cm_command_v3) + sizeof(struct cm_command_v4),
 };
 static_assert(ARRAY_SIZE(cm_command_packet_length_versions) == (CM_COMMAND_VERSION + 1), "Unexpected amount of command packet length versions.");
 
@@ -83,6 +87,8 @@ static const uint8_t cm_state_packet_length_versions[] = {
     sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1),
     sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2),
     sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2) + sizeof(struct cm_state_v3),
+    sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2) + sizeof(struct cm_state_v3) + sizeof(struct cm_state_v4),
+    sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2) + sizeof(struct cm_state_v3) + sizeof(struct cm_state_v4) + sizeof(struct cm_state_v5),
 };
 static_assert(ARRAY_SIZE(cm_state_packet_length_versions) == (CM_STATE_VERSION + 1), "Unexpected amount of state packet length versions.");
 
@@ -146,6 +152,12 @@ static bool seq_num_invalid(uint16_t received_sn, uint16_t last_seen_sn)
     return received_sn <= last_seen_sn && last_seen_sn - received_sn < 5;
 }
 
+// Returns true if the peer has seen the packet with sent_sn or a newer one.
+static bool seq_num_acked(uint16_t last_seen_sn, uint16_t sent_sn)
+{
+    return static_cast<int16_t>(last_seen_sn - sent_sn) >= 0;
+}
+
 static bool endswith(const char *haystack, const char *needle)
 {
     size_t haystack_len = strlen(haystack);
@@ -198,13 +210,14 @@ static void manager_task(void *arg)
 
 void CMNetworking::register_manager(const char *const *const hosts,
                                     int charger_count,
-                                    const std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *)> &manager_callback,
+                                    const std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *, cm_state_v5 *)> &manager_callback,
                                     const std::function<void(uint8_t, uint8_t)> &manager_error_callback)
 {
     this->hosts = hosts;
     this->charger_count = charger_count;
 
     dest_addrs = (struct sockaddr_in *)calloc_psram_or_dram(charger_count, sizeof(struct sockaddr_in));
+    manager_peers = static_cast<ManagerPeer *>(calloc_psram_or_dram(charger_count, sizeof(ManagerPeer)));
 
     for (int i = 0; i < charger_count; ++i) {
         if (endswith(hosts[i], ".local"))
@@ -215,6 +228,10 @@ void CMNetworking::register_manager(const char *const *const hosts,
         resolve_hostname(i);
         dest_addrs[i].sin_family = AF_INET;
         dest_addrs[i].sin_port = htons(CHARGE_MANAGEMENT_PORT);
+
+        // Spread the legacy commands over the send interval.
+        manager_peers[i].last_send = now_us() - micros_t{1000000ll * i / charger_count};
+        manager_peers[i].last_seen_state_seq_num = 65535;
     }
 
     manager_sock = create_socket(CHARGE_MANAGER_PORT, true);
@@ -266,13 +283,6 @@ void CMNetworking::register_manager(const char *const *const hosts,
     #endif
 
     task_scheduler.scheduleWithFixedDelay([this, manager_callback, manager_error_callback, manager_queue](){
-        static uint16_t last_seen_seq_num[MAX_CONTROLLED_CHARGERS];
-        static bool initialized = false;
-        if (!initialized) {
-            memset(last_seen_seq_num, 255, sizeof(last_seen_seq_num));
-            initialized = true; // FIXME: delayed initialization doesn't show in frontend
-        }
-
         ManagerQueueItem item;
 
         // Try to receive up to four packets in one go to catch up on the backlog.
@@ -328,19 +338,21 @@ void CMNetworking::register_manager(const char *const *const hosts,
                 return;
             }
 
-            if (seq_num_invalid(state_pkt.header.seq_num, last_seen_seq_num[charger_idx])) {
+            uint16_t last_seen_seq_num = manager_peers[charger_idx].last_seen_state_seq_num;
+
+            if (seq_num_invalid(state_pkt.header.seq_num, last_seen_seq_num)) {
                 char source_str[16];
                 tf_ip4addr_ntoa(&source_addr, source_str, sizeof(source_str));
 
                 logger.printfln("Received stale (out of order?) state packet from %s (%s). Last seen seq_num is %u, Received seq_num is %u",
                                 charge_manager.get_charger_name(charger_idx),
                                 source_str,
-                                last_seen_seq_num[charger_idx],
+                                last_seen_seq_num,
                                 state_pkt.header.seq_num);
                 return;
             }
 
-            last_seen_seq_num[charger_idx] = state_pkt.header.seq_num;
+            handle_state_packet_ack(charger_idx, &state_pkt);
 
             if (!CM_STATE_FLAGS_MANAGED_IS_SET(state_pkt.v1.state_flags)) {
                 char source_str[16];
@@ -360,31 +372,117 @@ void CMNetworking::register_manager(const char *const *const hosts,
 #endif
 
             if (manager_callback) {
-                manager_callback(charger_idx, &state_pkt.v1, state_pkt.header.version >= 2 ? &state_pkt.v2 : nullptr, state_pkt.header.version >= 3 ? &state_pkt.v3 : nullptr);
+                manager_callback(charger_idx,
+                                 &state_pkt.v1,
+                                 state_pkt.header.version >= 2 ? &state_pkt.v2 : nullptr,
+                                 state_pkt.header.version >= 3 ? &state_pkt.v3 : nullptr,
+                                 state_pkt.header.version >= 5 ? &state_pkt.v5 : nullptr);
             } else {
-                this->send_state_packet(&state_pkt);
+                this->send_state_packet(&client, &state_pkt);
             }
         }
     }, 50_ms, 50_ms);
 }
 
-bool CMNetworking::send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested, int8_t allocated_phases)
+void CMNetworking::handle_state_packet_ack(uint8_t charger_idx, const cm_state_packet *state_pkt)
+{
+    ManagerPeer &peer = manager_peers[charger_idx];
+
+    peer.last_seen_state_seq_num = state_pkt->header.seq_num;
+
+    bool change_driven = state_pkt->header.version >= 4;
+    if (peer.change_driven != change_driven) {
+        peer.change_driven = change_driven;
+        peer.command_ack_pending = false;
+        // Send the next command immediately to tell the charger about the mode.
+        peer.command_sent = false;
+    }
+
+    if (!change_driven)
+        return;
+
+    if (peer.command_ack_pending && seq_num_acked(state_pkt->v4.last_seen_command_seq_num, peer.unacked_command_seq_num))
+        peer.command_ack_pending = false;
+
+    if (CM_STATE_V4_FLAGS_ACK_REQUESTED_IS_SET(state_pkt->v4.flags))
+        peer.state_ack_requested = true;
+}
+
+void CMNetworking::set_sub_manager(uint8_t client_id)
+{
+    dest_addrs[client_id].sin_port = htons(CM_CASCADE_PORT);
+    manager_peers[client_id].sub_manager = true;
+}
+
+CMSendResult CMNetworking::send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested, int8_t allocated_phases, const cm_command_v4 *grant)
 {
     static uint16_t next_seq_num = 1;
+    static const cm_command_v4 no_grant = {};
+
+    if (grant == nullptr)
+        grant = &no_grant;
+
+    ManagerPeer &peer = manager_peers[client_id];
+    bool request_ack = false;
+
+    if (!peer.change_driven) {
+        if (!deadline_elapsed(peer.last_send + CM_COMMAND_LEGACY_INTERVAL))
+            return CMSendResult::NotDue;
+    } else {
+        bool changed = !peer.command_sent
+                    || peer.allocated_current != allocated_current
+                    || peer.cp_disconnect_requested != cp_disconnect_requested
+                    || peer.allocated_phases != allocated_phases
+                    || memcmp(&peer.grant, grant, sizeof(peer.grant)) != 0;
+        bool retransmit = peer.command_ack_pending && deadline_elapsed(peer.last_send + CM_RETRANSMIT_TIMEOUT);
+        bool heartbeat = deadline_elapsed(peer.last_send + CM_COMMAND_HEARTBEAT_INTERVAL);
+
+        if (!changed && !retransmit && !heartbeat && !peer.state_ack_requested)
+            return CMSendResult::NotDue;
+
+        request_ack = changed || peer.command_ack_pending;
+    }
+
+    uint16_t seq_num = next_seq_num;
+    ++next_seq_num;
 
     struct cm_command_packet command_pkt;
     command_pkt.header.magic = CM_PACKET_MAGIC;
-    command_pkt.header.length = CM_COMMAND_PACKET_LENGTH;
-    command_pkt.header.seq_num = next_seq_num;
-    ++next_seq_num;
-    command_pkt.header.version = CM_COMMAND_VERSION;
+    command_pkt.header.length = peer.sub_manager ? CM_COMMAND_PACKET_LENGTH : CM_COMMAND_CHARGER_PACKET_LENGTH;
+    command_pkt.header.seq_num = seq_num;
+    command_pkt.header.version = peer.sub_manager ? CM_COMMAND_VERSION : CM_COMMAND_VERSION_CHARGER;
+    command_pkt.header.padding = 0;
 
     command_pkt.v1.allocated_current = allocated_current;
-    command_pkt.v1.command_flags = cp_disconnect_requested << CM_COMMAND_FLAGS_CPDISC_BIT_POS;
+    command_pkt.v1.command_flags = 0
+        | cp_disconnect_requested << CM_COMMAND_FLAGS_CPDISC_BIT_POS
+        | peer.change_driven      << CM_COMMAND_FLAGS_CHANGE_DRIVEN_BIT_POS
+        | request_ack             << CM_COMMAND_FLAGS_ACK_REQUESTED_BIT_POS;
 
     command_pkt.v2.allocated_phases = allocated_phases;
 
-    return send_command_packet(client_id, &command_pkt);
+    command_pkt.v3.last_seen_state_seq_num = peer.last_seen_state_seq_num;
+    command_pkt.v3._padding = 0;
+
+    command_pkt.v4 = *grant;
+
+    if (!send_command_packet(client_id, &command_pkt))
+        return CMSendResult::Retry;
+
+    peer.last_send = now_us();
+    peer.allocated_current = allocated_current;
+    peer.allocated_phases = allocated_phases;
+    peer.cp_disconnect_requested = cp_disconnect_requested;
+    peer.grant = *grant;
+    peer.command_sent = true;
+    peer.state_ack_requested = false;
+
+    if (request_ack) {
+        peer.command_ack_pending = true;
+        peer.unacked_command_seq_num = seq_num;
+    }
+
+    return CMSendResult::Sent;
 }
 
 bool CMNetworking::send_command_packet(uint8_t client_id, cm_command_packet *command_pkt)
@@ -400,7 +498,10 @@ bool CMNetworking::send_command_packet(uint8_t client_id, cm_command_packet *com
     em_phase_switcher.filter_command_packet(client_id, command_pkt);
 #endif
 
-    int err = sendto(manager_sock, command_pkt, sizeof(decltype(*command_pkt)), MSG_DONTWAIT, (sockaddr *)&dest_addrs[client_id], sizeof(dest_addrs[client_id]));
+    // Only sub-managers get the cascade fields. Forwarded packets of newer versions were truncated to the known fields.
+    size_t length = std::min<size_t>(command_pkt->header.length, sizeof(decltype(*command_pkt)));
+
+    int err = sendto(manager_sock, command_pkt, length, MSG_DONTWAIT, (sockaddr *)&dest_addrs[client_id], sizeof(dest_addrs[client_id]));
 
     if (err < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -416,8 +517,8 @@ bool CMNetworking::send_command_packet(uint8_t client_id, cm_command_packet *com
 
         return true;
     }
-    if (err != CM_COMMAND_PACKET_LENGTH) {
-        logger.printfln("Failed to send command: sendto truncated packet (of %u bytes) to %d bytes.", CM_COMMAND_PACKET_LENGTH, err);
+    if (static_cast<size_t>(err) != length) {
+        logger.printfln("Failed to send command: sendto truncated packet (of %u bytes) to %d bytes.", length, err);
         return true;
     }
     return true;
@@ -425,22 +526,61 @@ bool CMNetworking::send_command_packet(uint8_t client_id, cm_command_packet *com
 
 void CMNetworking::register_client(const std::function<void(uint16_t, bool, int8_t)> &client_callback)
 {
-    client_sock = create_socket(CHARGE_MANAGEMENT_PORT, false);
+    register_client_connection(&client, CHARGE_MANAGEMENT_PORT, [this, client_callback](cm_command_packet *command_pkt) {
+        if (!client_callback) {
+            // Proxy mode: Forward the command to the charger.
+            if (command_pkt != nullptr)
+                this->send_command_packet(0, command_pkt);
+            return;
+        }
 
-    if (client_sock < 0)
-        return;
+        // Block charging
+        if (command_pkt == nullptr) {
+            client_callback(0, false, 0);
+            return;
+        }
 
-    memset(&manager_addr, 0, sizeof(manager_addr));
+        handle_command_packet_ack(&client, command_pkt);
 
-    task_scheduler.scheduleWithFixedDelay([this, client_callback](){
-        static uint16_t last_seen_seq_num = 255;
-        static uint32_t last_successful_recv = millis();
+        client_callback(command_pkt->v1.allocated_current,
+                        CM_COMMAND_FLAGS_CPDISC_IS_SET(command_pkt->v1.command_flags),
+                        command_pkt->header.version >= 2 ? command_pkt->v2.allocated_phases : 0);
+        //logger.printfln("Received command packet. Allocated current is %u", command_pkt->v1.allocated_current);
+    });
+}
+
+void CMNetworking::register_sub_manager(const std::function<void(const cm_command_v4 *)> &grant_callback)
+{
+    register_client_connection(&cascade_client, CM_CASCADE_PORT, [this, grant_callback](cm_command_packet *command_pkt) {
+        // Managers without cascade support can't grant a budget.
+        if (command_pkt == nullptr || command_pkt->header.version < 4) {
+            grant_callback(nullptr);
+            return;
+        }
+
+        handle_command_packet_ack(&cascade_client, command_pkt);
+
+        grant_callback(&command_pkt->v4);
+    });
+}
 
+// command_callback is called with nullptr if charging has to be blocked.
+void CMNetworking::register_client_connection(ClientConnection *conn, uint16_t port, const std::function<void(cm_command_packet *)> &command_callback)
+{
+    conn->sock = create_socket(port, false);
+
+    if (conn->sock < 0)
+        return;
+
+    memset(&conn->manager_addr, 0, sizeof(conn->manager_addr));
+    conn->last_successful_recv = millis();
+
+    task_scheduler.scheduleWithFixedDelay([conn, command_callback](){
         struct cm_command_packet command_pkt;
 
         struct sockaddr_storage from_addr;
         socklen_t socklen = sizeof(from_addr);
-        int len = recvfrom(client_sock, &command_pkt, sizeof(command_pkt), 0, (struct sockaddr *)&from_addr, &socklen);
+        int len = recvfrom(conn->sock, &command_pkt, sizeof(command_pkt), 0, (struct sockaddr *)&from_addr, &socklen);
 
         if (len < 0) {
             if (errno != EAGAIN && errno != EWOULDBLOCK)
@@ -448,8 +588,10 @@ void CMNetworking::register_client(const std::function<void(uint16_t, bool, int8
 
             // If we have not received a valid packet for one minute, invalidate manager_addr.
             // Otherwise we would send state packets to this address forever.
-            if (deadline_elapsed(last_successful_recv + 60 * 1000))
-                manager_addr_valid = false;
+            if (deadline_elapsed(conn->last_successful_recv + 60 * 1000)) {
+                conn->manager_addr_valid = false;
+                conn->change_driven = false;
+            }
 
             return;
         }
@@ -462,72 +604,122 @@ void CMNetworking::register_client(const std::function<void(uint16_t, bool, int8
             return;
         }
 
-        if (seq_num_invalid(command_pkt.header.seq_num, last_seen_seq_num)) {
-            logger.printfln("Received stale (out of order?) command packet. last seen seq_num is %u, received seq_num is %u", last_seen_seq_num, command_pkt.header.seq_num);
+        if (seq_num_invalid(command_pkt.header.seq_num, conn->last_seen_command_seq_num)) {
+            logger.printfln("Received stale (out of order?) command packet. last seen seq_num is %u, received seq_num is %u", conn->last_seen_command_seq_num, command_pkt.header.seq_num);
             return;
         }
 
-        last_seen_seq_num = command_pkt.header.seq_num;
+        conn->last_seen_command_seq_num = command_pkt.header.seq_num;
 
-        if (memcmp(&this->manager_addr, &from_addr, from_addr.s2_len) != 0) {
+        if (memcmp(&conn->manager_addr, &from_addr, from_addr.s2_len) != 0) {
             char manager_str[16];
             char from_str[16];
-            tf_ip4addr_ntoa(&this->manager_addr, manager_str, sizeof(manager_str));
+            tf_ip4addr_ntoa(&conn->manager_addr, manager_str, sizeof(manager_str));
             tf_ip4addr_ntoa(&from_addr,          from_str,    sizeof(from_str   ));
 
-            if (deadline_elapsed(this->last_manager_addr_change + 1_m)) {
-                if (this->manager_addr.s2_len > 0) {
+            if (deadline_elapsed(conn->last_manager_addr_change + 1_m)) {
+                if (conn->manager_addr.s2_len > 0) {
                     logger.printfln("Manager address changed from %s to %s", manager_str, from_str);
                 }
-                this->manager_addr_valid = true;
+                conn->manager_addr_valid = true;
             } else {
                 logger.printfln("Rejecting conflicting manager address change from %s to %s", manager_str, from_str);
-                this->manager_addr_valid = false;
+                conn->manager_addr_valid = false;
             }
 
-            memcpy(&this->manager_addr, &from_addr, from_addr.s2_len);
-            this->last_manager_addr_change = now_us();
-
-            if (!this->manager_addr_valid) {
-                // Block charging
-                if (client_callback) {
-                    client_callback(0, false, 0);
-                }
+            memcpy(&conn->manager_addr, &from_addr, from_addr.s2_len);
+            conn->last_manager_addr_change = now_us();
 
+            if (!conn->manager_addr_valid) {
+                command_callback(nullptr);
                 return;
             }
         } else { // Manager address unchanged
-            if (!this->manager_addr_valid && this->manager_addr.s2_len > 0) {
-                if (deadline_elapsed(this->last_manager_addr_change + 1_m)) {
+            if (!conn->manager_addr_valid && conn->manager_addr.s2_len > 0) {
+                if (deadline_elapsed(conn->last_manager_addr_change + 1_m)) {
                     char manager_str[16];
-                    tf_ip4addr_ntoa(&this->manager_addr, manager_str, sizeof(manager_str));
+                    tf_ip4addr_ntoa(&conn->manager_addr, manager_str, sizeof(manager_str));
 
                     logger.printfln("Accepting manager address %s", manager_str);
-                    this->manager_addr_valid = true;
+                    conn->manager_addr_valid = true;
                 } else {
-                    // Block charging
-                    if (client_callback) {
-                        client_callback(0, false, 0);
-                    }
-
+                    command_callback(nullptr);
                     return;
                 }
             }
         }
 
-        last_successful_recv = millis();
+        conn->last_successful_recv = millis();
 
-        if (client_callback) {
-            client_callback(command_pkt.v1.allocated_current,
-                            CM_COMMAND_FLAGS_CPDISC_IS_SET(command_pkt.v1.command_flags),
-                            command_pkt.header.version >= 2 ? command_pkt.v2.allocated_phases : 0);
-        } else {
-            this->send_command_packet(0, &command_pkt);
-        }
-        //logger.printfln("Received command packet. Allocated current is %u", command_pkt.v1.allocated_current);
+        command_callback(&command_pkt);
     }, 100_ms, 100_ms);
 }
 
+void CMNetworking::handle_command_packet_ack(ClientConnection *conn, const cm_command_packet *command_pkt)
+{
+    bool change_driven = command_pkt->header.version >= 3 && CM_COMMAND_FLAGS_CHANGE_DRIVEN_IS_SET(command_pkt->v1.command_flags);
+
+    if (conn->change_driven != change_driven) {
+        logger.printfln("Manager %s change-driven protocol mode", change_driven ? "enabled" : "disabled");
+        conn->change_driven = change_driven;
+        conn->state_ack_pending = false;
+        conn->state_reply_pending = false;
+    }
+
+    if (!change_driven)
+        return;
+
+    if (conn->state_ack_pending && seq_num_acked(command_pkt->v3.last_seen_state_seq_num, conn->unacked_state_seq_num))
+        conn->state_ack_pending = false;
+
+    // Delay the reply: The EVSE has to apply the command before the state can report it.
+    if (CM_COMMAND_FLAGS_ACK_REQUESTED_IS_SET(command_pkt->v1.command_flags) && !conn->state_reply_pending) {
+        conn->state_reply_pending = true;
+        conn->state_reply_deadline = now_us() + CM_STATE_REPLY_DELAY;
+    }
+}
+
+// Only values that influence the current allocation are compared.
+bool CMNetworking::client_state_changed(const ClientConnection *conn, const cm_state_packet *state_pkt)
+{
+    const cm_state_v1 &now  = state_pkt->v1;
+    const cm_state_v1 &sent = conn->last_sent_state.v1;
+
+    if (now.feature_flags != sent.feature_flags
+     || now.allowed_charging_current != sent.allowed_charging_current
+     || now.supported_current != sent.supported_current
+     || now.iec61851_state != sent.iec61851_state
+     || now.charger_state != sent.charger_state
+     || now.error_state != sent.error_state
+     || now.state_flags != sent.state_flags
+     || (now.car_stopped_charging == 0) != (sent.car_stopped_charging == 0)
+     || state_pkt->v3.phases != conn->last_sent_state.v3.phases)
+        return true;
+
+    for (size_t i = 0; i < 3; i++) {
+        if (fabsf(now.line_currents[i] - sent.line_currents[i]) >= CM_STATE_LINE_CURRENT_THRESHOLD)
+            return true;
+    }
+
+    const cm_state_v5 &now_v5  = state_pkt->v5;
+    const cm_state_v5 &sent_v5 = conn->last_sent_state.v5;
+
+    if (now_v5.flags != sent_v5.flags || now_v5.charger_count != sent_v5.charger_count)
+        return true;
+
+    // Aggregated currents are in mA.
+    const int32_t threshold_ma = static_cast<int32_t>(CM_STATE_LINE_CURRENT_THRESHOLD * 1000);
+
+    for (size_t i = 0; i < 4; i++) {
+        if (abs(now_v5.min_current[i]       - sent_v5.min_current[i])       >= threshold_ma
+         || abs(now_v5.requested_current[i] - sent_v5.requested_current[i]) >= threshold_ma
+         || abs(now_v5.max_current[i]       - sent_v5.max_current[i])       >= threshold_ma)
+            return true;
+    }
+
+    return false;
+}
+
 bool CMNetworking::send_client_update(uint32_t esp32_uid,
                                       uint8_t iec61851_state,
                                       uint8_t charger_state,
@@ -542,20 +734,22 @@ bool CMNetworking::send_client_update(uint32_t esp32_uid,
                                       int8_t phases,
                                       bool can_switch_phases_now)
 {
-    static uint16_t next_seq_num = 0;
-
-    if (!manager_addr_valid) {
+    if (!client.manager_addr_valid) {
         //logger.printfln("Manager addr not valid.");
         return false;
     }
+
+    // The manager discards states with an unchanged EVSE uptime.
+    if (client.change_driven && !deadline_elapsed(client.last_state_send + CM_STATE_MIN_INTERVAL))
+        return false;
+
     //logger.printfln("Sending state packet.");
 
     struct cm_state_packet state_pkt;
     state_pkt.header.magic = CM_PACKET_MAGIC;
-    state_pkt.header.length = CM_STATE_PACKET_LENGTH;
-    state_pkt.header.seq_num = next_seq_num;
-    ++next_seq_num;
-    state_pkt.header.version = CM_STATE_VERSION;
+    state_pkt.header.length = CM_STATE_CHARGER_PACKET_LENGTH;
+    state_pkt.header.version = CM_STATE_VERSION_CHARGER;
+    state_pkt.header.padding = 0;
 
     bool has_phase_switch = api.hasFeature("phase_switch");
     bool has_meter_values = api.hasFeature("meter_all_values");
@@ -625,25 +819,101 @@ bool CMNetworking::send_client_update(uint32_t esp32_uid,
 
     state_pkt.v3.phases = phases;
     state_pkt.v3.phases |= can_switch_phases_now << CM_STATE_V3_CAN_PHASE_SWITCH_BIT_POS;
+    memset(state_pkt.v3.padding, 0, sizeof(state_pkt.v3.padding));
+
+    // Not sent, but compared by client_state_changed.
+    memset(&state_pkt.v5, 0, sizeof(state_pkt.v5));
 
-    return send_state_packet(&state_pkt);
+    return send_client_state(&client, &state_pkt);
 }
 
-bool CMNetworking::send_state_packet(const cm_state_packet *state_pkt)
+bool CMNetworking::send_sub_manager_update(uint32_t esp32_uid, const cm_state_v5 *aggregate)
 {
-    if (!manager_addr_valid) {
+    if (!cascade_client.manager_addr_valid)
+        return false;
+
+    if (cascade_client.change_driven && !deadline_elapsed(cascade_client.last_state_send + CM_STATE_MIN_INTERVAL))
+        return false;
+
+    // v1 to v3 describe the sub-manager as a managed charger without vehicle:
+    // The upstream manager's allocator ignores it and distributes the budget with v5.
+    struct cm_state_packet state_pkt;
+    memset(&state_pkt, 0, sizeof(state_pkt));
+
+    state_pkt.header.magic = CM_PACKET_MAGIC;
+    state_pkt.header.length = CM_STATE_PACKET_LENGTH;
+    state_pkt.header.version = CM_STATE_VERSION;
+
+    state_pkt.v1.esp32_uid = esp32_uid;
+    // The upstream manager discards states with an unchanged uptime.
+    state_pkt.v1.evse_uptime = millis();
+    state_pkt.v1.state_flags = 1 << CM_STATE_FLAGS_MANAGED_BIT_POS;
+
+    state_pkt.v3.phases = 3;
+
+    state_pkt.v5 = *aggregate;
+    state_pkt.v5.flags |= CM_STATE_V5_FLAGS_SUB_MANAGER_MASK;
+
+    return send_client_state(&cascade_client, &state_pkt);
+}
+
+// Sends the state if the connection's protocol mode requires it now.
+bool CMNetworking::send_client_state(ClientConnection *conn, cm_state_packet *state_pkt)
+{
+    bool request_ack = false;
+
+    if (conn->change_driven) {
+        bool changed = client_state_changed(conn, state_pkt);
+        bool retransmit = conn->state_ack_pending && deadline_elapsed(conn->last_state_send + CM_RETRANSMIT_TIMEOUT);
+        bool reply = conn->state_reply_pending && deadline_elapsed(conn->state_reply_deadline);
+        bool heartbeat = deadline_elapsed(conn->last_state_send + CM_STATE_HEARTBEAT_INTERVAL);
+
+        if (!changed && !retransmit && !reply && !heartbeat)
+            return false;
+
+        request_ack = changed || conn->state_ack_pending;
+    }
+
+    state_pkt->header.seq_num = conn->next_state_seq_num;
+    ++conn->next_state_seq_num;
+
+    state_pkt->v4.last_seen_command_seq_num = conn->last_seen_command_seq_num;
+    state_pkt->v4.flags = request_ack << CM_STATE_V4_FLAGS_ACK_REQUESTED_BIT_POS;
+    state_pkt->v4.padding = 0;
+
+    if (!send_state_packet(conn, state_pkt))
+        return false;
+
+    conn->last_state_send = now_us();
+    conn->last_sent_state = *state_pkt;
+    conn->state_reply_pending = false;
+
+    if (request_ack) {
+        conn->state_ack_pending = true;
+        conn->unacked_state_seq_num = state_pkt->header.seq_num;
+    }
+
+    return true;
+}
+
+bool CMNetworking::send_state_packet(ClientConnection *conn, const cm_state_packet *state_pkt)
+{
+    if (!conn->manager_addr_valid) {
         //logger.printfln("Manager addr not valid.");
         return false;
     }
 
-    int err = sendto(client_sock, state_pkt, sizeof(decltype(*state_pkt)), 0, (sockaddr *)&manager_addr, sizeof(manager_addr));
+    // Only sub-managers send the cascade fields. Forwarded packets of newer versions were truncated to the known fields.
+    size_t length = std::min<size_t>(state_pkt->header.length, sizeof(decltype(*state_pkt)));
+
+    int err = sendto(conn->sock, state_pkt, length, 0, (sockaddr *)&conn->manager_addr, sizeof(conn->manager_addr));
     if (err < 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK)
             logger.printfln("Failed to send state: %s (%d)", strerror(errno), errno);
         return false;
     }
-    if (err != CM_STATE_PACKET_LENGTH) {
-        logger.printfln("Failed to send state: sendto truncated packet (of %u bytes) to %d bytes.", CM_STATE_PACKET_LENGTH, err);
+    if (static_cast<size_t>(err) != length) {
+        logger.printfln("Failed to send state: sendto truncated packet (of %u bytes) to %d bytes.", length, err);
         return false;
     }
 
@@ -118,9 +118,6 @@ void DayAheadPrices::setup()
     api.restorePersistentConfig("day_ahead_prices/config", &config);
     prices.get("resolution")->updateEnum(config.get("resolution")->asEnum<Resolution>());
 
-    json_buffer = nullptr;
-    json_buffer_position = 0;
-
     initialized = true;
 }
 
@@ -275,13 +272,21 @@ void DayAheadPrices::update()
         return;
     }
 
-    if(json_buffer == nullptr) {
-        json_buffer = (char *)calloc_psram_or_dram(DAY_AHEAD_PRICE_MAX_JSON_LENGTH, sizeof(char));
-    } else {
-        logger.printfln("JSON Buffer was potentially not freed correctly");
-        json_buffer_position = 0;
+    if (staged_prices == nullptr) {
+        staged_prices = static_cast<int32_t *>(calloc_psram_or_dram(DAY_AHEAD_PRICE_MAX_AMOUNT, sizeof(int32_t)));
+    }
+    else {
+        logger.printfln("Price buffer was potentially not freed correctly");
     }
 
+    staged_prices_count = 0;
+    staged_first_date = 0;
+    staged_next_date = 0;
+    json_parser.reset();
+
+    // Only ask the server for changes if there are prices that can be kept.
+    https_client.set_conditional_get(prices.get("prices")->count() > 0);
+
     https_client.download_async(get_api_url_with_path().c_str(), config.get("cert_id")->asInt(), [this](AsyncHTTPSClientEvent *event) {
         switch (event->type) {
         case AsyncHTTPSClientEventType::Error:
@@ -333,24 +338,25 @@ void DayAheadPrices::update()
             break;
 
         case AsyncHTTPSClientEventType::Data:
-            if(json_buffer == nullptr) {
-                logger.printfln("JSON Buffer was not allocated correctly");
-
-                download_state = DAP_DOWNLOAD_STATE_ERROR;
-                handle_cleanup();
+            if (download_state != DAP_DOWNLOAD_STATE_PENDING) {
+                // Parsing already failed, wait for the abort to complete.
                 break;
             }
 
-            if(json_buffer_position + event->data_chunk_len >= DAY_AHEAD_PRICE_MAX_JSON_LENGTH) {
-                logger.printfln("JSON Buffer overflow");
+            if (staged_prices == nullptr) {
+                logger.printfln("Price buffer was not allocated correctly");
 
                 download_state = DAP_DOWNLOAD_STATE_ERROR;
-                handle_cleanup();
+                https_client.abort_async();
                 break;
             }
 
-            memcpy(json_buffer + json_buffer_position, event->data_chunk, event->data_chunk_len);
-            json_buffer_position += event->data_chunk_len;
+            if (!json_parser.parse(static_cast<const char *>(event->data_chunk), event->data_chunk_len)) {
+                logger.printfln("Error during JSON parsing: %s", json_parser.get_error());
+
+                download_state = DAP_DOWNLOAD_STATE_ERROR;
+                https_client.abort_async();
+            }
             break;
 
         case AsyncHTTPSClientEventType::Aborted:
@@ -363,13 +369,21 @@ void DayAheadPrices::update()
             break;
 
         case AsyncHTTPSClientEventType::Finished:
-            if(json_buffer == nullptr) {
-                logger.printfln("JSON Buffer was not allocated correctly");
+            if (event->not_modified) {
+                // Prices did not change since the last download
+                state.get("last_check")->updateUint(rtc.timestamp_minutes());
+            }
+            else if (staged_prices == nullptr) {
+                logger.printfln("Price buffer was not allocated correctly");
 
                 download_state = DAP_DOWNLOAD_STATE_ERROR;
                 break;
-            } else {
-                json_buffer[json_buffer_position] = '\0';
+            }
+            else if (!json_parser.finish()) {
+                logger.printfln("Error during JSON parsing: %s", json_parser.get_error());
+                download_state = DAP_DOWNLOAD_STATE_ERROR;
+            }
+            else {
                 handle_new_data();
             }
             handle_cleanup();
@@ -385,44 +399,55 @@ void DayAheadPrices::update()
 
 void DayAheadPrices::handle_cleanup()
 {
-    free_any(json_buffer);
-    json_buffer = nullptr;
-    json_buffer_position = 0;
+    free_any(staged_prices);
+    staged_prices = nullptr;
+    staged_prices_count = 0;
 }
 
-void DayAheadPrices::handle_new_data()
+void DayAheadPrices::handle_json_value(const JsonStreamParser &parser, JsonStreamValueType type, const char *value)
 {
-    // Deserialize json received from API
-    DynamicJsonDocument json_doc{DAY_AHEAD_PRICE_MAX_ARDUINO_JSON_BUFFER_SIZE};
-    DeserializationError error = deserializeJson(json_doc, json_buffer, json_buffer_position);
-    if (error) {
-        logger.printfln("Error during JSON deserialization: %s", error.c_str());
-        download_state = DAP_DOWNLOAD_STATE_ERROR;
-    } else {
-        // Put data from json into day_ahead_prices/state object
-        JsonArray js_prices = json_doc["prices"].as<JsonArray>();
-        auto p = prices.get("prices");
-        p->removeAll();
-        int count = 0;
-        int max_count = this->get_max_price_values();
-        for(JsonVariant v : js_prices) {
-            p->add()->updateInt(v.as<int>());
-            count++;
-            if(count >= max_count) {
-                break;
-            }
-        }
+    if (type != JsonStreamValueType::Number) {
+        return;
+    }
 
-        const uint32_t current_minutes = rtc.timestamp_minutes();
-        state.get("last_sync")->updateUint(current_minutes);
-        state.get("last_check")->updateUint(current_minutes);
-        state.get("next_check")->updateUint(json_doc["next_date"].as<int>()/60);
-        prices.get("first_date")->updateUint(json_doc["first_date"].as<int>()/60);
+    int32_t number;
 
-        update_current_price();
-        update_minmaxavg_price();
-        update_prices_sorted();
+    if (!JsonStreamParser::to_int32(value, &number)) {
+        // Truncate non-integer numbers
+        number = static_cast<int32_t>(strtod(value, nullptr));
+    }
+
+    if (parser.path_is({"prices", nullptr})) {
+        if (staged_prices != nullptr && staged_prices_count < static_cast<uint32_t>(get_max_price_values())) {
+            staged_prices[staged_prices_count++] = number;
+        }
+    }
+    else if (parser.path_is({"first_date"})) {
+        staged_first_date = number;
     }
+    else if (parser.path_is({"next_date"})) {
+        staged_next_date = number;
+    }
+}
+
+void DayAheadPrices::handle_new_data()
+{
+    // Put data staged while parsing into day_ahead_prices/prices object
+    auto p = prices.get("prices");
+    p->removeAll();
+    for (uint32_t i = 0; i < staged_prices_count; i++) {
+        p->add()->updateInt(staged_prices[i]);
+    }
+
+    const uint32_t current_minutes = rtc.timestamp_minutes();
+    state.get("last_sync")->updateUint(current_minutes);
+    state.get("last_check")->updateUint(current_minutes);
+    state.get("next_check")->updateUint(staged_next_date/60);
+    prices.get("first_date")->updateUint(staged_first_date/60);
+
+    update_current_price();
+    update_minmaxavg_price();
+    update_prices_sorted();
 }
 
 // Create API path that includes currently configured region and resolution
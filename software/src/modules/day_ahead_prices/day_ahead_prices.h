@@ -21,11 +21,11 @@
 
 #include <FS.h> // FIXME: without this include here there is a problem with the IPADDR_NONE define in <lwip/ip4_addr.h>
 #include <esp_http_client.h>
-#include <ArduinoJson.h>
 
 #include <TFTools/Option.h>
 
 #include "async_https_client.h"
+#include "json_stream_parser.h"
 #include "module.h"
 #include "config.h"
 #include "module_available.h"
@@ -34,10 +34,6 @@
 #include "modules/automation/automation_backend.h"
 #endif
 
-// TODO: We can reduce this again after reducing data on weekend on API server
-#define DAY_AHEAD_PRICE_MAX_JSON_LENGTH 4096*2
-#define DAY_AHEAD_PRICE_MAX_ARDUINO_JSON_BUFFER_SIZE 8192
-
 #define DAY_AHEAD_PRICE_MAX_AMOUNT (25*4*2) // Two days with 15min resolution and one additional hour for daylight savings time switch
 
 enum DAPDownloadState {
@@ -58,6 +54,7 @@ private:
     String get_api_url_with_path();
     int get_max_price_values();
     bool time_between(const uint32_t index, const uint32_t start, const uint32_t end, const uint32_t first_date, const uint8_t resolution);
+    void handle_json_value(const JsonStreamParser &parser, JsonStreamValueType type, const char *value);
     void handle_new_data();
     void handle_cleanup();
 
@@ -66,8 +63,17 @@ private:
     void update_prices_sorted();
 
     micros_t last_update_begin;
-    char *json_buffer;
-    uint32_t json_buffer_position;
+
+    // The response is parsed while it is downloaded. Values are staged here
+    // and only copied into the prices state if the download completes.
+    JsonStreamParser json_parser{[this](const JsonStreamParser &parser, JsonStreamValueType type, const char *value, size_t /*value_len*/) {
+        this->handle_json_value(parser, type, value);
+    }};
+    int32_t *staged_prices = nullptr;
+    uint32_t staged_prices_count = 0;
+    int32_t staged_first_date = 0;
+    int32_t staged_next_date = 0;
+
     bool current_price_available = false;
     AsyncHTTPSClient https_client;
     uint64_t task_id = 0;
@@ -34,10 +34,13 @@
 #include "string_builder.h"
 #include "config/private.h"
 #include "tools/memory.h"
+#include "tools/loop_profiler.h"
 
 #include "gcc_warnings.h"
 
 #define BENCHMARK_BLOCKSIZE 32768
+// The state only contains the entries with the highest total runtime, the CSV contains all.
+#define LOOP_PROFILE_STATE_ENTRIES 20
 
 static float benchmark_area(uint32_t *start_address, size_t max_length);
 static void get_spi_settings(uint32_t spi_num, uint32_t apb_clk, uint32_t *spi_clk, uint32_t *dummy_cyclelen, const char **spi_mode);
@@ -61,6 +64,10 @@ static void malloc_failed_hook(size_t size, uint32_t caps, const char *function_
 {
     const char *task_name = pcTaskGetName(xTaskGetCurrentTaskHandle());
 
+    // esp_backtrace_print writes to the UART directly.
+    // Keep the log lines in order with it.
+    logger.begin_sync_serial();
+
     if (strcmp(task_name, "loopTask") == 0 || strcmp(task_name, "httpd") == 0 || strcmp(task_name, "wifi") == 0) {
         malloc_failed_log_detailed(size, caps, function_name, task_name);
     } else {
@@ -71,6 +78,8 @@ static void malloc_failed_hook(size_t size, uint32_t caps, const char *function_
 
         esp_backtrace_print(INT32_MAX);
     }
+
+    logger.end_sync_serial();
 }
 
 void Debug::pre_setup()
@@ -183,6 +192,60 @@ void Debug::pre_setup()
 
     register_task("ipc0", IPC_STACK_SIZE);
     register_task("ipc1", IPC_STACK_SIZE);
+
+    loop_profile_config = Config::Object({
+        {"enabled", Config::Bool(false)},
+    });
+
+    loop_profile_entry_prototype = Config::Object({
+        {"name",            Config::Str("", 0, 64)},
+        {"calls",           Config::Uint32(0)},
+        {"total_ms",        Config::Uint32(0)},
+        {"avg_us",          Config::Uint32(0)},
+        {"max_us",          Config::Uint32(0)},
+        {"max_lateness_us", Config::Uint32(0)},
+        {"histogram",       Config::Array({},
+            Config::get_prototype_uint32_0(),
+            0, LOOP_PROFILER_HISTOGRAM_BUCKETS, Config::type_id<Config::ConfUint>()
+        )},
+    });
+
+    loop_profile = Config::Object({
+        {"enabled",     Config::Bool(false)},
+        {"duration_ms", Config::Uint32(0)},
+        {"entries", Config::Array({},
+            &loop_profile_entry_prototype,
+            0, LOOP_PROFILE_STATE_ENTRIES, Config::type_id<Config::ConfObject>()
+        )},
+    });
+
+#ifdef HEAP_ATTRIBUTION
+    state_heap_by_module_prototype = Config::Object({
+        {"tag",                 Config::Str("", 0, HEAP_ATTRIBUTION_MAX_TAG_LENGTH)},
+        {"live_bytes",          Config::Uint32(0)},
+        {"live_blocks",         Config::Uint32(0)},
+        {"peak_live_bytes",     Config::Uint32(0)},
+        {"largest_block",       Config::Uint32(0)},
+        {"allocations",         Config::Uint32(0)},
+        {"frees",               Config::Uint32(0)},
+        {"allocations_per_s",   Config::Uint32(0)},
+        {"allocated_bytes_per_s", Config::Uint32(0)},
+        {"live_histogram",      Config::Array({},
+            Config::get_prototype_uint32_0(),
+            0, HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS, Config::type_id<Config::ConfUint>()
+        )},
+    });
+
+    state_heap_by_module = Config::Object({
+        {"tracked_blocks",        Config::Uint32(0)},
+        {"untracked_allocations", Config::Uint32(0)},
+        {"unknown_frees",         Config::Uint32(0)},
+        {"modules", Config::Array({},
+            &state_heap_by_module_prototype,
+            0, HEAP_ATTRIBUTION_MAX_TAGS, Config::type_id<Config::ConfObject>()
+        )},
+    });
+#endif
 }
 
 void Debug::setup()
@@ -251,9 +314,174 @@ void Debug::setup()
 
     last_state_update = now_us();
 
+#ifdef HEAP_ATTRIBUTION
+    if (heap_attribution_is_initialized()) {
+        // Allocate everything up front, so that the updates don't show up in the statistics themselves.
+        heap_stats.resize(HEAP_ATTRIBUTION_MAX_TAGS);
+        heap_prev_allocations.reserve(HEAP_ATTRIBUTION_MAX_TAGS);
+        heap_prev_allocated_bytes.reserve(HEAP_ATTRIBUTION_MAX_TAGS);
+        heap_last_update = now_us();
+
+        task_scheduler.scheduleWithFixedDelay([this](){
+            this->update_heap_by_module();
+        }, 5_s, 5_s);
+    }
+#endif
+
     initialized = true;
 }
 
+static void format_loop_profile_name(const LoopProfilerEntry &entry, bool is_module, char *buf, size_t buf_len)
+{
+    if (is_module) {
+        snprintf(buf, buf_len, "loop %s", entry.file);
+        return;
+    }
+
+    if (entry.file == nullptr) {
+        snprintf(buf, buf_len, "other tasks");
+        return;
+    }
+
+    // __FILE__ is an absolute path, keep only the part below src/.
+    const char *file = entry.file;
+    const char *src = strstr(file, "src/");
+    while (src != nullptr) {
+        file = src + 4;
+        src = strstr(file, "src/");
+    }
+
+    snprintf(buf, buf_len, "%s:%i", file, entry.line);
+}
+
+void Debug::update_loop_profile()
+{
+    loop_profile.get("enabled")->updateBool(loop_profiler.is_enabled());
+    loop_profile.get("duration_ms")->updateUint(loop_profiler.get_sampling_duration().as<uint32_t>() / 1000);
+
+    struct Top {
+        const LoopProfilerEntry *entry;
+        bool is_module;
+    };
+    Top top[LOOP_PROFILE_STATE_ENTRIES];
+    size_t top_count = 0;
+
+    // Keep the entries sorted by descending total runtime.
+    loop_profiler.for_each([&top, &top_count](const LoopProfilerEntry &entry, bool is_module) {
+        size_t i = top_count;
+        if (i == LOOP_PROFILE_STATE_ENTRIES) {
+            if (top[i - 1].entry->total_us >= entry.total_us) {
+                return;
+            }
+            --i;
+        }
+        else {
+            ++top_count;
+        }
+
+        while (i > 0 && top[i - 1].entry->total_us < entry.total_us) {
+            top[i] = top[i - 1];
+            --i;
+        }
+
+        top[i] = {&entry, is_module};
+    });
+
+    Config *entries = static_cast<Config *>(loop_profile.get("entries"));
+
+    while (entries->count() > top_count) {
+        entries->removeLast();
+    }
+
+    while (entries->count() < top_count) {
+        Config *conf = static_cast<Config *>(entries->add());
+        Config *histogram = static_cast<Config *>(conf->get("histogram"));
+        for (size_t i = 0; i < LOOP_PROFILER_HISTOGRAM_BUCKETS; ++i) {
+            histogram->add();
+        }
+    }
+
+    for (size_t i = 0; i < top_count; ++i) {
+        const LoopProfilerEntry &entry = *top[i].entry;
+        Config *conf = static_cast<Config *>(entries->get(i));
+        char name[65];
+
+        format_loop_profile_name(entry, top[i].is_module, name, sizeof(name));
+
+        conf->get("name")->updateString(name);
+        conf->get("calls")->updateUint(entry.calls);
+        conf->get("total_ms")->updateUint(static_cast<uint32_t>(entry.total_us / 1000));
+        conf->get("avg_us")->updateUint(static_cast<uint32_t>(entry.total_us / entry.calls));
+        conf->get("max_us")->updateUint(entry.max_us);
+        conf->get("max_lateness_us")->updateUint(entry.max_lateness_us);
+
+        Config *histogram = static_cast<Config *>(conf->get("histogram"));
+        for (size_t bucket = 0; bucket < LOOP_PROFILER_HISTOGRAM_BUCKETS; ++bucket) {
+            histogram->get(bucket)->updateUint(entry.histogram[bucket]);
+        }
+    }
+}
+
+#ifdef HEAP_ATTRIBUTION
+void Debug::update_heap_by_module()
+{
+    HeapAttributionSummary summary;
+    size_t tag_count = heap_attribution_get_stats(heap_stats.data(), heap_stats.size(), &summary);
+
+    micros_t now = now_us();
+    uint32_t elapsed_ms = (now - heap_last_update).as<uint32_t>() / 1000;
+    heap_last_update = now;
+    if (elapsed_ms == 0) {
+        elapsed_ms = 1;
+    }
+
+    state_heap_by_module.get("tracked_blocks")->updateUint(summary.tracked_blocks);
+    state_heap_by_module.get("untracked_allocations")->updateUint(summary.untracked_allocations);
+    state_heap_by_module.get("unknown_frees")->updateUint(summary.unknown_frees);
+
+    Config *modules = static_cast<Config *>(state_heap_by_module.get("modules"));
+
+    // Tags are never unregistered, so new tags are always appended.
+    while (modules->count() < tag_count) {
+        Config *module = static_cast<Config *>(modules->add());
+        Config *histogram = static_cast<Config *>(module->get("live_histogram"));
+        for (size_t i = 0; i < HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS; ++i) {
+            histogram->add();
+        }
+
+        heap_prev_allocations.push_back(0);
+        heap_prev_allocated_bytes.push_back(0);
+    }
+
+    for (size_t i = 0; i < tag_count; ++i) {
+        const HeapAttributionStats &stats = heap_stats[i];
+        Config *module = static_cast<Config *>(modules->get(i));
+
+        module->get("tag")->updateString(stats.tag);
+        module->get("live_bytes")->updateUint(stats.live_bytes);
+        module->get("live_blocks")->updateUint(stats.live_blocks);
+        module->get("peak_live_bytes")->updateUint(stats.peak_live_bytes);
+        module->get("largest_block")->updateUint(stats.largest_block);
+        module->get("allocations")->updateUint(stats.allocations);
+        module->get("frees")->updateUint(stats.frees);
+
+        // Counters wrap around, unsigned subtraction handles that.
+        uint32_t allocations = stats.allocations - heap_prev_allocations[i];
+        uint32_t allocated_bytes = stats.allocated_bytes - heap_prev_allocated_bytes[i];
+        heap_prev_allocations[i] = stats.allocations;
+        heap_prev_allocated_bytes[i] = stats.allocated_bytes;
+
+        module->get("allocations_per_s")->updateUint(static_cast<uint32_t>(static_cast<uint64_t>(allocations) * 1000 / elapsed_ms));
+        module->get("allocated_bytes_per_s")->updateUint(static_cast<uint32_t>(static_cast<uint64_t>(allocated_bytes) * 1000 / elapsed_ms));
+
+        Config *histogram = static_cast<Config *>(module->get("live_histogram"));
+        for (size_t bucket = 0; bucket < HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS; ++bucket) {
+            histogram->get(bucket)->updateUint(stats.live_histogram[bucket]);
+        }
+    }
+}
+#endif
+
 #ifdef DEBUG_FS_ENABLE
 const char * const fs_browser_header = "<script>"
 "async function uploadFile() {"
@@ -327,6 +555,93 @@ void Debug::register_urls()
     api.addState("debug/state_fast", &state_fast);
     api.addState("debug/state_slow", &state_slow);
     api.addState("debug/state_hwm", &state_hwm);
+    api.addState("debug/loop_profile", &loop_profile);
+
+    api.addCommand("debug/loop_profile_config", &loop_profile_config, {}, [this](String &errmsg) {
+        bool enable = loop_profile_config.get("enabled")->asBool();
+
+        if (!loop_profiler.set_enabled(enable)) {
+            errmsg = "Not enough memory for the loop profiler";
+            return;
+        }
+
+        if (enable && loop_profile_task_id == 0) {
+            loop_profile_task_id = task_scheduler.scheduleWithFixedDelay([this](){
+                this->update_loop_profile();
+            }, 5_s, 5_s);
+        }
+        else if (!enable && loop_profile_task_id != 0) {
+            task_scheduler.cancel(loop_profile_task_id);
+            loop_profile_task_id = 0;
+        }
+
+        update_loop_profile();
+    }, true);
+
+    api.addCommand("debug/loop_profile_reset", Config::Null(), {}, [this](String &/*errmsg*/) {
+        loop_profiler.reset();
+        update_loop_profile();
+    }, true);
+
+    server.on_HTTPThread("/debug/loop_profile.csv", HTTP_GET, [](WebServerRequest request) {
+        char buf[2048]; // on httpd stack, which is large enough
+        StringWriter sw(buf, sizeof(buf));
+        size_t rows_sent = 0;
+        bool done = false;
+
+        sw.printf("name,type,calls,total_us,max_us,max_lateness_us");
+        for (size_t bucket = 0; bucket < LOOP_PROFILER_HISTOGRAM_BUCKETS - 1; ++bucket) {
+            sw.printf(",le_%uus", 16u << (2 * bucket));
+        }
+        sw.printf(",gt_%uus\n", 16u << (2 * (LOOP_PROFILER_HISTOGRAM_BUCKETS - 2)));
+
+        request.beginChunkedResponse(200, "text/csv");
+
+        // Format as many rows as fit into the buffer per await, so that the
+        // main loop is not blocked while the chunks are sent.
+        while (!done) {
+            auto result = task_scheduler.await([&sw, &rows_sent, &done]() {
+                size_t row = 0;
+                done = true;
+
+                loop_profiler.for_each([&](const LoopProfilerEntry &entry, bool is_module) {
+                    if (row++ < rows_sent || !done) {
+                        return;
+                    }
+
+                    // A row is at most about 200 characters.
+                    if (sw.getRemainingLength() < 256) {
+                        done = false;
+                        return;
+                    }
+
+                    char name[65];
+                    format_loop_profile_name(entry, is_module, name, sizeof(name));
+
+                    sw.printf("%s,%s,%u,%llu,%u,%u", name, is_module ? "loop" : "task", entry.calls, entry.total_us, entry.max_us, entry.max_lateness_us);
+                    for (size_t bucket = 0; bucket < LOOP_PROFILER_HISTOGRAM_BUCKETS; ++bucket) {
+                        sw.printf(",%u", entry.histogram[bucket]);
+                    }
+                    sw.printf("\n");
+
+                    ++rows_sent;
+                });
+            });
+
+            if (result != TaskScheduler::AwaitResult::Done) {
+                break;
+            }
+
+            request.sendChunk(sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
+            sw.clear();
+        }
+
+        return request.endChunkedResponse();
+    });
+
+#ifdef HEAP_ATTRIBUTION
+    api.addState("debug/heap_by_module", &state_heap_by_module);
+#endif
 
 #ifdef DEBUG_FS_ENABLE
     server.on_HTTPThread("/debug/crash", HTTP_GET, [](WebServerRequest req) {
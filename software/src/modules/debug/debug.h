@@ -25,6 +25,7 @@
 #include "module.h"
 #include "config.h"
 #include "tools.h"
+#include "tools/heap_attribution.h"
 
 class Debug final : public IModule
 {
@@ -49,6 +50,10 @@ public:
 
 private:
     void deregister_task_internal(size_t index);
+#ifdef HEAP_ATTRIBUTION
+    void update_heap_by_module();
+#endif
+    void update_loop_profile();
 
     ConfigRoot state_static;
     ConfigRoot state_fast;
@@ -58,6 +63,21 @@ private:
     Config state_spi_bus_prototype;
     Config state_hwm_prototype;
 
+    ConfigRoot loop_profile;
+    ConfigRoot loop_profile_config;
+    Config loop_profile_entry_prototype;
+    uint64_t loop_profile_task_id = 0;
+
+#ifdef HEAP_ATTRIBUTION
+    ConfigRoot state_heap_by_module;
+    Config state_heap_by_module_prototype;
+
+    std::vector<HeapAttributionStats> heap_stats;
+    std::vector<uint32_t> heap_prev_allocations;
+    std::vector<uint32_t> heap_prev_allocated_bytes;
+    micros_t heap_last_update = 0_us;
+#endif
+
     std::vector<TaskHandle_t> task_handles;
 
     uint32_t run_max = 0;
@@ -147,7 +147,12 @@ bool EMCommon::format_sdcard()
     int rc = backend->wem_format_sd(0x4223ABCD, &ret_format_status);
     check_bricklet_reachable(rc, "format_sd");
 
-    return rc == TF_E_OK && ret_format_status == WEM_FORMAT_STATUS_OK;
+    if (rc != TF_E_OK || ret_format_status != WEM_FORMAT_STATUS_OK) {
+        return false;
+    }
+
+    ++sdcard_format_count;
+    return true;
 }
 
 uint16_t EMCommon::get_energy_meter_detailed_values(float *ret_values)
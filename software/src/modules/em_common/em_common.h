@@ -120,6 +120,8 @@ public:
 
     bool get_sdcard_info(struct sdcard_info *data);
     bool format_sdcard();
+    // Incremented by every successful format request. Allows caches of SD card data to detect a format.
+    inline uint32_t get_sdcard_format_count() const {return sdcard_format_count;}
 
     uint16_t get_energy_meter_detailed_values(float *ret_values);
     bool reset_energy_meter_relative_energy();
@@ -242,6 +244,7 @@ private:
     uint32_t error_flags = 0;
     uint32_t config_error_flags = 0;
     bool     bricklet_reachable = true;
+    uint32_t sdcard_format_count = 0;
 };
 
 #include "module_available_end.h"
@@ -30,7 +30,12 @@
 
 #define MAX_DATA_AGE 30000 // milliseconds
 #define DATA_INTERVAL_5MIN 5 // minutes
-#define MAX_PENDING_DATA_POINTS 250
+// Two rounds of 5min and daily data points of 64 chargers.
+#define MAX_PENDING_WALLBOX_DATA_POINTS 256
+#define MAX_PENDING_ENERGY_MANAGER_DATA_POINTS 16
+// Each data point is a separate bricklet call. Write several per run, but don't block the main loop for too long.
+#define MAX_DATA_POINTS_PER_RUN 8
+#define MAX_DATA_POINT_RUN_DURATION micros_t{20 * 1000}
 
 #if MODULE_EM_V1_AVAILABLE()
 #define FLAGS_NO_DATA 0x80
@@ -84,6 +89,17 @@ void EMEnergyAnalysis::pre_setup()
         {"month", Config::Uint(0, 1, 12)},
     });
 
+    history_cache_state = Config::Object({
+        {"enabled", Config::Bool(false)},
+        {"entries", Config::Uint32(0)},
+        {"bytes", Config::Uint32(0)},
+        {"hits", Config::Uint32(0)},
+        {"misses", Config::Uint32(0)},
+        {"invalidations", Config::Uint32(0)},
+        {"last_hit_us", Config::Uint32(0)},
+        {"last_miss_us", Config::Uint32(0)},
+    });
+
     for (uint32_t slot = 0; slot < METERS_SLOTS; ++slot) {
         history_meter_setup_done[slot] = false;
         history_meter_power_value[slot] = NAN;
@@ -100,6 +116,16 @@ void EMEnergyAnalysis::setup()
 
     all_data_common = em_common.get_all_data_common();
 
+    pending_wallbox_data_points.setup(MAX_PENDING_WALLBOX_DATA_POINTS);
+    pending_energy_manager_data_points.setup(MAX_PENDING_ENERGY_MANAGER_DATA_POINTS);
+
+    history_cache.setup();
+    history_cache_state.get("enabled")->updateBool(history_cache.is_enabled());
+
+    if (history_cache.is_enabled()) {
+        task_scheduler.scheduleWithFixedDelay([this]() {update_history_cache_state();}, 1_s, 1_s);
+    }
+
     task_scheduler.scheduleWallClock([this]() {collect_data_points();}, 5_m, 100_ms, true);
     task_scheduler.scheduleWithFixedDelay([this]() {set_pending_data_points();}, 15_s, 100_ms);
     task_scheduler.scheduleOnce([this]() {this->show_blank_value_id_update_warnings = true;}, 250_ms);
@@ -115,6 +141,8 @@ void EMEnergyAnalysis::register_urls()
     api.addResponse("energy_manager/history_wallbox_daily",        &history_wallbox_daily,        {}, [this](IChunkedResponse *response, Ownership *ownership, uint32_t owner_id){history_wallbox_daily_response(response, ownership, owner_id);});
     api.addResponse("energy_manager/history_energy_manager_5min",  &history_energy_manager_5min,  {}, [this](IChunkedResponse *response, Ownership *ownership, uint32_t owner_id){history_energy_manager_5min_response(response, ownership, owner_id);});
     api.addResponse("energy_manager/history_energy_manager_daily", &history_energy_manager_daily, {}, [this](IChunkedResponse *response, Ownership *ownership, uint32_t owner_id){history_energy_manager_daily_response(response, ownership, owner_id);});
+
+    api.addState("energy_manager/history_cache", &history_cache_state);
 }
 
 void EMEnergyAnalysis::register_events()
@@ -193,6 +221,15 @@ void EMEnergyAnalysis::update_history_meter_power(uint32_t slot, float power /*
     history_meter_power_timestamp[slot] = now;
 }
 
+void EMEnergyAnalysis::to_data_point_time(const struct tm *t, DataPointTime *time)
+{
+    time->year = t->tm_year - 100;
+    time->month = t->tm_mon + 1;
+    time->day = t->tm_mday;
+    time->hour = t->tm_hour;
+    time->minute = (t->tm_min / 5) * 5;
+}
+
 void EMEnergyAnalysis::collect_data_points()
 {
     struct timeval tv;
@@ -214,6 +251,12 @@ void EMEnergyAnalysis::collect_data_points()
     gmtime_r(&tv.tv_sec, &utc);
     localtime_r(&tv.tv_sec, &local);
 
+    DataPointTime utc_time;
+    DataPointTime local_time;
+
+    to_data_point_time(&utc, &utc_time);
+    to_data_point_time(&local, &local_time);
+
     // Even with scheduleWallClock still need to check if the slot has not already be written before the last boot
     uint32_t current_5min_slot = ((utc.tm_year * 366 + utc.tm_yday) * 24 + utc.tm_hour) * 12 + utc.tm_min / 5;
 
@@ -246,13 +289,17 @@ void EMEnergyAnalysis::collect_data_points()
                     }
                 }
 
-                if (pending_data_points.size() > MAX_PENDING_DATA_POINTS) {
-                    logger.printfln("Data point queue is full, dropping new data point");
+                if (pending_wallbox_data_points.full()) {
+                    ++dropped_data_points;
                 }
                 else {
-                    pending_data_points.push_back([this, utc, local, uid, flags, power]{
-                        return set_wallbox_5min_data_point(&utc, &local, uid, flags, power);
-                    });
+                    WallboxDataPoint *point = pending_wallbox_data_points.push_back();
+                    point->uid = uid;
+                    point->value = power;
+                    point->flags = flags;
+                    point->daily = false;
+                    point->utc = utc_time;
+                    point->local = local_time;
                 }
             }
 #ifdef DEBUG_LOGGING
@@ -319,13 +366,17 @@ void EMEnergyAnalysis::collect_data_points()
             }
 #endif
 
-            if (pending_data_points.size() > MAX_PENDING_DATA_POINTS) {
-                logger.printfln("Data point queue is full, dropping new data point");
+            if (pending_energy_manager_data_points.full()) {
+                ++dropped_data_points;
             }
             else {
-                pending_data_points.push_back([this, utc, local, flags, power, price] {
-                    return set_energy_manager_5min_data_point(&utc, &local, flags, power, price);
-                });
+                EnergyManagerDataPoint *point = pending_energy_manager_data_points.push_back();
+                point->daily = false;
+                point->flags = flags;
+                point->utc = utc_time;
+                point->local = local_time;
+                memcpy(point->data.five_min.power, power, sizeof(power));
+                point->data.five_min.price = price;
             }
         }
 
@@ -347,13 +398,17 @@ void EMEnergyAnalysis::collect_data_points()
                 }
 
                 if (have_data) {
-                    if (pending_data_points.size() > MAX_PENDING_DATA_POINTS) {
-                        logger.printfln("Data point queue is full, dropping new data point");
+                    if (pending_wallbox_data_points.full()) {
+                        ++dropped_data_points;
                     }
                     else {
-                        pending_data_points.push_back([this, local, uid, energy]{
-                            return set_wallbox_daily_data_point(&local, uid, energy);
-                        });
+                        WallboxDataPoint *point = pending_wallbox_data_points.push_back();
+                        point->uid = uid;
+                        point->value = energy;
+                        point->flags = 0;
+                        point->daily = true;
+                        point->utc = utc_time;
+                        point->local = local_time;
                     }
                 }
 #ifdef DEBUG_LOGGING
@@ -448,16 +503,28 @@ void EMEnergyAnalysis::collect_data_points()
 #endif
 
         if (have_data) {
-            if (pending_data_points.size() > MAX_PENDING_DATA_POINTS) {
-                logger.printfln("Data point queue is full, dropping new data point");
+            if (pending_energy_manager_data_points.full()) {
+                ++dropped_data_points;
             }
             else {
-                pending_data_points.push_back([this, local, energy_import, energy_export, price_min, price_avg, price_max] {
-                    return set_energy_manager_daily_data_point(&local, energy_import, energy_export, price_min, price_avg, price_max);
-                });
+                EnergyManagerDataPoint *point = pending_energy_manager_data_points.push_back();
+                point->daily = true;
+                point->flags = 0;
+                point->utc = utc_time;
+                point->local = local_time;
+                memcpy(point->data.daily.energy_import, energy_import, sizeof(energy_import));
+                memcpy(point->data.daily.energy_export, energy_export, sizeof(energy_export));
+                point->data.daily.price_min = price_min;
+                point->data.daily.price_avg = price_avg;
+                point->data.daily.price_max = price_max;
             }
         }
 
+        if (dropped_data_points > 0) {
+            logger.printfln("Data point queue is full, dropped %u new data points", dropped_data_points);
+            dropped_data_points = 0;
+        }
+
         last_history_5min_slot = current_5min_slot;
 
         save_persistent_data();
@@ -466,15 +533,60 @@ void EMEnergyAnalysis::collect_data_points()
 
 void EMEnergyAnalysis::set_pending_data_points()
 {
-    if (pending_data_points.empty()) {
-        return;
+    micros_t deadline = now_us() + MAX_DATA_POINT_RUN_DURATION;
+
+    for (size_t i = 0; i < MAX_DATA_POINTS_PER_RUN; ++i) {
+        if (!set_pending_data_point()) {
+            return; // queues empty or bricklet busy
+        }
+
+        if (deadline_elapsed(deadline)) {
+            return;
+        }
     }
+}
 
-    if (!pending_data_points.front()()) {
-        return;
+// Returns true if a data point was written or dropped because of an error.
+bool EMEnergyAnalysis::set_pending_data_point()
+{
+    if (!pending_energy_manager_data_points.empty()) {
+        const EnergyManagerDataPoint *point = pending_energy_manager_data_points.front();
+        bool done;
+
+        if (point->daily) {
+            done = set_energy_manager_daily_data_point(&point->local, point->data.daily.energy_import, point->data.daily.energy_export,
+                                                       point->data.daily.price_min, point->data.daily.price_avg, point->data.daily.price_max);
+        }
+        else {
+            done = set_energy_manager_5min_data_point(&point->utc, &point->local, point->flags, point->data.five_min.power, point->data.five_min.price);
+        }
+
+        if (done) {
+            pending_energy_manager_data_points.pop_front();
+        }
+
+        return done;
+    }
+
+    if (!pending_wallbox_data_points.empty()) {
+        const WallboxDataPoint *point = pending_wallbox_data_points.front();
+        bool done;
+
+        if (point->daily) {
+            done = set_wallbox_daily_data_point(&point->local, point->uid, point->value);
+        }
+        else {
+            done = set_wallbox_5min_data_point(&point->utc, &point->local, point->uid, point->flags, static_cast<uint16_t>(point->value));
+        }
+
+        if (done) {
+            pending_wallbox_data_points.pop_front();
+        }
+
+        return done;
     }
 
-    pending_data_points.pop_front();
+    return false;
 }
 
 #define DATA_STORAGE_PAGE_SIZE 63
@@ -674,14 +786,14 @@ void EMEnergyAnalysis::save_persistent_data()
     }
 }
 
-bool EMEnergyAnalysis::set_wallbox_5min_data_point(const struct tm *utc, const struct tm *local, uint32_t uid, uint16_t flags, uint16_t power /* W */)
+bool EMEnergyAnalysis::set_wallbox_5min_data_point(const DataPointTime *utc, const DataPointTime *local, uint32_t uid, uint16_t flags, uint16_t power /* W */)
 {
     uint8_t status;
-    uint8_t utc_year = utc->tm_year - 100;
-    uint8_t utc_month = utc->tm_mon + 1;
-    uint8_t utc_day = utc->tm_mday;
-    uint8_t utc_hour = utc->tm_hour;
-    uint8_t utc_minute = (utc->tm_min / 5) * 5;
+    uint8_t utc_year = utc->year;
+    uint8_t utc_month = utc->month;
+    uint8_t utc_day = utc->day;
+    uint8_t utc_hour = utc->hour;
+    uint8_t utc_minute = utc->minute;
     int rc = em_common.wem_set_sd_wallbox_data_point(uid,
                                                      utc_year,
                                                      utc_month,
@@ -716,17 +828,19 @@ bool EMEnergyAnalysis::set_wallbox_5min_data_point(const struct tm *utc, const s
         }
     }
     else {
+        history_cache.invalidate({uid, EMHistoryKind::Wallbox5min, local->year, local->month, local->day});
+
         char power_str[6] = "null";
 
         if (power != UINT16_MAX) {
             snprintf(power_str, sizeof(power_str), "%u", power);
         }
 
-        uint8_t local_year = local->tm_year - 100;
-        uint8_t local_month = local->tm_mon + 1;
-        uint8_t local_day = local->tm_mday;
-        uint8_t local_hour = local->tm_hour;
-        uint8_t local_minute = (local->tm_min / 5) * 5;
+        uint8_t local_year = local->year;
+        uint8_t local_month = local->month;
+        uint8_t local_day = local->day;
+        uint8_t local_hour = local->hour;
+        uint8_t local_minute = local->minute;
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_wallbox_5min_changed\","
@@ -756,12 +870,12 @@ bool EMEnergyAnalysis::set_wallbox_5min_data_point(const struct tm *utc, const s
     }
 }
 
-bool EMEnergyAnalysis::set_wallbox_daily_data_point(const struct tm *local, uint32_t uid, uint32_t energy /* daWh */)
+bool EMEnergyAnalysis::set_wallbox_daily_data_point(const DataPointTime *local, uint32_t uid, uint32_t energy /* daWh */)
 {
     uint8_t status;
-    uint8_t year = local->tm_year - 100;
-    uint8_t month = local->tm_mon + 1;
-    uint8_t day = local->tm_mday;
+    uint8_t year = local->year;
+    uint8_t month = local->month;
+    uint8_t day = local->day;
     int rc = em_common.wem_set_sd_wallbox_daily_data_point(uid, year, month, day, energy, &status);
 
 #ifdef DEBUG_LOGGING
@@ -788,6 +902,8 @@ bool EMEnergyAnalysis::set_wallbox_daily_data_point(const struct tm *local, uint
         }
     }
     else {
+        history_cache.invalidate({uid, EMHistoryKind::WallboxDaily, local->year, local->month, 0});
+
         char energy_str[12] = "null";
 
         if (energy != UINT32_MAX) {
@@ -817,8 +933,8 @@ bool EMEnergyAnalysis::set_wallbox_daily_data_point(const struct tm *local, uint
     }
 }
 
-bool EMEnergyAnalysis::set_energy_manager_5min_data_point(const struct tm *utc,
-                                                          const struct tm *local,
+bool EMEnergyAnalysis::set_energy_manager_5min_data_point(const DataPointTime *utc,
+                                                          const DataPointTime *local,
                                                           const uint16_t flags,
                                                           const int32_t power[7] /* W */,
                                                           const int32_t price /* mct/kWh */)
@@ -830,11 +946,11 @@ bool EMEnergyAnalysis::set_energy_manager_5min_data_point(const struct tm *utc,
     }
 
     uint8_t status;
-    uint8_t utc_year = utc->tm_year - 100;
-    uint8_t utc_month = utc->tm_mon + 1;
-    uint8_t utc_day = utc->tm_mday;
-    uint8_t utc_hour = utc->tm_hour;
-    uint8_t utc_minute = (utc->tm_min / 5) * 5;
+    uint8_t utc_year = utc->year;
+    uint8_t utc_month = utc->month;
+    uint8_t utc_day = utc->day;
+    uint8_t utc_hour = utc->hour;
+    uint8_t utc_minute = utc->minute;
     int rc = em_common.wem_set_sd_energy_manager_data_point(utc_year,
                                                             utc_month,
                                                             utc_day,
@@ -870,6 +986,8 @@ bool EMEnergyAnalysis::set_energy_manager_5min_data_point(const struct tm *utc,
         }
     }
     else {
+        history_cache.invalidate({0, EMHistoryKind::EnergyManager5min, local->year, local->month, local->day});
+
         char power_str[7][12] = {"null", "null", "null", "null", "null", "null", "null"};
         char price_str[12] = "null";
 
@@ -883,11 +1001,11 @@ bool EMEnergyAnalysis::set_energy_manager_5min_data_point(const struct tm *utc,
             snprintf(price_str, sizeof(price_str), "%.3f", (double)price / 1000.0); // mct/kWh -> ct/kWh
         }
 
-        uint8_t local_year = local->tm_year - 100;
-        uint8_t local_month = local->tm_mon + 1;
-        uint8_t local_day = local->tm_mday;
-        uint8_t local_hour = local->tm_hour;
-        uint8_t local_minute = (local->tm_min / 5) * 5;
+        uint8_t local_year = local->year;
+        uint8_t local_month = local->month;
+        uint8_t local_day = local->day;
+        uint8_t local_hour = local->hour;
+        uint8_t local_minute = local->minute;
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_energy_manager_5min_changed\","
@@ -945,7 +1063,7 @@ static int32_t price_from_10bit(uint32_t price)
     return price + PRICE_INT10_MIN;
 }
 
-bool EMEnergyAnalysis::set_energy_manager_daily_data_point(const struct tm *local,
+bool EMEnergyAnalysis::set_energy_manager_daily_data_point(const DataPointTime *local,
                                                            const uint32_t energy_import[7] /* daWh */,
                                                            const uint32_t energy_export[7] /* daWh */,
                                                            int32_t price_min /* ct/kWh */,
@@ -953,9 +1071,9 @@ bool EMEnergyAnalysis::set_energy_manager_daily_data_point(const struct tm *loca
                                                            int32_t price_max /* ct/kWh */)
 {
     uint8_t status;
-    uint8_t year = local->tm_year - 100;
-    uint8_t month = local->tm_mon + 1;
-    uint8_t day = local->tm_mday;
+    uint8_t year = local->year;
+    uint8_t month = local->month;
+    uint8_t day = local->day;
     uint32_t price_bits = (price_to_10bit(price_min) << 20) | (price_to_10bit(price_avg) << 10) | price_to_10bit(price_max);
     int rc = em_common.wem_set_sd_energy_manager_daily_data_point(year,
                                                                   month,
@@ -994,6 +1112,8 @@ bool EMEnergyAnalysis::set_energy_manager_daily_data_point(const struct tm *loca
         }
     }
     else {
+        history_cache.invalidate({0, EMHistoryKind::EnergyManagerDaily, local->year, local->month, 0});
+
         char energy_import_str[7][13] = {"null", "null", "null", "null", "null", "null", "null"};
         char energy_export_str[7][13] = {"null", "null", "null", "null", "null", "null", "null"};
         char price_min_str[12] = "null";
@@ -1079,6 +1199,45 @@ typedef struct {
 } StreamMetadata;
 
 static StreamMetadata metadata_array[4];
+static EMHistoryCapture capture_array[4];
+
+bool EMEnergyAnalysis::send_cached_history(const EMHistoryKey &key, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
+{
+    micros_t start = now_us();
+    size_t len;
+    const char *data = history_cache.get(key, &len);
+
+    if (data == nullptr) {
+        return false;
+    }
+
+    OwnershipGuard ownership_guard(response_ownership, response_owner_id);
+
+    if (ownership_guard.have_ownership()) {
+        response->begin(true);
+
+        bool write_success = response->write(data, len);
+
+        write_success &= response->flush();
+        response->end(write_success ? "" : "write error");
+    }
+
+    ++history_cache.hits;
+    history_cache.last_hit_us = (now_us() - start).as<uint32_t>();
+
+    return true;
+}
+
+void EMEnergyAnalysis::update_history_cache_state()
+{
+    history_cache_state.get("entries")->updateUint(history_cache.get_entry_count());
+    history_cache_state.get("bytes")->updateUint(history_cache.get_used_bytes());
+    history_cache_state.get("hits")->updateUint(history_cache.hits);
+    history_cache_state.get("misses")->updateUint(history_cache.misses);
+    history_cache_state.get("invalidations")->updateUint(history_cache.invalidations);
+    history_cache_state.get("last_hit_us")->updateUint(history_cache.last_hit_us);
+    history_cache_state.get("last_miss_us")->updateUint(history_cache.last_miss_us);
+}
 
 struct [[gnu::packed]] Wallbox5minData {
 #if MODULE_EM_V1_AVAILABLE()
@@ -1236,6 +1395,11 @@ void EMEnergyAnalysis::history_wallbox_5min_response(IChunkedResponse *response,
     uint8_t local_year = history_wallbox_5min.get("year")->asUint() - 2000;
     uint8_t local_month = history_wallbox_5min.get("month")->asUint();
     uint8_t local_day = history_wallbox_5min.get("day")->asUint();
+    EMHistoryKey cache_key{uid, EMHistoryKind::Wallbox5min, local_year, local_month, local_day};
+
+    if (send_cached_history(cache_key, response, response_ownership, response_owner_id)) {
+        return;
+    }
 
     struct tm local_start;
     struct tm local_end;
@@ -1325,7 +1489,7 @@ void EMEnergyAnalysis::history_wallbox_5min_response(IChunkedResponse *response,
     else {
         StreamMetadata *metadata = &metadata_array[0];
 
-        metadata->response = response;
+        metadata->response = capture_array[0].start(&history_cache, cache_key, response);
         metadata->response_ownership = response_ownership;
         metadata->response_owner_id = response_owner_id;
         metadata->call_begin = true;
@@ -1455,6 +1619,11 @@ void EMEnergyAnalysis::history_wallbox_daily_response(IChunkedResponse *response
     // date in local time to have the days properly aligned
     uint8_t year = history_wallbox_daily.get("year")->asUint() - 2000;
     uint8_t month = history_wallbox_daily.get("month")->asUint();
+    EMHistoryKey cache_key{uid, EMHistoryKind::WallboxDaily, year, month, 0};
+
+    if (send_cached_history(cache_key, response, response_ownership, response_owner_id)) {
+        return;
+    }
 
     uint32_t seqnum = history_request_seqnum++;
     uint8_t status;
@@ -1485,7 +1654,7 @@ void EMEnergyAnalysis::history_wallbox_daily_response(IChunkedResponse *response
     else {
         StreamMetadata *metadata = &metadata_array[1];
 
-        metadata->response = response;
+        metadata->response = capture_array[1].start(&history_cache, cache_key, response);
         metadata->response_ownership = response_ownership;
         metadata->response_owner_id = response_owner_id;
         metadata->call_begin = true;
@@ -1669,6 +1838,11 @@ void EMEnergyAnalysis::history_energy_manager_5min_response(IChunkedResponse *re
     uint8_t local_year = history_energy_manager_5min.get("year")->asUint() - 2000;
     uint8_t local_month = history_energy_manager_5min.get("month")->asUint();
     uint8_t local_day = history_energy_manager_5min.get("day")->asUint();
+    EMHistoryKey cache_key{0, EMHistoryKind::EnergyManager5min, local_year, local_month, local_day};
+
+    if (send_cached_history(cache_key, response, response_ownership, response_owner_id)) {
+        return;
+    }
 
     struct tm local_start;
     struct tm local_end;
@@ -1756,7 +1930,7 @@ void EMEnergyAnalysis::history_energy_manager_5min_response(IChunkedResponse *re
     else {
         StreamMetadata *metadata = &metadata_array[2];
 
-        metadata->response = response;
+        metadata->response = capture_array[2].start(&history_cache, cache_key, response);
         metadata->response_ownership = response_ownership;
         metadata->response_owner_id = response_owner_id;
         metadata->call_begin = true;
@@ -1910,6 +2084,11 @@ void EMEnergyAnalysis::history_energy_manager_daily_response(IChunkedResponse *r
     // date in local time to have the days properly aligned
     uint8_t year = history_energy_manager_daily.get("year")->asUint() - 2000;
     uint8_t month = history_energy_manager_daily.get("month")->asUint();
+    EMHistoryKey cache_key{0, EMHistoryKind::EnergyManagerDaily, year, month, 0};
+
+    if (send_cached_history(cache_key, response, response_ownership, response_owner_id)) {
+        return;
+    }
 
     uint32_t seqnum = history_request_seqnum++;
     uint8_t status;
@@ -1940,7 +2119,7 @@ void EMEnergyAnalysis::history_energy_manager_daily_response(IChunkedResponse *r
     else {
         StreamMetadata *metadata = &metadata_array[3];
 
-        metadata->response = response;
+        metadata->response = capture_array[3].start(&history_cache, cache_key, response);
         metadata->response_ownership = response_ownership;
         metadata->response_owner_id = response_owner_id;
         metadata->call_begin = true;
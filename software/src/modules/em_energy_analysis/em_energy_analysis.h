@@ -19,14 +19,54 @@
 
 #pragma once
 
-#include <list>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
 #include "chunked_response.h"
 #include "config.h"
+#include "history_cache.h"
 #include "module.h"
 #include "modules/em_common/structs.h"
+#include "tools/malloc.h"
+
+// Fixed capacity FIFO of POD data point records, allocated once.
+template<typename T>
+class DataPointQueue
+{
+public:
+    void setup(size_t capacity_)
+    {
+        items = static_cast<T *>(calloc_psram_or_dram(capacity_, sizeof(T)));
+        capacity = items == nullptr ? 0 : capacity_;
+    }
+
+    bool empty() const { return count == 0; }
+    bool full() const { return count >= capacity; }
+    size_t size() const { return count; }
+
+    // Returns the slot to fill in. The queue must not be full.
+    T *push_back()
+    {
+        T *item = &items[(head + count) % capacity];
+        ++count;
+        return item;
+    }
+
+    T *front() { return &items[head]; }
+
+    void pop_front()
+    {
+        head = (head + 1) % capacity;
+        --count;
+    }
+
+private:
+    T *items = nullptr;
+    size_t capacity = 0;
+    size_t head = 0;
+    size_t count = 0;
+};
 
 class EMEnergyAnalysis final : public IModule
 {
@@ -39,6 +79,45 @@ public:
     void register_events() override;
 
 private:
+    // Date and time of a data point as sent to the bricklet.
+    struct DataPointTime {
+        uint8_t year; // since 2000
+        uint8_t month;
+        uint8_t day;
+        uint8_t hour;
+        uint8_t minute; // start of the 5min slot
+    };
+
+    struct WallboxDataPoint {
+        uint32_t uid;
+        uint32_t value; // 5min: power (W), daily: energy (daWh)
+        uint16_t flags; // 5min only
+        bool daily;
+        DataPointTime utc; // 5min only
+        DataPointTime local;
+    };
+
+    struct EnergyManagerDataPoint {
+        bool daily;
+        uint16_t flags; // 5min only
+        DataPointTime utc; // 5min only
+        DataPointTime local;
+        union {
+            struct {
+                int32_t power[7]; // W
+                int32_t price; // mct/kWh
+            } five_min;
+            struct {
+                uint32_t energy_import[7]; // daWh
+                uint32_t energy_export[7]; // daWh
+                int32_t price_min; // ct/kWh
+                int32_t price_avg; // ct/kWh
+                int32_t price_max; // ct/kWh
+            } daily;
+        } data;
+    };
+
+    static void to_data_point_time(const struct tm *t, DataPointTime *time);
     void update_history_meter_power(uint32_t slot, float power /* W */);
     void collect_data_points();
     void set_pending_data_points();
@@ -46,18 +125,23 @@ private:
     void load_persistent_data_v1(uint8_t *buf);
     void load_persistent_data_v2(uint8_t *buf);
     void save_persistent_data();
+    bool send_cached_history(const EMHistoryKey &key, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void update_history_cache_state();
     void history_wallbox_5min_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
     void history_wallbox_daily_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
     void history_energy_manager_5min_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
     void history_energy_manager_daily_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
-    bool set_wallbox_5min_data_point(const struct tm *utc, const struct tm *local, uint32_t uid, uint16_t flags, uint16_t power /* W */);
-    bool set_wallbox_daily_data_point(const struct tm *local, uint32_t uid, uint32_t energy /* daWh */);
-    bool set_energy_manager_5min_data_point(const struct tm *utc, const struct tm *local, uint16_t flags, const int32_t power[7] /* W */,
+    bool set_pending_data_point();
+    bool set_wallbox_5min_data_point(const DataPointTime *utc, const DataPointTime *local, uint32_t uid, uint16_t flags, uint16_t power /* W */);
+    bool set_wallbox_daily_data_point(const DataPointTime *local, uint32_t uid, uint32_t energy /* daWh */);
+    bool set_energy_manager_5min_data_point(const DataPointTime *utc, const DataPointTime *local, uint16_t flags, const int32_t power[7] /* W */,
                                             const int32_t price /* mct/kWh */);
-    bool set_energy_manager_daily_data_point(const struct tm *local, const uint32_t energy_import[7] /* daWh */, const uint32_t energy_export[7] /* daWh */,
+    bool set_energy_manager_daily_data_point(const DataPointTime *local, const uint32_t energy_import[7] /* daWh */, const uint32_t energy_export[7] /* daWh */,
                                              int32_t price_min /* ct/kWh */, int32_t price_avg /* ct/kWh */, int32_t price_max /* ct/kWh */);
 
-    std::list<std::function<bool(void)>> pending_data_points;
+    DataPointQueue<WallboxDataPoint> pending_wallbox_data_points;
+    DataPointQueue<EnergyManagerDataPoint> pending_energy_manager_data_points;
+    uint32_t dropped_data_points = 0; // since the last collection
     bool persistent_data_loaded = false;
     bool show_blank_value_id_update_warnings = false;
     uint32_t last_history_5min_slot = 0;
@@ -65,6 +149,8 @@ private:
     ConfigRoot history_wallbox_daily;
     ConfigRoot history_energy_manager_5min;
     ConfigRoot history_energy_manager_daily;
+    ConfigRoot history_cache_state;
+    EMHistoryCache history_cache;
     bool history_meter_setup_done[METERS_SLOTS];
     float history_meter_power_value[METERS_SLOTS]; // W
     uint32_t history_meter_power_timestamp[METERS_SLOTS];
@@ -0,0 +1,225 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "history_cache.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "module_dependencies.h"
+#include "tools/malloc.h"
+
+void EMHistoryCache::setup()
+{
+#if defined(BOARD_HAS_PSRAM)
+    enabled = true;
+    sdcard_format_count = em_common.get_sdcard_format_count();
+#endif
+}
+
+void EMHistoryCache::check_format()
+{
+    uint32_t format_count = em_common.get_sdcard_format_count();
+
+    if (format_count == sdcard_format_count) {
+        return;
+    }
+
+    sdcard_format_count = format_count;
+
+    while (entry_count > 0) {
+        remove(entry_count - 1);
+    }
+
+    ++generation;
+}
+
+const char *EMHistoryCache::get(const EMHistoryKey &key, size_t *len)
+{
+    if (!enabled) {
+        return nullptr;
+    }
+
+    check_format();
+
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (entries[i].key == key) {
+            entries[i].last_used = ++use_counter;
+            *len = entries[i].len;
+            return entries[i].data;
+        }
+    }
+
+    return nullptr;
+}
+
+void EMHistoryCache::put(const EMHistoryKey &key, uint32_t put_generation, char *data, size_t len)
+{
+    check_format();
+
+    if (!enabled || put_generation != generation || len > EM_HISTORY_CACHE_MAX_BYTES) {
+        free_any(data);
+        return;
+    }
+
+    remove_key(key);
+
+    while (entry_count > 0 && (entry_count >= EM_HISTORY_CACHE_MAX_ENTRIES || used_bytes + len > EM_HISTORY_CACHE_MAX_BYTES)) {
+        size_t lru = 0;
+
+        for (size_t i = 1; i < entry_count; ++i) {
+            if (entries[i].last_used - entries[lru].last_used > UINT32_MAX / 2) {
+                lru = i;
+            }
+        }
+
+        remove(lru);
+    }
+
+    Entry &entry = entries[entry_count++];
+    entry.key = key;
+    entry.data = data;
+    entry.len = len;
+    entry.last_used = ++use_counter;
+    used_bytes += len;
+}
+
+void EMHistoryCache::invalidate(const EMHistoryKey &key)
+{
+    // A response that is being captured right now could already contain old data.
+    ++generation;
+    ++invalidations;
+
+    remove_key(key);
+}
+
+void EMHistoryCache::remove_key(const EMHistoryKey &key)
+{
+    for (size_t i = 0; i < entry_count; ++i) {
+        if (entries[i].key == key) {
+            remove(i);
+            return;
+        }
+    }
+}
+
+void EMHistoryCache::remove(size_t idx)
+{
+    used_bytes -= entries[idx].len;
+    free_any(entries[idx].data);
+
+    --entry_count;
+    entries[idx] = entries[entry_count];
+}
+
+IChunkedResponse *EMHistoryCapture::start(EMHistoryCache *cache_, const EMHistoryKey &key_, IChunkedResponse *inner_)
+{
+    if (!cache_->is_enabled()) {
+        return inner_;
+    }
+
+    cache = cache_;
+    inner = inner_;
+    key = key_;
+    generation = cache->get_generation();
+    start_us = now_us();
+    used = 0;
+    capturing = false;
+
+    ++cache->misses;
+
+    return this;
+}
+
+void EMHistoryCapture::begin(bool success)
+{
+    if (success && buffer == nullptr) {
+        buffer = static_cast<char *>(malloc_psram(EM_HISTORY_CACHE_MAX_ENTRY_SIZE));
+    }
+
+    capturing = success && buffer != nullptr;
+    inner->begin(success);
+}
+
+bool EMHistoryCapture::write_impl(const char *buf, size_t buf_size)
+{
+    if (capturing) {
+        if (used + buf_size > EM_HISTORY_CACHE_MAX_ENTRY_SIZE) {
+            capturing = false;
+        }
+        else {
+            memcpy(buffer + used, buf, buf_size);
+            used += buf_size;
+        }
+    }
+
+    return inner->write(buf, buf_size);
+}
+
+bool EMHistoryCapture::writef(const char *fmt, ...)
+{
+    // The history handlers only format single values.
+    char buf[64];
+    va_list args;
+
+    va_start(args, fmt);
+    int written = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (written < 0 || static_cast<size_t>(written) >= sizeof(buf)) {
+        return false;
+    }
+
+    return write(buf, written);
+}
+
+bool EMHistoryCapture::flush()
+{
+    return inner->flush();
+}
+
+void EMHistoryCapture::alive()
+{
+    inner->alive();
+}
+
+void EMHistoryCapture::end(String error)
+{
+    bool store = capturing && error.isEmpty();
+
+    capturing = false;
+    inner->end(error);
+
+    cache->last_miss_us = (now_us() - start_us).as<uint32_t>();
+
+    if (!store) {
+        return;
+    }
+
+    char *data = static_cast<char *>(malloc_psram(used));
+
+    if (data == nullptr) {
+        return;
+    }
+
+    memcpy(data, buffer, used);
+    cache->put(key, generation, data, used);
+}
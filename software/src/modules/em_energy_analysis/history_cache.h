@@ -0,0 +1,134 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunked_response.h"
+#include "TFTools/Micros.h"
+
+// Complete history responses are cached in PSRAM. Responses for past days
+// and months don't change anymore, so repeated requests don't have to read
+// the bricklet's SD card again. A cached response is invalidated when a
+// data point for its period is written.
+
+#define EM_HISTORY_CACHE_MAX_ENTRIES 64
+#define EM_HISTORY_CACHE_MAX_ENTRY_SIZE (32 * 1024)
+#define EM_HISTORY_CACHE_MAX_BYTES (512 * 1024)
+
+enum class EMHistoryKind : uint8_t {
+    Wallbox5min,
+    WallboxDaily,
+    EnergyManager5min,
+    EnergyManagerDaily,
+};
+
+struct EMHistoryKey {
+    uint32_t uid; // 0 for energy manager data
+    EMHistoryKind kind;
+    uint8_t year; // local time, since 2000
+    uint8_t month;
+    uint8_t day; // 0 for daily data, one response covers a month
+
+    bool operator==(const EMHistoryKey &other) const
+    {
+        return uid == other.uid && kind == other.kind && year == other.year && month == other.month && day == other.day;
+    }
+};
+
+class EMHistoryCache
+{
+public:
+    EMHistoryCache() {}
+
+    // Without PSRAM the cache stays disabled.
+    void setup();
+    bool is_enabled() const {return enabled;}
+
+    // Returns the cached response or nullptr. Marks the entry as recently used.
+    const char *get(const EMHistoryKey &key, size_t *len);
+    // Takes ownership of data, which must be allocated with malloc_psram.
+    // Not stored if the key was invalidated after generation was read.
+    void put(const EMHistoryKey &key, uint32_t generation, char *data, size_t len);
+    void invalidate(const EMHistoryKey &key);
+
+    uint32_t get_generation() const {return generation;}
+
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t invalidations = 0;
+    uint32_t last_hit_us = 0;  // duration of the last response from the cache
+    uint32_t last_miss_us = 0; // duration of the last response that was read from the SD card
+
+    size_t get_entry_count() const {return entry_count;}
+    size_t get_used_bytes() const {return used_bytes;}
+
+private:
+    struct Entry {
+        EMHistoryKey key;
+        char *data;
+        size_t len;
+        uint32_t last_used;
+    };
+
+    void check_format();
+    void remove_key(const EMHistoryKey &key);
+    void remove(size_t idx);
+
+    bool enabled = false;
+    Entry entries[EM_HISTORY_CACHE_MAX_ENTRIES];
+    size_t entry_count = 0;
+    size_t used_bytes = 0;
+    uint32_t use_counter = 0;
+    uint32_t generation = 0;
+    uint32_t sdcard_format_count = 0;
+};
+
+// Forwards a history response and records it for the cache.
+// The response is only stored if it ended without an error.
+class EMHistoryCapture final : public IChunkedResponse
+{
+public:
+    EMHistoryCapture() {}
+
+    // Returns the response to stream into: this or the inner response if the cache is disabled.
+    IChunkedResponse *start(EMHistoryCache *cache, const EMHistoryKey &key, IChunkedResponse *inner);
+
+    void begin(bool success) override;
+    bool writef(const char *fmt, ...) override;
+    bool flush() override;
+    void end(String error) override;
+    void alive() override;
+
+protected:
+    bool write_impl(const char *buf, size_t buf_size) override;
+
+private:
+    EMHistoryCache *cache = nullptr;
+    IChunkedResponse *inner = nullptr;
+    EMHistoryKey key;
+    uint32_t generation = 0;
+    micros_t start_us;
+    char *buffer = nullptr; // EM_HISTORY_CACHE_MAX_ENTRY_SIZE, allocated on first use
+    size_t used = 0;
+    bool capturing = false;
+};
@@ -0,0 +1,395 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "binary_trace.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <type_traits>
+
+enum class LengthModifier {
+    None,
+    hh,
+    h,
+    l,
+    ll,
+    j,
+    z,
+    t,
+    L,
+};
+
+struct ConversionSpec {
+    const char *start; // points to the '%'
+    size_t len;        // including the '%' and the conversion char
+    size_t star_count; // number of int arguments consumed by '*' width and precision
+    int precision;     // -1 if not given, -2 if given as '*'
+    LengthModifier length;
+    char conversion;
+};
+
+// Parses the conversion specification that starts at p, which must point to a '%'.
+static bool parse_conversion_spec(const char *p, ConversionSpec *spec)
+{
+    spec->start = p++;
+    spec->star_count = 0;
+    spec->precision = -1;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        ++p;
+    }
+
+    if (*p == '*') {
+        ++spec->star_count;
+        ++p;
+    }
+    else {
+        while (*p >= '0' && *p <= '9') {
+            ++p;
+        }
+    }
+
+    if (*p == '.') {
+        ++p;
+
+        if (*p == '*') {
+            ++spec->star_count;
+            spec->precision = -2;
+            ++p;
+        }
+        else {
+            spec->precision = 0;
+
+            while (*p >= '0' && *p <= '9') {
+                spec->precision = spec->precision * 10 + (*p - '0');
+                ++p;
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h': ++p; if (*p == 'h') {++p; spec->length = LengthModifier::hh;} else {spec->length = LengthModifier::h;} break;
+    case 'l': ++p; if (*p == 'l') {++p; spec->length = LengthModifier::ll;} else {spec->length = LengthModifier::l;} break;
+    case 'j': ++p; spec->length = LengthModifier::j; break;
+    case 'z': ++p; spec->length = LengthModifier::z; break;
+    case 't': ++p; spec->length = LengthModifier::t; break;
+    case 'L': ++p; spec->length = LengthModifier::L; break;
+    default:  spec->length = LengthModifier::None; break;
+    }
+
+    if (*p == '\0') {
+        return false;
+    }
+
+    spec->conversion = *p++;
+    spec->len = static_cast<size_t>(p - spec->start);
+
+    return true;
+}
+
+// Calls fn with a value of the C type that the conversion consumes.
+// Returns false for unsupported conversions.
+template<typename Fn>
+static bool visit_conversion_type(const ConversionSpec &spec, Fn &&fn)
+{
+    switch (spec.conversion) {
+    case 'd':
+    case 'i':
+        switch (spec.length) {
+        case LengthModifier::None:
+        case LengthModifier::hh:
+        case LengthModifier::h:  return fn(static_cast<int *>(nullptr));
+        case LengthModifier::l:  return fn(static_cast<long *>(nullptr));
+        case LengthModifier::ll: return fn(static_cast<long long *>(nullptr));
+        case LengthModifier::j:  return fn(static_cast<intmax_t *>(nullptr));
+        case LengthModifier::z:  return fn(static_cast<ssize_t *>(nullptr));
+        case LengthModifier::t:  return fn(static_cast<ptrdiff_t *>(nullptr));
+        case LengthModifier::L:  return false;
+        }
+
+        return false;
+
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        switch (spec.length) {
+        case LengthModifier::None:
+        case LengthModifier::hh:
+        case LengthModifier::h:  return fn(static_cast<unsigned int *>(nullptr));
+        case LengthModifier::l:  return fn(static_cast<unsigned long *>(nullptr));
+        case LengthModifier::ll: return fn(static_cast<unsigned long long *>(nullptr));
+        case LengthModifier::j:  return fn(static_cast<uintmax_t *>(nullptr));
+        case LengthModifier::z:  return fn(static_cast<size_t *>(nullptr));
+        case LengthModifier::t:  return fn(static_cast<ptrdiff_t *>(nullptr));
+        case LengthModifier::L:  return false;
+        }
+
+        return false;
+
+    case 'c':
+        return spec.length == LengthModifier::None && fn(static_cast<int *>(nullptr));
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return (spec.length == LengthModifier::None || spec.length == LengthModifier::l) && fn(static_cast<double *>(nullptr));
+
+    case 'p':
+        return spec.length == LengthModifier::None && fn(static_cast<void **>(nullptr));
+
+    case 's':
+        return spec.length == LengthModifier::None && fn(static_cast<const char **>(nullptr));
+
+    default:
+        // %n and unknown conversions
+        return false;
+    }
+}
+
+size_t binary_trace_encode_args(uint8_t *buf, size_t buf_len, const char *fmt, va_list args)
+{
+    size_t used = 0;
+    va_list args_copy;
+
+    va_copy(args_copy, args);
+
+    for (const char *p = strchr(fmt, '%'); p != nullptr; p = strchr(p, '%')) {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        ConversionSpec spec;
+
+        if (!parse_conversion_spec(p, &spec)) {
+            va_end(args_copy);
+            return 0;
+        }
+
+        p += spec.len;
+
+        int precision = spec.precision;
+
+        for (size_t i = 0; i < spec.star_count; ++i) {
+            int value = va_arg(args_copy, int);
+
+            if (buf_len - used < sizeof(value)) {
+                va_end(args_copy);
+                return 0;
+            }
+
+            memcpy(buf + used, &value, sizeof(value));
+            used += sizeof(value);
+
+            // The precision star is always the last one
+            if (precision == -2 && i == spec.star_count - 1) {
+                precision = value < 0 ? -1 : value;
+            }
+        }
+
+        bool ok = visit_conversion_type(spec, [buf, buf_len, &used, &args_copy, precision](auto *type) {
+            using T = typename std::remove_pointer<decltype(type)>::type;
+
+            T value = va_arg(args_copy, T);
+
+            if constexpr (std::is_same<T, const char *>::value) {
+                // Don't read past the precision, the string might not be NUL-terminated.
+                size_t max_len = BINARY_TRACE_MAX_STRING_LENGTH;
+
+                if (precision >= 0 && static_cast<size_t>(precision) < max_len) {
+                    max_len = static_cast<size_t>(precision);
+                }
+
+                const char *str = value == nullptr ? "(null)" : value;
+                size_t str_len = strnlen(str, max_len);
+
+                if (buf_len - used < 1 + str_len) {
+                    return false;
+                }
+
+                buf[used++] = static_cast<uint8_t>(str_len);
+                memcpy(buf + used, str, str_len);
+                used += str_len;
+            }
+            else {
+                if (buf_len - used < sizeof(value)) {
+                    return false;
+                }
+
+                memcpy(buf + used, &value, sizeof(value));
+                used += sizeof(value);
+            }
+
+            return true;
+        });
+
+        if (!ok) {
+            va_end(args_copy);
+            return 0;
+        }
+    }
+
+    va_end(args_copy);
+
+    // A format string without arguments still needs a non-zero length to be
+    // distinguishable from an error.
+    if (used == 0) {
+        if (buf_len == 0) {
+            return 0;
+        }
+
+        buf[used++] = 0;
+    }
+
+    return used;
+}
+
+size_t binary_trace_format(char *buf, size_t buf_len, const char *fmt, const uint8_t *args, size_t args_len)
+{
+    size_t written = 0;
+    size_t args_used = 0;
+    const char *p = fmt;
+
+    auto put = [buf, buf_len, &written](const char *s, size_t len) {
+        if (written < buf_len) {
+            size_t to_copy = buf_len - written - 1 < len ? buf_len - written - 1 : len;
+            memcpy(buf + written, s, to_copy);
+        }
+
+        written += len;
+    };
+
+    // Formats a single conversion with snprintf. The spec is copied because
+    // it is not NUL-terminated in fmt.
+    auto put_formatted = [buf, buf_len, &written](const char *spec_fmt, auto... values) {
+        size_t remaining = written < buf_len ? buf_len - written : 0;
+        int result = snprintf(remaining > 0 ? buf + written : nullptr, remaining, spec_fmt, values...);
+
+        if (result > 0) {
+            written += static_cast<size_t>(result);
+        }
+    };
+
+    while (*p != '\0') {
+        const char *percent = strchr(p, '%');
+
+        if (percent == nullptr) {
+            put(p, strlen(p));
+            break;
+        }
+
+        put(p, static_cast<size_t>(percent - p));
+
+        if (percent[1] == '%') {
+            put("%", 1);
+            p = percent + 2;
+            continue;
+        }
+
+        ConversionSpec spec;
+
+        if (!parse_conversion_spec(percent, &spec)) {
+            put(percent, strlen(percent));
+            break;
+        }
+
+        p = percent + spec.len;
+
+        char spec_fmt[32];
+
+        if (spec.len >= sizeof(spec_fmt)) {
+            put(spec.start, spec.len);
+            continue;
+        }
+
+        memcpy(spec_fmt, spec.start, spec.len);
+        spec_fmt[spec.len] = '\0';
+
+        int stars[2] = {0, 0};
+
+        for (size_t i = 0; i < spec.star_count; ++i) {
+            if (args_len - args_used < sizeof(int)) {
+                return written;
+            }
+
+            memcpy(&stars[i], args + args_used, sizeof(int));
+            args_used += sizeof(int);
+        }
+
+        bool ok = visit_conversion_type(spec, [&](auto *type) {
+            using T = typename std::remove_pointer<decltype(type)>::type;
+
+            if constexpr (std::is_same<T, const char *>::value) {
+                if (args_len - args_used < 1) {
+                    return false;
+                }
+
+                size_t str_len = args[args_used++];
+
+                if (args_len - args_used < str_len) {
+                    return false;
+                }
+
+                char str[BINARY_TRACE_MAX_STRING_LENGTH + 1];
+
+                memcpy(str, args + args_used, str_len);
+                str[str_len] = '\0';
+                args_used += str_len;
+
+                if (spec.star_count == 2)      put_formatted(spec_fmt, stars[0], stars[1], str);
+                else if (spec.star_count == 1) put_formatted(spec_fmt, stars[0], str);
+                else                           put_formatted(spec_fmt, str);
+            }
+            else {
+                T value;
+
+                if (args_len - args_used < sizeof(value)) {
+                    return false;
+                }
+
+                memcpy(&value, args + args_used, sizeof(value));
+                args_used += sizeof(value);
+
+                if (spec.star_count == 2)      put_formatted(spec_fmt, stars[0], stars[1], value);
+                else if (spec.star_count == 1) put_formatted(spec_fmt, stars[0], value);
+                else                           put_formatted(spec_fmt, value);
+            }
+
+            return true;
+        });
+
+        if (!ok) {
+            put(spec.start, spec.len);
+        }
+    }
+
+    if (buf_len > 0) {
+        buf[written < buf_len ? written : buf_len - 1] = '\0';
+    }
+
+    return written;
+}
@@ -0,0 +1,64 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A binary trace record stores everything that is needed to format the trace
+// line later: The format string and prefix pointers (both must point to
+// memory that lives forever, i.e. string literals), the timestamp and the raw
+// arguments. Strings passed via %s are copied into the record (truncated to
+// BINARY_TRACE_MAX_STRING_LENGTH bytes).
+
+#define BINARY_TRACE_MAX_RECORD_LENGTH 256
+#define BINARY_TRACE_MAX_STRING_LENGTH 64
+
+enum class BinaryTraceRecordType : uint8_t {
+    // Timestamp, prefix and message formatted from fmt and the arguments.
+    Prefixed,
+    // Message formatted from fmt and the arguments.
+    Formatted,
+    // Text stored verbatim after the header.
+    Plain,
+    // Only the timestamp.
+    Timestamp,
+};
+
+struct [[gnu::packed]] BinaryTraceRecordHeader {
+    uint16_t length; // including this header
+    BinaryTraceRecordType type;
+    uint8_t prefix_len;
+    uint8_t clock_synced;
+    uint16_t millis;
+    uint32_t secs;
+    const char *prefix;
+    const char *fmt;
+};
+
+// Stores the arguments that fmt consumes into buf. Returns the number of bytes
+// written or 0 if fmt contains an unsupported conversion or buf is too small.
+size_t binary_trace_encode_args(uint8_t *buf, size_t buf_len, const char *fmt, va_list args);
+
+// Formats fmt with arguments previously stored by binary_trace_encode_args.
+// Behaves like snprintf: Returns the number of chars that would have been
+// written if buf was large enough, buf is always NUL-terminated.
+size_t binary_trace_format(char *buf, size_t buf_len, const char *fmt, const uint8_t *args, size_t args_len);
@@ -38,19 +38,49 @@
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "build.h"
+#include "string_builder.h"
 #include "tools.h"
 
+#define SINK_TASK_STACK_SIZE 3072
+#define SINK_CHUNK_SIZE 1024
+// Retry interval if the websocket backlog of a client is full.
+#define WS_SINK_RETRY_DELAY_MS 100
+
+static void event_log_sink_task(void *arg)
+{
+    static_cast<EventLog *>(arg)->sink_task();
+}
+
+// Linked with -Wl,--wrap=esp_system_abort, see platformio.ini.
+// abort() and failed asserts end up here too. Write the lines that explain
+// the abort before the panic handler takes over the serial console.
+extern "C" {
+[[noreturn]] void __real_esp_system_abort(const char *details);
+
+[[noreturn]] void __wrap_esp_system_abort(const char *details)
+{
+    logger.begin_sync_serial(true);
+    __real_esp_system_abort(details);
+}
+}
+
 void EventLog::pre_init()
 {
     event_buf.setup();
 
+    // Same priority as the main loop: Sinks catch up whenever the main loop
+    // yields, bursts of log messages are coalesced in the meantime.
+    if (xTaskCreate(event_log_sink_task, "event_log_sinks", SINK_TASK_STACK_SIZE, this, tskIDLE_PRIORITY + 1, &sink_task_handle) != pdPASS) {
+        sink_task_handle = nullptr;
+    }
+
     printfln_prefixed("", 0, "    **** " BUILD_MANUFACTURER_UPPER " " BUILD_DISPLAY_NAME_UPPER " V%s ****", build_version_full_str_upper());
     printfln_prefixed("", 0, "         %uK RAM SYSTEM   %u HEAP BYTES FREE", ESP.getHeapSize() / 1024, ESP.getFreeHeap());
     printfln_prefixed("", 0, "READY.");
     printfln_prefixed("", 0, "Last reset reason was: %s", tf_reset_reason());
 }
 
-size_t EventLog::alloc_trace_buffer(const char *name, size_t size) {
+size_t EventLog::alloc_trace_buffer(const char *name, size_t size, TraceBufferFormat format) {
 #if defined(BOARD_HAS_PSRAM)
     if (boot_stage > BootStage::PRE_SETUP){
         esp_system_abort("Using alloc_trace_buffer after the pre_setup is not allowed!");
@@ -65,10 +95,15 @@ size_t EventLog::alloc_trace_buffer(const char *name, size_t size) {
     }
 
     trace_buffers[trace_buffers_in_use].name = name;
+    trace_buffers[trace_buffers_in_use].format = format;
     trace_buffers[trace_buffers_in_use].buf.setup(size);
     ++trace_buffers_in_use;
     return trace_buffers_in_use - 1;
 #else
+    (void)name;
+    (void)size;
+    (void)format;
+
     return -1;
 #endif
 }
@@ -78,6 +113,13 @@ void EventLog::pre_setup()
     boot_id = Config::Object({
         {"boot_id", Config::Uint32(0)}
     });
+
+    sinks = Config::Object({
+        {"serial_lag", Config::Uint32(0)},
+        {"serial_dropped", Config::Uint32(0)},
+        {"ws_lag", Config::Uint32(0)},
+        {"ws_dropped", Config::Uint32(0)},
+    });
 }
 
 #define CHUNK_SIZE 1024
@@ -85,23 +127,73 @@ void EventLog::pre_setup()
 void EventLog::register_urls()
 {
     server.on_HTTPThread("/event_log", HTTP_GET, [this](WebServerRequest request) {
-        std::lock_guard<std::mutex> lock{event_buf_mutex};
-        char chunk_buf[CHUNK_SIZE]; // The HTTP task's stack is large enough.
-        auto used = event_buf.used();
+        String since_str = request.query_param("since");
+        uint64_t since = since_str.isEmpty() ? 0 : strtoull(since_str.c_str(), nullptr, 10);
+        uint64_t first_offset;
+        uint64_t end_offset;
+        size_t skip;
+        size_t len;
+        std::unique_ptr<char, decltype(&free_any)> snapshot{nullptr, free_any};
+
+        // Must be called with event_buf_mutex held.
+        auto span_since = [this, since](uint64_t *first, size_t *skipped) {
+            size_t used = event_buf.used();
+
+            *first   = event_buf_total - used;
+            *skipped = 0;
+
+            if (since > *first) {
+                *skipped = static_cast<size_t>(MIN(since - *first, static_cast<uint64_t>(used)));
+                *first  += *skipped;
+            }
 
-        request.beginChunkedResponse(200);
+            return used - *skipped;
+        };
 
-        for (int index = 0; index < used; index += CHUNK_SIZE) {
-            size_t to_write = MIN(CHUNK_SIZE, used - index);
+        // Only copy the log while holding the mutex. Sending it to a possibly
+        // slow client must not block all threads that want to log something.
+        // Don't allocate while holding the mutex either: The malloc failed
+        // hook logs and would deadlock on the mutex.
+        {
+            std::lock_guard<std::mutex> lock{event_buf_mutex};
+            len = span_since(&first_offset, &skip);
+        }
 
-            for (int i = 0; i < to_write; ++i) {
-                event_buf.peek_offset(chunk_buf + i, index + i);
+        if (len > 0) {
+            snapshot.reset(static_cast<char *>(malloc_psram_or_dram(len)));
+
+            if (snapshot == nullptr) {
+                return request.send(503, "text/plain", "Not enough memory to copy event log");
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{event_buf_mutex};
+            // Lines could have been logged in the meantime. Send them with the next request.
+            len = MIN(len, span_since(&first_offset, &skip));
+            end_offset = first_offset + len;
+
+            if (len > 0) {
+                event_buf.peek_n(snapshot.get(), skip, len);
             }
+        }
+
+        char offset_buf[24];
 
-            int result = request.sendChunk(chunk_buf, to_write);
+        snprintf(offset_buf, ARRAY_SIZE(offset_buf), "%" PRIu64, first_offset);
+        request.addResponseHeader("X-Event-Log-Start", offset_buf);
+        snprintf(offset_buf, ARRAY_SIZE(offset_buf), "%" PRIu64, end_offset);
+        request.addResponseHeader("X-Event-Log-End", offset_buf);
+
+        request.beginChunkedResponse(200);
+
+        for (size_t index = 0; index < len; index += CHUNK_SIZE) {
+            size_t to_write = MIN(CHUNK_SIZE, len - index);
+
+            int result = request.sendChunk(snapshot.get() + index, to_write);
             if (result != ESP_OK) {
                 if (result != ESP_ERR_HTTPD_RESP_SEND) { // Don't log connection closed during transfer. This happens when the front-end is reloaded after a websocket reconnect.
-                    Serial.printf("/event_log sendChunk failed: %s (0x%X)\n", esp_err_to_name(result), static_cast<unsigned int>(result)); // Can't write to the event log while holding the event_buf_mutex.
+                    printfln_prefixed(event_log_prefix, event_log_prefix_len, "/event_log sendChunk failed: %s (0x%X)", esp_err_to_name(result), static_cast<unsigned int>(result));
                 }
                 break;
             }
@@ -117,20 +209,26 @@ void EventLog::register_urls()
 
         for (size_t i = 0; i < trace_buffers_in_use; ++i) {
             auto &trace_buffer = trace_buffers[i];
-            std::lock_guard<std::mutex> lock{trace_buffer.mutex};
-
-            char *first_chunk, *second_chunk;
-            size_t first_len, second_len;
-            trace_buffer.buf.get_chunks(&first_chunk, &first_len, &second_chunk, &second_len);
 
             char buf[128];
             size_t written = snprintf(buf, ARRAY_SIZE(buf), "__begin_%.100s__\n", trace_buffer.name);
             request.sendChunk(buf, written);
 
-            if (first_len > 0)
-                request.sendChunk(first_chunk, first_len);
-            if (second_len > 0)
-                request.sendChunk(second_chunk, second_len);
+            if (trace_buffer.format == TraceBufferFormat::Binary) {
+                send_binary_trace_buffer(request, trace_buffer);
+            }
+            else {
+                std::lock_guard<std::mutex> lock{trace_buffer.mutex};
+
+                char *first_chunk, *second_chunk;
+                size_t first_len, second_len;
+                trace_buffer.buf.get_chunks(&first_chunk, &first_len, &second_chunk, &second_len);
+
+                if (first_len > 0)
+                    request.sendChunk(first_chunk, first_len);
+                if (second_len > 0)
+                    request.sendChunk(second_chunk, second_len);
+            }
 
             written = snprintf(buf, ARRAY_SIZE(buf), "__end_%.100s__\n", trace_buffer.name);
             request.sendChunk(buf, written);
@@ -144,6 +242,116 @@ void EventLog::register_urls()
 
 
     api.addState("event_log/boot_id", &boot_id);
+    api.addState("event_log/sinks", &sinks);
+}
+
+// Copies the records while holding the mutex and formats them afterwards, so
+// that tracing is not blocked while the lines are formatted and sent.
+void EventLog::send_binary_trace_buffer(WebServerRequest &request, TraceBuffer &trace_buffer)
+{
+    std::unique_ptr<char, decltype(&free_any)> snapshot{nullptr, free_any};
+    size_t len;
+
+    {
+        std::lock_guard<std::mutex> lock{trace_buffer.mutex};
+
+        char *first_chunk, *second_chunk;
+        size_t first_len, second_len;
+        trace_buffer.buf.get_chunks(&first_chunk, &first_len, &second_chunk, &second_len);
+
+        len = first_len + second_len;
+
+        if (len > 0) {
+            snapshot.reset(static_cast<char *>(malloc_psram_or_dram(len)));
+
+            if (snapshot == nullptr) {
+                static const char msg[] = "Not enough memory to copy trace buffer\n";
+                request.sendChunk(msg, ARRAY_SIZE(msg) - 1);
+                return;
+            }
+
+            memcpy(snapshot.get(), first_chunk, first_len);
+
+            if (second_len > 0) {
+                memcpy(snapshot.get() + first_len, second_chunk, second_len);
+            }
+        }
+    }
+
+    char out[CHUNK_SIZE];
+    size_t out_len = 0;
+
+    auto append = [&request, &out, &out_len](const char *data, size_t data_len) {
+        if (out_len + data_len > ARRAY_SIZE(out)) {
+            request.sendChunk(out, out_len);
+            out_len = 0;
+        }
+
+        if (data_len > ARRAY_SIZE(out)) {
+            request.sendChunk(data, data_len);
+            return;
+        }
+
+        memcpy(out + out_len, data, data_len);
+        out_len += data_len;
+    };
+
+    char line[EVENT_LOG_TIMESTAMP_LENGTH + 256];
+    size_t offset = 0;
+
+    while (len - offset >= sizeof(BinaryTraceRecordHeader)) {
+        BinaryTraceRecordHeader header;
+        memcpy(&header, snapshot.get() + offset, sizeof(header));
+
+        if (header.length < sizeof(header) || header.length > len - offset) {
+            break;
+        }
+
+        const uint8_t *payload = reinterpret_cast<const uint8_t *>(snapshot.get() + offset + sizeof(header));
+        size_t payload_len = header.length - sizeof(header);
+        size_t line_len = 0;
+
+        offset += header.length;
+
+        switch (header.type) {
+            case BinaryTraceRecordType::Prefixed:
+                line_len = format_line_start(line, ARRAY_SIZE(line), header.clock_synced != 0, header.secs, header.millis, header.prefix, header.prefix_len);
+
+                if (line_len < ARRAY_SIZE(line)) {
+                    line_len += binary_trace_format(line + line_len, ARRAY_SIZE(line) - line_len, header.fmt, payload, payload_len);
+                }
+                break;
+
+            case BinaryTraceRecordType::Formatted:
+                line_len = binary_trace_format(line, ARRAY_SIZE(line), header.fmt, payload, payload_len);
+                break;
+
+            case BinaryTraceRecordType::Timestamp:
+                format_timestamp_at(line, header.clock_synced != 0, header.secs, header.millis);
+                line_len = EVENT_LOG_TIMESTAMP_LENGTH;
+                break;
+
+            case BinaryTraceRecordType::Plain:
+                append(reinterpret_cast<const char *>(payload), payload_len);
+                continue;
+        }
+
+        if (line_len >= ARRAY_SIZE(line)) {
+            line_len = ARRAY_SIZE(line) - 1; // Don't include termination, which vsnprintf always leaves in
+        }
+
+        // The IDF might log messages ending with "\r\n" via tf_event_log_[v]printfln
+        if (line_len >= 2 && line[line_len - 2] == '\r' && line[line_len - 1] == '\n') {
+            line_len -= 2;
+        }
+
+        line[line_len++] = '\n'; // At this point line_len < ARRAY_SIZE(line) is guaranteed
+        append(line, line_len);
+    }
+
+    if (out_len > 0) {
+        request.sendChunk(out, out_len);
+    }
 }
 
 void EventLog::post_setup()
@@ -151,23 +359,284 @@ void EventLog::post_setup()
     // Entropy is created by the wifi modem.
     auto id = esp_random();
     boot_id.get("boot_id")->updateUint(id);
+
+#if MODULE_DEBUG_AVAILABLE()
+    if (sink_task_handle != nullptr) {
+        debug.register_task(sink_task_handle, SINK_TASK_STACK_SIZE);
+    }
+#endif
+
+    task_scheduler.scheduleWithFixedDelay([this]() {
+        update_sinks_state();
+    }, 1_s, 1_s);
 }
 
-void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */])
+void EventLog::sink_task()
+{
+    char buf[SINK_CHUNK_SIZE];
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, ws_sink_blocked ? pdMS_TO_TICKS(WS_SINK_RETRY_DELAY_MS) : portMAX_DELAY);
+        ws_sink_blocked = false;
+
+        // Keep draining until both sinks caught up. Everything that was logged
+        // in the meantime is sent in the same batch.
+        while (drain_serial_sink(buf, ARRAY_SIZE(buf)) + drain_ws_sink(buf, ARRAY_SIZE(buf)) > 0) {
+        }
+    }
+}
+
+// Copies the oldest bytes the sink has not seen yet and advances its offset.
+size_t EventLog::copy_sink_data(uint64_t *sink_offset, uint32_t *sink_dropped, char *buf, size_t buf_len)
+{
+    std::lock_guard<std::mutex> lock{event_buf_mutex};
+    return copy_sink_data_locked(sink_offset, sink_dropped, buf, buf_len);
+}
+
+size_t EventLog::copy_sink_data_locked(uint64_t *sink_offset, uint32_t *sink_dropped, char *buf, size_t buf_len)
+{
+    uint64_t first_offset = event_buf_total - event_buf.used();
+
+    if (*sink_offset < first_offset) {
+        *sink_dropped += static_cast<uint32_t>(first_offset - *sink_offset);
+        *sink_offset = first_offset;
+    }
+
+    size_t len = event_buf.peek_n(buf, static_cast<size_t>(*sink_offset - first_offset), buf_len);
+
+    *sink_offset += len;
+
+    return len;
+}
+
+size_t EventLog::drain_serial_sink(char *buf, size_t buf_len)
+{
+    // Held while writing, so that a synchronous drain can't overtake a chunk.
+    std::lock_guard<std::mutex> lock{serial_sink_mutex};
+
+    size_t len = copy_sink_data(&serial_sink_offset, &serial_sink_dropped, buf, buf_len);
+
+    if (len > 0) {
+        Serial.write(buf, len);
+    }
+
+    return len;
+}
+
+// Tries to lock the mutex for up to 100 ticks, but only once if the caller must not block.
+static bool try_lock_bounded(std::mutex &mutex, bool can_delay)
+{
+    for (int i = 0; i < 100; ++i) {
+        if (mutex.try_lock()) {
+            return true;
+        }
+
+        if (!can_delay) {
+            return false;
+        }
+
+        vTaskDelay(1);
+    }
+
+    return false;
+}
+
+void EventLog::drain_serial_sink_sync(bool aborting)
+{
+    if (xPortInIsrContext()) {
+        return;
+    }
+
+    // esp_system_abort can be called in a critical section or with the
+    // scheduler suspended. Delaying or blocking there asserts.
+    bool can_delay = xPortCanYield() && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+
+    // The sink task releases the lock after writing its current chunk. Don't
+    // wait forever: This might be called from the sink task itself.
+    bool locked = try_lock_bounded(serial_sink_mutex, can_delay);
+
+    // Small buffer: Called on the stack of the failing task.
+    char buf[128];
+
+    while (true) {
+        // The aborting task might hold event_buf_mutex itself. Waiting for
+        // it would hang instead of panicking.
+        if (!try_lock_bounded(event_buf_mutex, can_delay && !aborting)) {
+            break;
+        }
+
+        size_t len = copy_sink_data_locked(&serial_sink_offset, &serial_sink_dropped, buf, ARRAY_SIZE(buf));
+
+        event_buf_mutex.unlock();
+
+        if (len == 0) {
+            break;
+        }
+
+        Serial.write(buf, len);
+    }
+
+    Serial.flush();
+
+    if (locked) {
+        serial_sink_mutex.unlock();
+    }
+}
+
+void EventLog::begin_sync_serial(bool aborting)
+{
+    ++sync_serial_depth;
+    drain_serial_sink_sync(aborting);
+}
+
+void EventLog::end_sync_serial()
+{
+    --sync_serial_depth;
+}
+
+size_t EventLog::drain_ws_sink(char *buf, size_t buf_len)
+{
+#if MODULE_WS_AVAILABLE()
+    if (ws_sink_blocked) {
+        return 0;
+    }
+
+    if (!ws.web_sockets.haveActiveClient()) {
+        std::lock_guard<std::mutex> lock{event_buf_mutex};
+        ws_sink_offset = event_buf_total;
+        return 0;
+    }
+
+    size_t len = copy_sink_data(&ws_sink_offset, &ws_sink_dropped, buf, buf_len);
+
+    if (len == 0) {
+        return 0;
+    }
+
+    // Only send complete lines, unless a single line fills the whole buffer.
+    if (buf[len - 1] != '\n') {
+        size_t complete_len = len;
+
+        while (complete_len > 0 && buf[complete_len - 1] != '\n') {
+            --complete_len;
+        }
+
+        if (complete_len > 0) {
+            std::lock_guard<std::mutex> lock{event_buf_mutex};
+            ws_sink_offset -= len - complete_len;
+            len = complete_len;
+        }
+    }
+
+    // The frontend appends a newline to each message, which also works for
+    // multiple lines in one message.
+    size_t stripped_len = len;
+
+    if (buf[stripped_len - 1] == '\n') {
+        --stripped_len;
+    }
+
+    size_t json_len;
+
+    {
+        TFJsonSerializer json{nullptr, 0};
+        json.addString(buf, stripped_len, false);
+        json_len = json.end();
+    }
+
+    StringBuilder sb;
+
+    if (!ws.pushRawStateUpdateBegin(&sb, 1 /* " */ + json_len + 1 /* " */, "event_log/message")) {
+        std::lock_guard<std::mutex> lock{event_buf_mutex};
+        ws_sink_dropped += len;
+        return len;
+    }
+
+    sb.putc('"');
+
+    {
+        TFJsonSerializer json{sb.getRemainingPtr(), sb.getRemainingLength() + 1 /* \0 */};
+        json.addString(buf, stripped_len, false);
+        sb.setLength(sb.getLength() + json.end());
+    }
+
+    sb.putc('"');
+
+    // The websocket queue or the backlog of a client is full. Send the
+    // same lines again after a delay.
+    if (!ws.pushRawStateUpdateEnd(&sb)) {
+        std::lock_guard<std::mutex> lock{event_buf_mutex};
+        ws_sink_offset -= len;
+        ws_sink_blocked = true;
+        return 0;
+    }
+
+    return len;
+#else
+    (void)buf;
+    (void)buf_len;
+
+    return 0;
+#endif
+}
+
+void EventLog::update_sinks_state()
+{
+    uint32_t serial_lag, serial_dropped, ws_lag, ws_dropped;
+
+    {
+        std::lock_guard<std::mutex> lock{event_buf_mutex};
+        serial_lag     = static_cast<uint32_t>(event_buf_total - serial_sink_offset);
+        serial_dropped = serial_sink_dropped;
+        ws_lag         = static_cast<uint32_t>(event_buf_total - ws_sink_offset);
+        ws_dropped     = ws_sink_dropped;
+    }
+
+    sinks.get("serial_lag")->updateUint(serial_lag);
+    sinks.get("serial_dropped")->updateUint(serial_dropped);
+    sinks.get("ws_lag")->updateUint(ws_lag);
+    sinks.get("ws_dropped")->updateUint(ws_dropped);
+}
+
+void EventLog::get_timestamp(bool *clock_synced, uint32_t *secs, uint16_t *ms)
 {
     struct timeval tv_now;
-    struct tm timeinfo;
 
     if (rtc.clock_synced(&tv_now)) {
-        localtime_r(&tv_now.tv_sec, &timeinfo);
+        *clock_synced = true;
+        *secs = static_cast<uint32_t>(tv_now.tv_sec);
+        *ms = static_cast<uint16_t>(tv_now.tv_usec / 1000);
+    } else {
+        uint32_t now = millis();
+
+        *clock_synced = false;
+        *secs = now / 1000;
+        *ms = static_cast<uint16_t>(now % 1000);
+    }
+}
+
+void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */])
+{
+    bool clock_synced;
+    uint32_t secs;
+    uint16_t ms;
+
+    get_timestamp(&clock_synced, &secs, &ms);
+    format_timestamp_at(buf, clock_synced, secs, ms);
+}
+
+void EventLog::format_timestamp_at(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */], bool clock_synced, uint32_t secs, uint16_t ms)
+{
+    if (clock_synced) {
+        time_t t = static_cast<time_t>(secs);
+        struct tm timeinfo;
+
+        localtime_r(&t, &timeinfo);
 
         // ISO 8601 allows omitting the T between date and time. Also  ',' is the preferred decimal sign.
         size_t written = strftime(buf, EVENT_LOG_TIMESTAMP_LENGTH + 1, "%F %T", &timeinfo);
-        snprintf(buf + written, EVENT_LOG_TIMESTAMP_LENGTH + 1 - written, ",%03ld", tv_now.tv_usec / 1000);
+        snprintf(buf + written, EVENT_LOG_TIMESTAMP_LENGTH + 1 - written, ",%03u", static_cast<unsigned int>(ms));
     } else {
-        uint32_t now = millis();
-        uint32_t secs = now / 1000;
-        uint32_t ms = now % 1000;
         size_t to_write = snprintf_u(nullptr, 0, "%" PRIu32, secs) + 4; // +4 for the decimal sign and fractional part
         size_t start = EVENT_LOG_TIMESTAMP_LENGTH - to_write;
 
@@ -175,13 +644,31 @@ void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */
             buf[i] = ' ';
         }
 
-        snprintf(buf + start, to_write + 1, "%" PRIu32 ",%03" PRIu32, secs, ms); // +1 for the NUL-terminator
+        snprintf(buf + start, to_write + 1, "%" PRIu32 ",%03u", secs, static_cast<unsigned int>(ms)); // +1 for the NUL-terminator
     }
 
     buf[EVENT_LOG_TIMESTAMP_LENGTH] = '\0';
 }
 
 size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+{
+    bool clock_synced;
+    uint32_t secs;
+    uint16_t ms;
+
+    get_timestamp(&clock_synced, &secs, &ms);
+
+    size_t written = format_line_start(buf, buf_len, clock_synced, secs, ms, prefix, prefix_len);
+
+    if (written < buf_len) {
+        written += vsnprintf_u(buf + written, buf_len - written, fmt, args);
+    }
+
+    return written;
+}
+
+// Writes the timestamp and the padded prefix column of a log line.
+size_t EventLog::format_line_start(char *buf, size_t buf_len, bool clock_synced, uint32_t secs, uint16_t ms, const char *prefix, size_t prefix_len)
 {
     if (buf_len < EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */) {
         return 0;
@@ -189,7 +676,7 @@ size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefi
 
     size_t written = 0;
 
-    format_timestamp(buf);
+    format_timestamp_at(buf, clock_synced, secs, ms);
     written += EVENT_LOG_TIMESTAMP_LENGTH;
 
     if (written + 3 <= buf_len) {
@@ -216,10 +703,6 @@ size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefi
         }
     }
 
-    if (written < buf_len) {
-        written += vsnprintf_u(buf + written, buf_len - written, fmt, args);
-    }
-
     return written;
 }
 
@@ -248,7 +731,10 @@ void EventLog::print_timestamp()
 
 size_t EventLog::print_plain(const char *buf, size_t len)
 {
-    Serial.write(buf, len);
+    // Without the sink task, fall back to writing synchronously.
+    if (sink_task_handle == nullptr) {
+        Serial.write(buf, len);
+    }
 
     {
         std::lock_guard<std::mutex> lock{event_buf_mutex};
@@ -257,42 +743,21 @@ size_t EventLog::print_plain(const char *buf, size_t len)
             print_drop(len - event_buf.free());
         }
 
-        for (size_t i = 0; i < len; ++i) {
-            event_buf.push(buf[i]);
-        }
-    }
-
-#if MODULE_WS_AVAILABLE()
-    size_t stripped_len = len;
-
-    if (len >= 1 && buf[len - 1] == '\n') {
-        stripped_len = len - 1;
-    }
-
-    size_t json_len;
+        event_buf.push_n(buf, len);
+        event_buf_total += len;
 
-    {
-        TFJsonSerializer json{nullptr, 0};
-        json.addString(buf, stripped_len, false);
-        json_len = json.end();
+        if (sink_task_handle == nullptr) {
+            serial_sink_offset = event_buf_total;
+        }
     }
 
-    CoolString payload;
-
-    if (payload.reserve(1 /* " */ + json_len + 1 /* " */ + 1 /* \0 */)) {
-        payload += '"';
-
-        {
-            TFJsonSerializer json{payload.begin() + payload.length(), json_len + 1 /* \0 */};
-            json.addString(buf, stripped_len, false);
-            payload.setLength(payload.length() + json.end());
+    if (sink_task_handle != nullptr) {
+        if (sync_serial_depth > 0) {
+            drain_serial_sink_sync();
         }
 
-        payload += '"';
-
-        ws.pushRawStateUpdate(payload, "event_log/message");
+        xTaskNotifyGive(sink_task_handle);
     }
-#endif
 
     return len;
 }
@@ -405,9 +870,86 @@ void EventLog::trace_drop(size_t trace_buf_idx, size_t count)
 #endif
 }
 
+size_t EventLog::trace_binary(size_t trace_buf_idx, BinaryTraceRecordType type, const char *prefix, size_t prefix_len, const char *fmt, const uint8_t *payload, size_t payload_len)
+{
+#if defined(BOARD_HAS_PSRAM)
+    BinaryTraceRecordHeader header;
+    bool clock_synced;
+    uint32_t secs;
+    uint16_t ms;
+
+    get_timestamp(&clock_synced, &secs, &ms);
+
+    header.length       = static_cast<uint16_t>(sizeof(header) + payload_len);
+    header.type         = type;
+    header.prefix_len   = static_cast<uint8_t>(MIN(prefix_len, 255u));
+    header.clock_synced = clock_synced ? 1 : 0;
+    header.millis       = ms;
+    header.secs         = secs;
+    header.prefix       = prefix;
+    header.fmt          = fmt;
+
+    auto *trace_buffer = &this->trace_buffers[trace_buf_idx];
+
+    std::lock_guard<std::mutex> lock{trace_buffer->mutex};
+    auto &buf = trace_buffer->buf;
+
+    // Drop whole records to make room. Never let push_n overwrite the oldest
+    // record partially, the decoder would lose track of the record boundaries.
+    while (buf.free() <= header.length && !buf.empty()) {
+        char length_lo, length_hi;
+
+        buf.peek_offset(&length_lo, 0);
+        buf.peek_offset(&length_hi, 1);
+
+        buf.drop_n(static_cast<uint8_t>(length_lo) | (static_cast<uint8_t>(length_hi) << 8));
+    }
+
+    if (buf.free() <= header.length) {
+        return 0;
+    }
+
+    buf.push_n(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    if (payload_len > 0) {
+        buf.push_n(reinterpret_cast<const char *>(payload), payload_len);
+    }
+
+    return header.length;
+#else
+    (void)trace_buf_idx;
+    (void)type;
+    (void)prefix;
+    (void)prefix_len;
+    (void)fmt;
+    (void)payload;
+    (void)payload_len;
+
+    return 0;
+#endif
+}
+
+// Returns 0 if fmt can't be stored in binary form. The caller then has to format it as text.
+size_t EventLog::vtrace_binary(size_t trace_buf_idx, BinaryTraceRecordType type, const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+{
+    uint8_t payload[BINARY_TRACE_MAX_RECORD_LENGTH - sizeof(BinaryTraceRecordHeader)];
+    size_t payload_len = binary_trace_encode_args(payload, ARRAY_SIZE(payload), fmt, args);
+
+    if (payload_len == 0) {
+        return 0;
+    }
+
+    return trace_binary(trace_buf_idx, type, prefix, prefix_len, fmt, payload, payload_len);
+}
+
 void EventLog::trace_timestamp(size_t trace_buf_idx)
 {
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx != -1 && trace_buffers[trace_buf_idx].format == TraceBufferFormat::Binary) {
+        trace_binary(trace_buf_idx, BinaryTraceRecordType::Timestamp, nullptr, 0, nullptr, nullptr, 0);
+        return;
+    }
+
     char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \n | \0 */];
 
     format_timestamp(buf);
@@ -427,6 +969,16 @@ size_t EventLog::trace_plain(size_t trace_buf_idx, const char *buf, size_t len)
 
     auto *trace_buffer = &this->trace_buffers[trace_buf_idx];
 
+    if (trace_buffer->format == TraceBufferFormat::Binary) {
+        const size_t max_chunk_len = BINARY_TRACE_MAX_RECORD_LENGTH - sizeof(BinaryTraceRecordHeader);
+
+        for (size_t offset = 0; offset < len; offset += max_chunk_len) {
+            trace_binary(trace_buf_idx, BinaryTraceRecordType::Plain, nullptr, 0, nullptr, reinterpret_cast<const uint8_t *>(buf + offset), MIN(max_chunk_len, len - offset));
+        }
+
+        return len;
+    }
+
     std::lock_guard<std::mutex> lock{trace_buffer->mutex};
     bool drop_line = trace_buffer->buf.free() < len;
 
@@ -450,6 +1002,14 @@ size_t EventLog::vtracefln_plain(size_t trace_buf_idx, const char *fmt, va_list
 {
     size_t written = 0;
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx != -1 && trace_buffers[trace_buf_idx].format == TraceBufferFormat::Binary) {
+        written = vtrace_binary(trace_buf_idx, BinaryTraceRecordType::Formatted, nullptr, 0, fmt, args);
+
+        if (written > 0) {
+            return written;
+        }
+    }
+
     char buf[256];
     size_t buf_len = ARRAY_SIZE(buf);
 
@@ -490,6 +1050,14 @@ size_t EventLog::vtracefln_prefixed(size_t trace_buf_idx, const char *prefix, si
 {
     size_t written = 0;
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx != -1 && trace_buffers[trace_buf_idx].format == TraceBufferFormat::Binary) {
+        written = vtrace_binary(trace_buf_idx, BinaryTraceRecordType::Prefixed, prefix, prefix_len, fmt, args);
+
+        if (written > 0) {
+            return written;
+        }
+    }
+
     char buf[EVENT_LOG_TIMESTAMP_LENGTH + 256];
     size_t buf_len = ARRAY_SIZE(buf);
 
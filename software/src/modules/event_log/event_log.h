@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <stdarg.h>
 #include <mutex>
 #include <Arduino.h>
@@ -27,11 +28,22 @@
 #include "config.h"
 #include "ringbuffer.h"
 #include "tools/malloc.h"
+#include "modules/web_server/web_server.h"
+#include "binary_trace.h"
 
 // Length of an ISO 8601 timestamp. For example "2022-02-11 12:34:56,789"
 // Also change in frontend when changing here!
 #define EVENT_LOG_TIMESTAMP_LENGTH 23
 
+enum class TraceBufferFormat {
+    // Trace lines are formatted when they are traced.
+    Text,
+    // Format string pointer, timestamp and arguments are stored and only
+    // formatted when the trace log is read. The format strings and prefixes
+    // must live forever, which is the case for string literals.
+    Binary,
+};
+
 class EventLog final : public IModule
 {
 public:
@@ -43,13 +55,26 @@ public:
 
     void post_setup();
 
+    void sink_task();
+
     void format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */]);
+    void get_timestamp(bool *clock_synced, uint32_t *secs, uint16_t *ms);
+    void format_timestamp_at(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */], bool clock_synced, uint32_t secs, uint16_t ms);
+    size_t format_line_start(char *buf, size_t buf_len, bool clock_synced, uint32_t secs, uint16_t ms, const char *prefix, size_t prefix_len);
     size_t vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefix, size_t prefix_len, const char *fmt, va_list args);
 
     void print_drop(size_t count);
     void print_timestamp();
     size_t print_plain(const char *buf, size_t len);
 
+    // Writes everything the serial sink has not written yet in the calling
+    // task. Until end_sync_serial is called, print_plain also writes to the
+    // serial console in the calling task. Use on abort, reboot and other
+    // paths that must not rely on the sink task. If aborting is set, the
+    // log is only written if that does not have to wait for another task.
+    void begin_sync_serial(bool aborting = false);
+    void end_sync_serial();
+
     size_t vprintfln_plain(const char *fmt, va_list args);
     [[gnu::format(__printf__, 2, 3)]] size_t printfln_plain(const char *fmt, ...);
 
@@ -80,10 +105,17 @@ public:
     [[gnu::format(__printf__, 2, 3)]] size_t tracefln_debug(const char *fmt, ...);
 
     // Returns id of allocated buffer
-    size_t alloc_trace_buffer(const char *name, size_t size);
+    size_t alloc_trace_buffer(const char *name, size_t size, TraceBufferFormat format = TraceBufferFormat::Text);
     size_t get_trace_buffer_idx(const char *name);
 
 private:
+    size_t copy_sink_data(uint64_t *sink_offset, uint32_t *sink_dropped, char *buf, size_t buf_len);
+    size_t copy_sink_data_locked(uint64_t *sink_offset, uint32_t *sink_dropped, char *buf, size_t buf_len);
+    size_t drain_serial_sink(char *buf, size_t buf_len);
+    void drain_serial_sink_sync(bool aborting = false);
+    size_t drain_ws_sink(char *buf, size_t buf_len);
+    void update_sinks_state();
+
     std::mutex event_buf_mutex;
     TF_PackedRingbuffer<char,
                         10000,
@@ -94,10 +126,25 @@ private:
                         malloc_32bit_addressed,
 #endif
                         free_any> event_buf;
+    // Number of bytes ever pushed into event_buf. Used as offset for /event_log?since=
+    uint64_t event_buf_total = 0;
+
+    // The serial and websocket sinks are fed by sink_task from event_buf, so
+    // that logging only has to format into event_buf. Offsets are in the same
+    // unit as event_buf_total and protected by event_buf_mutex.
+    TaskHandle_t sink_task_handle = nullptr;
+    std::mutex serial_sink_mutex;
+    std::atomic<uint32_t> sync_serial_depth{0};
+    uint64_t serial_sink_offset   = 0;
+    uint32_t serial_sink_dropped  = 0;
+    uint64_t ws_sink_offset       = 0;
+    uint32_t ws_sink_dropped      = 0;
+    bool ws_sink_blocked          = false; // only used by sink_task
 
 
     struct TraceBuffer {
         const char *name;
+        TraceBufferFormat format = TraceBufferFormat::Text;
         std::mutex mutex;
         TF_Ringbuffer<char,
                       malloc_psram,
@@ -105,6 +152,9 @@ private:
     };
 
     TraceBuffer *find_trace_buffer(const char *prefix);
+    size_t trace_binary(size_t trace_buf_idx, BinaryTraceRecordType type, const char *prefix, size_t prefix_len, const char *fmt, const uint8_t *payload, size_t payload_len);
+    size_t vtrace_binary(size_t trace_buf_idx, BinaryTraceRecordType type, const char *prefix, size_t prefix_len, const char *fmt, va_list args);
+    void send_binary_trace_buffer(WebServerRequest &request, TraceBuffer &trace_buffer);
 
 #if defined(BOARD_HAS_PSRAM)
     std::array<TraceBuffer, 16> trace_buffers;
@@ -114,6 +164,7 @@ private:
 #endif
 
     ConfigRoot boot_id;
+    ConfigRoot sinks;
 };
 
 #define vprintfln(fmt, args)          vprintfln_prefixed(event_log_prefix, event_log_prefix_len, fmt, args)
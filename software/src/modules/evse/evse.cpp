@@ -633,7 +633,10 @@ void EVSE::update_all_data()
     // get_button_state
     evse_common.button_state.get("button_press_time")->updateUint(button_press_time);
     evse_common.button_state.get("button_release_time")->updateUint(button_release_time);
-    evse_common.button_state.get("button_pressed")->updateBool(button_pressed);
+    if (evse_common.button_state.get("button_pressed")->updateBool(button_pressed)) {
+        // Don't wait for the next state update check: Button presses should be shown immediately.
+        api.flushState(&evse_common.button_state);
+    }
 
     evse_common.boost_mode.get("enabled")->updateBool(boost_mode_enabled);
 
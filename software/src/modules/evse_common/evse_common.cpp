@@ -421,7 +421,8 @@ void EvseCommon::register_urls()
     });
 
     task_scheduler.scheduleWithFixedDelay([this](){
-        if (!deadline_elapsed(next_cm_send_deadline))
+        // In change-driven mode, cm_networking only sends the state if it changed or a heartbeat is due.
+        if (!cm_networking.is_client_change_driven() && !deadline_elapsed(next_cm_send_deadline))
             return;
 
         send_cm_client_update();
@@ -1186,6 +1186,11 @@ void EVSEV2::update_all_data()
     evse_common.button_state.get("button_release_time")->updateUint(button_release_time);
     bool button_pressed_changed = evse_common.button_state.get("button_pressed")->updateBool(button_pressed);
 
+    // Don't wait for the next state update check: Button presses should be shown immediately.
+    if (button_pressed_changed) {
+        api.flushState(&evse_common.button_state);
+    }
+
 #if MODULE_AUTOMATION_AVAILABLE()
     if (button_pressed_changed && button_pressed) {
         // Don't attempt to trigger actions during the setup stage because the automation rules are probably not loaded yet.
@@ -1194,8 +1199,6 @@ void EVSEV2::update_all_data()
             automation.trigger(AutomationTriggerID::EVSEButton, nullptr, this);
         }
     }
-#else
-    (void)button_pressed_changed;
 #endif
 
     ev_wakeup.get("enabled")->updateBool(ev_wakeup_enabled);
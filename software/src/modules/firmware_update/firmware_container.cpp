@@ -0,0 +1,169 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "firmware_container.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Header layout, all values little endian:
+//  0: uint32 magic
+//  4: uint8  version
+//  5: uint8  window bits of the zlib stream
+//  6: uint16 reserved, 0
+//  8: uint32 length of the decompressed image
+
+static uint32_t read_u32_le(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0])
+        | (static_cast<uint32_t>(p[1]) << 8)
+        | (static_cast<uint32_t>(p[2]) << 16)
+        | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+bool firmware_container_detect(const uint8_t *data, size_t data_len)
+{
+    return data_len >= 4 && read_u32_le(data) == FIRMWARE_CONTAINER_MAGIC;
+}
+
+FirmwareContainerDecoder::FirmwareContainerDecoder(WindowAllocator &&window_allocator, ImageCallback &&image_callback) :
+    window_allocator(std::move(window_allocator)),
+    image_callback(std::move(image_callback)),
+    inflate([this](const uint8_t *data, size_t data_len) {
+        size_t offset = inflate.get_total_out() - data_len;
+
+        if (offset + data_len > image_length) {
+            fail("Image longer than announced");
+            return false;
+        }
+
+        return this->image_callback(offset, data, data_len);
+    })
+{
+}
+
+FirmwareContainerDecoder::~FirmwareContainerDecoder()
+{
+    free(window);
+}
+
+void FirmwareContainerDecoder::reset()
+{
+    free(window);
+    window = nullptr;
+    header_read = 0;
+    image_length = 0;
+    out_of_memory = false;
+    error = nullptr;
+}
+
+bool FirmwareContainerDecoder::fail(const char *msg)
+{
+    if (error == nullptr) {
+        error = msg;
+    }
+
+    return false;
+}
+
+bool FirmwareContainerDecoder::parse_header()
+{
+    if (read_u32_le(header) != FIRMWARE_CONTAINER_MAGIC) {
+        return fail("Not a firmware container");
+    }
+
+    if (header[4] != FIRMWARE_CONTAINER_VERSION) {
+        return fail("Unsupported container version");
+    }
+
+    uint8_t window_bits = header[5];
+    if (window_bits < 8 || window_bits > 15) {
+        return fail("Invalid window bits");
+    }
+
+    image_length = read_u32_le(header + 8);
+
+    size_t window_size = 1u << window_bits;
+    window = static_cast<uint8_t *>(window_allocator(window_size));
+    if (window == nullptr) {
+        out_of_memory = true;
+        return fail("Failed to allocate window");
+    }
+
+    inflate.begin(window, window_size);
+    return true;
+}
+
+bool FirmwareContainerDecoder::feed(const uint8_t *data, size_t data_len)
+{
+    if (error != nullptr) {
+        return false;
+    }
+
+    if (header_read < FIRMWARE_CONTAINER_HEADER_LENGTH) {
+        size_t to_copy = FIRMWARE_CONTAINER_HEADER_LENGTH - header_read;
+        if (to_copy > data_len) {
+            to_copy = data_len;
+        }
+
+        memcpy(header + header_read, data, to_copy);
+        header_read += to_copy;
+        data += to_copy;
+        data_len -= to_copy;
+
+        if (header_read < FIRMWARE_CONTAINER_HEADER_LENGTH) {
+            return true;
+        }
+
+        if (!parse_header()) {
+            return false;
+        }
+    }
+
+    if (data_len == 0) {
+        return true;
+    }
+
+    if (!inflate.feed(data, data_len)) {
+        return fail(inflate.get_error());
+    }
+
+    return true;
+}
+
+bool FirmwareContainerDecoder::finish()
+{
+    if (error != nullptr) {
+        return false;
+    }
+
+    if (!header_complete()) {
+        return fail("Container truncated");
+    }
+
+    if (!inflate.finish()) {
+        return fail(inflate.get_error());
+    }
+
+    if (inflate.get_total_out() != image_length) {
+        return fail("Image shorter than announced");
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inflate_stream.h"
+
+// A compressed firmware container is a header followed by the merged firmware
+// image as zlib stream. See tools/firmware_container/make_container.py.
+// The image inside is the same as the uncompressed firmware file, so the
+// signature and firmware info pages are checked on the decompressed data.
+#define FIRMWARE_CONTAINER_MAGIC 0x5A314654 // "TF1Z"
+#define FIRMWARE_CONTAINER_VERSION 1
+#define FIRMWARE_CONTAINER_HEADER_LENGTH 12
+
+// The first byte of an uncompressed firmware file is the magic byte of the
+// bootloader image (0xE9), so the container magic can't be mistaken for it.
+bool firmware_container_detect(const uint8_t *data, size_t data_len);
+
+// Incremental decoder of a firmware container. Parses the header and passes
+// the decompressed image to the callback.
+class FirmwareContainerDecoder final
+{
+public:
+    typedef std::function<bool(size_t image_offset, const uint8_t *data, size_t data_len)> ImageCallback;
+    // Allocates the window after the header was read. Freed with free().
+    typedef std::function<void *(size_t size)> WindowAllocator;
+
+    FirmwareContainerDecoder(WindowAllocator &&window_allocator, ImageCallback &&image_callback);
+    ~FirmwareContainerDecoder();
+
+    void reset();
+
+    // Returns false if the container is invalid or the callback aborted.
+    bool feed(const uint8_t *data, size_t data_len);
+
+    // Returns true if the complete image was decoded and its length matches the header.
+    bool finish();
+
+    // Only valid after the header was read.
+    bool header_complete() const { return header_read == FIRMWARE_CONTAINER_HEADER_LENGTH; }
+    size_t get_image_length() const { return image_length; }
+
+    const char *get_error() const { return error; }
+
+    // True if decoding failed because the window could not be allocated.
+    bool is_out_of_memory() const { return out_of_memory; }
+
+private:
+    bool parse_header();
+    bool fail(const char *msg);
+
+    WindowAllocator window_allocator;
+    ImageCallback image_callback;
+    InflateStream inflate;
+
+    uint8_t header[FIRMWARE_CONTAINER_HEADER_LENGTH];
+    size_t header_read = 0;
+    size_t image_length = 0;
+    uint8_t *window = nullptr;
+    bool out_of_memory = false;
+
+    const char *error = nullptr;
+};
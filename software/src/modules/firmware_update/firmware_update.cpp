@@ -25,6 +25,7 @@
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "tools.h"
+#include "tools/malloc.h"
 #include "build.h"
 #include "string_builder.h"
 #include "check_state.enum.h"
@@ -72,10 +73,10 @@ void BlockReader<T>::reset()
 }
 
 template <typename T>
-bool BlockReader<T>::handle_chunk(size_t chunk_offset, uint8_t *chunk_data, size_t chunk_len)
+bool BlockReader<T>::handle_chunk(size_t chunk_offset, const uint8_t *chunk_data, size_t chunk_len)
 {
     if (chunk_offset + chunk_len >= block_offset && chunk_offset < block_offset + block_len) {
-        uint8_t *start = chunk_data;
+        const uint8_t *start = chunk_data;
         size_t len = chunk_len;
 
         if (chunk_offset < block_offset) {
@@ -125,7 +126,69 @@ bool BlockReader<T>::handle_chunk(size_t chunk_offset, uint8_t *chunk_data, size
 }
 
 FirmwareUpdate::FirmwareUpdate() :
-    firmware_info(FIRMWARE_INFO_OFFSET, FIRMWARE_INFO_LENGTH, FIRMWARE_INFO_MAGIC_0, FIRMWARE_INFO_MAGIC_1)
+    firmware_info(FIRMWARE_INFO_OFFSET, FIRMWARE_INFO_LENGTH, FIRMWARE_INFO_MAGIC_0, FIRMWARE_INFO_MAGIC_1),
+    container_decoder([](size_t size) {
+        return calloc_psram_or_dram(1, size);
+    },
+    [this](size_t image_offset, const uint8_t *data, size_t data_len) {
+        container_image_result = handle_image_chunk(image_offset, data, data_len, container_decoder.get_image_length(), container_json_ptr);
+        return container_image_result == InstallState::InProgress;
+    }),
+    write_pipeline([this](size_t image_offset, uint8_t *data, size_t data_len) {
+#if signature_sodium_public_key_length != 0
+        // The signature was calculated with the signature itself replaced by 0x55 bytes.
+        if (image_offset + data_len >= SIGNATURE_INFO_SIGNATURE_OFFSET && image_offset < SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH) {
+            uint8_t *start = data;
+            size_t len = data_len;
+
+            if (image_offset < SIGNATURE_INFO_SIGNATURE_OFFSET) {
+                size_t to_skip = SIGNATURE_INFO_SIGNATURE_OFFSET - image_offset;
+                start += to_skip;
+                len -= to_skip;
+            }
+
+            if (image_offset + data_len > SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH) {
+                len -= (image_offset + data_len) - (SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH);
+            }
+
+            memset(start, 0x55, len);
+        }
+
+        if (crypto_sign_update(&signature_state, data, data_len) < 0) {
+            logger.printfln("Failed to update signature verification");
+            return InstallState::SignatureUpdateFailed;
+        }
+#else
+        (void)image_offset;
+        (void)data;
+        (void)data_len;
+#endif
+
+        return InstallState::InProgress;
+    },
+    [](size_t image_offset, uint8_t *data, size_t data_len) {
+        if (image_offset + data_len <= FIRMWARE_OFFSET) {
+            return InstallState::InProgress;
+        }
+
+        uint8_t *start = data;
+        size_t len = data_len;
+
+        if (image_offset < FIRMWARE_OFFSET) {
+            size_t to_skip = FIRMWARE_OFFSET - image_offset;
+            start += to_skip;
+            len -= to_skip;
+        }
+
+        size_t written = Update.write(start, len);
+
+        if (written != len) {
+            logger.printfln("Failed to write update chunk with length %u; written %u, error: %s", len, written, Update.errorString());
+            return InstallState::FlashShortWrite;
+        }
+
+        return InstallState::InProgress;
+    })
 #if signature_sodium_public_key_length != 0
     , signature_info(SIGNATURE_INFO_OFFSET, SIGNATURE_INFO_LENGTH, SIGNATURE_INFO_MAGIC_0, SIGNATURE_INFO_MAGIC_1)
 #endif
@@ -273,19 +336,23 @@ InstallState FirmwareUpdate::check_firmware_info(bool detect_downgrade, bool log
     return InstallState::InProgress;
 }
 
-InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t *chunk_data, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr)
+void FirmwareUpdate::abort_update()
 {
-    if (chunk_offset == 0) {
-#if signature_sodium_public_key_length != 0
-        if (signature_override_cookie != 0) {
-            signature_override_cookie = 0;
-            Update.abort();
+    write_pipeline.abort();
+    container_decoder.reset();
+    Update.abort();
+}
+
+InstallState FirmwareUpdate::handle_image_chunk(size_t image_offset, const uint8_t *data, size_t data_len, size_t image_len, TFJsonSerializer *json_ptr)
+{
+    if (image_offset == 0) {
+        if (image_len <= FIRMWARE_OFFSET) {
+            logger.printfln("Firmware image is too small: %u", image_len);
+            return InstallState::FirmwareTooSmall;
         }
-#endif
 
-        if (!Update.begin(complete_len - FIRMWARE_OFFSET, U_FLASH)) {
+        if (!Update.begin(image_len - FIRMWARE_OFFSET, U_FLASH)) {
             logger.printfln("Failed to begin update: %s", Update.errorString());
-            Update.abort();
             return InstallState::FlashBeginFailed;
         }
 
@@ -294,111 +361,147 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
 #if signature_sodium_public_key_length != 0
         if (sodium_init() < 0 || crypto_sign_init(&signature_state) < 0) {
             logger.printfln("Failed to begin signature verification");
-            Update.abort();
             return InstallState::SignatureBeginFailed;
         }
 
         signature_info.reset();
 #endif
+
+        if (!write_pipeline.begin()) {
+            return InstallState::InternalError;
+        }
     }
 
 #if signature_sodium_public_key_length != 0
-    signature_info.handle_chunk(chunk_offset, chunk_data, chunk_len);
+    signature_info.handle_chunk(image_offset, data, data_len);
+#endif
 
-    if (chunk_offset + chunk_len >= SIGNATURE_INFO_SIGNATURE_OFFSET && chunk_offset < SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH) {
-        uint8_t *start = chunk_data;
-        size_t len = chunk_len;
-        size_t to_skip = 0;
+    if (firmware_info.handle_chunk(image_offset, data, data_len)) {
+        InstallState result = check_firmware_info(false, true, json_ptr);
 
-        if (chunk_offset < SIGNATURE_INFO_SIGNATURE_OFFSET) {
-            to_skip = SIGNATURE_INFO_SIGNATURE_OFFSET - chunk_offset;
-            start += to_skip;
-            len -= to_skip;
+        if (result != InstallState::InProgress) {
+            return result;
         }
+    }
+
+    return write_pipeline.push(image_offset, data, data_len);
+}
 
-        if (chunk_offset + chunk_len > SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH) {
-            len -= (chunk_offset + chunk_len) - (SIGNATURE_INFO_SIGNATURE_OFFSET + SIGNATURE_INFO_SIGNATURE_LENGTH);
+InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, const uint8_t *chunk_data, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr)
+{
+    if (chunk_offset == 0) {
+#if signature_sodium_public_key_length != 0
+        if (signature_override_cookie != 0) {
+            signature_override_cookie = 0;
+            Update.abort();
         }
+#endif
 
-        memset(start, 0x55, len);
-    }
+        // Leftovers of an interrupted update
+        write_pipeline.abort();
+        container_decoder.reset();
 
-    if (crypto_sign_update(&signature_state, chunk_data, chunk_len) < 0) {
-        logger.printfln("Failed to update signature verification");
-        Update.abort();
-        return InstallState::SignatureUpdateFailed;
+        firmware_is_container = firmware_container_detect(chunk_data, chunk_len);
+        container_out_of_memory = false;
+
+        if (firmware_is_container) {
+            logger.printfln("Firmware file is compressed");
+        }
     }
-#endif
 
-    if (firmware_info.handle_chunk(chunk_offset, chunk_data, chunk_len)) {
-        InstallState result = check_firmware_info(false, true, json_ptr);
+    InstallState result;
 
-        if (result != InstallState::InProgress) {
-            Update.abort();
-            return result;
+    if (firmware_is_container) {
+        container_image_result = InstallState::InProgress;
+        container_json_ptr = json_ptr;
+
+        if (container_decoder.feed(chunk_data, chunk_len) && (!is_complete || container_decoder.finish())) {
+            result = InstallState::InProgress;
+        }
+        else if (container_image_result != InstallState::InProgress) {
+            result = container_image_result;
         }
+        else {
+            logger.printfln("Failed to decompress firmware: %s", container_decoder.get_error());
+            container_out_of_memory = container_decoder.is_out_of_memory();
+            result = InstallState::DecompressionFailed;
+        }
+
+        container_json_ptr = nullptr;
+    }
+    else {
+        result = handle_image_chunk(chunk_offset, chunk_data, chunk_len, complete_len, json_ptr);
+    }
+
+    if (result != InstallState::InProgress) {
+        abort_update();
+        return result;
     }
 
-    if (chunk_offset + chunk_len < FIRMWARE_OFFSET) {
+    if (!is_complete) {
         return InstallState::InProgress;
     }
 
-    uint8_t *start = chunk_data;
-    size_t len = chunk_len;
+    return finish_update(json_ptr);
+}
+
+InstallState FirmwareUpdate::finish_update(TFJsonSerializer *json_ptr)
+{
+    container_decoder.reset();
 
-    if (chunk_offset < FIRMWARE_OFFSET) {
-        size_t to_skip = FIRMWARE_OFFSET - chunk_offset;
-        start += to_skip;
-        len -= to_skip;
+    if (!write_pipeline.is_running()) {
+        logger.printfln("Firmware image is empty");
+        Update.abort();
+        return InstallState::FirmwareTooSmall;
     }
 
-    size_t written = Update.write(start, len);
+    // Wait until the last block is verified and written.
+    InstallState result = write_pipeline.finish();
 
-    if (written != len) {
-        logger.printfln("Failed to write update chunk with length %u; written %u, error: %s", len, written, Update.errorString());
+    if (result != InstallState::InProgress) {
         Update.abort();
-        return InstallState::FlashShortWrite;
+        return result;
     }
 
-    if (is_complete) {
 #if signature_sodium_public_key_length != 0
-        signature_info.block.publisher[ARRAY_SIZE(signature_info.block.publisher) - 1] = '\0';
+    signature_info.block.publisher[ARRAY_SIZE(signature_info.block.publisher) - 1] = '\0';
 
-        if (crypto_sign_final_verify(&signature_state, signature_info.block.signature, signature_sodium_public_key_data) < 0) {
-            signature_override_cookie = esp_random();
+    if (crypto_sign_final_verify(&signature_state, signature_info.block.signature, signature_sodium_public_key_data) < 0) {
+        signature_override_cookie = esp_random();
 
-            if (signature_override_cookie == 0) {
-                signature_override_cookie = 1;
-            }
+        if (signature_override_cookie == 0) {
+            signature_override_cookie = 1;
+        }
 
-            if (json_ptr != nullptr) {
-                json_ptr->addObject();
-                json_ptr->addMemberNumber("error", static_cast<uint8_t>(InstallState::SignatureVerifyFailed));
+        if (json_ptr != nullptr) {
+            json_ptr->addObject();
+            json_ptr->addMemberNumber("error", static_cast<uint8_t>(InstallState::SignatureVerifyFailed));
 
-                if (signature_info.block.publisher[0] == 0xff) {
-                    json_ptr->addMemberNull("actual_publisher");
-                }
-                else {
-                    json_ptr->addMemberString("actual_publisher", signature_info.block.publisher);
-                }
-
-                json_ptr->addMemberString("expected_publisher", signature_publisher);
-                json_ptr->addMemberNumber("cookie", signature_override_cookie);
-                json_ptr->endObject();
-                json_ptr->end();
+            if (signature_info.block.publisher[0] == 0xff) {
+                json_ptr->addMemberNull("actual_publisher");
+            }
+            else {
+                json_ptr->addMemberString("actual_publisher", signature_info.block.publisher);
             }
 
-            logger.printfln("Failed to verify signature");
-            return InstallState::SignatureVerifyFailed;
+            json_ptr->addMemberString("expected_publisher", signature_publisher);
+            json_ptr->addMemberNumber("cookie", signature_override_cookie);
+            json_ptr->endObject();
+            json_ptr->end();
         }
 
-        logger.printfln("Update signature is valid, published by %s", signature_info.block.publisher);
+        logger.printfln("Failed to verify signature");
+        return InstallState::SignatureVerifyFailed;
+    }
+
+    logger.printfln("Update signature is valid, published by %s", signature_info.block.publisher);
+#else
+    (void)json_ptr;
 #endif
 
-        if (!Update.end(true) || Update.hasError()) {
-            logger.printfln("Failed to apply update: %s", Update.errorString());
-            return InstallState::FlashApplyFailed;
-        }
+    if (!Update.end(true) || Update.hasError()) {
+        logger.printfln("Failed to apply update: %s", Update.errorString());
+        return InstallState::FlashApplyFailed;
     }
 
     return InstallState::InProgress;
@@ -410,6 +513,8 @@ static size_t firmware_url_infix_len = strlen(firmware_url_infix);
 static size_t firmware_url_version_len = strlen("MAJ_MIN_PAT_beta_BET_TIMESTAM");
 static const char *firmware_url_suffix = "_merged.bin";
 static size_t firmware_url_suffix_len = strlen(firmware_url_suffix);
+static const char *firmware_container_url_suffix = "_merged.tfz";
+static size_t firmware_container_url_suffix_len = strlen(firmware_container_url_suffix);
 #endif
 
 void FirmwareUpdate::register_urls()
@@ -453,7 +558,7 @@ void FirmwareUpdate::register_urls()
 
         StringBuilder firmware_url;
 
-        if (firmware_url.setCapacity(update_url.length() + BUILD_NAME_LENGTH + firmware_url_infix_len + firmware_url_version_len + firmware_url_suffix_len) == 0) {
+        if (firmware_url.setCapacity(update_url.length() + BUILD_NAME_LENGTH + firmware_url_infix_len + firmware_url_version_len + firmware_container_url_suffix_len) == 0) {
             logger.printfln("Could not build firmware URL");
             state.get("install_state")->updateEnum(InstallState::InternalError);
             state.get("install_progress")->updateUint(0);
@@ -470,10 +575,15 @@ void FirmwareUpdate::register_urls()
         }
 
         firmware_url.printf("_%x", version.timestamp);
-        firmware_url.puts(firmware_url_suffix, firmware_url_suffix_len);
+        firmware_url.puts(firmware_container_url_suffix, firmware_container_url_suffix_len);
 
         char *firmware_url_ptr = firmware_url.take();
 
+        // Try the compressed firmware first, fall back to the uncompressed one if it does not exist.
+        install_fallback_url = firmware_url_ptr;
+        install_fallback_url.remove(install_fallback_url.length() - firmware_container_url_suffix_len);
+        install_fallback_url += firmware_url_suffix;
+
         install_firmware(firmware_url_ptr);
 
         free(firmware_url_ptr);
@@ -632,7 +742,7 @@ void FirmwareUpdate::register_urls()
     },
     [this](WebServerRequest request, int error_code) {
         logger.printfln("File reception failed: %s (%d)", strerror(error_code), error_code);
-        Update.abort();
+        abort_update();
         task_scheduler.await([this](){flash_firmware_in_progress = false;});
         return request.send(500, "Failed to receive file");
     });
@@ -886,6 +996,22 @@ void FirmwareUpdate::handle_index_data(const void *data, size_t data_len)
     }
 }
 
+void FirmwareUpdate::install_fallback_firmware()
+{
+    install_fallback_pending = true;
+
+    // Start the next download after the HTTP client has finished this one.
+    task_scheduler.scheduleOnce([this]() {
+        String fallback_url = install_fallback_url;
+
+        install_fallback_url = "";
+        install_fallback_pending = false;
+        install_firmware_in_progress = false;
+
+        install_firmware(fallback_url.c_str());
+    });
+}
+
 void FirmwareUpdate::install_firmware(const char *url)
 {
 #if signature_sodium_public_key_length == 0
@@ -924,6 +1050,19 @@ void FirmwareUpdate::install_firmware(const char *url)
 
         switch (event->type) {
         case AsyncHTTPSClientEventType::Error:
+            if (install_fallback_pending) {
+                // Further chunks of the error response
+                return;
+            }
+
+            if (event->error == AsyncHTTPSClientError::HTTPStatusError && event->error_http_status == 404 && install_fallback_url.length() > 0) {
+                logger.printfln("No compressed firmware available, downloading uncompressed firmware");
+                install_fallback_firmware();
+                return;
+            }
+
+            install_fallback_url = "";
+
             switch (event->error) {
             case AsyncHTTPSClientError::NoHTTPSURL:
                 logger.printfln("No HTTPS update URL");
@@ -977,11 +1116,16 @@ void FirmwareUpdate::install_firmware(const char *url)
                 break;
             }
 
-            Update.abort();
+            abort_update();
             install_firmware_in_progress = false;
             break;
 
         case AsyncHTTPSClientEventType::Data:
+            if (install_fallback_pending) {
+                // Chunks received before the abort took effect
+                return;
+            }
+
             if (event->data_complete_len < 0) {
                 logger.printfln("Firmware file size is unknown");
                 state.get("install_state")->updateEnum(InstallState::FirmwareSizeUnknown);
@@ -996,7 +1140,15 @@ void FirmwareUpdate::install_firmware(const char *url)
                 return;
             }
 
-            result = handle_firmware_chunk(event->data_chunk_offset, (uint8_t *)event->data_chunk, event->data_chunk_len, (size_t)event->data_complete_len, event->data_is_complete, nullptr);
+            result = handle_firmware_chunk(event->data_chunk_offset, static_cast<const uint8_t *>(event->data_chunk), event->data_chunk_len, (size_t)event->data_complete_len, event->data_is_complete, nullptr);
+
+            // Nothing was flashed yet if the window could not be allocated for the container header.
+            if (result == InstallState::DecompressionFailed && container_out_of_memory && install_fallback_url.length() > 0) {
+                logger.printfln("Not enough memory to decompress firmware, downloading uncompressed firmware");
+                install_fallback_pending = true;
+                https_client.abort_async();
+                return;
+            }
 
             if (result != InstallState::InProgress) {
                 https_client.abort_async();
@@ -1007,11 +1159,16 @@ void FirmwareUpdate::install_firmware(const char *url)
             break;
 
         case AsyncHTTPSClientEventType::Aborted:
+            if (install_fallback_pending) {
+                install_fallback_firmware();
+                return;
+            }
+
             if (state.get("install_state")->asEnum<InstallState>() == InstallState::InProgress) {
                 logger.printfln("Firmware install aborted");
                 state.get("install_state")->updateEnum(InstallState::Aborted);
                 state.get("install_progress")->updateUint(0);
-                Update.abort();
+                abort_update();
             }
 
             install_firmware_in_progress = false;
@@ -30,6 +30,8 @@
 #include "async_https_client.h"
 #include "signature_verify.embedded.h"
 #include "install_state.enum.h"
+#include "firmware_container.h"
+#include "firmware_write_pipeline.h"
 
 struct TFJsonSerializer;
 
@@ -41,7 +43,7 @@ public:
         block_offset(block_offset), block_len(block_len), expected_magic_0(expected_magic_0), expected_magic_1(expected_magic_1) {}
 
     void reset();
-    bool handle_chunk(size_t chunk_offset, uint8_t *chunk_data, size_t chunk_len);
+    bool handle_chunk(size_t chunk_offset, const uint8_t *chunk_data, size_t chunk_len);
 
     size_t block_offset;
     size_t block_len;
@@ -79,10 +81,14 @@ public:
 
 private:
     bool is_vehicle_blocking_update() const;
-    InstallState handle_firmware_chunk(size_t chunk_offset, uint8_t *chunk, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr);
+    InstallState handle_firmware_chunk(size_t chunk_offset, const uint8_t *chunk, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr);
+    InstallState handle_image_chunk(size_t image_offset, const uint8_t *data, size_t data_len, size_t image_len, TFJsonSerializer *json_ptr);
+    InstallState finish_update(TFJsonSerializer *json_ptr);
+    void abort_update();
     InstallState check_firmware_info(bool detect_downgrade, bool log, TFJsonSerializer *json_ptr);
     void check_for_update();
     void install_firmware(const char *url);
+    void install_fallback_firmware();
 
     ConfigRoot config;
     ConfigRoot state;
@@ -102,6 +108,15 @@ private:
 
     BlockReader<firmware_info_t> firmware_info;
 
+    // Compressed firmware files are decompressed while they are received.
+    // Verification and flashing of the image run in the write pipeline.
+    FirmwareContainerDecoder container_decoder;
+    FirmwareWritePipeline write_pipeline;
+    bool firmware_is_container = false;
+    InstallState container_image_result = InstallState::InProgress;
+    TFJsonSerializer *container_json_ptr = nullptr;
+    bool container_out_of_memory = false;
+
 #if signature_sodium_public_key_length != 0
     struct signature_info_t {
         uint32_t magic[2] = {0};
@@ -122,4 +137,9 @@ private:
     //uint32_t last_version_timestamp;
     bool check_for_update_in_progress = false;
     bool install_firmware_in_progress = false;
+
+    // The uncompressed firmware is downloaded if the update server has no compressed one
+    // or if there is not enough memory to decompress it.
+    String install_fallback_url;
+    bool install_fallback_pending = false;
 };
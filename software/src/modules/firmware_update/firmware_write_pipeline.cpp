@@ -0,0 +1,240 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "firmware_write_pipeline.h"
+
+#include <string.h>
+
+#include "event_log_prefix.h"
+#include "module_dependencies.h"
+#include "tools/malloc.h"
+
+// Signature verification (SHA-512) and Update.write both need more than the default stack.
+#define FIRMWARE_WRITE_PIPELINE_TASK_STACK_SIZE 4096
+
+FirmwareWritePipeline::FirmwareWritePipeline(Stage &&verify_stage, Stage &&write_stage) :
+    verify_stage(std::move(verify_stage)),
+    write_stage(std::move(write_stage))
+{
+}
+
+void FirmwareWritePipeline::verify_task(void *arg)
+{
+    FirmwareWritePipeline *pipeline = static_cast<FirmwareWritePipeline *>(arg);
+    pipeline->run_stage(pipeline->verify_queue, pipeline->write_queue, pipeline->verify_stage, false);
+}
+
+void FirmwareWritePipeline::write_task(void *arg)
+{
+    FirmwareWritePipeline *pipeline = static_cast<FirmwareWritePipeline *>(arg);
+    pipeline->run_stage(pipeline->write_queue, pipeline->free_queue, pipeline->write_stage, true);
+}
+
+void FirmwareWritePipeline::run_stage(QueueHandle_t input, QueueHandle_t output, const Stage &stage, bool last_stage)
+{
+    bool last = false;
+
+    while (!last) {
+        Block *block;
+
+        if (xQueueReceive(input, &block, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        last = block->last;
+
+        // Keep passing blocks after an error, so that the producer never waits forever.
+        if (block->len > 0 && result.load() == InstallState::InProgress) {
+            InstallState stage_result = stage(block->image_offset, block->data, block->len);
+
+            if (stage_result != InstallState::InProgress) {
+                InstallState expected = InstallState::InProgress;
+                result.compare_exchange_strong(expected, stage_result);
+            }
+        }
+
+        xQueueSend(output, &block, portMAX_DELAY);
+    }
+
+    if (last_stage) {
+        xSemaphoreGive(done);
+    }
+
+    vTaskDelete(nullptr);
+}
+
+bool FirmwareWritePipeline::begin()
+{
+    if (running) {
+        return false;
+    }
+
+    // Queues are kept for the next update. The blocks are only allocated while an update is running.
+    if (free_queue == nullptr) {
+        free_queue   = xQueueCreate(FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT, sizeof(Block *));
+        verify_queue = xQueueCreate(FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT, sizeof(Block *));
+        write_queue  = xQueueCreate(FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT, sizeof(Block *));
+        done         = xSemaphoreCreateBinary();
+
+        if (free_queue == nullptr || verify_queue == nullptr || write_queue == nullptr || done == nullptr) {
+            logger.printfln("Failed to create firmware write pipeline");
+            return false;
+        }
+    }
+
+    block_data = static_cast<uint8_t *>(calloc_dram(FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT, FIRMWARE_WRITE_PIPELINE_BLOCK_SIZE));
+
+    if (block_data == nullptr) {
+        logger.printfln("Failed to allocate firmware write pipeline");
+        return false;
+    }
+
+    xQueueReset(free_queue);
+    xQueueReset(verify_queue);
+    xQueueReset(write_queue);
+    xSemaphoreTake(done, 0);
+
+    for (size_t i = 0; i < FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT; ++i) {
+        Block *block = &blocks[i];
+
+        block->data = block_data + i * FIRMWARE_WRITE_PIPELINE_BLOCK_SIZE;
+        xQueueSend(free_queue, &block, 0);
+    }
+
+    current = nullptr;
+    next_image_offset = 0;
+    result = InstallState::InProgress;
+
+    // Same priority as the main loop. Not pinned, so that the stages can run on the other core.
+    if (xTaskCreate(write_task, "fw_write", FIRMWARE_WRITE_PIPELINE_TASK_STACK_SIZE, this, tskIDLE_PRIORITY + 1, nullptr) != pdPASS) {
+        logger.printfln("Failed to create firmware write task");
+        free_any(block_data);
+        block_data = nullptr;
+        return false;
+    }
+
+    running = true;
+
+    if (xTaskCreate(verify_task, "fw_verify", FIRMWARE_WRITE_PIPELINE_TASK_STACK_SIZE, this, tskIDLE_PRIORITY + 1, nullptr) != pdPASS) {
+        logger.printfln("Failed to create firmware verify task");
+
+        // Stop the write task by passing the last block directly to it.
+        Block *block;
+        xQueueReceive(free_queue, &block, 0);
+        block->len = 0;
+        block->last = true;
+        xQueueSend(write_queue, &block, portMAX_DELAY);
+        xSemaphoreTake(done, portMAX_DELAY);
+
+        free_any(block_data);
+        block_data = nullptr;
+        running = false;
+        return false;
+    }
+
+    return true;
+}
+
+InstallState FirmwareWritePipeline::send_current(bool last)
+{
+    if (current == nullptr) {
+        xQueueReceive(free_queue, &current, portMAX_DELAY);
+        current->image_offset = next_image_offset;
+        current->len = 0;
+    }
+
+    current->last = last;
+    xQueueSend(verify_queue, &current, portMAX_DELAY);
+    current = nullptr;
+
+    return result.load();
+}
+
+InstallState FirmwareWritePipeline::push(size_t image_offset, const uint8_t *data, size_t data_len)
+{
+    if (!running) {
+        return InstallState::InternalError;
+    }
+
+    if (image_offset != next_image_offset) {
+        logger.printfln("Firmware image chunk at offset %u, expected %u", image_offset, next_image_offset);
+        return InstallState::InternalError;
+    }
+
+    while (data_len > 0) {
+        InstallState stage_result = result.load();
+
+        if (stage_result != InstallState::InProgress) {
+            return stage_result;
+        }
+
+        if (current == nullptr) {
+            xQueueReceive(free_queue, &current, portMAX_DELAY);
+            current->image_offset = next_image_offset;
+            current->len = 0;
+        }
+
+        size_t to_copy = std::min(data_len, FIRMWARE_WRITE_PIPELINE_BLOCK_SIZE - current->len);
+
+        memcpy(current->data + current->len, data, to_copy);
+        current->len += to_copy;
+        next_image_offset += to_copy;
+        data += to_copy;
+        data_len -= to_copy;
+
+        if (current->len == FIRMWARE_WRITE_PIPELINE_BLOCK_SIZE) {
+            send_current(false);
+        }
+    }
+
+    return result.load();
+}
+
+InstallState FirmwareWritePipeline::stop()
+{
+    send_current(true);
+    xSemaphoreTake(done, portMAX_DELAY);
+
+    free_any(block_data);
+    block_data = nullptr;
+    running = false;
+
+    return result.load();
+}
+
+InstallState FirmwareWritePipeline::finish()
+{
+    if (!running) {
+        return InstallState::InternalError;
+    }
+
+    return stop();
+}
+
+void FirmwareWritePipeline::abort()
+{
+    if (!running) {
+        return;
+    }
+
+    InstallState expected = InstallState::InProgress;
+    result.compare_exchange_strong(expected, InstallState::Aborted);
+
+    stop();
+}
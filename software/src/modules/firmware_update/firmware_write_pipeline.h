@@ -0,0 +1,94 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include "install_state.enum.h"
+
+#define FIRMWARE_WRITE_PIPELINE_BLOCK_SIZE 4096
+#define FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT 3
+
+// Passes the firmware image through the verify and the write stage, each
+// running in its own task. The image is copied into blocks of 4 KiB: While
+// one block is verified and the previous one is written to flash, the next one
+// is received (and decompressed). Both stages see all blocks in image order.
+class FirmwareWritePipeline final
+{
+public:
+    // Returns InstallState::InProgress on success. A block is passed to the
+    // write stage only after the verify stage has processed it and may be
+    // modified by the verify stage.
+    typedef std::function<InstallState(size_t image_offset, uint8_t *data, size_t data_len)> Stage;
+
+    FirmwareWritePipeline(Stage &&verify_stage, Stage &&write_stage);
+
+    bool begin();
+
+    // Copies the data into the pipeline. Blocks while all blocks are in use.
+    // Returns the error of a failed stage.
+    InstallState push(size_t image_offset, const uint8_t *data, size_t data_len);
+
+    // Waits until both stages have processed all blocks.
+    InstallState finish();
+
+    // Stops the stages without processing the remaining blocks. Does nothing if not running.
+    void abort();
+
+    bool is_running() const { return running; }
+
+private:
+    struct Block {
+        size_t image_offset;
+        size_t len;
+        bool last;
+        uint8_t *data;
+    };
+
+    static void verify_task(void *arg);
+    static void write_task(void *arg);
+
+    void run_stage(QueueHandle_t input, QueueHandle_t output, const Stage &stage, bool last_stage);
+    InstallState send_current(bool last);
+    InstallState stop();
+
+    Stage verify_stage;
+    Stage write_stage;
+
+    QueueHandle_t free_queue = nullptr;
+    QueueHandle_t verify_queue = nullptr;
+    QueueHandle_t write_queue = nullptr;
+    SemaphoreHandle_t done = nullptr;
+
+    Block blocks[FIRMWARE_WRITE_PIPELINE_BLOCK_COUNT];
+    uint8_t *block_data = nullptr;
+
+    Block *current = nullptr;
+    size_t next_image_offset = 0;
+    bool running = false;
+
+    std::atomic<InstallState> result{InstallState::InProgress};
+};
@@ -0,0 +1,649 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "inflate_stream.h"
+
+#include <string.h>
+
+// Canonical Huffman decoding as described in RFC 1951 and done by zlib's puff.c.
+// Every step (a block header, a code length or a literal/length/distance
+// triple) needs at most 48 bits. A step is only executed if all of its bits are
+// available, otherwise the bits stay buffered until more input is fed.
+
+#define MAX_BITS 15
+#define MAX_LIT_CODES 286
+#define MAX_DIST_CODES 30
+#define FIXED_LIT_CODES 288
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static const uint32_t ADLER_MOD = 65521;
+
+// Returns the number of unused codes: 0 for a complete code, > 0 for an
+// incomplete code and < 0 for an over-subscribed (invalid) code.
+template <typename T>
+static int construct(T *h, const uint8_t *length, size_t n)
+{
+    uint16_t offs[MAX_BITS + 1];
+
+    memset(h->count, 0, sizeof(h->count));
+
+    for (size_t symbol = 0; symbol < n; ++symbol) {
+        ++h->count[length[symbol]];
+    }
+
+    if (h->count[0] == n) {
+        return 0;
+    }
+
+    int left = 1;
+    for (size_t len = 1; len <= MAX_BITS; ++len) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+
+    offs[1] = 0;
+    for (size_t len = 1; len < MAX_BITS; ++len) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+
+    for (size_t symbol = 0; symbol < n; ++symbol) {
+        if (length[symbol] != 0) {
+            h->symbol[offs[length[symbol]]++] = symbol;
+        }
+    }
+
+    return left;
+}
+
+void InflateStream::begin(uint8_t *window_, size_t window_size)
+{
+    window = window_;
+    window_mask = window_size - 1;
+    window_pos = 0;
+    flush_pos = 0;
+    total_out = 0;
+    adler_a = 1;
+    adler_b = 0;
+
+    next_in = nullptr;
+    end_in = nullptr;
+    bit_buf = 0;
+    bit_count = 0;
+
+    last_block = false;
+    error = nullptr;
+
+    if (window == nullptr || window_size == 0 || (window_size & window_mask) != 0) {
+        fail("Invalid window");
+        return;
+    }
+
+    mode = Mode::ZlibHeader;
+}
+
+bool InflateStream::fail(const char *msg)
+{
+    if (mode != Mode::Error) {
+        error = msg;
+        mode = Mode::Error;
+    }
+
+    return false;
+}
+
+void InflateStream::fill_bits()
+{
+    while (bit_count <= 56 && next_in < end_in) {
+        bit_buf |= static_cast<uint64_t>(*next_in++) << bit_count;
+        bit_count += 8;
+    }
+}
+
+void InflateStream::drop_bits(uint32_t n)
+{
+    bit_buf >>= n;
+    bit_count -= n;
+}
+
+// Decodes a symbol starting offset bits into the bit buffer without consuming it.
+// Returns the length of the code, 0 if more bits are needed or -1 if the code is invalid.
+int InflateStream::decode(const Huffman &h, uint32_t offset, uint16_t *symbol) const
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+
+    for (uint32_t len = 1; len <= MAX_BITS; ++len) {
+        if (offset + len > bit_count) {
+            return 0;
+        }
+
+        code |= static_cast<int>((bit_buf >> (offset + len - 1)) & 1);
+        int count = h.count[len];
+
+        if (code - count < first) {
+            *symbol = h.symbol[index + (code - first)];
+            return len;
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+void InflateStream::put(uint8_t b)
+{
+    window[window_pos++] = b;
+
+    // Hand out the window before it wraps around.
+    if (window_pos > window_mask) {
+        flush();
+    }
+}
+
+bool InflateStream::flush()
+{
+    size_t len = window_pos - flush_pos;
+
+    if (len > 0) {
+        const uint8_t *data = window + flush_pos;
+
+        // Deferred modulo: 5552 is the largest n for which no overflow can happen.
+        for (size_t done = 0; done < len;) {
+            size_t n = len - done < 5552 ? len - done : 5552;
+
+            for (size_t i = 0; i < n; ++i) {
+                adler_a += data[done + i];
+                adler_b += adler_a;
+            }
+
+            adler_a %= ADLER_MOD;
+            adler_b %= ADLER_MOD;
+            done += n;
+        }
+
+        total_out += len;
+
+        if (!output_callback(data, len)) {
+            return fail("Aborted by output callback");
+        }
+    }
+
+    if (window_pos > window_mask) {
+        window_pos = 0;
+    }
+
+    flush_pos = window_pos;
+    return true;
+}
+
+bool InflateStream::build_dynamic_tables()
+{
+    if (lengths[256] == 0) {
+        return fail("Missing end-of-block code");
+    }
+
+    int left = construct(&lit_code, lengths, lit_count);
+    // Only a single length code may be incomplete.
+    if (left < 0 || (left > 0 && lit_count - lit_code.count[0] != 1)) {
+        return fail("Invalid literal/length code");
+    }
+
+    left = construct(&dist_code, lengths + lit_count, dist_count);
+    if (left < 0 || (left > 0 && dist_count - dist_code.count[0] != 1)) {
+        return fail("Invalid distance code");
+    }
+
+    return true;
+}
+
+InflateStream::Step InflateStream::step_stored()
+{
+    // Bytes that are still in the bit buffer first.
+    while (stored_remaining > 0 && bit_count >= 8) {
+        put(static_cast<uint8_t>(bit_buf));
+        drop_bits(8);
+        --stored_remaining;
+
+        if (mode == Mode::Error) {
+            return Step::Stop;
+        }
+    }
+
+    while (stored_remaining > 0 && next_in < end_in) {
+        size_t n = static_cast<size_t>(end_in - next_in);
+        size_t space = window_mask + 1 - window_pos;
+
+        if (n > stored_remaining) {
+            n = stored_remaining;
+        }
+
+        if (n > space) {
+            n = space;
+        }
+
+        memcpy(window + window_pos, next_in, n);
+        window_pos += n;
+        next_in += n;
+        stored_remaining -= n;
+
+        if (window_pos > window_mask && !flush()) {
+            return Step::Stop;
+        }
+    }
+
+    if (stored_remaining > 0) {
+        return Step::NeedInput;
+    }
+
+    mode = last_block ? Mode::Trailer : Mode::BlockHeader;
+    return Step::Continue;
+}
+
+InflateStream::Step InflateStream::step_code_lengths()
+{
+    uint16_t symbol;
+    int len = decode(lit_code, 0, &symbol);
+
+    if (len < 0) {
+        fail("Invalid code length code");
+        return Step::Stop;
+    }
+
+    if (len == 0) {
+        return Step::NeedInput;
+    }
+
+    uint16_t total = lit_count + dist_count;
+
+    if (symbol < 16) {
+        drop_bits(len);
+        lengths[lengths_read++] = symbol;
+    } else {
+        static const uint8_t repeat_extra[3] = {2, 3, 7};
+        static const uint8_t repeat_base[3] = {3, 3, 11};
+
+        uint32_t extra = repeat_extra[symbol - 16];
+        if (len + extra > bit_count) {
+            return Step::NeedInput;
+        }
+
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (lengths_read == 0) {
+                fail("Repeated length without first length");
+                return Step::Stop;
+            }
+            value = lengths[lengths_read - 1];
+        }
+
+        uint32_t repeat = repeat_base[symbol - 16] + ((bit_buf >> len) & ((1u << extra) - 1));
+        drop_bits(len + extra);
+
+        if (lengths_read + repeat > total) {
+            fail("Too many code lengths");
+            return Step::Stop;
+        }
+
+        memset(lengths + lengths_read, value, repeat);
+        lengths_read += repeat;
+    }
+
+    if (lengths_read < total) {
+        return Step::Continue;
+    }
+
+    if (!build_dynamic_tables()) {
+        return Step::Stop;
+    }
+
+    mode = Mode::Codes;
+    return Step::Continue;
+}
+
+InflateStream::Step InflateStream::step_codes()
+{
+    uint16_t symbol;
+    int len = decode(lit_code, 0, &symbol);
+
+    if (len < 0) {
+        fail("Invalid literal/length code");
+        return Step::Stop;
+    }
+
+    if (len == 0) {
+        return Step::NeedInput;
+    }
+
+    if (symbol < 256) {
+        drop_bits(len);
+        put(static_cast<uint8_t>(symbol));
+        return mode == Mode::Error ? Step::Stop : Step::Continue;
+    }
+
+    if (symbol == 256) {
+        drop_bits(len);
+        mode = last_block ? Mode::Trailer : Mode::BlockHeader;
+        return Step::Continue;
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) {
+        fail("Invalid length symbol");
+        return Step::Stop;
+    }
+
+    uint32_t used = len;
+    uint32_t extra = length_extra[symbol];
+    if (used + extra > bit_count) {
+        return Step::NeedInput;
+    }
+
+    uint32_t length = length_base[symbol] + ((bit_buf >> used) & ((1u << extra) - 1));
+    used += extra;
+
+    uint16_t dist_symbol;
+    len = decode(dist_code, used, &dist_symbol);
+
+    if (len < 0) {
+        fail("Invalid distance code");
+        return Step::Stop;
+    }
+
+    if (len == 0) {
+        return Step::NeedInput;
+    }
+
+    if (dist_symbol >= 30) {
+        fail("Invalid distance symbol");
+        return Step::Stop;
+    }
+
+    used += len;
+    extra = dist_extra[dist_symbol];
+    if (used + extra > bit_count) {
+        return Step::NeedInput;
+    }
+
+    size_t dist = dist_base[dist_symbol] + ((bit_buf >> used) & ((1u << extra) - 1));
+    used += extra;
+
+    size_t available = total_out + (window_pos - flush_pos);
+    if (dist > window_mask + 1 || dist > available) {
+        fail("Distance too far back");
+        return Step::Stop;
+    }
+
+    drop_bits(used);
+
+    for (uint32_t i = 0; i < length; ++i) {
+        put(window[(window_pos - dist) & window_mask]);
+
+        if (mode == Mode::Error) {
+            return Step::Stop;
+        }
+    }
+
+    return Step::Continue;
+}
+
+InflateStream::Step InflateStream::step()
+{
+    switch (mode) {
+        case Mode::ZlibHeader: {
+            if (bit_count < 16) {
+                return Step::NeedInput;
+            }
+
+            uint32_t cmf = bit_buf & 0xFF;
+            uint32_t flg = (bit_buf >> 8) & 0xFF;
+            drop_bits(16);
+
+            if ((cmf & 0x0F) != 8 || ((cmf << 8) | flg) % 31 != 0) {
+                fail("Not a zlib stream");
+                return Step::Stop;
+            }
+
+            if ((flg & 0x20) != 0) {
+                fail("Preset dictionary not supported");
+                return Step::Stop;
+            }
+
+            if ((1u << ((cmf >> 4) + 8)) > window_mask + 1) {
+                fail("Window too large");
+                return Step::Stop;
+            }
+
+            mode = Mode::BlockHeader;
+            return Step::Continue;
+        }
+
+        case Mode::BlockHeader: {
+            if (bit_count < 3) {
+                return Step::NeedInput;
+            }
+
+            last_block = (bit_buf & 1) != 0;
+            uint32_t type = (bit_buf >> 1) & 3;
+            drop_bits(3);
+
+            if (type == 0) {
+                // Skip to the next byte boundary.
+                drop_bits(bit_count & 7);
+                mode = Mode::StoredHeader;
+            } else if (type == 1) {
+                for (size_t i = 0; i < FIXED_LIT_CODES; ++i) {
+                    lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+                }
+                construct(&lit_code, lengths, FIXED_LIT_CODES);
+
+                for (size_t i = 0; i < MAX_DIST_CODES; ++i) {
+                    lengths[i] = 5;
+                }
+                construct(&dist_code, lengths, MAX_DIST_CODES);
+
+                mode = Mode::Codes;
+            } else if (type == 2) {
+                mode = Mode::DynamicHeader;
+            } else {
+                fail("Invalid block type");
+                return Step::Stop;
+            }
+
+            return Step::Continue;
+        }
+
+        case Mode::StoredHeader: {
+            if (bit_count < 32) {
+                return Step::NeedInput;
+            }
+
+            uint16_t len = bit_buf & 0xFFFF;
+            uint16_t nlen = (bit_buf >> 16) & 0xFFFF;
+            drop_bits(32);
+
+            if (len != static_cast<uint16_t>(~nlen)) {
+                fail("Stored block length mismatch");
+                return Step::Stop;
+            }
+
+            stored_remaining = len;
+            mode = Mode::Stored;
+            return Step::Continue;
+        }
+
+        case Mode::Stored:
+            return step_stored();
+
+        case Mode::DynamicHeader: {
+            if (bit_count < 14) {
+                return Step::NeedInput;
+            }
+
+            lit_count = (bit_buf & 0x1F) + 257;
+            dist_count = ((bit_buf >> 5) & 0x1F) + 1;
+            code_length_count = ((bit_buf >> 10) & 0x0F) + 4;
+            drop_bits(14);
+
+            if (lit_count > MAX_LIT_CODES || dist_count > MAX_DIST_CODES) {
+                fail("Too many length or distance codes");
+                return Step::Stop;
+            }
+
+            memset(lengths, 0, 19);
+            lengths_read = 0;
+            mode = Mode::CodeLengthCodes;
+            return Step::Continue;
+        }
+
+        case Mode::CodeLengthCodes: {
+            if (bit_count < 3) {
+                return Step::NeedInput;
+            }
+
+            lengths[code_length_order[lengths_read++]] = bit_buf & 7;
+            drop_bits(3);
+
+            if (lengths_read < code_length_count) {
+                return Step::Continue;
+            }
+
+            // The code length code is only needed until all lengths are read.
+            if (construct(&lit_code, lengths, 19) != 0) {
+                fail("Invalid code length code");
+                return Step::Stop;
+            }
+
+            lengths_read = 0;
+            mode = Mode::CodeLengths;
+            return Step::Continue;
+        }
+
+        case Mode::CodeLengths:
+            return step_code_lengths();
+
+        case Mode::Codes:
+            return step_codes();
+
+        case Mode::Trailer: {
+            drop_bits(bit_count & 7);
+
+            if (bit_count < 32) {
+                return Step::NeedInput;
+            }
+
+            uint32_t expected = 0;
+            for (size_t i = 0; i < 4; ++i) {
+                expected = (expected << 8) | (bit_buf & 0xFF);
+                drop_bits(8);
+            }
+
+            if (!flush()) {
+                return Step::Stop;
+            }
+
+            if (expected != ((adler_b << 16) | adler_a)) {
+                fail("Checksum mismatch");
+                return Step::Stop;
+            }
+
+            mode = Mode::Done;
+            return Step::Stop;
+        }
+
+        case Mode::Done:
+        case Mode::Error:
+            return Step::Stop;
+    }
+
+    return Step::Stop;
+}
+
+bool InflateStream::feed(const uint8_t *data, size_t data_len)
+{
+    if (mode == Mode::Error) {
+        return false;
+    }
+
+    next_in = data;
+    end_in = data + data_len;
+
+    while (true) {
+        fill_bits();
+
+        Step result = step();
+
+        if (result == Step::Continue) {
+            continue;
+        }
+
+        if (result == Step::NeedInput && next_in < end_in) {
+            continue;
+        }
+
+        break;
+    }
+
+    if (mode == Mode::Done && (next_in < end_in || bit_count > 0)) {
+        return fail("Trailing data after stream");
+    }
+
+    next_in = nullptr;
+    end_in = nullptr;
+
+    if (mode == Mode::Error) {
+        return false;
+    }
+
+    return flush();
+}
+
+bool InflateStream::finish()
+{
+    if (mode == Mode::Error) {
+        return false;
+    }
+
+    if (mode != Mode::Done) {
+        return fail("Stream truncated");
+    }
+
+    return true;
+}
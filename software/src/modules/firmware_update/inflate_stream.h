@@ -0,0 +1,130 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest window of a zlib stream (window bits 15).
+#define INFLATE_STREAM_MAX_WINDOW_SIZE (1u << 15)
+
+// Incremental decoder for zlib streams (RFC 1950 and 1951) that can be fed
+// with arbitrarily split chunks, for example the data events of an
+// AsyncHTTPSClient or the chunks of a file upload.
+//
+// The decompressed data is collected in the window buffer passed to begin and
+// handed to the callback in contiguous pieces of at most the window size.
+// Besides the window, only the Huffman tables of the current block are stored.
+class InflateStream final
+{
+public:
+    // Return false to abort decompression.
+    typedef std::function<bool(const uint8_t *data, size_t data_len)> OutputCallback;
+
+    InflateStream(OutputCallback &&output_callback) : output_callback(std::move(output_callback)) {}
+
+    // The window size has to be a power of two and at least as large as the
+    // window of the zlib stream.
+    void begin(uint8_t *window, size_t window_size);
+
+    // Returns false if the data is not a valid zlib stream or the callback
+    // aborted. The decoder then stays in the error state until begin is called.
+    bool feed(const uint8_t *data, size_t data_len);
+
+    // Returns true if a complete stream with a matching checksum was decoded.
+    bool finish();
+
+    bool is_done() const { return mode == Mode::Done; }
+
+    const char *get_error() const { return error; }
+
+    // Decompressed bytes passed to the callback.
+    size_t get_total_out() const { return total_out; }
+
+private:
+    enum class Mode : uint8_t {
+        ZlibHeader,
+        BlockHeader,
+        StoredHeader,
+        Stored,
+        DynamicHeader,
+        CodeLengthCodes,
+        CodeLengths,
+        Codes,
+        Trailer,
+        Done,
+        Error,
+    };
+
+    enum class Step : uint8_t {
+        Continue,
+        NeedInput,
+        Stop,
+    };
+
+    struct Huffman {
+        uint16_t count[16];   // Number of symbols per code length
+        uint16_t symbol[288]; // Symbols ordered by code
+    };
+
+    Step step();
+    Step step_stored();
+    Step step_code_lengths();
+    Step step_codes();
+
+    void fill_bits();
+    void drop_bits(uint32_t n);
+    int decode(const Huffman &h, uint32_t offset, uint16_t *symbol) const;
+    bool build_dynamic_tables();
+    void put(uint8_t b);
+    bool flush();
+    bool fail(const char *msg);
+
+    OutputCallback output_callback;
+
+    uint8_t *window = nullptr;
+    size_t window_mask = 0;
+    size_t window_pos = 0;
+    size_t flush_pos = 0;
+    size_t total_out = 0;
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+
+    const uint8_t *next_in = nullptr;
+    const uint8_t *end_in = nullptr;
+    uint64_t bit_buf = 0;
+    uint32_t bit_count = 0;
+
+    Mode mode = Mode::Error;
+    bool last_block = false;
+    uint16_t stored_remaining = 0;
+
+    uint16_t lit_count = 0;
+    uint16_t dist_count = 0;
+    uint16_t code_length_count = 0;
+    uint16_t lengths_read = 0;
+    uint8_t lengths[286 + 30];
+
+    Huffman lit_code;
+    Huffman dist_code;
+
+    const char *error = nullptr;
+};
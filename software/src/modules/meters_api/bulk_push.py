@@ -0,0 +1,100 @@
+#!/usr/bin/python3 -u
+
+# Pushes values for one or more API meter slots via meters_api/push as fast as
+# possible and reports the sustained push rate and latency. Compare with
+# --legacy, which pushes each slot via the per-meter meters/N/update command.
+
+import urllib.request
+import json
+import argparse
+import struct
+import threading
+import time
+import random
+
+def build_request(args):
+    values = {slot: [random.uniform(0, 1000) for _ in range(args.values)] for slot in args.slots}
+
+    if args.legacy:
+        return [urllib.request.Request(f'http://{args.host}/meters/{slot}/update',
+                                       data=json.dumps(vals).encode('utf-8'),
+                                       method='PUT',
+                                       headers={'Content-Type': 'application/json'}) for slot, vals in values.items()]
+
+    if args.binary:
+        payload = b''.join(struct.pack(f'<BB{len(vals)}f', slot, len(vals), *vals) for slot, vals in values.items())
+        content_type = 'application/octet-stream'
+    else:
+        payload = json.dumps([[slot] + vals for slot, vals in values.items()], separators=(',', ':')).encode('utf-8')
+        content_type = 'application/json'
+
+    return [urllib.request.Request(f'http://{args.host}/meters_api/push',
+                                   data=payload,
+                                   method='PUT',
+                                   headers={'Content-Type': content_type})]
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.pushes = 0
+        self.errors = 0
+        self.latencies = []
+
+def worker(args, stats):
+    while True:
+        for request in build_request(args):
+            start = time.time()
+
+            try:
+                with urllib.request.urlopen(request, timeout=args.timeout) as f:
+                    f.read()
+
+                ok = True
+            except Exception as e:
+                print(f'error: {e}')
+                ok = False
+
+            duration = time.time() - start
+
+            with stats.lock:
+                if ok:
+                    stats.pushes += 1
+                    stats.latencies.append(duration)
+                else:
+                    stats.errors += 1
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host')
+    parser.add_argument('slots', type=int, nargs='+')
+    parser.add_argument('--values', type=int, default=10, help='number of values per slot')
+    parser.add_argument('--binary', action='store_true', help='send raw float32 payload instead of JSON')
+    parser.add_argument('--legacy', action='store_true', help='push each slot via meters/N/update')
+    parser.add_argument('--connections', type=int, default=1)
+    parser.add_argument('--timeout', type=float, default=2.0)
+    parser.add_argument('--report-interval', type=float, default=5.0)
+
+    args = parser.parse_args()
+    stats = Stats()
+
+    for _ in range(args.connections):
+        threading.Thread(target=worker, args=(args, stats), daemon=True).start()
+
+    while True:
+        time.sleep(args.report_interval)
+
+        with stats.lock:
+            pushes, errors, latencies = stats.pushes, stats.errors, sorted(stats.latencies)
+            stats.pushes = stats.errors = 0
+            stats.latencies = []
+
+        if len(latencies) > 0:
+            median = latencies[len(latencies) // 2] * 1000
+            worst = latencies[-1] * 1000
+        else:
+            median = worst = 0
+
+        print(f'{pushes / args.report_interval:.1f} pushes/s, {errors} errors, latency median {median:.1f} ms, max {worst:.1f} ms')
+
+if __name__ == '__main__':
+    main()
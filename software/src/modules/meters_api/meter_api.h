@@ -47,6 +47,8 @@ public:
     bool supports_reset()         override {return reset_supported;}
     bool reset() override;
 
+    size_t get_value_count() const {return value_count;}
+
 private:
     uint32_t slot;
     ConfigRoot push_values;
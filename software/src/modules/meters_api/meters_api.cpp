@@ -19,11 +19,215 @@
 
 #include "meters_api.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "module_dependencies.h"
 #include "meter_api.h"
+#include "tools.h"
 
 #include "gcc_warnings.h"
 
+// Largest accepted bulk push payload. The binary format needs 2 bytes per slot
+// plus 4 bytes per value. The JSON format needs up to 21 bytes per value.
+#define METERS_API_MAX_PUSH_PAYLOAD_LENGTH (METERS_SLOTS * (2 + METERS_MAX_VALUES_PER_METER * 21))
+
+struct PushRecord {
+    uint32_t slot;
+    uint32_t value_count;
+    float *values;
+};
+
+struct PushBatch {
+    PushRecord records[METERS_SLOTS];
+    size_t record_count;
+    float values[METERS_SLOTS * METERS_MAX_VALUES_PER_METER];
+    size_t values_used;
+};
+
+static const char *push_batch_add_record(PushBatch *batch, uint32_t slot)
+{
+    if (batch->record_count >= METERS_SLOTS) {
+        return "Too many meter slots";
+    }
+
+    PushRecord *record = &batch->records[batch->record_count++];
+
+    record->slot        = slot;
+    record->value_count = 0;
+    record->values      = batch->values + batch->values_used;
+
+    return nullptr;
+}
+
+static const char *push_batch_add_value(PushBatch *batch, float value)
+{
+    PushRecord *record = &batch->records[batch->record_count - 1];
+
+    if (record->value_count >= METERS_MAX_VALUES_PER_METER) {
+        return "Too many values for one meter slot";
+    }
+
+    if (isinf(value)) {
+        return "Values must be finite numbers or null";
+    }
+
+    record->values[record->value_count++] = value;
+    ++batch->values_used;
+
+    return nullptr;
+}
+
+static const char *skip_whitespace(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        ++p;
+    }
+
+    return p;
+}
+
+// Decodes [[slot, value, ...], ...] with null for values that should not be
+// updated. buf must be NUL-terminated.
+static const char *decode_json_push(const char *buf, PushBatch *batch)
+{
+    const char *p = skip_whitespace(buf);
+
+    if (*p++ != '[') {
+        return "Expected '[' at start of payload";
+    }
+
+    p = skip_whitespace(p);
+
+    if (*p == ']') {
+        return "Payload contains no meter slots";
+    }
+
+    while (true) {
+        if (*p++ != '[') {
+            return "Expected '[' at start of meter slot";
+        }
+
+        char *end;
+        unsigned long slot = strtoul(p, &end, 10);
+
+        if (end == p || slot >= METERS_SLOTS) {
+            return "Expected meter slot number as first array element";
+        }
+
+        const char *error = push_batch_add_record(batch, static_cast<uint32_t>(slot));
+
+        if (error != nullptr) {
+            return error;
+        }
+
+        p = skip_whitespace(end);
+
+        while (*p == ',') {
+            p = skip_whitespace(p + 1);
+
+            float value;
+
+            if (strncmp(p, "null", 4) == 0) {
+                value = NAN;
+                p += 4;
+            }
+            else {
+                value = strtof(p, &end);
+
+                if (end == p || isnan(value)) {
+                    return "Expected number or null as value";
+                }
+
+                p = end;
+            }
+
+            error = push_batch_add_value(batch, value);
+
+            if (error != nullptr) {
+                return error;
+            }
+
+            p = skip_whitespace(p);
+        }
+
+        if (*p++ != ']') {
+            return "Expected ',' or ']' after value";
+        }
+
+        p = skip_whitespace(p);
+
+        if (*p == ']') {
+            break;
+        }
+
+        if (*p++ != ',') {
+            return "Expected ',' or ']' after meter slot";
+        }
+
+        p = skip_whitespace(p);
+    }
+
+    if (*skip_whitespace(p + 1) != '\0') {
+        return "Unexpected data after end of payload";
+    }
+
+    return nullptr;
+}
+
+// Decodes a sequence of records, each consisting of an uint8 meter slot, an
+// uint8 value count and that many little-endian float32 values. NaN values are
+// not updated.
+static const char *decode_binary_push(const uint8_t *buf, size_t len, PushBatch *batch)
+{
+    if (len == 0) {
+        return "Payload contains no meter slots";
+    }
+
+    size_t offset = 0;
+
+    while (offset < len) {
+        if (len - offset < 2) {
+            return "Truncated record header";
+        }
+
+        uint8_t slot        = buf[offset];
+        uint8_t value_count = buf[offset + 1];
+
+        offset += 2;
+
+        if (slot >= METERS_SLOTS) {
+            return "Meter slot out of range";
+        }
+
+        if (len - offset < value_count * sizeof(float)) {
+            return "Truncated record values";
+        }
+
+        const char *error = push_batch_add_record(batch, slot);
+
+        if (error != nullptr) {
+            return error;
+        }
+
+        for (size_t i = 0; i < value_count; ++i) {
+            float value;
+
+            memcpy(&value, buf + offset, sizeof(value));
+            offset += sizeof(value);
+
+            error = push_batch_add_value(batch, value);
+
+            if (error != nullptr) {
+                return error;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
 void MetersAPI::pre_setup()
 {
     config_prototype = Config::Object({
@@ -37,6 +241,83 @@ void MetersAPI::pre_setup()
     meters.register_meter_generator(get_class(), this);
 }
 
+void MetersAPI::register_urls()
+{
+    // Bulk push path for external energy management systems: Decodes the
+    // payload on the HTTP thread and writes the values directly into the
+    // meter slots, bypassing the per-meter update command's ConfigRoot.
+    auto push_handler = [](WebServerRequest request) {
+        size_t length = request.contentLength();
+
+        if (length > METERS_API_MAX_PUSH_PAYLOAD_LENGTH) {
+            return request.send(413);
+        }
+
+        auto payload = heap_alloc_array<char>(length + 1);
+
+        if (request.receive(payload.get(), length) < 0) {
+            return request.send(400, "text/plain", "Failed to receive payload");
+        }
+
+        payload[length] = '\0';
+
+        auto batch = heap_alloc_array<PushBatch>(1);
+
+        const char *error;
+        String content_type = request.header("Content-Type");
+
+        if (content_type.startsWith("application/octet-stream")) {
+            error = decode_binary_push(reinterpret_cast<const uint8_t *>(payload.get()), length, &batch[0]);
+        }
+        else {
+            error = decode_json_push(payload.get(), &batch[0]);
+        }
+
+        if (error != nullptr) {
+            return request.send(400, "text/plain", error);
+        }
+
+        String errmsg;
+        PushBatch *b = &batch[0];
+
+        auto result = task_scheduler.await([b, &errmsg]() {
+            for (size_t i = 0; i < b->record_count; ++i) {
+                const PushRecord &record = b->records[i];
+                IMeter *meter = meters.get_meter(record.slot);
+
+                if (meter == nullptr || meter->get_class() != MeterClassID::API) {
+                    errmsg = "Meter in slot " + String(record.slot) + " is not an API meter";
+                    return;
+                }
+
+                size_t value_count = static_cast<MeterAPI *>(meter)->get_value_count();
+
+                if (record.value_count != value_count) {
+                    errmsg = "Meter in slot " + String(record.slot) + " expects " + String(value_count) + " values, got " + String(record.value_count);
+                    return;
+                }
+            }
+
+            for (size_t i = 0; i < b->record_count; ++i) {
+                meters.update_all_values(b->records[i].slot, b->records[i].values);
+            }
+        });
+
+        if (result == TaskScheduler::AwaitResult::Timeout) {
+            return request.send(500, "text/plain", "Failed to push values. Task timed out.");
+        }
+
+        if (!errmsg.isEmpty()) {
+            return request.send(400, "text/plain", errmsg.c_str());
+        }
+
+        return request.send(200);
+    };
+
+    server.on_HTTPThread("/meters_api/push", HTTP_PUT, push_handler);
+    server.on_HTTPThread("/meters_api/push", HTTP_POST, push_handler);
+}
+
 [[gnu::const]]
 MeterClassID MetersAPI::get_class() const
 {
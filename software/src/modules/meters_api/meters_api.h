@@ -34,6 +34,7 @@ class MetersAPI final : public IModule, public IMeterGenerator
 public:
     // for IModule
     void pre_setup() override;
+    void register_urls() override;
 
     // for IMeterGenerator
     [[gnu::const]] MeterClassID get_class() const override;
@@ -93,7 +93,14 @@ void MeterRCTPower::setup(const Config &ephemeral_config)
     }
 
     task_scheduler.scheduleWithFixedDelay([this]() {
-        if (read_allowed) {
+        if (reading) {
+            // Other meters sharing the client might have used all scheduled
+            // transactions. Continue with the remaining value specs.
+            if (value_specs_outstanding == 0) {
+                schedule_reads();
+            }
+        }
+        else if (read_allowed) {
             read_allowed = false;
             read_next();
         }
@@ -121,14 +128,13 @@ void MeterRCTPower::pre_reboot()
 
 void MeterRCTPower::connect_callback()
 {
-    value_specs_index = 0;
-
     read_next();
 }
 
 void MeterRCTPower::disconnect_callback()
 {
     read_allowed = false;
+    reading      = false;
 }
 
 void MeterRCTPower::read_next()
@@ -141,35 +147,89 @@ void MeterRCTPower::read_next()
         return;
     }
 
-    if (value_specs_index >= value_specs_length) {
-        value_specs_index = 0;
+    // Request the whole value set at once. The client pipelines the requests
+    // and the update is finished after the last response or error arrived.
+    value_specs_next        = 0;
+    value_specs_outstanding = 0;
+    values_updated          = false;
+    reading                 = true;
+
+    schedule_reads();
+}
+
+void MeterRCTPower::schedule_reads()
+{
+    // A read can fail immediately, calling read_done from inside the loop below.
+    if (scheduling) {
+        return;
     }
 
-    static_cast<RCTPowerSharedClient *>(connected_client)->read(&value_specs[value_specs_index], 2_s,
-    [this](RCTPowerClientTransactionResult result, float value) {
-        if (result != RCTPowerClientTransactionResult::Success) {
-            if (result == RCTPowerClientTransactionResult::Timeout) {
-                auto timeout = errors->get("timeout");
-                timeout->updateUint(timeout->asUint() + 1);
-            }
-            else if (result == RCTPowerClientTransactionResult::ChecksumMismatch) {
-                auto checksum_mismatch = errors->get("checksum_mismatch");
-                checksum_mismatch->updateUint(checksum_mismatch->asUint() + 1);
-            }
-            else {
-                logger.printfln("Error reading ID 0x%08x: %s [%d]",
-                                value_specs[value_specs_index].id,
-                                get_rct_power_client_transaction_result_name(result),
-                                static_cast<int>(result));
-            }
+    scheduling = true;
+
+    // Several meters can share one client. Schedule as many reads as the
+    // client accepts, the remaining ones are scheduled when reads are done.
+    while (reading && value_specs_next < value_specs_length) {
+        if (connected_client == nullptr) {
+            value_specs_next = value_specs_length;
+            break;
         }
-        else {
-            meters.update_value(slot, value_specs_index, value);
-            meters.finish_update(slot);
 
-            ++value_specs_index;
+        RCTPowerSharedClient *client = static_cast<RCTPowerSharedClient *>(connected_client);
+
+        if (!client->can_schedule_read()) {
+            break;
         }
 
-        read_allowed = true;
-    });
+        size_t i = value_specs_next++;
+
+        ++value_specs_outstanding;
+
+        client->read(&value_specs[i], 2_s, [this, i](RCTPowerClientTransactionResult result, float value) {
+            read_done(i, result, value);
+        });
+    }
+
+    scheduling = false;
+
+    if (!reading || value_specs_outstanding > 0 || value_specs_next < value_specs_length) {
+        return;
+    }
+
+    reading = false;
+
+    if (values_updated) {
+        meters.finish_update(slot);
+    }
+
+    read_allowed = true;
+}
+
+void MeterRCTPower::read_done(size_t i, RCTPowerClientTransactionResult result, float value)
+{
+    if (result != RCTPowerClientTransactionResult::Success) {
+        if (result == RCTPowerClientTransactionResult::Timeout) {
+            auto timeout = errors->get("timeout");
+            timeout->updateUint(timeout->asUint() + 1);
+        }
+        else if (result == RCTPowerClientTransactionResult::ChecksumMismatch) {
+            auto checksum_mismatch = errors->get("checksum_mismatch");
+            checksum_mismatch->updateUint(checksum_mismatch->asUint() + 1);
+        }
+        else {
+            logger.printfln("Error reading ID 0x%08x: %s [%d]",
+                            value_specs[i].id,
+                            get_rct_power_client_transaction_result_name(result),
+                            static_cast<int>(result));
+        }
+    }
+    else {
+        meters.update_value(slot, i, value);
+        values_updated = true;
+    }
+
+    if (value_specs_outstanding > 0) {
+        --value_specs_outstanding;
+    }
+
+    schedule_reads();
 }
@@ -47,6 +47,8 @@ private:
     void connect_callback() override;
     void disconnect_callback() override;
     void read_next();
+    void schedule_reads();
+    void read_done(size_t i, RCTPowerClientTransactionResult result, float value);
 
     uint32_t slot;
     Config *state;
@@ -54,6 +56,10 @@ private:
     VirtualMeter virtual_meter      = VirtualMeter::None;
     const RCTValueSpec *value_specs = nullptr;
     size_t value_specs_length       = 0;
-    size_t value_specs_index        = 0;
+    size_t value_specs_next         = 0;
+    size_t value_specs_outstanding  = 0;
+    bool values_updated             = false;
     bool read_allowed               = false;
+    bool reading                    = false;
+    bool scheduling                 = false;
 };
@@ -102,17 +102,15 @@ void RCTPowerClient::read(const RCTValueSpec *spec, micros_t timeout, RCTPowerCl
         return;
     }
 
+    if (!can_schedule_read()) {
+        callback(RCTPowerClientTransactionResult::NoTransactionAvailable, NAN);
+        return;
+    }
+
     RCTPowerClientTransaction **tail_ptr = &scheduled_transaction_head;
-    size_t scheduled_transaction_count = 0;
 
     while (*tail_ptr != nullptr) {
         tail_ptr = &(*tail_ptr)->next;
-        ++scheduled_transaction_count;
-    }
-
-    if (scheduled_transaction_count >= RCT_POWER_CLIENT_MAX_SCHEDULED_TRANSACTION_COUNT) {
-        callback(RCTPowerClientTransactionResult::NoTransactionAvailable, NAN);
-        return;
     }
 
     RCTPowerClientTransaction *transaction = new RCTPowerClientTransaction;
@@ -123,6 +121,12 @@ void RCTPowerClient::read(const RCTValueSpec *spec, micros_t timeout, RCTPowerCl
     transaction->next     = nullptr;
 
     *tail_ptr = transaction;
+    ++scheduled_transaction_count;
+}
+
+bool RCTPowerClient::can_schedule_read() const
+{
+    return scheduled_transaction_count < RCT_POWER_CLIENT_MAX_SCHEDULED_TRANSACTION_COUNT;
 }
 
 void RCTPowerClient::close_hook()
@@ -137,58 +141,76 @@ void RCTPowerClient::close_hook()
 
 void RCTPowerClient::tick_hook()
 {
-    check_pending_transaction_timeout();
+    check_pending_transaction_timeouts();
+
+    if (scheduled_transaction_head == nullptr || pending_transaction_count >= RCT_POWER_CLIENT_MAX_PENDING_TRANSACTION_COUNT) {
+        return;
+    }
+
+    // Send all scheduled read requests that fit into the pending list in one
+    // TCP write. The responses are matched to the pending requests by ID as
+    // they stream back, instead of waiting one round trip per request.
+    uint8_t batch[RCT_POWER_CLIENT_MAX_PENDING_TRANSACTION_COUNT * RCT_POWER_CLIENT_MAX_ESCAPED_REQUEST_LENGTH];
+    size_t batch_length = 0;
+    RCTPowerClientTransaction **pending_tail_ptr = &pending_transaction_head;
+
+    while (*pending_tail_ptr != nullptr) {
+        pending_tail_ptr = &(*pending_tail_ptr)->next;
+    }
+
+    while (scheduled_transaction_head != nullptr && pending_transaction_count < RCT_POWER_CLIENT_MAX_PENDING_TRANSACTION_COUNT) {
+        RCTPowerClientTransaction *transaction = scheduled_transaction_head;
+
+        scheduled_transaction_head = transaction->next;
+        transaction->next          = nullptr;
+        --scheduled_transaction_count;
+        transaction->deadline      = calculate_deadline(transaction->timeout);
 
-    if (pending_transaction == nullptr && scheduled_transaction_head != nullptr) {
-        pending_transaction          = scheduled_transaction_head;
-        scheduled_transaction_head   = scheduled_transaction_head->next;
-        pending_transaction->next    = nullptr;
-        pending_transaction_deadline = calculate_deadline(pending_transaction->timeout);
+        *pending_tail_ptr = transaction;
+        pending_tail_ptr  = &transaction->next;
+        ++pending_transaction_count;
 
         uint8_t request[8];
 
         request[0] = 1; // command: read
         request[1] = 4; // length
-        request[2] = (uint8_t)((pending_transaction->spec->id >> 24) & 0xFF);
-        request[3] = (uint8_t)((pending_transaction->spec->id >> 16) & 0xFF);
-        request[4] = (uint8_t)((pending_transaction->spec->id >>  8) & 0xFF);
-        request[5] = (uint8_t)((pending_transaction->spec->id >>  0) & 0xFF);
+        request[2] = (uint8_t)((transaction->spec->id >> 24) & 0xFF);
+        request[3] = (uint8_t)((transaction->spec->id >> 16) & 0xFF);
+        request[4] = (uint8_t)((transaction->spec->id >>  8) & 0xFF);
+        request[5] = (uint8_t)((transaction->spec->id >>  0) & 0xFF);
 
         uint32_t checksum = crc16ccitt(request, 6);
 
         request[6] = (checksum >> 8) & 0xFF;
         request[7] = (checksum >> 0) & 0xFF;
 
-        uint8_t escaped_request[1 + 8 * 2] = "+";
-        size_t escaped_request_length = 1;
+        batch[batch_length++] = '+';
 
         for (size_t i = 0; i < sizeof(request); ++i) {
             if (request[i] == '+' || request[i] == '-') {
-                escaped_request[escaped_request_length++] = '-';
+                batch[batch_length++] = '-';
             }
 
-            escaped_request[escaped_request_length++] = request[i];
+            batch[batch_length++] = request[i];
         }
+    }
 
-        if (!send(escaped_request, escaped_request_length)) {
-            int saved_errno = errno;
-            finish_pending_transaction(RCTPowerClientTransactionResult::SendFailed, NAN);
-            disconnect(TFGenericTCPClientDisconnectReason::SocketSendFailed, saved_errno);
-        }
+    debugfln("Sending %zu bytes for %zu pending transactions", batch_length, pending_transaction_count);
+
+    if (!send(batch, batch_length)) {
+        int saved_errno = errno;
+        finish_transaction_list(&pending_transaction_head, RCTPowerClientTransactionResult::SendFailed);
+        disconnect(TFGenericTCPClientDisconnectReason::SocketSendFailed, saved_errno);
     }
 }
 
 bool RCTPowerClient::receive_hook()
 {
     micros_t deadline = calculate_deadline(10_ms);
+    uint8_t buffer[64];
 
-    while (sizeof(pending_response) - pending_response_used > 0) {
-        if (deadline_elapsed(deadline)) {
-            return true;
-        }
-
-        uint8_t received_byte;
-        ssize_t result = recv(socket_fd, &received_byte, 1, 0);
+    while (!deadline_elapsed(deadline)) {
+        ssize_t result = recv(socket_fd, buffer, sizeof(buffer), 0);
 
         if (result < 0) {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -203,60 +225,79 @@ bool RCTPowerClient::receive_hook()
             return false;
         }
 
-        bootloader_magic_number = (bootloader_magic_number << 8) | received_byte;
-
-        if (bootloader_magic_number == 0x50F705AB) {
-            bootloader_last_detected = now_us();
+        for (ssize_t i = 0; i < result; ++i) {
+            process_received_byte(buffer[i]);
         }
+    }
 
-        debugfln("received_byte %u 0x%02x %s| last_received_byte %u 0x%02x %s",
-                 received_byte, received_byte, received_byte == '+' ? "+ " : (received_byte == '-' ? "- " : ""),
-                 last_received_byte, last_received_byte, last_received_byte == '+' ? "+ " : (last_received_byte == '-' ? "- " : ""));
+    return true;
+}
 
-        if (wait_for_start) {
-            if (received_byte == '+' && last_received_byte != '-') {
-                debugfln("Received expected start byte");
-                wait_for_start = false;
-            }
-        }
-        else if (received_byte == '+') {
-            if (last_received_byte == '-') {
-                pending_response[pending_response_used++] = received_byte;
-            }
-            else {
-                debugfln("Received unexpected start byte, starting new response");
-                pending_response_used = 0;
-            }
+void RCTPowerClient::process_received_byte(uint8_t received_byte)
+{
+    bootloader_magic_number = (bootloader_magic_number << 8) | received_byte;
+
+    if (bootloader_magic_number == 0x50F705AB) {
+        bootloader_last_detected = now_us();
+    }
+
+    debugfln("received_byte %u 0x%02x %s| last_received_byte %u 0x%02x %s",
+             received_byte, received_byte, received_byte == '+' ? "+ " : (received_byte == '-' ? "- " : ""),
+             last_received_byte, last_received_byte, last_received_byte == '+' ? "+ " : (last_received_byte == '-' ? "- " : ""));
+
+    if (wait_for_start) {
+        if (received_byte == '+' && last_received_byte != '-') {
+            debugfln("Received expected start byte");
+            wait_for_start = false;
         }
-        else if (received_byte == '-') {
-            if (last_received_byte == '-') {
-                pending_response[pending_response_used++] = received_byte;
-            }
+    }
+    else if (received_byte == '+') {
+        if (last_received_byte == '-') {
+            pending_response[pending_response_used++] = received_byte;
         }
         else {
+            debugfln("Received unexpected start byte, starting new response");
+            pending_response_used = 0;
+        }
+    }
+    else if (received_byte == '-') {
+        if (last_received_byte == '-') {
             pending_response[pending_response_used++] = received_byte;
         }
+    }
+    else {
+        pending_response[pending_response_used++] = received_byte;
+    }
 
-        last_received_byte = received_byte;
+    // An escaped escape byte must not escape the following byte
+    last_received_byte = (received_byte == '-' && last_received_byte == '-') ? 0 : received_byte;
 
-        if (pending_response_used == 1 && pending_response[0] != 5) {
-            debugfln("Received response with unexpected command %u, ignoring response", pending_response[0]);
-            reset_pending_response();
-        }
-        else if (pending_response_used == 2 && pending_response[1] != 8) {
-            debugfln("Received response with unexpected length %u, ignoring response", pending_response[1]);
-            reset_pending_response();
-        }
+    if (pending_response_used == 1 && pending_response[0] != 5) {
+        debugfln("Received response with unexpected command %u, ignoring response", pending_response[0]);
+        reset_pending_response();
     }
+    else if (pending_response_used == 2 && pending_response[1] != 8) {
+        debugfln("Received response with unexpected length %u, ignoring response", pending_response[1]);
+        reset_pending_response();
+    }
+    else if (pending_response_used == sizeof(pending_response)) {
+        process_pending_response();
+    }
+}
 
+void RCTPowerClient::process_pending_response()
+{
     uint32_t id = ((uint32_t)pending_response[2] << 24) |
                   ((uint32_t)pending_response[3] << 16) |
                   ((uint32_t)pending_response[4] <<  8) |
                   ((uint32_t)pending_response[5] <<  0);
 
-    if (pending_transaction == nullptr || pending_transaction->spec->id != id) {
+    RCTPowerClientTransaction *transaction = take_pending_transaction(id);
+
+    if (transaction == nullptr) {
+        debugfln("Received response for ID 0x%08x without pending transaction, ignoring response", id);
         reset_pending_response();
-        return true;
+        return;
     }
 
     uint16_t actual_checksum   = crc16ccitt(pending_response, pending_response_used - 2);
@@ -269,8 +310,8 @@ bool RCTPowerClient::receive_hook()
                  id, actual_checksum, expected_checksum);
 
         reset_pending_response();
-        finish_pending_transaction(RCTPowerClientTransactionResult::ChecksumMismatch, NAN);
-        return true;
+        finish_transaction(transaction, RCTPowerClientTransactionResult::ChecksumMismatch, NAN);
+        return;
     }
 
     union {
@@ -287,54 +328,90 @@ bool RCTPowerClient::receive_hook()
 
     if (value != 0.0f) { // Really compare exactly with 0.0f
         // Don't convert 0.0f into -0.0f if the scale factor is negative
-        value *= pending_transaction->spec->scale_factor;
+        value *= transaction->spec->scale_factor;
     }
 
     debugfln("Received response for ID 0x%08x with value %f [%f]", id, u.value, value);
 
     reset_pending_response();
-    finish_pending_transaction(RCTPowerClientTransactionResult::Success, value);
-    return true;
+    finish_transaction(transaction, RCTPowerClientTransactionResult::Success, value);
 }
 
-void RCTPowerClient::finish_pending_transaction(RCTPowerClientTransactionResult result, float value)
+// Removes the oldest pending transaction for the given ID from the pending list
+RCTPowerClientTransaction *RCTPowerClient::take_pending_transaction(uint32_t id)
 {
-    if (pending_transaction != nullptr) {
-        RCTPowerClientTransactionCallback callback = std::move(pending_transaction->callback);
-        pending_transaction->callback = nullptr;
+    RCTPowerClientTransaction **transaction_ptr = &pending_transaction_head;
+
+    while (*transaction_ptr != nullptr) {
+        RCTPowerClientTransaction *transaction = *transaction_ptr;
 
-        delete pending_transaction;
-        pending_transaction          = nullptr;
-        pending_transaction_deadline = 0_s;
+        if (transaction->spec->id == id) {
+            *transaction_ptr  = transaction->next;
+            transaction->next = nullptr;
+            --pending_transaction_count;
 
-        callback(result, value);
+            return transaction;
+        }
+
+        transaction_ptr = &transaction->next;
     }
+
+    return nullptr;
 }
 
-void RCTPowerClient::finish_all_transactions(RCTPowerClientTransactionResult result)
+void RCTPowerClient::finish_transaction(RCTPowerClientTransaction *transaction, RCTPowerClientTransactionResult result, float value)
 {
-    finish_pending_transaction(result, NAN);
+    RCTPowerClientTransactionCallback callback = std::move(transaction->callback);
+    transaction->callback = nullptr;
 
-    RCTPowerClientTransaction *scheduled_transaction = scheduled_transaction_head;
-    scheduled_transaction_head = nullptr;
+    delete transaction;
 
-    while (scheduled_transaction != nullptr) {
-        RCTPowerClientTransactionCallback callback = std::move(scheduled_transaction->callback);
-        scheduled_transaction->callback = nullptr;
+    callback(result, value);
+}
 
-        RCTPowerClientTransaction *scheduled_transaction_next = scheduled_transaction->next;
+void RCTPowerClient::finish_transaction_list(RCTPowerClientTransaction **head_ptr, RCTPowerClientTransactionResult result)
+{
+    RCTPowerClientTransaction *transaction = *head_ptr;
+    *head_ptr = nullptr;
+
+    if (head_ptr == &pending_transaction_head) {
+        pending_transaction_count = 0;
+    }
+    else if (head_ptr == &scheduled_transaction_head) {
+        scheduled_transaction_count = 0;
+    }
 
-        delete scheduled_transaction;
-        scheduled_transaction = scheduled_transaction_next;
+    while (transaction != nullptr) {
+        RCTPowerClientTransaction *transaction_next = transaction->next;
 
-        callback(result, NAN);
+        finish_transaction(transaction, result, NAN);
+        transaction = transaction_next;
     }
 }
 
-void RCTPowerClient::check_pending_transaction_timeout()
+void RCTPowerClient::finish_all_transactions(RCTPowerClientTransactionResult result)
 {
-    if (pending_transaction != nullptr && deadline_elapsed(pending_transaction_deadline)) {
-        finish_pending_transaction(RCTPowerClientTransactionResult::Timeout, NAN);
+    finish_transaction_list(&pending_transaction_head, result);
+    finish_transaction_list(&scheduled_transaction_head, result);
+}
+
+void RCTPowerClient::check_pending_transaction_timeouts()
+{
+    RCTPowerClientTransaction **transaction_ptr = &pending_transaction_head;
+
+    while (*transaction_ptr != nullptr) {
+        RCTPowerClientTransaction *transaction = *transaction_ptr;
+
+        if (!deadline_elapsed(transaction->deadline)) {
+            transaction_ptr = &transaction->next;
+            continue;
+        }
+
+        *transaction_ptr  = transaction->next;
+        transaction->next = nullptr;
+        --pending_transaction_count;
+
+        finish_transaction(transaction, RCTPowerClientTransactionResult::Timeout, NAN);
     }
 }
 
@@ -26,7 +26,9 @@
 #include "modules/meters/meter_value_id.h"
 #include "modules/modbus_tcp_client/generic_tcp_client_pool_connector.h"
 
-#define RCT_POWER_CLIENT_MAX_SCHEDULED_TRANSACTION_COUNT 8
+#define RCT_POWER_CLIENT_MAX_SCHEDULED_TRANSACTION_COUNT 16
+#define RCT_POWER_CLIENT_MAX_PENDING_TRANSACTION_COUNT 16
+#define RCT_POWER_CLIENT_MAX_ESCAPED_REQUEST_LENGTH (1 + 8 * 2)
 
 struct RCTValueSpec
 {
@@ -56,6 +58,7 @@ struct RCTPowerClientTransaction
 {
     const RCTValueSpec *spec;
     micros_t timeout;
+    micros_t deadline;
     RCTPowerClientTransactionCallback callback;
     RCTPowerClientTransaction *next;
 };
@@ -66,19 +69,25 @@ public:
     RCTPowerClient() {}
 
     void read(const RCTValueSpec *spec, micros_t timeout, RCTPowerClientTransactionCallback &&callback);
+    bool can_schedule_read() const;
 
 private:
     void close_hook() override;
     void tick_hook() override;
     bool receive_hook() override;
-    void finish_pending_transaction(RCTPowerClientTransactionResult result, float value);
+    void process_received_byte(uint8_t received_byte);
+    void process_pending_response();
+    RCTPowerClientTransaction *take_pending_transaction(uint32_t id);
+    void finish_transaction(RCTPowerClientTransaction *transaction, RCTPowerClientTransactionResult result, float value);
+    void finish_transaction_list(RCTPowerClientTransaction **head_ptr, RCTPowerClientTransactionResult result);
     void finish_all_transactions(RCTPowerClientTransactionResult result);
-    void check_pending_transaction_timeout();
+    void check_pending_transaction_timeouts();
     void reset_pending_response();
 
-    RCTPowerClientTransaction *pending_transaction        = nullptr;
-    micros_t pending_transaction_deadline                 = 0_s;
+    RCTPowerClientTransaction *pending_transaction_head   = nullptr;
+    size_t pending_transaction_count                      = 0;
     RCTPowerClientTransaction *scheduled_transaction_head = nullptr;
+    size_t scheduled_transaction_count                    = 0;
     bool wait_for_start                                   = true;
     uint8_t last_received_byte                            = 0;
     uint8_t pending_response[12];
@@ -97,6 +106,11 @@ public:
         client->read(spec, timeout, std::move(callback));
     }
 
+    bool can_schedule_read() const
+    {
+        return client->can_schedule_read();
+    }
+
 private:
     RCTPowerClient *client;
 };
@@ -0,0 +1,199 @@
+#!/usr/bin/python3 -u
+
+# Local stand-in for an RCT Power inverter. Answers read requests for the
+# object IDs used by the grid and battery virtual meters and reports how many
+# complete virtual meter value sets per second the connected client reads.
+
+import argparse
+import socketserver
+import struct
+import threading
+import time
+import random
+
+VALUES = {
+    # Grid
+    0x44D4C533: 1234567.0, # Total energy grid feed-in [Wh]
+    0x62FBE7DC: 7654321.0, # Total energy grid load [Wh]
+    0x91617C58: 1500.0,    # Total grid power [W]
+    # Battery
+    0x21961B58: 3.5,       # Battery current [A]
+    0x400F015B: 1200.0,    # Battery power [W]
+    0x5570401B: 456789.0,  # Total energy flow into battery [Wh]
+    0x65EED11B: 345.6,     # Battery voltage [V]
+    0x902AFAFB: 24.5,      # Battery temperature [°C]
+    0x959930BF: 0.75,      # Battery SOC [0..1]
+    0xA9033880: 987654.0,  # Total energy flow from battery [Wh]
+}
+
+VIRTUAL_METERS = {
+    'grid': [0x44D4C533, 0x62FBE7DC, 0x91617C58],
+    'battery': [0x21961B58, 0x400F015B, 0x5570401B, 0x65EED11B, 0x902AFAFB, 0x959930BF, 0xA9033880],
+}
+
+def crc16ccitt(data):
+    checksum = 0xFFFF
+
+    for b in data:
+        for k in range(8):
+            bit = (b >> (7 - k)) & 1
+            c15 = (checksum >> 15) & 1
+            checksum = (checksum << 1) & 0xFFFF
+
+            if c15 ^ bit:
+                checksum ^= 0x1021
+
+    return checksum
+
+def escape(frame):
+    escaped = bytearray(b'+')
+
+    for b in frame:
+        if b in b'+-':
+            escaped.append(ord('-'))
+
+        escaped.append(b)
+
+    return bytes(escaped)
+
+def unescape_frames(buf):
+    frames = []
+    frame = None
+    escaped = False
+    consumed = 0
+
+    for i, b in enumerate(buf):
+        if escaped:
+            if frame is not None:
+                frame.append(b)
+
+            escaped = False
+        elif b == ord('-'):
+            escaped = True
+        elif b == ord('+'):
+            frame = bytearray()
+        elif frame is not None:
+            frame.append(b)
+
+        if frame is not None and len(frame) >= 2 and len(frame) == 2 + frame[1] + 2:
+            frames.append(bytes(frame))
+            frame = None
+            consumed = i + 1
+
+    if frame is None and not escaped:
+        consumed = len(buf)
+
+    return frames, buf[consumed:]
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.batches = 0
+        self.seen = set()
+        self.value_sets = 0
+
+stats = Stats()
+args = None
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        print(f'Client {self.client_address[0]}:{self.client_address[1]} connected')
+        buf = b''
+        value_set = set(VIRTUAL_METERS[args.virtual_meter])
+
+        while True:
+            data = self.request.recv(4096)
+
+            if len(data) == 0:
+                break
+
+            frames, buf = unescape_frames(buf + data)
+
+            if len(frames) == 0:
+                continue
+
+            if args.latency > 0:
+                time.sleep(args.latency)
+
+            response = bytearray()
+
+            for frame in frames:
+                if frame[0] != 1 or frame[1] != 4:
+                    print(f'Ignoring unexpected frame {frame.hex()}')
+                    continue
+
+                if crc16ccitt(frame[:-2]) != struct.unpack('>H', frame[-2:])[0]:
+                    print(f'Ignoring frame with checksum mismatch {frame.hex()}')
+                    continue
+
+                object_id = struct.unpack('>I', frame[2:6])[0]
+                value = VALUES.get(object_id, 0.0) * random.uniform(0.99, 1.01)
+                reply = struct.pack('>BBIf', 5, 8, object_id, value)
+                checksum = crc16ccitt(reply)
+
+                if random.random() < args.corrupt:
+                    checksum ^= 0x5555
+
+                reply += struct.pack('>H', checksum)
+
+                if random.random() >= args.drop:
+                    response += escape(reply)
+
+                with stats.lock:
+                    stats.requests += 1
+
+                    if object_id in value_set:
+                        stats.seen.add(object_id)
+
+                        if stats.seen == value_set:
+                            stats.value_sets += 1
+                            stats.seen = set()
+
+            with stats.lock:
+                stats.batches += 1
+
+            self.request.sendall(response)
+
+        print(f'Client {self.client_address[0]}:{self.client_address[1]} disconnected')
+
+def report():
+    last = time.time()
+
+    while True:
+        time.sleep(args.report_interval)
+
+        now = time.time()
+        duration = now - last
+        last = now
+
+        with stats.lock:
+            requests, batches, value_sets = stats.requests, stats.batches, stats.value_sets
+            stats.requests = stats.batches = stats.value_sets = 0
+
+        print(f'{requests / duration:.1f} requests/s, {batches / duration:.1f} batches/s, {value_sets / duration:.2f} {args.virtual_meter} value sets/s')
+
+def main():
+    global args
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8899)
+    parser.add_argument('--virtual-meter', choices=VIRTUAL_METERS.keys(), default='battery')
+    parser.add_argument('--latency', type=float, default=0.05, help='delay in seconds before answering a batch of requests')
+    parser.add_argument('--corrupt', type=float, default=0.0, help='probability of sending a response with a wrong checksum')
+    parser.add_argument('--drop', type=float, default=0.0, help='probability of not answering a request')
+    parser.add_argument('--report-interval', type=float, default=10.0)
+
+    args = parser.parse_args()
+
+    threading.Thread(target=report, daemon=True).start()
+
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+
+    with socketserver.ThreadingTCPServer((args.host, args.port), Handler) as server:
+        print(f'Listening on {args.host}:{args.port}')
+        server.serve_forever()
+
+if __name__ == '__main__':
+    main()
@@ -46,6 +46,13 @@ extern char local_uid_str[32];
 
 #define MQTT_RECV_BUFFER_HEADROOM (MQTT_RECV_BUFFER_SIZE / 6)
 
+// esp_mqtt_client_publish writes to the transport in the calling task, so TLS needs some stack.
+#define MQTT_PUBLISH_TASK_STACK_SIZE 4096U
+// Messages that are not state updates. State updates are queued once per state.
+#define MQTT_PUBLISH_QUEUE_LENGTH 16U
+// States marked as updated after connecting are only queued while less than this many states are queued.
+#define MQTT_RESEND_MAX_QUEUED_STATES 16U
+
 extern "C" esp_err_t esp_crt_bundle_attach(void *conf);
 
 #if !MODULE_CERTS_AVAILABLE()
@@ -97,6 +104,21 @@ void Mqtt::pre_setup()
         {"last_error", Config::Int(0)}
     });
 
+    publish_queue_state = Config::Object({
+        {"queued_states", Config::Uint32(0)},
+        {"queued_messages", Config::Uint32(0)},
+        {"published", Config::Uint32(0)},
+        {"publish_failed", Config::Uint32(0)},
+        {"coalesced", Config::Uint32(0)},
+        {"queue_full", Config::Uint32(0)},
+        {"publish_avg_us", Config::Uint32(0)}, // since the last update of this state
+        {"publish_max_us", Config::Uint32(0)},
+        {"enqueue_max_us", Config::Uint32(0)},
+        {"state_serializations", Config::Uint32(0)},
+        {"state_updates", Config::Uint32(0)},
+        {"connect_resend_ms", Config::Uint32(0)}, // time to queue and publish all states after the last connect
+    });
+
 #if MODULE_AUTOMATION_AVAILABLE()
     automation.register_trigger(
         AutomationTriggerID::MQTT,
@@ -146,7 +168,9 @@ void Mqtt::pre_setup()
             if (cfg->get("use_prefix")->asBool()) {
                 topic = config.get("global_topic_prefix")->asString() + "/automation_action/" + topic;
             }
-            publish(topic, cfg->get("payload")->asString(), cfg->get("retain")->asBool());
+            if (!publish(topic, cfg->get("payload")->asString(), cfg->get("retain")->asBool())) {
+                logger.printfln("Could not publish automation action to %s: Not connected or publish queue full", topic.c_str());
+            }
         },
         [this](const Config *cfg) {
             const CoolString &topic = cfg->get("topic")->asString();
@@ -207,7 +231,17 @@ void Mqtt::addCommand(size_t commandIdx, const CommandRegistration &reg)
 
 void Mqtt::addState(size_t stateIdx, const StateRegistration &reg)
 {
-    this->states.push_back({0});
+    this->states.push_back({0, 0});
+
+    // Build the prefixed topic once instead of on every publish.
+    String topic;
+    topic.reserve(global_topic_prefix.length() + 1 + reg.path_len);
+    topic.concat(global_topic_prefix);
+    topic.concat('/');
+    topic.concat(reg.path, reg.path_len);
+
+    std::lock_guard<std::mutex> lock{publish_mutex};
+    this->queued_states.push_back({std::move(topic), String(), false});
 }
 
 void Mqtt::addResponse(size_t responseIdx, const ResponseRegistration &reg)
@@ -216,51 +250,406 @@ void Mqtt::addResponse(size_t responseIdx, const ResponseRegistration &reg)
 
 bool Mqtt::publish_with_prefix(const String &path, const String &payload, bool retain)
 {
-    String topic = global_topic_prefix + "/" + path;
+    String topic;
+    topic.reserve(global_topic_prefix.length() + 1 + path.length());
+    topic.concat(global_topic_prefix);
+    topic.concat('/');
+    topic.concat(path);
+
     return publish(topic, payload, retain);
 }
 
+static void update_max(std::atomic<uint32_t> *max, uint32_t value)
+{
+    uint32_t current = max->load(std::memory_order_relaxed);
+
+    while (value > current && !max->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// esp_mqtt_client_publish blocks until the message is written to the
+// transport, which stalls the caller on a slow broker link.
+// esp_mqtt_client_enqueue uses an unbounded queue. Instead, messages are
+// queued in a bounded queue here and published by the publish task.
 bool Mqtt::publish(const String &topic, const String &payload, bool retain)
 {
     // ESP-MQTT does this check but we only want to allow publishing after
     // onMqttConnect was called (in the main thread!)
     // ESP-MQTT's check can asynchronously flip to connected.
-    if (client == nullptr || this->state.get("connection_state")->asEnum<MqttConnectionState>() != MqttConnectionState::Connected)
+    if (client == nullptr || publish_task_handle == nullptr || !connected)
         return false;
 
-// enqueue uses an unbounded queue! IDF 5.3 adds a limit for the queue. Until then use publish even though it blocks the main thread.
-//#if defined(BOARD_HAS_PSRAM)
-//    return esp_mqtt_client_enqueue(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain, true) >= 0;
-//#else
-    return esp_mqtt_client_publish(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain) >= 0;
-//#endif
+    micros_t start = now_us();
+
+    {
+        std::lock_guard<std::mutex> lock{publish_mutex};
+
+        if (queued_message_count >= MQTT_PUBLISH_QUEUE_LENGTH) {
+            queue_full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        MqttMessage &msg = queued_messages[(queued_message_head + queued_message_count) % MQTT_PUBLISH_QUEUE_LENGTH];
+        msg.topic = topic;
+        msg.payload = payload;
+        msg.retained = retain;
+        ++queued_message_count;
+    }
+
+    xTaskNotifyGive(publish_task_handle);
+
+    update_max(&enqueue_max_us, (now_us() - start).as<uint32_t>());
+
+    return true;
+}
+
+size_t Mqtt::get_free_publish_queue_slots()
+{
+    std::lock_guard<std::mutex> lock{publish_mutex};
+    return MQTT_PUBLISH_QUEUE_LENGTH - queued_message_count;
 }
 
 bool Mqtt::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
 {
     auto &state = this->states[stateIdx];
 
+    // Another backend requested the payload before the send interval elapsed.
     if (!deadline_elapsed(state.last_send_ms + this->send_interval_ms))
         return false;
 
-    bool success = this->publish_with_prefix(path, payload);
+    if (client == nullptr || publish_task_handle == nullptr || !connected)
+        return false;
+
+    if (state.pending) {
+        state.pending = 0;
+        --pending_state_count;
+    }
+
+    micros_t start = now_us();
+
+    {
+        std::lock_guard<std::mutex> lock{publish_mutex};
+        MqttQueuedState &queued_state = queued_states[stateIdx];
+
+        if (queued_state.queued) {
+            // The publish task did not get to the previous update yet.
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            queued_state.queued = true;
+            ++queued_state_count;
+        }
+
+        queued_state.payload = payload;
+    }
+
+    xTaskNotifyGive(publish_task_handle);
+
+    update_max(&enqueue_max_us, (now_us() - start).as<uint32_t>());
+
+    state.last_send_ms = millis();
+    ++state_updates;
+
+    return true;
+}
+
+// Messages are published first: They are rare and some of them
+// (for example removed discovery topics) are caused by received messages.
+// Raw state updates are rare too and are published before the states.
+bool Mqtt::take_next_message(MqttMessage *msg)
+{
+    std::lock_guard<std::mutex> lock{publish_mutex};
+
+    if (queued_message_count > 0) {
+        MqttMessage &queued = queued_messages[queued_message_head];
+        msg->topic = std::move(queued.topic);
+        msg->payload = std::move(queued.payload);
+        msg->retained = queued.retained;
+
+        queued_message_head = (queued_message_head + 1) % MQTT_PUBLISH_QUEUE_LENGTH;
+        --queued_message_count;
+        return true;
+    }
+
+    if (queued_state_count == 0) {
+        return false;
+    }
+
+    for (auto &raw_state : queued_raw_states) {
+        if (!raw_state.queued) {
+            continue;
+        }
+
+        msg->topic = raw_state.topic;
+        msg->payload = std::move(raw_state.payload);
+        msg->retained = true;
+
+        raw_state.queued = false;
+        --queued_state_count;
+        return true;
+    }
+
+    // Continue after the last published state, so that frequently updated
+    // states can't starve the others.
+    size_t count = queued_states.size();
+    for (size_t i = 0; i < count; ++i) {
+        size_t idx = (next_queued_state + i) % count;
+        MqttQueuedState &queued_state = queued_states[idx];
+
+        if (!queued_state.queued) {
+            continue;
+        }
+
+        msg->topic = queued_state.topic;
+        msg->payload = std::move(queued_state.payload);
+        msg->retained = true;
+
+        queued_state.queued = false;
+        --queued_state_count;
+        next_queued_state = idx + 1;
+        return true;
+    }
+
+    return false;
+}
+
+void Mqtt::clear_publish_queue()
+{
+    std::lock_guard<std::mutex> lock{publish_mutex};
+
+    for (auto &queued_state : queued_states) {
+        queued_state.payload = String();
+        queued_state.queued = false;
+    }
+    queued_raw_states.clear();
+    queued_state_count = 0;
+
+    for (size_t i = 0; i < queued_message_count; ++i) {
+        MqttMessage &queued = queued_messages[(queued_message_head + i) % MQTT_PUBLISH_QUEUE_LENGTH];
+        queued.topic = String();
+        queued.payload = String();
+    }
+    queued_message_head = 0;
+    queued_message_count = 0;
+}
+
+void Mqtt::publish_task()
+{
+    MqttMessage msg;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (take_next_message(&msg)) {
+            // Messages queued before a disconnect are dropped.
+            if (!connected) {
+                continue;
+            }
+
+            micros_t start = now_us();
+            bool success = esp_mqtt_client_publish(this->client, msg.topic.c_str(), msg.payload.c_str(), msg.payload.length(), 0, msg.retained) >= 0;
+            uint32_t duration_us = (now_us() - start).as<uint32_t>();
+
+            // Read by the main thread. A torn read is not possible for 32 bit values.
+            ++published;
+            if (!success) {
+                ++publish_failed;
+            }
+            publish_total_us += duration_us;
+            if (duration_us > publish_max_us) {
+                publish_max_us = duration_us;
+            }
+        }
+    }
+}
+
+static void mqtt_publish_task(void *arg)
+{
+    static_cast<Mqtt *>(arg)->publish_task();
+}
+
+void Mqtt::update_publish_queue_state()
+{
+    uint32_t published_now = published;
+    uint32_t publish_total_us_now = publish_total_us;
+    uint32_t published_since = published_now - last_published;
 
-    if (success) {
-        state.last_send_ms = millis();
+    {
+        std::lock_guard<std::mutex> lock{publish_mutex};
+
+        publish_queue_state.get("queued_states")->updateUint(queued_state_count);
+        publish_queue_state.get("queued_messages")->updateUint(queued_message_count);
     }
 
-    return success;
+    publish_queue_state.get("published")->updateUint(published_now);
+    publish_queue_state.get("publish_failed")->updateUint(publish_failed);
+    publish_queue_state.get("coalesced")->updateUint(coalesced.load(std::memory_order_relaxed));
+    publish_queue_state.get("queue_full")->updateUint(queue_full.load(std::memory_order_relaxed));
+    publish_queue_state.get("publish_avg_us")->updateUint(published_since == 0 ? 0 : (publish_total_us_now - last_publish_total_us) / published_since);
+    publish_queue_state.get("publish_max_us")->updateUint(publish_max_us);
+    publish_queue_state.get("enqueue_max_us")->updateUint(enqueue_max_us.load(std::memory_order_relaxed));
+    publish_queue_state.get("state_serializations")->updateUint(state_serializations);
+    publish_queue_state.get("state_updates")->updateUint(state_updates);
+
+    last_published = published_now;
+    last_publish_total_us = publish_total_us_now;
 }
 
+// Raw state updates are coalesced per topic like state updates instead of
+// using the message queue, so that they are not dropped if it is full.
 bool Mqtt::pushRawStateUpdate(const String &payload, const String &path)
 {
-    return this->publish_with_prefix(path, payload);
+    if (client == nullptr || publish_task_handle == nullptr || !connected)
+        return false;
+
+    String topic;
+    topic.reserve(global_topic_prefix.length() + 1 + path.length());
+    topic.concat(global_topic_prefix);
+    topic.concat('/');
+    topic.concat(path);
+
+    {
+        std::lock_guard<std::mutex> lock{publish_mutex};
+        MqttQueuedState *queued_state = nullptr;
+
+        for (auto &raw_state : queued_raw_states) {
+            if (raw_state.topic == topic) {
+                queued_state = &raw_state;
+                break;
+            }
+        }
+
+        if (queued_state == nullptr) {
+            queued_raw_states.push_back({std::move(topic), String(), false});
+            queued_state = &queued_raw_states.back();
+        }
+
+        if (queued_state->queued) {
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            queued_state->queued = true;
+            ++queued_state_count;
+        }
+
+        queued_state->payload = payload;
+    }
+
+    xTaskNotifyGive(publish_task_handle);
+
+    return true;
 }
 
+// A state that changes while the send interval did not elapse yet is not
+// serialized on every API tick. It is marked as pending and its updated flag
+// for this backend is cleared instead. Otherwise the API would serialize it on
+// every tick as long as another backend (for example a connected web
+// interface) wants every update. flush_pending_states marks it as updated
+// again when the interval elapsed, so that the payload is serialized once,
+// right before it is published.
 IAPIBackend::WantsStateUpdate Mqtt::wantsStateUpdate(size_t stateIdx) {
-    return this->state.get("connection_state")->asEnum<MqttConnectionState>() == MqttConnectionState::Connected ?
-           IAPIBackend::WantsStateUpdate::AsString :
-           IAPIBackend::WantsStateUpdate::No;
+    if (this->state.get("connection_state")->asEnum<MqttConnectionState>() != MqttConnectionState::Connected)
+        return IAPIBackend::WantsStateUpdate::No;
+
+    // Only other backends are interested in this update.
+    if (api.states[stateIdx].config->was_updated(1 << this->backend_idx) == 0)
+        return IAPIBackend::WantsStateUpdate::No;
+
+    auto &state = this->states[stateIdx];
+    uint32_t deadline = state.last_send_ms + this->send_interval_ms;
+
+    if (deadline_elapsed(deadline)) {
+        ++state_serializations;
+        return IAPIBackend::WantsStateUpdate::AsString;
+    }
+
+    if (!state.pending) {
+        state.pending = 1;
+
+        if (pending_state_count == 0 || a_after_b(flush_deadline_ms, deadline))
+            flush_deadline_ms = deadline;
+
+        ++pending_state_count;
+    }
+
+    api.states[stateIdx].config->clear_updated(1 << this->backend_idx);
+
+    return IAPIBackend::WantsStateUpdate::No;
+}
+
+void Mqtt::flush_pending_states()
+{
+    if (pending_state_count == 0 || !deadline_elapsed(flush_deadline_ms))
+        return;
+
+    bool have_next_deadline = false;
+    uint32_t next_deadline = 0;
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        auto &state = states[i];
+
+        if (!state.pending)
+            continue;
+
+        uint32_t deadline = state.last_send_ms + this->send_interval_ms;
+
+        if (deadline_elapsed(deadline)) {
+            state.pending = 0;
+            --pending_state_count;
+            // The API clears the updated flag if no backend wanted the update.
+            api.states[i].config->set_updated(1 << this->backend_idx);
+            continue;
+        }
+
+        if (!have_next_deadline || a_after_b(next_deadline, deadline)) {
+            next_deadline = deadline;
+            have_next_deadline = true;
+        }
+    }
+
+    if (have_next_deadline)
+        flush_deadline_ms = next_deadline;
+}
+
+void Mqtt::resend_states()
+{
+    if (!resending_states || !connected)
+        return;
+
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock{publish_mutex};
+        queued = queued_state_count + queued_message_count;
+    }
+
+    size_t state_count = api.states.size();
+
+    if (resend_next_state >= state_count) {
+        // The API loop pushes states that are not low latency only every fourth tick.
+        // Then wait until the publish task caught up.
+        if (!deadline_elapsed(resend_marked_all_ms + 1000) || queued > 0)
+            return;
+
+        resending_states = false;
+
+        uint32_t resend_ms = millis() - last_connected_ms;
+        publish_queue_state.get("connect_resend_ms")->updateUint(resend_ms);
+        logger.printfln("Published %u states %u ms after connecting.", state_count, resend_ms);
+        return;
+    }
+
+    // Only mark as many states as the publish task can take.
+    // States that are already queued are coalesced anyway.
+    size_t budget = queued >= MQTT_RESEND_MAX_QUEUED_STATES ? 0 : MQTT_RESEND_MAX_QUEUED_STATES - queued;
+
+    while (budget > 0 && resend_next_state < state_count) {
+        api.states[resend_next_state].config->set_updated(1 << this->backend_idx);
+        ++resend_next_state;
+        --budget;
+    }
+
+    if (resend_next_state >= state_count)
+        resend_marked_all_ms = millis();
 }
 
 void Mqtt::resubscribe()
@@ -312,14 +701,17 @@ void Mqtt::onMqttConnect()
     logger.printfln("Connected to broker at %s%s:%u%s.", schema, this->config.get("broker_host")->asEphemeralCStr(), this->config.get("broker_port")->asUint(), print_path ? this->config.get("broker_path")->asEphemeralCStr() : "");
 
     this->state.get("connection_state")->updateEnum(MqttConnectionState::Connected);
+    connected = true;
 
     for (size_t i = 0; i < api.commands.size(); ++i) {
         auto &reg = api.commands[i];
         this->addCommand(i, reg);
     }
-    for (auto &reg : api.states) {
-        reg.config->set_updated(1 << this->backend_idx);
-    }
+    // Marking all states as updated at once would serialize all of them
+    // in the next API tick. resend_states paces this instead.
+    resend_next_state = 0;
+    resending_states = true;
+    publish_queue_state.get("connect_resend_ms")->updateUint(0);
 
     this->global_topic_prefix_subscribed = false;
     for (auto &cmd : this->commands) {
@@ -340,6 +732,16 @@ void Mqtt::onMqttDisconnect()
         logger.printfln("Disconnected from broker.");
 
     this->state.get("connection_state")->updateEnum(MqttConnectionState::NotConnected);
+    connected = false;
+    // All states are marked as updated on the next connect.
+    clear_publish_queue();
+    resending_states = false;
+
+    for (auto &mqtt_state : states) {
+        mqtt_state.pending = 0;
+    }
+    pending_state_count = 0;
+
     if (was_connected) {
         was_connected = false;
         uint32_t now = millis();
@@ -691,6 +1093,24 @@ void Mqtt::setup()
 
     esp_mqtt_client_register_event(client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, mqtt_event_handler, this);
 
+    queued_messages = new MqttMessage[MQTT_PUBLISH_QUEUE_LENGTH];
+
+    // Same priority as the main loop.
+    if (xTaskCreate(mqtt_publish_task, "mqtt_publish", MQTT_PUBLISH_TASK_STACK_SIZE, this, tskIDLE_PRIORITY + 1, &publish_task_handle) != pdPASS) {
+        logger.printfln("Could not create MQTT publish task");
+        publish_task_handle = nullptr;
+    }
+
+    task_scheduler.scheduleWithFixedDelay([this](){
+        this->update_publish_queue_state();
+    }, 5_s, 5_s);
+
+    // Same period as the API state loop.
+    task_scheduler.scheduleWithFixedDelay([this](){
+        this->resend_states();
+        this->flush_pending_states();
+    }, 250_ms, 250_ms);
+
     task_scheduler.scheduleWithFixedDelay([this](){
         this->resubscribe();
     }, 1_s, 1_s);
@@ -700,6 +1120,7 @@ void Mqtt::register_urls()
 {
     api.addPersistentConfig("mqtt/config", &config, {"broker_password"});
     api.addState("mqtt/state", &state);
+    api.addState("mqtt/publish_queue", &publish_queue_state);
 
 #if MODULE_AUTOMATION_AVAILABLE()
     if (automation.has_task_with_trigger(AutomationTriggerID::MQTT) && config.get("enable_mqtt")->asBool()) {
@@ -738,6 +1159,12 @@ void Mqtt::register_events()
         return;
     }
 
+#if MODULE_DEBUG_AVAILABLE()
+    if (publish_task_handle != nullptr) {
+        debug.register_task(publish_task_handle, MQTT_PUBLISH_TASK_STACK_SIZE);
+    }
+#endif
+
     // Start MQTT client here to make sure all handlers are already registered.
     event.registerEvent("network/state", {"connected"}, [this](const Config *connected) {
         if (connected->asBool()) {
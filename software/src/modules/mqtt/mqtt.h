@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <mqtt_client.h>
+#include <mutex>
 
 #include "module.h"
 #include "config.h"
@@ -65,8 +67,11 @@ public:
     void pre_reboot() override;
 
     // Retain messages by default because we only send on change.
+    // Both only queue the message. It is published by the publish task.
     bool publish_with_prefix(const String &path, const String &payload, bool retain = true);
     bool publish(const String &topic, const String &payload, bool retain);
+    // Free entries of the queue used by publish. Used to pace bulk publishing.
+    size_t get_free_publish_queue_slots();
 
     void subscribe(const String &path, SubscribeCallback &&callback, Retained retained, CallbackInThread callback_in_thread = CallbackInThread::Main, AddPrefix add_prefix = AddPrefix::No);
 
@@ -84,12 +89,15 @@ public:
 
     void resubscribe();
 
+    void publish_task();
+
 #if MODULE_AUTOMATION_AVAILABLE()
     bool has_triggered(const Config *conf, void *data) override;
 #endif
 
     ConfigRoot config;
     ConfigRoot state;
+    ConfigRoot publish_queue_state;
 
     // Both strings are read by mqtt_auto_discovery.
     String client_name;
@@ -106,8 +114,10 @@ private:
         bool subscribed;
     };
 
+    // Allocated in IRAM: Only 32 bit members are allowed.
     struct MqttState {
         uint32_t last_send_ms;
+        uint32_t pending; // Update was held back by the send interval. Flushed by flush_pending_states.
     };
 
     struct MqttMessage {
@@ -116,8 +126,60 @@ private:
         bool retained;
     };
 
+    // Latest value wins: A state update replaces the queued payload of the same state.
+    struct MqttQueuedState {
+        String topic; // with global topic prefix
+        String payload;
+        bool queued;
+    };
+
+    bool take_next_message(MqttMessage *msg);
+    void clear_publish_queue();
+    void update_publish_queue_state();
+    void flush_pending_states();
+    void resend_states();
+
     std::vector<MqttCommand> commands;
     std::vector<MqttState, IRAMAlloc<MqttState>> states;
+    size_t pending_state_count = 0;
+    uint32_t flush_deadline_ms = 0; // earliest send deadline of all pending states
+
+    // All states are marked as updated in batches after connecting.
+    size_t resend_next_state = 0;
+    uint32_t resend_marked_all_ms = 0;
+    bool resending_states = false;
+
+    // Main thread only. Serializations caused by this backend vs. queued state updates.
+    uint32_t state_serializations = 0;
+    uint32_t state_updates = 0;
+
+    // Protects everything below that is accessed by the publish task.
+    std::mutex publish_mutex;
+    std::vector<MqttQueuedState> queued_states;
+    std::vector<MqttQueuedState> queued_raw_states; // by topic, see pushRawStateUpdate
+    size_t queued_state_count = 0;
+    size_t next_queued_state = 0;
+    MqttMessage *queued_messages = nullptr; // ring buffer
+    size_t queued_message_head = 0;
+    size_t queued_message_count = 0;
+
+    TaskHandle_t publish_task_handle = nullptr;
+    std::atomic<bool> connected{false}; // onMqttConnect was called, read by the publish task
+
+    // Written by the publish task.
+    uint32_t published = 0;
+    uint32_t publish_failed = 0;
+    uint32_t publish_max_us = 0;
+    uint32_t publish_total_us = 0;
+
+    // Main thread only, to calculate publish_avg_us.
+    uint32_t last_published = 0;
+    uint32_t last_publish_total_us = 0;
+
+    // Written by the main thread and the MQTT thread.
+    std::atomic<uint32_t> coalesced{0};
+    std::atomic<uint32_t> queue_full{0};
+    std::atomic<uint32_t> enqueue_max_us{0};
 
     size_t backend_idx;
 
@@ -22,6 +22,7 @@
 
 #include "mqtt_auto_discovery.h"
 
+#include <esp_rom_crc.h>
 #include <string.h>
 #include <mqtt_client.h>
 
@@ -29,6 +30,11 @@
 #include "module_dependencies.h"
 #include "build.h"
 
+// Time to wait after connecting for the broker to send the retained discovery documents.
+#define MQTT_AUTO_DISCOVERY_RETAINED_WAIT 3_s
+// Wait while the MQTT publish queue has fewer free slots.
+#define MQTT_AUTO_DISCOVERY_MIN_FREE_PUBLISH_SLOTS 8
+
 void MqttAutoDiscovery::pre_setup()
 {
     config = ConfigRoot{Config::Object({
@@ -73,7 +79,7 @@ void MqttAutoDiscovery::setup()
     discovery_topic.concat("/+/config");
 
     mqtt.subscribe(discovery_topic, [this](const char *topic, size_t topic_len, char *data, size_t data_len) {
-        check_discovery_topic(topic, topic_len, data_len);
+        check_discovery_topic(topic, topic_len, data, data_len);
     }, Mqtt::Retained::Accept);
 }
 
@@ -138,15 +144,14 @@ void MqttAutoDiscovery::subscribe_to_own()
 {
 }
 
-void MqttAutoDiscovery::check_discovery_topic(const char *topic, size_t topic_len, size_t data_len)
+void MqttAutoDiscovery::check_discovery_topic(const char *topic, size_t topic_len, const char *data, size_t data_len)
 {
     // auto discovery is disabled. remove all entities
     if (this->mode == MqttAutoDiscoveryMode::Disabled) {
         if (data_len == 0) //already removed
             return;
 
-        String tp(topic, topic_len);
-        mqtt.publish(tp, String(), true);
+        remove_topic(String(topic, topic_len));
         return;
     }
 
@@ -155,7 +160,9 @@ void MqttAutoDiscovery::check_discovery_topic(const char *topic, size_t topic_le
             continue;
 
         if (memcmp(mqtt_discovery_topics[i].full_path.c_str(), topic, topic_len) == 0) {
-            // Discovery topic is known; nothing to do.
+            // Discovery topic is known. Remember what the broker has to not publish the same document again.
+            mqtt_discovery_topics[i].broker_crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(data), data_len);
+            mqtt_discovery_topics[i].broker_crc_valid = true;
             return;
         }
     }
@@ -169,7 +176,60 @@ void MqttAutoDiscovery::check_discovery_topic(const char *topic, size_t topic_le
 
     // Unknown discovery topic with data; needs to be removed by sending a retained empty payload.
     logger.printfln("Removing unused topic '%s'.", tp.c_str());
-    mqtt.publish(tp, String(), true);
+    remove_topic(std::move(tp));
+}
+
+// The broker sends all retained discovery topics at once after subscribing,
+// which can be more removals than fit into the publish queue. They are kept
+// in a list and published as fast as the queue allows.
+void MqttAutoDiscovery::remove_topic(String &&topic)
+{
+    for (const String &pending : topics_to_remove) {
+        if (pending == topic)
+            return;
+    }
+
+    topics_to_remove.push_back(std::move(topic));
+
+    if (remove_task_id != 0)
+        return;
+
+    remove_task_id = task_scheduler.scheduleOnce([this](){
+        this->remove_next_topics();
+    });
+}
+
+void MqttAutoDiscovery::remove_next_topics()
+{
+    remove_task_id = 0;
+
+    // The broker sends the retained topics again after reconnecting.
+    if (mqtt.state.get("connection_state")->asEnum<MqttConnectionState>() != MqttConnectionState::Connected) {
+        topics_to_remove.clear();
+        topics_to_remove.shrink_to_fit();
+        return;
+    }
+
+    size_t removed = 0;
+
+    // Leave room in the queue for other messages.
+    while (removed < topics_to_remove.size() && mqtt.get_free_publish_queue_slots() >= MQTT_AUTO_DISCOVERY_MIN_FREE_PUBLISH_SLOTS) {
+        if (!mqtt.publish(topics_to_remove[removed], String(), true))
+            break;
+
+        ++removed;
+    }
+
+    topics_to_remove.erase(topics_to_remove.begin(), topics_to_remove.begin() + removed);
+
+    if (topics_to_remove.empty()) {
+        topics_to_remove.shrink_to_fit();
+        return;
+    }
+
+    remove_task_id = task_scheduler.scheduleOnce([this](){
+        this->remove_next_topics();
+    }, 100_ms);
 }
 
 void MqttAutoDiscovery::reschedule_announce_next_topic()
@@ -183,90 +243,147 @@ void MqttAutoDiscovery::reschedule_announce_next_topic()
     }, 1_s);
 }
 
+bool MqttAutoDiscovery::build_payload(uint32_t topic_num, String *payload)
+{
+    if (!api.hasFeature(mqtt_discovery_topic_infos[topic_num].feature))
+        return false;
+
+    const char *static_info = mqtt_discovery_topic_infos[topic_num].static_infos[config_in_use.get("auto_discovery_mode")->asUint() - 1];
+    if (!static_info) // No static info? Skip topic.
+        return false;
+
+    const String &client_name = mqtt.client_name;
+    const String &topic_prefix = mqtt.global_topic_prefix;
+#if MODULE_SYSTEM_AVAILABLE()
+    const char *name = (system_.get_system_language() == Language::English) ? mqtt_discovery_topic_infos[topic_num].name_en : mqtt_discovery_topic_infos[topic_num].name_de;
+#else
+    const char *name = mqtt_discovery_topic_infos[topic_num].name_de;
+#endif
+
+    // FIXME: convert to StringBuilder and TFJson
+    // MQTT_DISCOVERY_MAX_JSON_LENGTH: max length generated by prepare.py
+    // 240: String literals
+    // 5*64: topic_prefix (thrice) and client name (twice)
+    // 250: device_info
+    payload->reserve(MQTT_DISCOVERY_MAX_JSON_LENGTH + 240 + 5 * 64 + 250);
+
+    payload->concat("{\"name\":\"");
+    payload->concat(name);
+    payload->concat("\",\"unique_id\":\"");
+    payload->concat(client_name);
+    payload->concat('-');
+    payload->concat(mqtt_discovery_topic_infos[topic_num].object_id);
+    payload->concat("\",\"object_id\":\"");
+    payload->concat(client_name);
+    payload->concat('-');
+    payload->concat(mqtt_discovery_topic_infos[topic_num].object_id);
+    payload->concat("\",");
+    switch (mqtt_discovery_topic_infos[topic_num].type) {
+        case MqttDiscoveryType::StateAndUpdate:
+            payload->concat("\"command_topic\":\"");
+            payload->concat(topic_prefix);
+            payload->concat('/');
+            payload->concat(mqtt_discovery_topic_infos[topic_num].path);
+            payload->concat("_update\",");
+            /* FALLTHROUGH */
+        case MqttDiscoveryType::StateOnly:
+            payload->concat("\"state_topic\":\"");
+            payload->concat(topic_prefix);
+            payload->concat('/');
+            payload->concat(mqtt_discovery_topic_infos[topic_num].path);
+            payload->concat("\",");
+            break;
+        case MqttDiscoveryType::CommandOnly:
+            payload->concat("\"command_topic\":\"");
+            payload->concat(topic_prefix);
+            payload->concat('/');
+            payload->concat(mqtt_discovery_topic_infos[topic_num].path);
+            payload->concat("\",");
+            break;
+    }
+    if (mqtt_discovery_topic_infos[topic_num].availability_path[0] != 0) {
+        payload->concat("\"availability\":{\"topic\":\"");
+        payload->concat(topic_prefix);
+        payload->concat('/');
+        payload->concat(mqtt_discovery_topic_infos[topic_num].availability_path);
+        payload->concat("\",\"payload_available\":\"");
+        payload->concat(mqtt_discovery_topic_infos[topic_num].availability_yes);
+        payload->concat("\",\"payload_not_available\":\"");
+        payload->concat(mqtt_discovery_topic_infos[topic_num].availability_no);
+        payload->concat("\"},");
+    }
+    payload->concat(static_info);
+    payload->concat(',');
+    payload->concat(device_info);
+    payload->concat('}');
+
+    return true;
+}
+
+// The own discovery topics are subscribed to, so the broker sends its
+// retained documents after connecting and echoes every document published
+// here. A document is only published if its CRC differs from the broker's.
+// Documents are built one at a time and at most one is published per
+// main loop iteration. While the MQTT publish queue is more than half full,
+// the pass waits.
 void MqttAutoDiscovery::announce_next_topic(uint32_t topic_num)
 {
-    seconds_t delay = 0_s;
+    millis_t delay = 0_ms;
 
     if (mqtt.state.get("connection_state")->asEnum<MqttConnectionState>() != MqttConnectionState::Connected) {
         topic_num = 0;
         delay = 5_s;
+    } else if (mqtt.state.get("connection_start")->asUint() != connection_start) {
+        // New connection: The broker could have lost documents. Wait for its retained documents.
+        connection_start = mqtt.state.get("connection_start")->asUint();
+
+        for (size_t i = 0; i < MQTT_DISCOVERY_TOPIC_COUNT; ++i) {
+            mqtt_discovery_topics[i].broker_crc_valid = false;
+        }
+
+        topic_num = 0;
+        first_pass_after_connect = true;
+        pass_published = 0;
+        pass_unchanged = 0;
+        delay = MQTT_AUTO_DISCOVERY_RETAINED_WAIT;
+    } else if (mqtt.get_free_publish_queue_slots() < MQTT_AUTO_DISCOVERY_MIN_FREE_PUBLISH_SLOTS) {
+        delay = 100_ms;
     } else {
         // deal with one topic
-        if (api.hasFeature(mqtt_discovery_topic_infos[topic_num].feature)) {
-            const char *static_info = mqtt_discovery_topic_infos[topic_num].static_infos[config_in_use.get("auto_discovery_mode")->asUint() - 1];
-            if (static_info) { // No static info? Skip topic.
-                const String &client_name = mqtt.client_name;
-                const String &topic_prefix = mqtt.global_topic_prefix;
-#if MODULE_SYSTEM_AVAILABLE()
-                const char *name = (system_.get_system_language() == Language::English) ? mqtt_discovery_topic_infos[topic_num].name_en : mqtt_discovery_topic_infos[topic_num].name_de;
-#else
-                const char *name = mqtt_discovery_topic_infos[topic_num].name_de;
-#endif
-
-                // FIXME: convert to StringBuilder and TFJson
-                String payload;
-                // MQTT_DISCOVERY_MAX_JSON_LENGTH: max length generated by prepare.py
-                // 240: String literals
-                // 5*64: topic_prefix (thrice) and client name (twice)
-                // 250: device_info
-                payload.reserve(MQTT_DISCOVERY_MAX_JSON_LENGTH + 240 + 5 * 64 + 250);
-
-                payload.concat("{\"name\":\"");
-                payload.concat(name);
-                payload.concat("\",\"unique_id\":\"");
-                payload.concat(client_name);
-                payload.concat('-');
-                payload.concat(mqtt_discovery_topic_infos[topic_num].object_id);
-                payload.concat("\",\"object_id\":\"");
-                payload.concat(client_name);
-                payload.concat('-');
-                payload.concat(mqtt_discovery_topic_infos[topic_num].object_id);
-                payload.concat("\",");
-                switch (mqtt_discovery_topic_infos[topic_num].type) {
-                    case MqttDiscoveryType::StateAndUpdate:
-                        payload.concat("\"command_topic\":\"");
-                        payload.concat(topic_prefix);
-                        payload.concat('/');
-                        payload.concat(mqtt_discovery_topic_infos[topic_num].path);
-                        payload.concat("_update\",");
-                        /* FALLTHROUGH */
-                    case MqttDiscoveryType::StateOnly:
-                        payload.concat("\"state_topic\":\"");
-                        payload.concat(topic_prefix);
-                        payload.concat('/');
-                        payload.concat(mqtt_discovery_topic_infos[topic_num].path);
-                        payload.concat("\",");
-                        break;
-                    case MqttDiscoveryType::CommandOnly:
-                        payload.concat("\"command_topic\":\"");
-                        payload.concat(topic_prefix);
-                        payload.concat('/');
-                        payload.concat(mqtt_discovery_topic_infos[topic_num].path);
-                        payload.concat("\",");
-                        break;
-                }
-                if (mqtt_discovery_topic_infos[topic_num].availability_path[0] != 0) {
-                    payload.concat("\"availability\":{\"topic\":\"");
-                    payload.concat(topic_prefix);
-                    payload.concat('/');
-                    payload.concat(mqtt_discovery_topic_infos[topic_num].availability_path);
-                    payload.concat("\",\"payload_available\":\"");
-                    payload.concat(mqtt_discovery_topic_infos[topic_num].availability_yes);
-                    payload.concat("\",\"payload_not_available\":\"");
-                    payload.concat(mqtt_discovery_topic_infos[topic_num].availability_no);
-                    payload.concat("\"},");
-                }
-                payload.concat(static_info);
-                payload.concat(',');
-                payload.concat(device_info);
-                payload.concat('}');
-
-                mqtt.publish(mqtt_discovery_topics[topic_num].full_path, payload, true);
+        String payload;
+
+        if (build_payload(topic_num, &payload)) {
+            DiscoveryTopic &topic = mqtt_discovery_topics[topic_num];
+            uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(payload.c_str()), payload.length());
+
+            if (topic.broker_crc_valid && topic.broker_crc == crc) {
+                ++pass_unchanged;
+            } else if (mqtt.publish(topic.full_path, payload, true)) {
+                // The echo from the broker confirms this.
+                topic.broker_crc = crc;
+                topic.broker_crc_valid = true;
+                ++pass_published;
+            } else {
+                // Queue full or disconnected. Try this topic again.
+                task_id = task_scheduler.scheduleOnce([this, topic_num](){
+                    this->announce_next_topic(topic_num);
+                }, 100_ms);
+                return;
             }
         }
 
         if (++topic_num >= MQTT_DISCOVERY_TOPIC_COUNT) {
+            if (first_pass_after_connect) {
+                uint32_t since_connect_ms = millis() - connection_start;
+                logger.printfln("Checked discovery topics %u ms after connecting: %u published, %u unchanged.", since_connect_ms, pass_published, pass_unchanged);
+            } else if (pass_published > 0) {
+                logger.printfln("Published %u changed discovery topics.", pass_published);
+            }
+
             topic_num = 0;
+            first_pass_after_connect = false;
+            pass_published = 0;
+            pass_unchanged = 0;
             delay = 15_m;
         }
     }
@@ -44,6 +44,8 @@ private:
 
     struct DiscoveryTopic {
         String full_path;
+        uint32_t broker_crc; // CRC32 of the retained document the broker has
+        bool broker_crc_valid;
     };
 
     struct DiscoveryTopic mqtt_discovery_topics[MQTT_DISCOVERY_TOPIC_COUNT];
@@ -52,8 +54,21 @@ private:
 
     uint64_t task_id = 0;
     void announce_next_topic(uint32_t next_topic);
+    bool build_payload(uint32_t topic_num, String *payload);
+
+    // Connection the broker CRCs belong to, identified by mqtt/state's connection_start.
+    uint32_t connection_start = 0;
+    bool first_pass_after_connect = false;
+    uint32_t pass_published = 0;
+    uint32_t pass_unchanged = 0;
 
     void prepare_topics();
     void subscribe_to_own();
-    void check_discovery_topic(const char *topic, size_t topic_len, size_t data_len);
+    void check_discovery_topic(const char *topic, size_t topic_len, const char *data, size_t data_len);
+
+    // Discovery topics that have to be removed by publishing an empty retained message.
+    std::vector<String> topics_to_remove;
+    uint64_t remove_task_id = 0;
+    void remove_topic(String &&topic);
+    void remove_next_topics();
 };
@@ -28,6 +28,10 @@
 #include <mbedtls/base64.h>
 #include <esp_transport_ws.h>
 #include <LittleFS.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define TRACE_LOG_PREFIX nullptr
 
@@ -36,6 +40,7 @@
 #include "tf_websocket_client.h"
 #include "build.h"
 #include "ocpp.h"
+#include "ocpp_journal.h"
 #include "modules/meters/meter_defs.h"
 
 static bool feature_evse = false;
@@ -520,6 +525,49 @@ const size_t supported_measurand_offsets_sdm72v2[] = {
     38  /*NONE*/
 };
 
+// Where the value of a measurand/phase combination comes from. Resolved once
+// per combination, so that sampling does not have to go through the measurand
+// switch and look up API states by path for every sampled value.
+enum class MeterValueSource : uint8_t {
+    Zero,
+    Value,                // all_values[value_index]
+    ValueIfImport,        // all_values[value_index] if all_values[sign_index] >= 0
+    ValueIfExport,        // all_values[value_index] if all_values[sign_index] < 0
+    NegatedValueIfExport, // -all_values[value_index] if all_values[sign_index] < 0
+    AbsValue,             // fabs(all_values[value_index])
+    PowerOffered,
+    CurrentOffered,
+};
+
+struct MeterValueSample {
+    SampledValueMeasurand measurand;
+    SampledValuePhase phase;
+    MeterValueSource source;
+    uint8_t value_index;
+    uint8_t sign_index;
+    uint8_t phase_index; // for PowerOffered and CurrentOffered
+    float value;
+};
+
+static_assert(METER_ALL_VALUES_LEGACY_COUNT <= UINT8_MAX, "meter value indices don't fit into MeterValueSample");
+
+// All sampled values of one MeterValues message are taken from the same
+// snapshot, that is refreshed once the sampled values are older than this.
+#define METER_VALUE_SNAPSHOT_MAX_AGE 100_ms
+
+// Only one connector is supported: The table is shared by all connector IDs.
+static std::vector<MeterValueSample> meter_value_samples;
+static uint32_t meter_value_snapshot_time = 0;
+static bool meter_value_snapshot_valid = false;
+
+#ifdef OCPP_DEBUG
+static OcppMeterValueStats meter_value_stats = {};
+#endif
+
+static const Config *meter_all_values_state = nullptr;
+static const Config *meter_phases_connected_state = nullptr;
+static const Config *evse_allowed_charging_current_state = nullptr;
+
 static uint8_t meter_type = 0;
 static const SupportedMeasurand *supported_measurands = nullptr;
 static size_t supported_measurands_len = 0;
@@ -533,6 +581,11 @@ void update_meter_type()
     REQUIRE_FEATURE(meter, );
 
     meter_type = api.getState("meter/state")->get("type")->asUint();
+
+    // Resolved by platform_get_raw_meter_value for the measurands the OCPP library samples.
+    meter_value_samples.clear();
+    meter_value_snapshot_valid = false;
+
     if (meter_type == METER_TYPE_SDM72DMV2) {
         supported_measurands = supported_measurands_sdm72v2;
         supported_measurands_len = ARRAY_SIZE(supported_measurands_sdm72v2);
@@ -542,6 +595,9 @@ void update_meter_type()
         supported_measurands_len = ARRAY_SIZE(supported_measurands_sdm630);
         supported_measurand_offsets = supported_measurand_offsets_sdm630;
     }
+
+    if (supported_measurands != nullptr)
+        meter_value_samples.reserve(supported_measurands_len);
 }
 
 size_t platform_get_supported_measurand_count(int32_t connector_id, SampledValueMeasurand measurand) {
@@ -575,20 +631,58 @@ const SupportedMeasurand *platform_get_supported_measurands(int32_t connector_id
     return supported_measurands + supported_measurand_offsets[(size_t)measurand];
 }
 
-float platform_get_raw_meter_value_common(const Config *meter_all_values, int32_t connectorId, SampledValueMeasurand measurand, SampledValuePhase phase, SampledValueLocation location) {
+static MeterValueSample resolve_meter_value(SampledValueMeasurand measurand, SampledValuePhase phase)
+{
+    MeterValueSample sample;
+    sample.measurand = measurand;
+    sample.phase = phase;
+    sample.source = MeterValueSource::Zero;
+    sample.value_index = 0;
+    sample.sign_index = 0;
+    sample.phase_index = 0;
+    sample.value = 0.0f;
+
+    auto set = [&sample](MeterValueSource source, size_t value_index, size_t sign_index = 0) {
+        if (value_index >= METER_ALL_VALUES_LEGACY_COUNT || sign_index >= METER_ALL_VALUES_LEGACY_COUNT)
+            return;
+
+        sample.source = source;
+        sample.value_index = (uint8_t)value_index;
+        sample.sign_index = (uint8_t)sign_index;
+    };
+
     switch (measurand) {
+        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_REGISTER:
+            if (meter_type == METER_TYPE_SDM630)
+                set(MeterValueSource::Value, METER_ALL_VALUES_EXPORT_KWH_L1 + (size_t) phase);
+            else if (meter_type == METER_TYPE_SDM72DMV2)
+                set(MeterValueSource::Value, METER_ALL_VALUES_TOTAL_EXPORT_KWH);
+            break;
+        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_REGISTER:
+            if (meter_type == METER_TYPE_SDM630)
+                set(MeterValueSource::Value, METER_ALL_VALUES_IMPORT_KWH_L1 + (size_t) phase);
+            else if (meter_type == METER_TYPE_SDM72DMV2)
+                set(MeterValueSource::Value, METER_ALL_VALUES_TOTAL_IMPORT_KWH);
+            break;
+        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_REGISTER:
+            if (meter_type == METER_TYPE_SDM630)
+                set(MeterValueSource::Value, METER_ALL_VALUES_EXPORT_KVARH_L1 + (size_t) phase);
+            break;
+        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_REGISTER:
+            if (meter_type == METER_TYPE_SDM630)
+                set(MeterValueSource::Value, METER_ALL_VALUES_IMPORT_KVARH_L1 + (size_t) phase);
+            break;
+
         case SampledValueMeasurand::POWER_ACTIVE_EXPORT:
             // The power factor's sign indicates the direction of the current flow.
             // Positive = energy flow from grid to vehicle = import
             // The active power itself is negative if the power factor's sign is negative.
             // Report a positive value instead.
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() < 0 ?
-                   -meter_all_values->get(METER_ALL_VALUES_POWER_L1_W + (size_t) phase)->asFloat() :
-                   0.0f;
+            set(MeterValueSource::NegatedValueIfExport, METER_ALL_VALUES_POWER_L1_W + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
         case SampledValueMeasurand::POWER_ACTIVE_IMPORT:
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() >= 0 ?
-                   meter_all_values->get(METER_ALL_VALUES_POWER_L1_W + (size_t) phase)->asFloat() :
-                   0.0f;
+            set(MeterValueSource::ValueIfImport, METER_ALL_VALUES_POWER_L1_W + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
 
         case SampledValueMeasurand::POWER_OFFERED:
             /*
@@ -603,25 +697,22 @@ float platform_get_raw_meter_value_common(const Config *meter_all_values, int32_
             110 volt).
             */
             // Thus we use 230 to calculate the offered power. This ideally matches the power of the active ChargingSchedulePeriod.
-            REQUIRE_FEATURE(meter_phases, 0);
-            REQUIRE_FEATURE(evse, 0);
-            return api.getState("meter/phases")->get("phases_connected")->get((size_t) phase)->asBool() ?
-                   (((float)api.getState("evse/state")->get("allowed_charging_current")->asUint()) / 1000.0f) * 230.0f :
-                   0.0f;
+            set(MeterValueSource::PowerOffered, 0);
+            sample.phase_index = (uint8_t) phase;
+            break;
 
         case SampledValueMeasurand::POWER_REACTIVE_EXPORT:
             // Reactive power sign indicates capatitive/inductive load.
             // Use power factor sign to determine current flow direction.
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() < 0 ?
-                   meter_all_values->get(METER_ALL_VALUES_VOLT_AMPS_REACTIVE_L1 + (size_t) phase)->asFloat() :
-                   0.0f;
+            set(MeterValueSource::ValueIfExport, METER_ALL_VALUES_VOLT_AMPS_REACTIVE_L1 + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
         case SampledValueMeasurand::POWER_REACTIVE_IMPORT:
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() >= 0 ?
-                   meter_all_values->get(METER_ALL_VALUES_VOLT_AMPS_REACTIVE_L1 + (size_t) phase)->asFloat() :
-                   0.0f;
+            set(MeterValueSource::ValueIfImport, METER_ALL_VALUES_VOLT_AMPS_REACTIVE_L1 + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
 
         case SampledValueMeasurand::POWER_FACTOR:
-            return fabs(meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat());
+            set(MeterValueSource::AbsValue, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
 
         case SampledValueMeasurand::CURRENT_EXPORT:
             // Current is always positive. Use power factor sign to determine current flow direction.
@@ -629,59 +720,51 @@ float platform_get_raw_meter_value_common(const Config *meter_all_values, int32_
             // is positive, current is flowing into the vehicle (this is an import), thus the neutral current
             // is exported.
             if (phase == SampledValuePhase::N)
-                return meter_all_values->get(METER_ALL_VALUES_TOTAL_SYSTEM_POWER_FACTOR)->asFloat() >= 0 ?
-                       meter_all_values->get(METER_ALL_VALUES_NEUTRAL_CURRENT_A)->asFloat() :
-                       0.0f;
-
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() < 0 ?
-                   meter_all_values->get(METER_ALL_VALUES_CURRENT_L1_A + (size_t) phase)->asFloat() :
-                   0.0f;
+                set(MeterValueSource::ValueIfImport, METER_ALL_VALUES_NEUTRAL_CURRENT_A, METER_ALL_VALUES_TOTAL_SYSTEM_POWER_FACTOR);
+            else
+                set(MeterValueSource::ValueIfExport, METER_ALL_VALUES_CURRENT_L1_A + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
 
         case SampledValueMeasurand::CURRENT_IMPORT:
             if (phase == SampledValuePhase::N)
-                return meter_all_values->get(METER_ALL_VALUES_TOTAL_SYSTEM_POWER_FACTOR)->asFloat() < 0 ?
-                       meter_all_values->get(METER_ALL_VALUES_NEUTRAL_CURRENT_A)->asFloat() :
-                       0.0f;
-
-            // Current is always positive. Use power factor sign to determine current flow direction.
-            return meter_all_values->get(METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase)->asFloat() >= 0 ?
-                   meter_all_values->get(METER_ALL_VALUES_CURRENT_L1_A + (size_t) phase)->asFloat() :
-                   0.0f;
+                set(MeterValueSource::ValueIfExport, METER_ALL_VALUES_NEUTRAL_CURRENT_A, METER_ALL_VALUES_TOTAL_SYSTEM_POWER_FACTOR);
+            else
+                // Current is always positive. Use power factor sign to determine current flow direction.
+                set(MeterValueSource::ValueIfImport, METER_ALL_VALUES_CURRENT_L1_A + (size_t) phase, METER_ALL_VALUES_POWER_FACTOR_L1 + (size_t) phase);
+            break;
 
         case SampledValueMeasurand::CURRENT_OFFERED:
-            REQUIRE_FEATURE(meter_phases, 0);
-            REQUIRE_FEATURE(evse, 0);
-            return api.getState("meter/phases")->get("phases_connected")->get((size_t) phase)->asBool() ?
-                   ((float)api.getState("evse/state")->get("allowed_charging_current")->asUint()) / 1000.0f :
-                   0.0f;
+            set(MeterValueSource::CurrentOffered, 0);
+            sample.phase_index = (uint8_t) phase;
+            break;
+
         case SampledValueMeasurand::VOLTAGE:
             switch (phase) {
                 case SampledValuePhase::L1_N:
                 case SampledValuePhase::L2_N:
                 case SampledValuePhase::L3_N:
-                    return meter_all_values->get(METER_ALL_VALUES_LINE_TO_NEUTRAL_VOLTS_L1 + ((size_t) phase - (size_t) SampledValuePhase::L1_N))->asFloat();
+                    set(MeterValueSource::Value, METER_ALL_VALUES_LINE_TO_NEUTRAL_VOLTS_L1 + ((size_t) phase - (size_t) SampledValuePhase::L1_N));
+                    break;
 
                 case SampledValuePhase::L1_L2:
                 case SampledValuePhase::L2_L3:
                 case SampledValuePhase::L3_L1:
-                    return meter_all_values->get(METER_ALL_VALUES_LINE1_TO_LINE2_VOLTS + ((size_t) phase - (size_t) SampledValuePhase::L1_L2))->asFloat();
+                    set(MeterValueSource::Value, METER_ALL_VALUES_LINE1_TO_LINE2_VOLTS + ((size_t) phase - (size_t) SampledValuePhase::L1_L2));
+                    break;
 
                 case SampledValuePhase::L1:
                 case SampledValuePhase::L2:
                 case SampledValuePhase::L3:
                 case SampledValuePhase::N:
                 case SampledValuePhase::NONE:
-                    return 0.0f;
+                    break;
             }
-            return 0.0f;
+            break;
 
         case SampledValueMeasurand::FREQUENCY:
-            return meter_all_values->get(METER_ALL_VALUES_FREQUENCY_OF_SUPPLY_VOLTAGES_HERTZ)->asFloat();
+            set(MeterValueSource::Value, METER_ALL_VALUES_FREQUENCY_OF_SUPPLY_VOLTAGES_HERTZ);
+            break;
 
-        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_REGISTER:
-        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_REGISTER:
-        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_REGISTER:
-        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_REGISTER:
         case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_INTERVAL:
         case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_INTERVAL:
         case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_INTERVAL:
@@ -690,109 +773,161 @@ float platform_get_raw_meter_value_common(const Config *meter_all_values, int32_
         case SampledValueMeasurand::SO_C:
         case SampledValueMeasurand::RPM:
         case SampledValueMeasurand::NONE:
-            return 0.0f;
+            break;
     }
-    return 0.0f;
+
+    return sample;
 }
 
-float platform_get_raw_meter_value_sdm630(int32_t connectorId, SampledValueMeasurand measurand, SampledValuePhase phase, SampledValueLocation location) {
-    if (connectorId != 1)
-        return 0.0f;
+static void resolve_meter_value_states()
+{
+    if (meter_all_values_state == nullptr && (feature_meter_all_values || api.hasFeature("meter_all_values"))) {
+        feature_meter_all_values = true;
+        meter_all_values_state = api.getState("meter/all_values");
+    }
 
-    REQUIRE_FEATURE(meter_all_values, 0);
+    if (meter_phases_connected_state == nullptr && (feature_meter_phases || api.hasFeature("meter_phases"))) {
+        feature_meter_phases = true;
+        const Config *meter_phases = api.getState("meter/phases");
+        if (meter_phases != nullptr)
+            meter_phases_connected_state = static_cast<const Config *>(meter_phases->get("phases_connected"));
+    }
 
-    const Config *meter_all_values = api.getState("meter/all_values");
+    if (evse_allowed_charging_current_state == nullptr && (feature_evse || api.hasFeature("evse"))) {
+        feature_evse = true;
+        const Config *evse_state = api.getState("evse/state");
+        if (evse_state != nullptr)
+            evse_allowed_charging_current_state = static_cast<const Config *>(evse_state->get("allowed_charging_current"));
+    }
+}
 
-    switch (measurand) {
-        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_EXPORT_KWH_L1 + (size_t)phase)->asFloat();
-        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_IMPORT_KWH_L1 + (size_t)phase)->asFloat();
-        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_EXPORT_KVARH_L1 + (size_t)phase)->asFloat();
-        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_IMPORT_KVARH_L1 + (size_t)phase)->asFloat();
+static float get_all_value(size_t index)
+{
+    // The meter's values are filled in after the meter type was detected.
+    if (index >= meter_all_values_state->count())
+        return NAN;
 
-        case SampledValueMeasurand::POWER_ACTIVE_EXPORT:
-        case SampledValueMeasurand::POWER_ACTIVE_IMPORT:
-        case SampledValueMeasurand::POWER_OFFERED:
-        case SampledValueMeasurand::POWER_REACTIVE_EXPORT:
-        case SampledValueMeasurand::POWER_REACTIVE_IMPORT:
-        case SampledValueMeasurand::POWER_FACTOR:
-        case SampledValueMeasurand::CURRENT_EXPORT:
-        case SampledValueMeasurand::CURRENT_IMPORT:
-        case SampledValueMeasurand::CURRENT_OFFERED:
-        case SampledValueMeasurand::VOLTAGE:
-        case SampledValueMeasurand::FREQUENCY:
-            return platform_get_raw_meter_value_common(meter_all_values, connectorId, measurand, phase, location);
+    return meter_all_values_state->get(index)->asFloat();
+}
 
-        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_INTERVAL:
-        case SampledValueMeasurand::TEMPERATURE:
-        case SampledValueMeasurand::SO_C:
-        case SampledValueMeasurand::RPM:
-        case SampledValueMeasurand::NONE:
-            return 0.0f;
+// Samples all measurands that the OCPP library has requested so far in one pass.
+static void update_meter_value_snapshot()
+{
+    resolve_meter_value_states();
+
+    float allowed_current = evse_allowed_charging_current_state == nullptr ? 0.0f : ((float)evse_allowed_charging_current_state->asUint()) / 1000.0f;
+
+    for (MeterValueSample &sample : meter_value_samples) {
+        switch (sample.source) {
+            case MeterValueSource::Zero:
+                sample.value = 0.0f;
+                continue;
+
+            case MeterValueSource::PowerOffered:
+            case MeterValueSource::CurrentOffered:
+                if (meter_phases_connected_state == nullptr
+                 || evse_allowed_charging_current_state == nullptr
+                 || sample.phase_index >= meter_phases_connected_state->count()
+                 || !meter_phases_connected_state->get(sample.phase_index)->asBool()) {
+                    sample.value = 0.0f;
+                    continue;
+                }
+
+                sample.value = sample.source == MeterValueSource::PowerOffered ? allowed_current * 230.0f : allowed_current;
+                continue;
+
+            case MeterValueSource::Value:
+            case MeterValueSource::ValueIfImport:
+            case MeterValueSource::ValueIfExport:
+            case MeterValueSource::NegatedValueIfExport:
+            case MeterValueSource::AbsValue:
+                break;
+        }
+
+        if (meter_all_values_state == nullptr) {
+            sample.value = 0.0f;
+            continue;
+        }
+
+        float value = get_all_value(sample.value_index);
+
+        switch (sample.source) {
+            case MeterValueSource::ValueIfImport:
+                sample.value = get_all_value(sample.sign_index) >= 0 ? value : 0.0f;
+                break;
+            case MeterValueSource::ValueIfExport:
+                sample.value = get_all_value(sample.sign_index) < 0 ? value : 0.0f;
+                break;
+            case MeterValueSource::NegatedValueIfExport:
+                sample.value = get_all_value(sample.sign_index) < 0 ? -value : 0.0f;
+                break;
+            case MeterValueSource::AbsValue:
+                sample.value = fabs(value);
+                break;
+            default:
+                sample.value = value;
+                break;
+        }
     }
-    return 0.0f;
-}
 
-float platform_get_raw_meter_value_sdm72v2(int32_t connectorId, SampledValueMeasurand measurand, SampledValuePhase phase, SampledValueLocation location) {
-    if (connectorId != 1)
-        return 0.0f;
+    meter_value_snapshot_time = millis();
+    meter_value_snapshot_valid = true;
+}
 
-    REQUIRE_FEATURE(meter_all_values, 0);
+static float get_raw_meter_value(SampledValueMeasurand measurand, SampledValuePhase phase) {
+    update_meter_type();
 
-    const Config *meter_all_values = api.getState("meter/all_values");
+    if (meter_type != METER_TYPE_SDM72DMV2 && meter_type != METER_TYPE_SDM630)
+        return 0.0f;
 
-    switch (measurand) {
-        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_TOTAL_EXPORT_KWH)->asFloat();
-        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_REGISTER:
-            return meter_all_values->get(METER_ALL_VALUES_TOTAL_IMPORT_KWH)->asFloat();
+    MeterValueSample *sample = nullptr;
 
-        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_REGISTER:
-        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_REGISTER:
-            return 0.0f;
+    for (MeterValueSample &s : meter_value_samples) {
+        if (s.measurand == measurand && s.phase == phase) {
+            sample = &s;
+            break;
+        }
+    }
 
-        case SampledValueMeasurand::POWER_ACTIVE_EXPORT:
-        case SampledValueMeasurand::POWER_ACTIVE_IMPORT:
-        case SampledValueMeasurand::POWER_OFFERED:
-        case SampledValueMeasurand::POWER_REACTIVE_EXPORT:
-        case SampledValueMeasurand::POWER_REACTIVE_IMPORT:
-        case SampledValueMeasurand::POWER_FACTOR:
-        case SampledValueMeasurand::CURRENT_EXPORT:
-        case SampledValueMeasurand::CURRENT_IMPORT:
-        case SampledValueMeasurand::CURRENT_OFFERED:
-        case SampledValueMeasurand::VOLTAGE:
-        case SampledValueMeasurand::FREQUENCY:
-            return platform_get_raw_meter_value_common(meter_all_values, connectorId, measurand, phase, location);
+    if (sample == nullptr) {
+        meter_value_samples.push_back(resolve_meter_value(measurand, phase));
+        sample = &meter_value_samples.back();
+        // Sample the new measurand together with the others.
+        meter_value_snapshot_valid = false;
+    }
 
-        case SampledValueMeasurand::ENERGY_ACTIVE_EXPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_ACTIVE_IMPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_REACTIVE_EXPORT_INTERVAL:
-        case SampledValueMeasurand::ENERGY_REACTIVE_IMPORT_INTERVAL:
-        case SampledValueMeasurand::TEMPERATURE:
-        case SampledValueMeasurand::SO_C:
-        case SampledValueMeasurand::RPM:
-        case SampledValueMeasurand::NONE:
-            return 0.0f;
+    if (!meter_value_snapshot_valid || deadline_elapsed(meter_value_snapshot_time + METER_VALUE_SNAPSHOT_MAX_AGE)) {
+#ifdef OCPP_DEBUG
+        uint32_t snapshot_start = micros();
+        update_meter_value_snapshot();
+        meter_value_stats.snapshot_us += micros() - snapshot_start;
+        ++meter_value_stats.snapshots;
+#else
+        update_meter_value_snapshot();
+#endif
     }
-    return 0.0f;
+
+    return sample->value;
 }
 
 float platform_get_raw_meter_value(int32_t connectorId, SampledValueMeasurand measurand, SampledValuePhase phase, SampledValueLocation location) {
-    update_meter_type();
-
-    if (meter_type == METER_TYPE_SDM72DMV2)
-        return platform_get_raw_meter_value_sdm72v2(connectorId, measurand, phase, location);
-    else if (meter_type == METER_TYPE_SDM630)
-        return platform_get_raw_meter_value_sdm630(connectorId, measurand, phase, location);
+#ifdef OCPP_DEBUG
+    uint32_t start = micros();
+    float result = get_raw_meter_value(measurand, phase);
+    meter_value_stats.sample_us += micros() - start;
+    ++meter_value_stats.samples;
+    return result;
+#else
+    return get_raw_meter_value(measurand, phase);
+#endif
+}
 
-    return 0.0f;
+#ifdef OCPP_DEBUG
+void platform_get_meter_value_stats(OcppMeterValueStats *stats)
+{
+    *stats = meter_value_stats;
 }
+#endif
 
 void platform_lock_cable(int32_t connectorId)
 {
@@ -813,36 +948,327 @@ void platform_set_charging_current(int32_t connectorId, uint32_t milliAmps)
         evse_common.set_ocpp_current(current);
 }
 
-#define PATH_PREFIX String("/ocpp/")
+#define OCPP_DIRECTORY "/ocpp"
+#define JOURNAL_NAME "journal"
+#define JOURNAL_DIRECTORY OCPP_DIRECTORY "/" JOURNAL_NAME
+// LittleFS is mounted at /spiffs, the journal uses the VFS directly to be able to fsync.
+#define VFS_JOURNAL_DIRECTORY "/spiffs" JOURNAL_DIRECTORY
+// Writes are synced after this delay, so that a burst of queued messages shares one segment.
+#define JOURNAL_SYNC_DELAY 1_s
+// While the central system is unreachable, queued messages are only removed
+// when the connection is back. Sync less often, so that the segments fill
+// whole blocks: The journal writes a segment early if its pending records
+// need more than OCPP_JOURNAL_MAX_PENDING_SIZE bytes of RAM.
+#define JOURNAL_OFFLINE_SYNC_DELAY 30_s
+
+// Each segment of the journal is a file named after its hexadecimal id.
+class LittleFSJournalStorage final : public IOcppJournalStorage
+{
+public:
+    ~LittleFSJournalStorage()
+    {
+        close();
+    }
 
-size_t platform_read_file(const char *name, char *buf, size_t len)
+    void close()
+    {
+        if (read_fd >= 0) {
+            ::close(read_fd);
+            read_fd = -1;
+        }
+    }
+
+    bool list_segments(std::vector<uint32_t> *ids) override
+    {
+        File dir = LittleFS.open(JOURNAL_DIRECTORY);
+
+        if (!dir || !dir.isDirectory()) {
+            return false;
+        }
+
+        File f;
+
+        while (f = dir.openNextFile()) {
+            const char *name = f.name();
+            char *end;
+            uint32_t id = strtoul(name, &end, 16);
+
+            if (end != name && *end == '\0') {
+                ids->push_back(id);
+            }
+        }
+
+        std::sort(ids->begin(), ids->end());
+
+        return true;
+    }
+
+    size_t segment_size(uint32_t id) override
+    {
+        char path[48];
+        struct stat st;
+
+        if (stat(segment_path(id, path), &st) != 0) {
+            return 0;
+        }
+
+        return static_cast<size_t>(st.st_size);
+    }
+
+    size_t read(uint32_t id, size_t offset, uint8_t *buf, size_t len) override
+    {
+        // Most reads hit the same segment, keep it open.
+        if (read_fd < 0 || read_id != id) {
+            close();
+
+            char path[48];
+            read_fd = ::open(segment_path(id, path), O_RDONLY);
+            read_id = id;
+
+            if (read_fd < 0) {
+                return 0;
+            }
+        }
+
+        if (lseek(read_fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+            return 0;
+        }
+
+        size_t used = 0;
+
+        while (used < len) {
+            ssize_t result = ::read(read_fd, buf + used, len - used);
+
+            if (result <= 0) {
+                break;
+            }
+
+            used += static_cast<size_t>(result);
+        }
+
+        return used;
+    }
+
+    bool write_segment(uint32_t id, const uint8_t *buf, size_t len) override
+    {
+        char path[48];
+        int fd = ::open(segment_path(id, path), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        bool written = write_all(fd, buf, len) && fsync(fd) == 0;
+
+        ::close(fd);
+
+        if (!written) {
+            ::unlink(path);
+        }
+
+        return written;
+    }
+
+    bool remove_segment(uint32_t id) override
+    {
+        if (read_id == id) {
+            close();
+        }
+
+        char path[48];
+
+        return ::unlink(segment_path(id, path)) == 0 || errno == ENOENT;
+    }
+
+private:
+    static const char *segment_path(uint32_t id, char *buf)
+    {
+        snprintf(buf, 48, VFS_JOURNAL_DIRECTORY "/%08lx", static_cast<unsigned long>(id));
+        return buf;
+    }
+
+    static bool write_all(int file, const uint8_t *buf, size_t len)
+    {
+        size_t used = 0;
+
+        while (used < len) {
+            ssize_t result = ::write(file, buf + used, len - used);
+
+            if (result <= 0) {
+                return false;
+            }
+
+            used += static_cast<size_t>(result);
+        }
+
+        return true;
+    }
+
+    int read_fd = -1;
+    uint32_t read_id = 0;
+};
+
+static LittleFSJournalStorage journal_storage;
+static OcppJournal journal{&journal_storage};
+static bool journal_loaded = false;
+static uint64_t journal_sync_task_id = 0;
+
+// Moves the files written by older firmwares, that stored each OCPP file as a LittleFS file, into the journal.
+static void import_files(const String &dir, const String &name_prefix, std::vector<String> *imported_paths)
 {
-    auto path = PATH_PREFIX + name;
-    if (!LittleFS.exists(path))
-        return 0;
+    File root = LittleFS.open(dir);
+    File f;
 
-    File f = LittleFS.open(path);
-    size_t read = f.read((uint8_t *)buf, len);
-    // File::read can return 2^32-1 because it returns -1 if the file is not open but the return type is size_t.
-    if (read > len)
-        return 0;
-    return read;
+    while (f = root.openNextFile()) {
+        String name = name_prefix + f.name();
+        String path = f.path();
+
+        if (name == JOURNAL_NAME) {
+            continue;
+        }
+
+        if (f.isDirectory()) {
+            f.close();
+            import_files(path, name + "/", imported_paths);
+            imported_paths->push_back(path);
+            continue;
+        }
+
+        size_t size = f.size();
+        auto buf = heap_alloc_array<uint8_t>(size);
+
+        if (buf == nullptr || f.read(buf.get(), size) != size || !journal.write(name.c_str(), buf.get(), size)) {
+            logger.printfln("Failed to move %s into the journal", path.c_str());
+            continue;
+        }
+
+        imported_paths->push_back(path);
+    }
+}
+
+static OcppJournal *get_journal()
+{
+    if (journal_loaded) {
+        return &journal;
+    }
+
+    journal_loaded = true;
+
+    if (!LittleFS.exists(OCPP_DIRECTORY)) {
+        LittleFS.mkdir(OCPP_DIRECTORY);
+    }
+
+    bool created = !LittleFS.exists(JOURNAL_DIRECTORY);
+
+    if (created && !LittleFS.mkdir(JOURNAL_DIRECTORY)) {
+        logger.printfln("Failed to create journal directory");
+        return &journal;
+    }
+
+    if (!journal.load()) {
+        logger.printfln("Failed to load journal: %s (%d)", strerror(errno), errno);
+    }
+
+    if (created) {
+        std::vector<String> imported_paths;
+
+        import_files(OCPP_DIRECTORY, "", &imported_paths);
+
+        if (!imported_paths.empty() && journal.sync()) {
+            // Directories are listed after their files.
+            for (const String &path : imported_paths) {
+                if (LittleFS.exists(path)) {
+                    LittleFS.remove(path);
+                    ::rmdir(("/spiffs" + path).c_str());
+                }
+            }
+
+            logger.printfln("Moved %u files into the journal", journal.get_file_count());
+        }
+    }
+
+    return &journal;
+}
+
+static void schedule_journal_sync()
+{
+    if (journal_sync_task_id != 0) {
+        return;
+    }
+
+    bool connected = client != nullptr && tf_websocket_client_is_connected(client);
+
+    journal_sync_task_id = task_scheduler.scheduleOnce([]() {
+        journal_sync_task_id = 0;
+
+        if (!journal.sync()) {
+            logger.printfln("Failed to sync journal: %s (%d)", strerror(errno), errno);
+        }
+
+        if (journal.needs_compaction()) {
+            size_t old_size = journal.get_journal_size();
+
+            if (journal.compact()) {
+                logger.printfln("Compacted journal from %u to %u bytes", old_size, journal.get_journal_size());
+            }
+            else {
+                logger.printfln("Failed to compact journal: %s (%d)", strerror(errno), errno);
+            }
+        }
+    }, connected ? JOURNAL_SYNC_DELAY : JOURNAL_OFFLINE_SYNC_DELAY);
+}
+
+// The OCPP library uses names relative to the OCPP directory.
+static const char *normalize_name(const char *name)
+{
+    while (*name == '/') {
+        ++name;
+    }
+
+    return name;
+}
+
+size_t platform_read_file(const char *name, char *buf, size_t len)
+{
+    return get_journal()->read(normalize_name(name), (uint8_t *)buf, len);
 }
+
 bool platform_write_file(const char *name, char *buf, size_t len)
 {
-    File f = LittleFS.open(PATH_PREFIX + name, "w", true);
-    return f.write((const uint8_t *)buf, len) == len;
+    if (!get_journal()->write(normalize_name(name), (const uint8_t *)buf, len)) {
+        return false;
+    }
+
+    if (journal.is_dirty()) {
+        schedule_journal_sync();
+    }
+
+    return true;
 }
 
+struct JournalDir {
+    std::vector<OcppDirEnt> entries;
+    size_t next = 0;
+};
+
 // return nullptr if name does not exist or is not a directory
 void *platform_open_dir(const char *name)
 {
-    File *f = new File(LittleFS.open(PATH_PREFIX + name));
-    if (!f->isDirectory()) {
-        delete f;
+    JournalDir *dir = new JournalDir();
+
+    get_journal()->list(normalize_name(name), [dir](const char *child, bool is_dir) {
+        OcppDirEnt ent = {};
+        ent.is_dir = is_dir;
+        strncpy(ent.name, child, ARRAY_SIZE(ent.name) - 1);
+        dir->entries.push_back(ent);
+    });
+
+    if (dir->entries.empty()) {
+        delete dir;
         return nullptr;
     }
-    return f;
+
+    return dir;
 }
 
 OcppDirEnt dir_ent;
@@ -850,28 +1276,45 @@ OcppDirEnt dir_ent;
 // return nullptr if no more files
 OcppDirEnt *platform_read_dir(void *dir_fd)
 {
-    File *dir = (File *)dir_fd;
-    File f;
-    while (f = dir->openNextFile()) {
-        dir_ent.is_dir = f.isDirectory();
-        strncpy(dir_ent.name, f.name(), ARRAY_SIZE(dir_ent.name) - 1);
-        return &dir_ent;
+    JournalDir *dir = (JournalDir *)dir_fd;
+
+    if (dir->next >= dir->entries.size()) {
+        return nullptr;
     }
-    return nullptr;
+
+    dir_ent = dir->entries[dir->next++];
+    return &dir_ent;
 }
+
 void platform_close_dir(void *dir_fd)
 {
-    File *f = (File *)dir_fd;
-    delete f;
+    JournalDir *dir = (JournalDir *)dir_fd;
+    delete dir;
 }
 
 void platform_remove_file(const char *name)
 {
-    auto path = PATH_PREFIX + name;
-    if (!LittleFS.exists(path))
+    if (!get_journal()->remove(normalize_name(name))) {
         return;
+    }
+
+    if (journal.is_dirty()) {
+        schedule_journal_sync();
+    }
+}
+
+void platform_remove_all_files()
+{
+    if (journal_sync_task_id != 0) {
+        task_scheduler.cancel(journal_sync_task_id);
+        journal_sync_task_id = 0;
+    }
+
+    journal_storage.close();
+    journal.remove_all();
+    journal_loaded = false;
 
-    LittleFS.remove(path);
+    remove_directory(OCPP_DIRECTORY);
 }
 
 void platform_reset(bool hard)
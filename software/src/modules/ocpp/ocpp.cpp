@@ -46,6 +46,15 @@ void Ocpp::pre_setup()
         {"value", Config::Str("", 0, 500)}
     });
 
+#ifdef OCPP_DEBUG
+    meter_value_stats = Config::Object({
+        {"samples", Config::Uint32(0)},
+        {"snapshots", Config::Uint32(0)},
+        {"sample_us", Config::Uint32(0)},
+        {"snapshot_us", Config::Uint32(0)}
+    });
+#endif
+
 #ifdef OCPP_STATE_CALLBACKS
     state = Config::Object({
         {"charge_point_state", Config::Uint8(0)},
@@ -160,6 +169,18 @@ void Ocpp::setup()
             cp->tick();
         }, 100_ms, 100_ms);
     }, 5_s);
+
+#ifdef OCPP_DEBUG
+    task_scheduler.scheduleWithFixedDelay([this](){
+        OcppMeterValueStats stats;
+        platform_get_meter_value_stats(&stats);
+
+        meter_value_stats.get("samples")->updateUint(stats.samples);
+        meter_value_stats.get("snapshots")->updateUint(stats.snapshots);
+        meter_value_stats.get("sample_us")->updateUint(stats.sample_us);
+        meter_value_stats.get("snapshot_us")->updateUint(stats.snapshot_us);
+    }, 1_s, 1_s);
+#endif
 }
 
 void Ocpp::register_urls()
@@ -170,11 +191,12 @@ void Ocpp::register_urls()
     api.addState("ocpp/configuration", &configuration);
 #endif
     api.addCommand("ocpp/reset", Config::Null(), {}, [](String &/*errmsg*/) {
-        remove_directory("/ocpp");
+        platform_remove_all_files();
     }, true);
 
 #ifdef OCPP_DEBUG
     api.addFeature("ocpp_debug");
+    api.addState("ocpp/meter_value_stats", &meter_value_stats);
     api.addCommand("ocpp/change_configuration", &change_configuration, {}, [this](String &/*errmsg*/) {
         auto status = cp->changeConfig(change_configuration.get("key")->asEphemeralCStr(), change_configuration.get("value")->asEphemeralCStr());
         logger.printfln("Change config %s status %s", change_configuration.get("key")->asEphemeralCStr(), ChangeConfigurationResponseStatusStrings[(size_t) status]);
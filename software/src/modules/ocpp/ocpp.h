@@ -24,6 +24,21 @@
 #include "module.h"
 #include "config.h"
 
+// Removes all files the OCPP library stored, implemented by the platform.
+void platform_remove_all_files();
+
+#ifdef OCPP_DEBUG
+struct OcppMeterValueStats {
+    uint32_t samples;     // calls of platform_get_raw_meter_value
+    uint32_t snapshots;   // sampling passes over all measurands
+    uint32_t sample_us;   // total time spent in platform_get_raw_meter_value
+    uint32_t snapshot_us; // part of sample_us spent in sampling passes
+};
+
+// Accumulated cost of sampling meter values, implemented by the platform.
+void platform_get_meter_value_stats(OcppMeterValueStats *stats);
+#endif
+
 class Ocpp final : public IModule
 {
 public:
@@ -49,4 +64,7 @@ private:
 
     ConfigRoot config;
     ConfigRoot change_configuration;
+#ifdef OCPP_DEBUG
+    ConfigRoot meter_value_stats;
+#endif
 };
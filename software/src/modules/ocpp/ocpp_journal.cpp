@@ -0,0 +1,592 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "ocpp_journal.h"
+
+#include <algorithm>
+#include <esp_rom_crc.h>
+#include <string.h>
+
+#define OCPP_JOURNAL_MAGIC 0x4A4F // "OJ"
+
+static uint32_t crc_record(const OcppJournalRecordHeader *header, const char *name, const uint8_t *data)
+{
+    OcppJournalRecordHeader copy = *header;
+    copy.crc = 0;
+
+    uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&copy), sizeof(copy));
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(name), header->name_len);
+
+    return esp_rom_crc32_le(crc, data, header->data_len);
+}
+
+static size_t record_size(size_t name_len, size_t data_len)
+{
+    return sizeof(OcppJournalRecordHeader) + name_len + data_len;
+}
+
+bool OcppJournal::load()
+{
+    entries.clear();
+    segments.clear();
+    pending.clear();
+    pending_remove_records = 0;
+    journal_size = 0;
+    live_size = 0;
+
+    std::vector<uint32_t> ids;
+
+    if (!storage->list_segments(&ids)) {
+        return false;
+    }
+
+    next_segment = ids.empty() ? 0 : ids.back() + 1;
+
+    bool corrupted = false;
+    std::vector<uint8_t> record;
+
+    for (uint32_t id : ids) {
+        if (!load_segment(id, &record)) {
+            corrupted = true;
+            break;
+        }
+    }
+
+    if (!corrupted) {
+        return remove_dead_segments();
+    }
+
+    // Records after a corrupted one would be lost when loading the journal
+    // the next time. Move the valid records into new segments, then remove
+    // the old segments starting with the newest one: As long as the corrupted
+    // segment exists, the new segments are not loaded.
+    const uint32_t first_new = next_segment;
+
+    for (Entry &entry : entries) {
+        if (!move_entry(&entry, &record)) {
+            return false;
+        }
+    }
+
+    if (!flush_pending()) {
+        return false;
+    }
+
+    for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+        if (!storage->remove_segment(*it)) {
+            return false;
+        }
+    }
+
+    segments.erase(std::remove_if(segments.begin(), segments.end(), [first_new](const Segment &segment) {
+        return segment.id < first_new;
+    }), segments.end());
+
+    journal_size = 0;
+
+    for (const Segment &segment : segments) {
+        journal_size += segment.size;
+    }
+
+    return true;
+}
+
+// Returns false if the segment contains a torn or corrupted record.
+bool OcppJournal::load_segment(uint32_t id, std::vector<uint8_t> *record)
+{
+    const size_t size = storage->segment_size(id);
+    size_t offset = 0;
+    bool corrupted = false;
+
+    segments.push_back({id, 0, 0, 0});
+
+    while (offset < size) {
+        OcppJournalRecordHeader header;
+
+        if (size - offset < sizeof(header) || storage->read(id, offset, reinterpret_cast<uint8_t *>(&header), sizeof(header)) != sizeof(header)) {
+            corrupted = true;
+            break;
+        }
+
+        const size_t total_len = record_size(header.name_len, header.data_len);
+
+        if (header.magic != OCPP_JOURNAL_MAGIC
+         || (header.type != OcppJournalRecordType::Write && header.type != OcppJournalRecordType::Remove)
+         || header.name_len == 0
+         || header.name_len > OCPP_JOURNAL_MAX_NAME_LENGTH
+         || header.data_len > OCPP_JOURNAL_MAX_DATA_LENGTH
+         || size - offset < total_len) {
+            corrupted = true;
+            break;
+        }
+
+        record->resize(header.name_len + header.data_len);
+
+        if (storage->read(id, offset + sizeof(header), record->data(), record->size()) != record->size()) {
+            corrupted = true;
+            break;
+        }
+
+        const char *name = reinterpret_cast<const char *>(record->data());
+        const uint8_t *data = record->data() + header.name_len;
+
+        if (crc_record(&header, name, data) != header.crc) {
+            corrupted = true;
+            break;
+        }
+
+        char name_buf[OCPP_JOURNAL_MAX_NAME_LENGTH + 1];
+        memcpy(name_buf, name, header.name_len);
+        name_buf[header.name_len] = '\0';
+
+        Entry *entry = find(name_buf);
+
+        if (entry != nullptr) {
+            release_record(entry);
+
+            if (header.type == OcppJournalRecordType::Remove) {
+                *entry = entries.back();
+                entries.pop_back();
+            }
+        }
+
+        if (header.type == OcppJournalRecordType::Remove) {
+            ++segments.back().remove_records;
+        }
+        else {
+            if (entry == nullptr) {
+                entries.emplace_back();
+                entry = &entries.back();
+                memcpy(entry->name, name_buf, header.name_len + 1);
+            }
+
+            entry->segment = id;
+            entry->data_offset = static_cast<uint32_t>(offset + sizeof(header) + header.name_len);
+            entry->data_len = header.data_len;
+            entry->data_crc = esp_rom_crc32_le(0, data, header.data_len);
+            entry->on_storage = true;
+
+            ++segments.back().live_records;
+            live_size += total_len;
+        }
+
+        offset += total_len;
+    }
+
+    segments.back().size = static_cast<uint32_t>(offset);
+    journal_size += offset;
+
+    return !corrupted;
+}
+
+OcppJournal::Entry *OcppJournal::find(const char *name)
+{
+    for (Entry &entry : entries) {
+        if (strcmp(entry.name, name) == 0) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+const OcppJournal::Entry *OcppJournal::find(const char *name) const
+{
+    return const_cast<OcppJournal *>(this)->find(name);
+}
+
+OcppJournal::Segment *OcppJournal::find_segment(uint32_t id)
+{
+    auto it = std::lower_bound(segments.begin(), segments.end(), id, [](const Segment &segment, uint32_t segment_id) {
+        return segment.id < segment_id;
+    });
+
+    if (it == segments.end() || it->id != id) {
+        return nullptr;
+    }
+
+    return &*it;
+}
+
+// The current record of the file is obsolete.
+void OcppJournal::release_record(const Entry *entry)
+{
+    live_size -= record_size(strlen(entry->name), entry->data_len);
+
+    if (is_pending(entry)) {
+        return;
+    }
+
+    Segment *segment = find_segment(entry->segment);
+
+    if (segment != nullptr) {
+        --segment->live_records;
+    }
+}
+
+bool OcppJournal::exists(const char *name) const
+{
+    return find(name) != nullptr;
+}
+
+size_t OcppJournal::read(const char *name, uint8_t *buf, size_t len)
+{
+    const Entry *entry = find(name);
+
+    if (entry == nullptr) {
+        return 0;
+    }
+
+    return read_data(entry, buf, len);
+}
+
+size_t OcppJournal::read_data(const Entry *entry, uint8_t *buf, size_t len)
+{
+    const size_t to_read = len < entry->data_len ? len : entry->data_len;
+
+    if (!is_pending(entry)) {
+        return storage->read(entry->segment, entry->data_offset, buf, to_read);
+    }
+
+    memcpy(buf, pending.data() + entry->data_offset, to_read);
+
+    return to_read;
+}
+
+bool OcppJournal::append_record(OcppJournalRecordType type, const char *name, size_t name_len, const uint8_t *data, size_t data_len, uint32_t *data_offset)
+{
+    const size_t total_len = record_size(name_len, data_len);
+
+    if (!pending.empty() && pending.size() + total_len > OCPP_JOURNAL_MAX_PENDING_SIZE && !flush_pending()) {
+        return false;
+    }
+
+    OcppJournalRecordHeader header;
+
+    header.magic = OCPP_JOURNAL_MAGIC;
+    header.type = type;
+    header.name_len = static_cast<uint8_t>(name_len);
+    header.data_len = static_cast<uint32_t>(data_len);
+    header.crc = crc_record(&header, name, data);
+
+    const uint8_t *header_bytes = reinterpret_cast<const uint8_t *>(&header);
+
+    pending.insert(pending.end(), header_bytes, header_bytes + sizeof(header));
+    pending.insert(pending.end(), name, name + name_len);
+
+    if (data_len > 0) {
+        pending.insert(pending.end(), data, data + data_len);
+    }
+
+    if (data_offset != nullptr) {
+        *data_offset = static_cast<uint32_t>(pending.size() - data_len);
+    }
+
+    if (type == OcppJournalRecordType::Remove) {
+        ++pending_remove_records;
+    }
+
+    journal_size += total_len;
+
+    return true;
+}
+
+bool OcppJournal::is_pending(const Entry *entry) const
+{
+    return entry->segment == next_segment;
+}
+
+// The record is obsolete before it reached the storage. Removes it from the
+// pending records and moves all following records.
+void OcppJournal::drop_pending_record(const Entry *entry, uint32_t *other_offset)
+{
+    const size_t name_len = strlen(entry->name);
+    const uint32_t record_offset = static_cast<uint32_t>(entry->data_offset - sizeof(OcppJournalRecordHeader) - name_len);
+    const uint32_t total_len = static_cast<uint32_t>(record_size(name_len, entry->data_len));
+
+    auto begin = pending.begin() + record_offset;
+    pending.erase(begin, begin + total_len);
+
+    journal_size -= total_len;
+
+    for (Entry &e : entries) {
+        if (is_pending(&e) && e.data_offset > record_offset) {
+            e.data_offset -= total_len;
+        }
+    }
+
+    if (other_offset != nullptr && *other_offset > record_offset) {
+        *other_offset -= total_len;
+    }
+}
+
+bool OcppJournal::flush_pending()
+{
+    if (pending.empty()) {
+        return true;
+    }
+
+    if (!storage->write_segment(next_segment, pending.data(), pending.size())) {
+        return false;
+    }
+
+    Segment segment = {next_segment, static_cast<uint32_t>(pending.size()), 0, pending_remove_records};
+
+    for (Entry &entry : entries) {
+        if (is_pending(&entry)) {
+            entry.on_storage = true;
+            ++segment.live_records;
+        }
+    }
+
+    segments.push_back(segment);
+    pending.clear();
+    pending_remove_records = 0;
+    ++next_segment;
+
+    return true;
+}
+
+// Appends a copy of the record of a file that is on the storage, so that its
+// old segment can be removed.
+bool OcppJournal::move_entry(Entry *entry, std::vector<uint8_t> *data)
+{
+    if (is_pending(entry)) {
+        return true;
+    }
+
+    data->resize(entry->data_len);
+
+    if (read_data(entry, data->data(), entry->data_len) != entry->data_len) {
+        return false;
+    }
+
+    uint32_t data_offset;
+
+    if (!append_record(OcppJournalRecordType::Write, entry->name, strlen(entry->name), data->data(), entry->data_len, &data_offset)) {
+        return false;
+    }
+
+    Segment *segment = find_segment(entry->segment);
+
+    if (segment != nullptr) {
+        --segment->live_records;
+    }
+
+    entry->segment = next_segment;
+    entry->data_offset = data_offset;
+
+    return true;
+}
+
+// A segment without live records can be removed if it contains no removal
+// records either: Those could hide a file in an older segment. Removal
+// records in the oldest segment hide nothing. Must only be called without
+// pending records: A record is obsolete as soon as a pending record replaces
+// it, but has to stay on the storage until the pending record was written.
+bool OcppJournal::remove_dead_segments()
+{
+    size_t i = 0;
+
+    while (i < segments.size()) {
+        const Segment &segment = segments[i];
+
+        if (segment.live_records > 0 || (i > 0 && segment.remove_records > 0)) {
+            ++i;
+            continue;
+        }
+
+        if (!storage->remove_segment(segment.id)) {
+            return false;
+        }
+
+        journal_size -= segment.size;
+        segments.erase(segments.begin() + i);
+    }
+
+    return true;
+}
+
+bool OcppJournal::write(const char *name, const uint8_t *buf, size_t len)
+{
+    const size_t name_len = strlen(name);
+
+    if (name_len == 0 || name_len > OCPP_JOURNAL_MAX_NAME_LENGTH || len > OCPP_JOURNAL_MAX_DATA_LENGTH) {
+        return false;
+    }
+
+    const uint32_t data_crc = esp_rom_crc32_le(0, buf, len);
+    Entry *entry = find(name);
+
+    // The OCPP library rewrites its configuration even if nothing changed.
+    if (entry != nullptr && entry->data_len == len && entry->data_crc == data_crc) {
+        return true;
+    }
+
+    uint32_t data_offset;
+
+    if (!append_record(OcppJournalRecordType::Write, name, name_len, buf, len, &data_offset)) {
+        return false;
+    }
+
+    if (entry == nullptr) {
+        entries.emplace_back();
+        entry = &entries.back();
+        memcpy(entry->name, name, name_len + 1);
+        entry->on_storage = false;
+    }
+    else {
+        release_record(entry);
+
+        if (is_pending(entry)) {
+            drop_pending_record(entry, &data_offset);
+        }
+    }
+
+    entry->segment = next_segment;
+    entry->data_offset = data_offset;
+    entry->data_len = static_cast<uint32_t>(len);
+    entry->data_crc = data_crc;
+
+    live_size += record_size(name_len, len);
+
+    return true;
+}
+
+bool OcppJournal::remove(const char *name)
+{
+    Entry *entry = find(name);
+
+    if (entry == nullptr) {
+        return true;
+    }
+
+    const size_t name_len = strlen(name);
+
+    // A file that never reached the storage does not need a tombstone.
+    if (entry->on_storage && !append_record(OcppJournalRecordType::Remove, name, name_len, nullptr, 0, nullptr)) {
+        return false;
+    }
+
+    release_record(entry);
+
+    if (is_pending(entry)) {
+        drop_pending_record(entry, nullptr);
+    }
+
+    *entry = entries.back();
+    entries.pop_back();
+
+    return true;
+}
+
+void OcppJournal::remove_all()
+{
+    entries.clear();
+    segments.clear();
+    pending.clear();
+    next_segment = 0;
+    pending_remove_records = 0;
+    journal_size = 0;
+    live_size = 0;
+}
+
+void OcppJournal::list(const char *dir, const std::function<void(const char *name, bool is_dir)> &callback) const
+{
+    const size_t dir_len = strlen(dir);
+    std::vector<const char *> seen_dirs;
+
+    for (const Entry &entry : entries) {
+        const char *child = entry.name;
+
+        if (dir_len > 0) {
+            if (strncmp(entry.name, dir, dir_len) != 0 || entry.name[dir_len] != '/') {
+                continue;
+            }
+
+            child += dir_len + 1;
+        }
+
+        const char *slash = strchr(child, '/');
+
+        if (slash == nullptr) {
+            callback(child, false);
+            continue;
+        }
+
+        const size_t child_len = static_cast<size_t>(slash - child);
+        bool seen = false;
+
+        for (const char *seen_dir : seen_dirs) {
+            if (strncmp(seen_dir, child, child_len) == 0 && seen_dir[child_len] == '/') {
+                seen = true;
+                break;
+            }
+        }
+
+        if (seen) {
+            continue;
+        }
+
+        seen_dirs.push_back(child);
+
+        char dir_name[OCPP_JOURNAL_MAX_NAME_LENGTH + 1];
+        memcpy(dir_name, child, child_len);
+        dir_name[child_len] = '\0';
+
+        callback(dir_name, true);
+    }
+}
+
+bool OcppJournal::sync()
+{
+    return flush_pending() && remove_dead_segments();
+}
+
+bool OcppJournal::needs_compaction() const
+{
+    return journal_size > OCPP_JOURNAL_COMPACTION_MIN_SIZE && journal_size > 2 * live_size;
+}
+
+bool OcppJournal::compact()
+{
+    if (!sync()) {
+        return false;
+    }
+
+    const uint32_t first_new = next_segment;
+    std::vector<uint8_t> data;
+
+    while (needs_compaction() && !segments.empty() && segments.front().id < first_new) {
+        const uint32_t oldest = segments.front().id;
+
+        for (Entry &entry : entries) {
+            if (entry.segment == oldest && !move_entry(&entry, &data)) {
+                return false;
+            }
+        }
+
+        // The oldest segment has no live records left and is removed.
+        if (!sync() || (!segments.empty() && segments.front().id == oldest)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,145 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define OCPP_JOURNAL_MAX_NAME_LENGTH 63
+#define OCPP_JOURNAL_MAX_DATA_LENGTH 65535
+// Don't compact small journals, even if most of their records are obsolete.
+#define OCPP_JOURNAL_COMPACTION_MIN_SIZE (32 * 1024)
+// Unsynced records are written to a segment early if they need more RAM than this.
+#define OCPP_JOURNAL_MAX_PENDING_SIZE 4096
+
+// Backing store of the journal. The journal is split into segments with
+// ascending ids. Each segment is written and synced at once and never
+// appended to later, so that the filesystem never has to copy a partially
+// written block. Obsolete segments are removed.
+class IOcppJournalStorage
+{
+public:
+    virtual ~IOcppJournalStorage() {}
+
+    // Appends the ids of all segments in ascending order.
+    virtual bool list_segments(std::vector<uint32_t> *ids) = 0;
+    virtual size_t segment_size(uint32_t id) = 0;
+    virtual size_t read(uint32_t id, size_t offset, uint8_t *buf, size_t len) = 0;
+    // Must not return before the segment is durable.
+    virtual bool write_segment(uint32_t id, const uint8_t *buf, size_t len) = 0;
+    virtual bool remove_segment(uint32_t id) = 0;
+};
+
+enum class OcppJournalRecordType : uint8_t {
+    Write = 1,
+    Remove = 2,
+};
+
+struct [[gnu::packed]] OcppJournalRecordHeader {
+    uint16_t magic;
+    OcppJournalRecordType type;
+    uint8_t name_len;
+    uint32_t data_len;
+    uint32_t crc; // over the header (with crc set to 0), the name and the data
+};
+
+// Emulates the small set of file operations the OCPP library uses on top of
+// an append-only log: Every write or remove appends one CRC-protected record.
+// An index of the live files is kept in RAM, the file contents stay in the
+// journal. Syncing is left to the caller, so that multiple writes can share
+// one segment. Until then, records are kept in RAM: A file that is written
+// and removed again before the next sync never reaches the storage.
+class OcppJournal final
+{
+public:
+    OcppJournal(IOcppJournalStorage *storage) : storage(storage) {}
+
+    // Replays the journal. A torn or corrupted record and all records after
+    // it are dropped by rewriting the journal. Returns false if the journal
+    // could not be rewritten.
+    bool load();
+
+    bool exists(const char *name) const;
+    // Returns the number of bytes read, 0 if the file does not exist.
+    size_t read(const char *name, uint8_t *buf, size_t len);
+    bool write(const char *name, const uint8_t *buf, size_t len);
+    bool remove(const char *name);
+    void remove_all();
+
+    // Calls the callback once for each file and directory directly in dir.
+    // Directories exist implicitly as long as they contain a file.
+    void list(const char *dir, const std::function<void(const char *name, bool is_dir)> &callback) const;
+
+    bool is_dirty() const { return !pending.empty(); }
+    // Writes the pending records into a new segment and removes segments
+    // that only contain obsolete records.
+    bool sync();
+
+    bool needs_compaction() const;
+    // Moves the live records of the oldest segments into new segments until
+    // the journal is small enough.
+    bool compact();
+
+    size_t get_journal_size() const { return journal_size; }
+    size_t get_live_size() const { return live_size; }
+    size_t get_file_count() const { return entries.size(); }
+    size_t get_segment_count() const { return segments.size(); }
+
+private:
+    struct Entry {
+        char name[OCPP_JOURNAL_MAX_NAME_LENGTH + 1];
+        uint32_t segment;
+        uint32_t data_offset; // in the segment
+        uint32_t data_len;
+        uint32_t data_crc;
+        bool on_storage; // a write record of this file was passed to the storage
+    };
+
+    struct Segment {
+        uint32_t id;
+        uint32_t size;
+        uint32_t live_records;
+        uint32_t remove_records;
+    };
+
+    Entry *find(const char *name);
+    const Entry *find(const char *name) const;
+    Segment *find_segment(uint32_t id);
+    bool load_segment(uint32_t id, std::vector<uint8_t> *record);
+    void release_record(const Entry *entry);
+    size_t read_data(const Entry *entry, uint8_t *buf, size_t len);
+    bool append_record(OcppJournalRecordType type, const char *name, size_t name_len, const uint8_t *data, size_t data_len, uint32_t *data_offset);
+    bool is_pending(const Entry *entry) const;
+    void drop_pending_record(const Entry *entry, uint32_t *other_offset);
+    bool flush_pending();
+    bool move_entry(Entry *entry, std::vector<uint8_t> *data);
+    bool remove_dead_segments();
+
+    IOcppJournalStorage *storage;
+    std::vector<Entry> entries;
+    std::vector<Segment> segments; // ascending ids, without the pending segment
+    std::vector<uint8_t> pending; // records of the segment next_segment
+    uint32_t next_segment = 0;
+    uint32_t pending_remove_records = 0;
+    size_t journal_size = 0; // including pending records
+    size_t live_size = 0;
+};
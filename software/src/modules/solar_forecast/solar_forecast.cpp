@@ -18,12 +18,15 @@
  */
 #include "solar_forecast.h"
 
+#include <inttypes.h>
+#include <string.h>
 #include <time.h>
 #include <lwip/inet.h>
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "build.h"
+#include "tools.h"
 
 #if !BUILD_IS_SIGNED()
 #define SOLAR_FORECAST_USE_TEST_DATA
@@ -120,9 +123,6 @@ void SolarForecast::setup()
         api.restorePersistentConfig(get_path(plane, SolarForecast::PathType::Config), &plane.config);
     }
 
-    json_buffer = nullptr;
-    json_buffer_position = 0;
-
     initialized = true;
 }
 
@@ -184,112 +184,163 @@ void SolarForecast::next_update() {
     }, millis_t{first_delay_ms}, millis_t{CHECK_INTERVAL});
 }
 
-void SolarForecast::handle_new_data()
+bool SolarForecast::handle_begin()
 {
-    // Deserialize json received from API
-    DynamicJsonDocument json_doc{SOLAR_FORECAST_MAX_ARDUINO_JSON_BUFFER_SIZE};
-    DeserializationError error = deserializeJson(json_doc, json_buffer, json_buffer_position);
-    if (error) {
-        logger.printfln("Error during JSON deserialization: %s", error.c_str());
-        logger.printfln("Next solar forecast API call will be in 30 minutes");
-        next_sync_forced = rtc.timestamp_minutes() + 30;
-        download_state = SF_DOWNLOAD_STATE_ERROR;
-    } else {
-        JsonObject js_message = json_doc["message"];
-        JsonInteger code      = js_message["code"];
-        if (code != 0) {
-            JsonString text = js_message["text"];
-            logger.printfln("Solar Forecast server returned error code %ld (%s)", code, text.c_str());
-            if(code == 429) { // 429 = rate limit reached
-                logger.printfln("Solar Forecast rate limit reached, next solar forecast API call will be in 2 hours");
-                next_sync_forced = rtc.timestamp_minutes() + 120;
-                state.get("rate_remaining")->updateInt(0);
-            } else {
-                // Wait 30 minutes after unknown error
-                logger.printfln("Next solar forecast API call will be in 30 minutes");
-                next_sync_forced = rtc.timestamp_minutes() + 30;
-            }
-            return;
-        } else {
-            JsonObject js_info      = js_message["info"];
-            JsonObject js_ratelimit = js_message["ratelimit"];
-
-            JsonString place         = js_info["place"];
-            plane_current->state.get("place")->updateString(place.c_str());
-
-            JsonInteger limit        = js_ratelimit["limit"];
-            JsonInteger remaining    = js_ratelimit["remaining"];
-            JsonInteger period       = js_ratelimit["period"];
-            state.get("rate_limit")->updateInt(limit);
-            state.get("rate_remaining")->updateInt(remaining);
-            if (remaining == 0) {
-                logger.printfln("Solar Forecast rate limit reached, next solar forecast API call will be in 2 hours");
-                next_sync_forced = rtc.timestamp_minutes() + 120;
-            } else {
-                next_sync_forced = 0;
-            }
+    if (staging == nullptr) {
+        staging = static_cast<SolarForecastStaging *>(malloc_psram_or_dram(sizeof(SolarForecastStaging)));
 
-            JsonObject js_result     = json_doc["result"];
-            JsonObject js_wh_period  = js_result["watt_hours_period"];
-            bool first = true;
-            char day_start0 = 0;
-            char day_start1 = 0;
+        if (staging == nullptr) {
+            logger.printfln("Could not allocate staging buffer");
+            return false;
+        }
+    }
+    else {
+        logger.printfln("Staging buffer was potentially not freed correctly");
+    }
 
-            plane_current->forecast.get("forecast")->removeAll();
-            while(plane_current->forecast.get("forecast")->count() < 48) {
-                plane_current->forecast.get("forecast")->add();
-            }
-            for (JsonPair pair : js_wh_period) {
-                String key(pair.key().c_str());
-                uint32_t value = pair.value().as<int>();
+    memset(staging, 0, sizeof(SolarForecastStaging));
+    staging->first = true;
+    json_parser.reset();
 
-                // Calculate start time of the data from first day
-                if (first) {
-                    first = false;
-                    day_start0 = key[8];
-                    day_start1 = key[9];
+    return true;
+}
 
-                    // String for 00:00:00 of first day
-                    const String first_date = key.substring(0, 11) + "00:00:00";
+static int32_t json_value_to_int(const char *value)
+{
+    int32_t result;
 
-                    // String to tm struct
-                    struct tm tm;
-                    strptime(first_date.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+    if (!JsonStreamParser::to_int32(value, &result)) {
+        // Truncate non-integer numbers
+        result = static_cast<int32_t>(strtod(value, nullptr));
+    }
 
-                    // Set first date as unix time in minutes
-                    plane_current->forecast.get("first_date")->updateUint(mktime(&tm) / 60);
-                }
+    return result;
+}
 
-                // Add 24 hours for second day
-                const uint8_t index_add = ((day_start0 == key[8]) && (day_start1 == key[9])) ? 0 : 24;
-                const uint8_t index = index_add + (key[11] - '0')*10 + (key[12] - '0');
-                if(index > 47) {
-                    logger.printfln("Found impossible index: %d (date %s)", index, key.c_str());
-                    continue;
-                }
-                // We add up all kWh values that correspond to the same hour
-                // The data is sometimes split up in two values for the same hour
-                const uint32_t old_value = plane_current->forecast.get("forecast")->get(index)->asUint();
-                plane_current->forecast.get("forecast")->get(index)->updateUint(value + old_value);
-            }
+void SolarForecast::handle_json_value(const JsonStreamParser &parser, JsonStreamValueType type, const char *value)
+{
+    if (staging == nullptr) {
+        return;
+    }
+
+    if (type == JsonStreamValueType::String) {
+        if (parser.path_is({"message", "text"})) {
+            strncpy(staging->text, value, SOLAR_FORECAST_MAX_PLACE_LENGTH);
+        }
+        else if (parser.path_is({"message", "info", "place"})) {
+            strncpy(staging->place, value, SOLAR_FORECAST_MAX_PLACE_LENGTH);
+        }
+
+        return;
+    }
+
+    if (type != JsonStreamValueType::Number) {
+        return;
+    }
+
+    if (parser.path_is({"message", "code"})) {
+        staging->code = json_value_to_int(value);
+    }
+    else if (parser.path_is({"message", "ratelimit", "limit"})) {
+        staging->limit = json_value_to_int(value);
+    }
+    else if (parser.path_is({"message", "ratelimit", "remaining"})) {
+        staging->remaining = json_value_to_int(value);
+    }
+    else if (parser.path_is({"message", "ratelimit", "period"})) {
+        staging->period = json_value_to_int(value);
+    }
+    else if (parser.get_depth() == 3 && strcmp(parser.get_key(0), "result") == 0 && strcmp(parser.get_key(1), "watt_hours_period") == 0) {
+        // Key is a date in the format "YYYY-MM-DD HH:MM:SS"
+        const char *key = parser.get_key(2);
+
+        if (strlen(key) < 13) {
+            logger.printfln("Found malformed date %s", key);
+            return;
+        }
+
+        // Calculate start time of the data from first day
+        if (staging->first) {
+            staging->first = false;
+            staging->day_start0 = key[8];
+            staging->day_start1 = key[9];
 
-            const uint32_t current_minutes = rtc.timestamp_minutes();
-            plane_current->state.get("last_sync")->updateUint(current_minutes);
-            plane_current->state.get("last_check")->updateUint(current_minutes);
+            // String for 00:00:00 of first day
+            char first_date[20];
+            snprintf(first_date, sizeof(first_date), "%.11s00:00:00", key);
+
+            // String to tm struct
+            struct tm tm;
+            strptime(first_date, "%Y-%m-%d %H:%M:%S", &tm);
+
+            // Set first date as unix time in minutes
+            staging->first_date = mktime(&tm) / 60;
+        }
 
-            // For the next check we take the period given by the server and multiply it by two
-            // to be a good "free tier user" and not hit the server too often.
-            // Usually the period is 3600 seconds (one hour), so we will check every two hours.
-            plane_current->state.get("next_check")->updateUint(current_minutes + (period/60)*2);
+        // Add 24 hours for second day
+        const uint8_t index_add = ((staging->day_start0 == key[8]) && (staging->day_start1 == key[9])) ? 0 : 24;
+        const uint8_t index = index_add + (key[11] - '0')*10 + (key[12] - '0');
+        if(index > 47) {
+            logger.printfln("Found impossible index: %d (date %s)", index, key);
+            return;
         }
+        // We add up all kWh values that correspond to the same hour
+        // The data is sometimes split up in two values for the same hour
+        staging->wh[index] += static_cast<uint32_t>(json_value_to_int(value));
     }
 }
 
+void SolarForecast::handle_new_data()
+{
+    if (staging->code != 0) {
+        logger.printfln("Solar Forecast server returned error code %" PRIi32 " (%s)", staging->code, staging->text);
+        if(staging->code == 429) { // 429 = rate limit reached
+            logger.printfln("Solar Forecast rate limit reached, next solar forecast API call will be in 2 hours");
+            next_sync_forced = rtc.timestamp_minutes() + 120;
+            state.get("rate_remaining")->updateInt(0);
+        } else {
+            // Wait 30 minutes after unknown error
+            logger.printfln("Next solar forecast API call will be in 30 minutes");
+            next_sync_forced = rtc.timestamp_minutes() + 30;
+        }
+        return;
+    }
+
+    plane_current->state.get("place")->updateString(staging->place);
+
+    state.get("rate_limit")->updateInt(staging->limit);
+    state.get("rate_remaining")->updateInt(staging->remaining);
+    if (staging->remaining == 0) {
+        logger.printfln("Solar Forecast rate limit reached, next solar forecast API call will be in 2 hours");
+        next_sync_forced = rtc.timestamp_minutes() + 120;
+    } else {
+        next_sync_forced = 0;
+    }
+
+    auto forecast = plane_current->forecast.get("forecast");
+    forecast->removeAll();
+    for (size_t i = 0; i < ARRAY_SIZE(staging->wh); i++) {
+        forecast->add()->updateUint(staging->wh[i]);
+    }
+
+    if (!staging->first) {
+        plane_current->forecast.get("first_date")->updateUint(staging->first_date);
+    }
+
+    const uint32_t current_minutes = rtc.timestamp_minutes();
+    plane_current->state.get("last_sync")->updateUint(current_minutes);
+    plane_current->state.get("last_check")->updateUint(current_minutes);
+
+    // For the next check we take the period given by the server and multiply it by two
+    // to be a good "free tier user" and not hit the server too often.
+    // Usually the period is 3600 seconds (one hour), so we will check every two hours.
+    plane_current->state.get("next_check")->updateUint(current_minutes + (staging->period/60)*2);
+}
+
 void SolarForecast::handle_cleanup()
 {
-    free_any(json_buffer);
-    json_buffer = nullptr;
-    json_buffer_position = 0;
+    free_any(staging);
+    staging = nullptr;
 }
 
 void SolarForecast::retry_update(millis_t delay)
@@ -345,20 +396,17 @@ void SolarForecast::update()
     }
 
 #ifdef SOLAR_FORECAST_USE_TEST_DATA
-    if(json_buffer == nullptr) {
-        json_buffer = (char *)calloc_psram_or_dram(SOLAR_FORECAST_MAX_JSON_LENGTH, sizeof(char));
-    } else {
-        logger.printfln("JSON Buffer was potentially not freed correctly");
-        json_buffer_position = 0;
-    }
-
-    // Copy test data to temporary buffer
+    // Feed test data through the parser like a downloaded response
     logger.printfln("Using test data");
-    memcpy(json_buffer + json_buffer_position, test_data.c_str(), test_data.length());
-    json_buffer_position += test_data.length();
-    json_buffer[json_buffer_position] = '\0';
+    if (handle_begin()) {
+        if (json_parser.parse(test_data.c_str(), test_data.length()) && json_parser.finish()) {
+            handle_new_data();
+        }
+        else {
+            logger.printfln("Error during JSON parsing: %s", json_parser.get_error());
+        }
+    }
 
-    handle_new_data();
     handle_cleanup();
     next_update();
 
@@ -373,11 +421,11 @@ void SolarForecast::update()
         return;
     }
 
-    if(json_buffer == nullptr) {
-        json_buffer = (char *)calloc_psram_or_dram(SOLAR_FORECAST_MAX_JSON_LENGTH, sizeof(char));
-    } else {
-        logger.printfln("JSON Buffer was potentially not freed correctly");
-        json_buffer_position = 0;
+    if (!handle_begin()) {
+        next_sync_forced = rtc.timestamp_minutes() + 30;
+        download_state = SF_DOWNLOAD_STATE_ERROR;
+        next_update();
+        return;
     }
 
     download_state = SF_DOWNLOAD_STATE_PENDING;
@@ -445,28 +493,28 @@ void SolarForecast::update()
             break;
 
         case AsyncHTTPSClientEventType::Data:
-            if(json_buffer == nullptr) {
-                logger.printfln("JSON Buffer was not allocated correctly");
+            if (download_state != SF_DOWNLOAD_STATE_PENDING) {
+                // Parsing already failed, wait for the abort to complete.
+                break;
+            }
+
+            if (staging == nullptr) {
+                logger.printfln("Staging buffer was not allocated correctly");
                 next_sync_forced = rtc.timestamp_minutes() + 30;
 
                 download_state = SF_DOWNLOAD_STATE_ERROR;
-                handle_cleanup();
-                next_update();
+                https_client.abort_async();
                 break;
             }
 
-            if(json_buffer_position + event->data_chunk_len >= SOLAR_FORECAST_MAX_JSON_LENGTH) {
-                logger.printfln("JSON Buffer overflow");
+            if (!json_parser.parse(static_cast<const char *>(event->data_chunk), event->data_chunk_len)) {
+                logger.printfln("Error during JSON parsing: %s", json_parser.get_error());
+                logger.printfln("Next solar forecast API call will be in 30 minutes");
                 next_sync_forced = rtc.timestamp_minutes() + 30;
 
                 download_state = SF_DOWNLOAD_STATE_ERROR;
-                handle_cleanup();
-                next_update();
-                break;
+                https_client.abort_async();
             }
-
-            memcpy(json_buffer + json_buffer_position, event->data_chunk, event->data_chunk_len);
-            json_buffer_position += event->data_chunk_len;
             break;
 
         case AsyncHTTPSClientEventType::Aborted:
@@ -481,14 +529,20 @@ void SolarForecast::update()
             break;
 
         case AsyncHTTPSClientEventType::Finished:
-            if(json_buffer == nullptr) {
-                logger.printfln("JSON Buffer was not allocated correctly");
+            if (staging == nullptr) {
+                logger.printfln("Staging buffer was not allocated correctly");
                 next_sync_forced = rtc.timestamp_minutes() + 30;
 
                 download_state = SF_DOWNLOAD_STATE_ERROR;
                 break;
-            } else {
-                json_buffer[json_buffer_position] = '\0';
+            }
+            else if (!json_parser.finish()) {
+                logger.printfln("Error during JSON parsing: %s", json_parser.get_error());
+                logger.printfln("Next solar forecast API call will be in 30 minutes");
+                next_sync_forced = rtc.timestamp_minutes() + 30;
+                download_state = SF_DOWNLOAD_STATE_ERROR;
+            }
+            else {
                 handle_new_data();
             }
 
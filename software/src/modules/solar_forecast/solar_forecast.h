@@ -21,17 +21,16 @@
 
 #include <FS.h> // FIXME: without this include here there is a problem with the IPADDR_NONE define in <lwip/ip4_addr.h>
 #include <esp_http_client.h>
-#include <ArduinoJson.h>
 
 #include <TFTools/Option.h>
 
 #include "async_https_client.h"
+#include "json_stream_parser.h"
 #include "module.h"
 #include "config.h"
 
-#define SOLAR_FORECAST_MAX_JSON_LENGTH 8192
-#define SOLAR_FORECAST_MAX_ARDUINO_JSON_BUFFER_SIZE 8192
 #define SOLAR_FORECAST_PLANES 6
+#define SOLAR_FORECAST_MAX_PLACE_LENGTH 128
 
 enum SFDownloadState {
     SF_DOWNLOAD_STATE_OK,
@@ -77,6 +76,21 @@ private:
         ConfigRoot state;
     };
 
+    // Values of interest from the API response, collected while parsing.
+    struct SolarForecastStaging {
+        uint32_t wh[48];
+        uint32_t first_date;
+        bool first;
+        char day_start0;
+        char day_start1;
+        int32_t code;
+        int32_t limit;
+        int32_t remaining;
+        int32_t period;
+        char text[SOLAR_FORECAST_MAX_PLACE_LENGTH + 1];
+        char place[SOLAR_FORECAST_MAX_PLACE_LENGTH + 1];
+    };
+
     void update();
     void retry_update(millis_t delay);
     void update_price();
@@ -84,14 +98,18 @@ private:
     String get_api_url_with_path(const SolarForecastPlane &plane);
     uint32_t get_timestamp_today_00_00_in_minutes();
     bool forecast_time_between(const uint32_t first_date, const uint32_t index, const uint32_t start, const uint32_t end);
+    bool handle_begin();
+    void handle_json_value(const JsonStreamParser &parser, JsonStreamValueType type, const char *value);
     void handle_new_data();
     void handle_cleanup();
 
     SolarForecastPlane *plane_current;
 
     uint32_t last_update_begin;
-    char *json_buffer;
-    uint32_t json_buffer_position;
+    JsonStreamParser json_parser{[this](const JsonStreamParser &parser, JsonStreamValueType type, const char *value, size_t /*value_len*/) {
+        this->handle_json_value(parser, type, value);
+    }};
+    SolarForecastStaging *staging = nullptr;
     uint32_t next_sync_forced = 0;
     AsyncHTTPSClient https_client;
 
@@ -27,6 +27,8 @@
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
+#include "tools/heap_attribution.h"
+#include "tools/loop_profiler.h"
 
 static uint64_t last_task_id = 0;
 
@@ -151,7 +153,12 @@ void TaskScheduler::custom_loop()
         if (!this->currentTask->fn) {
             logger.printfln("Invalid task");
         } else {
+#ifdef HEAP_ATTRIBUTION
+            HeapAttributionScope heap_scope{heap_attribution_get_tag_for_file(this->currentTask->file)};
+#endif
+            micros_t task_start = loop_profiler.begin();
             this->currentTask->fn();
+            loop_profiler.record_task(this->currentTask->file, this->currentTask->line, this->currentTask->next_deadline, task_start);
         }
     }
 
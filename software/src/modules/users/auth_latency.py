@@ -0,0 +1,84 @@
+#!/usr/bin/python3 -u
+
+# Measures the latency of authenticated requests while the main loop is kept
+# busy by a second set of clients. Each request is made once with digest
+# authentication only and once with the session cookie (if session tokens are
+# enabled in the user management).
+
+import argparse
+import statistics
+import threading
+import time
+
+import requests
+from requests.auth import HTTPDigestAuth
+
+def load(args, auth, stop):
+    session = requests.Session()
+    session.auth = auth
+
+    while not stop.is_set():
+        try:
+            session.get(f'http://{args.host}{args.load_url}', timeout=10)
+        except requests.RequestException:
+            pass
+
+def measure(args, session):
+    latencies = []
+
+    for _ in range(args.count):
+        start = time.perf_counter()
+        response = session.get(f'http://{args.host}{args.url}', timeout=10)
+        latencies.append((time.perf_counter() - start) * 1000)
+
+        if response.status_code != 200:
+            raise Exception(f'Request failed with status {response.status_code}')
+
+    latencies.sort()
+
+    return statistics.median(latencies), latencies[int(len(latencies) * 0.95) - 1], latencies[-1]
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host')
+    parser.add_argument('username')
+    parser.add_argument('password')
+    parser.add_argument('--url', default='/info/version')
+    parser.add_argument('--load-url', default='/users/config', help='URL that is handled on the main thread')
+    parser.add_argument('--load-clients', type=int, default=2)
+    parser.add_argument('--count', type=int, default=100)
+
+    args = parser.parse_args()
+    auth = HTTPDigestAuth(args.username, args.password)
+
+    stop = threading.Event()
+    load_threads = [threading.Thread(target=load, args=(args, auth, stop), daemon=True) for _ in range(args.load_clients)]
+
+    for thread in load_threads:
+        thread.start()
+
+    try:
+        # Digest authentication on every request: Drop the cookie each time.
+        digest_session = requests.Session()
+        digest_session.auth = auth
+        digest_session.hooks['response'].append(lambda r, *a, **kw: digest_session.cookies.clear())
+
+        # Digest authentication once, afterwards the session cookie is sent.
+        cookie_session = requests.Session()
+        cookie_session.get(f'http://{args.host}{args.url}', auth=auth, timeout=10)
+
+        if 'tf_session' not in cookie_session.cookies:
+            print('No session cookie received, session tokens are disabled')
+            cookie_session = None
+
+        for name, session in [('digest', digest_session), ('session cookie', cookie_session)]:
+            if session is None:
+                continue
+
+            median, p95, maximum = measure(args, session)
+            print(f'{name:15} median {median:6.1f} ms   p95 {p95:6.1f} ms   max {maximum:6.1f} ms')
+    finally:
+        stop.set()
+
+if __name__ == '__main__':
+    main()
@@ -19,8 +19,10 @@
 #include "users.h"
 
 #include <cmath>
+#include <inttypes.h>
 #include <memory>
 #include <LittleFS.h>
+#include <mbedtls/md.h>
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
@@ -157,7 +159,8 @@ void Users::pre_setup()
             Config::type_id<Config::ConfObject>()
         )},
         {"next_user_id", Config::Uint8(0)},
-        {"http_auth_enabled", Config::Bool(false)}
+        {"http_auth_enabled", Config::Bool(false)},
+        {"http_auth_session_tokens", Config::Bool(false)}
     });
 
     add = ConfigRoot{Config::Object({
@@ -318,6 +321,10 @@ void Users::pre_setup()
 
         return "Can't enable HTTP authentication if not at least one user with a password is configured!";
     }};
+
+    session_tokens_update = Config::Object({
+        {"enabled", Config::Bool(false)}
+    });
 }
 
 void create_username_file()
@@ -425,38 +432,237 @@ void Users::setup()
             return;
         }
 
+        esp_fill_random(session_key, sizeof(session_key));
+        http_auth_active = true;
+        publish_http_auth_table();
+
         server.onAuthenticate_HTTPThread([this](WebServerRequest req) -> bool {
-            String auth = req.header("Authorization");
-            if (auth.isEmpty()) {
-                return false;
-            }
+            return authenticate_HTTPThread(req);
+        });
 
-            if (!auth.startsWith("Digest ")) {
-                return false;
-            }
+        logger.printfln("Web interface authentication enabled.");
+    }
+}
 
-            auth = auth.substring(7);
-            AuthFields fields = parseDigestAuth(auth.c_str());
+void Users::publish_http_auth_table()
+{
+    auto table = std::unique_ptr<HTTPAuthTable>{new HTTPAuthTable};
 
-            bool result = false;
+    table->session_tokens_enabled = config.get("http_auth_session_tokens")->asBool();
+    table->count = 0;
 
-            // If this times out, result stays false.
-            task_scheduler.await([this, &req, &fields, &result]() {
-                for (size_t i = 0; i < config.get("users")->count(); ++i) {
-                    if (config.get("users")->get(i)->get("username")->asString().equals(fields.username)) {
-                        result = checkDigestAuthentication(fields, req.methodString(), fields.username.c_str(), config.get("users")->get(i)->get("digest_hash")->asEphemeralCStr(), nullptr, true, nullptr, nullptr, nullptr); // use of emphemeral C string ok
-                        break;
-                    }
-                }
-            });
+    for (auto &user : config.get("users")) {
+        const String &digest_hash = user.get("digest_hash")->asString();
 
-            return result;
-        });
+        if (digest_hash.length() != DIGEST_HASH_LENGTH) {
+            continue;
+        }
 
-        logger.printfln("Web interface authentication enabled.");
+        auto &entry = table->users[table->count++];
+
+        entry.id = static_cast<uint8_t>(user.get("id")->asUint());
+        strncpy(entry.username, user.get("username")->asEphemeralCStr(), ARRAY_SIZE(entry.username) - 1);
+        entry.username[ARRAY_SIZE(entry.username) - 1] = '\0';
+        memcpy(entry.digest_hash, digest_hash.c_str(), DIGEST_HASH_LENGTH + 1);
+    }
+
+    // Before the web server is started, no request can be in flight.
+    if (server.httpd == nullptr) {
+        http_auth_table = std::move(table);
+        return;
+    }
+
+    struct Handover {
+        Users *users;
+        HTTPAuthTable *table;
+    };
+
+    auto *handover = new Handover{this, table.release()};
+
+    bool queued = server.runInHTTPThread([](void *arg) {
+        auto *handover = static_cast<Handover *>(arg);
+        handover->users->http_auth_table.reset(handover->table);
+        delete handover;
+    }, handover);
+
+    if (!queued) {
+        delete handover->table;
+        delete handover;
+
+        // The table is rebuilt from the current config when retrying.
+        logger.printfln("Failed to hand over HTTP authentication table. Retrying");
+        task_scheduler.scheduleOnce([this]() {
+            if (http_auth_active)
+                publish_http_auth_table();
+        }, 100_ms);
     }
 }
 
+void Users::disable_http_auth()
+{
+    bool queued = server.runInHTTPThread([](void * /*arg*/) {
+        server.onAuthenticate_HTTPThread([](WebServerRequest req){return true;});
+    }, nullptr);
+
+    if (!queued) {
+        logger.printfln("Failed to disable HTTP authentication. Retrying");
+        task_scheduler.scheduleOnce([this]() {
+            if (!http_auth_active)
+                disable_http_auth();
+        }, 100_ms);
+    }
+}
+
+bool Users::authenticate_HTTPThread(WebServerRequest &req)
+{
+    const HTTPAuthTable *table = http_auth_table.get();
+
+    if (table == nullptr) {
+        return false;
+    }
+
+    if (table->session_tokens_enabled && check_session_token_HTTPThread(req, table)) {
+        return true;
+    }
+
+    String auth = req.header("Authorization");
+    if (auth.isEmpty()) {
+        return false;
+    }
+
+    if (!auth.startsWith("Digest ")) {
+        return false;
+    }
+
+    auth = auth.substring(7);
+    AuthFields fields = parseDigestAuth(auth.c_str());
+
+    for (size_t i = 0; i < table->count; ++i) {
+        const HTTPAuthUser &user = table->users[i];
+
+        if (!fields.username.equals(user.username)) {
+            continue;
+        }
+
+        if (!checkDigestAuthentication(fields, req.methodString(), user.username, user.digest_hash, nullptr, true, nullptr, nullptr, nullptr)) {
+            return false;
+        }
+
+        if (table->session_tokens_enabled) {
+            set_session_cookie_HTTPThread(req, user);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// The MAC covers the user's digest hash, so that changing the password
+// ends all sessions of this user.
+void Users::calculate_session_token_mac(uint8_t user_id, uint32_t expiry, const char *digest_hash, uint8_t mac[SESSION_TOKEN_MAC_LENGTH])
+{
+    uint8_t message[1 + sizeof(expiry) + DIGEST_HASH_LENGTH];
+    uint8_t full_mac[32];
+
+    message[0] = user_id;
+    memcpy(message + 1, &expiry, sizeof(expiry));
+    memcpy(message + 1 + sizeof(expiry), digest_hash, DIGEST_HASH_LENGTH);
+
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), session_key, sizeof(session_key), message, sizeof(message), full_mac);
+    memcpy(mac, full_mac, SESSION_TOKEN_MAC_LENGTH);
+}
+
+// A session token is the user ID, the expiry time in seconds since boot and a
+// MAC, all hex encoded: iieeeeeeeemmmmmmmmmmmmmmmmmmmmmmmmmmmmmmmm
+bool Users::check_session_token_HTTPThread(WebServerRequest &req, const HTTPAuthTable *table)
+{
+    String cookies = req.header("Cookie");
+    if (cookies.isEmpty()) {
+        return false;
+    }
+
+    int start = -1;
+
+    // Don't match cookies whose name ends with the session cookie name.
+    do {
+        start = cookies.indexOf(SESSION_COOKIE_NAME "=", start + 1);
+    } while (start > 0 && cookies[start - 1] != ' ' && cookies[start - 1] != ';');
+
+    if (start < 0) {
+        return false;
+    }
+
+    start += strlen(SESSION_COOKIE_NAME "=");
+
+    const size_t token_len = 2 + 8 + SESSION_TOKEN_MAC_LENGTH * 2;
+    if (cookies.length() - start < token_len) {
+        return false;
+    }
+
+    const char *token = cookies.c_str() + start;
+    uint8_t decoded[1 + 4 + SESSION_TOKEN_MAC_LENGTH];
+
+    for (size_t i = 0; i < ARRAY_SIZE(decoded); ++i) {
+        char hex[3] = {token[i * 2], token[i * 2 + 1], '\0'};
+        char *end;
+
+        decoded[i] = static_cast<uint8_t>(strtoul(hex, &end, 16));
+
+        if (end != hex + 2) {
+            return false;
+        }
+    }
+
+    uint8_t user_id = decoded[0];
+    uint32_t expiry = (static_cast<uint32_t>(decoded[1]) << 24) | (static_cast<uint32_t>(decoded[2]) << 16) | (static_cast<uint32_t>(decoded[3]) << 8) | decoded[4];
+    uint32_t now = now_us().to<seconds_t>().as<uint32_t>();
+
+    if (now >= expiry) {
+        return false;
+    }
+
+    for (size_t i = 0; i < table->count; ++i) {
+        const HTTPAuthUser &user = table->users[i];
+
+        if (user.id != user_id) {
+            continue;
+        }
+
+        uint8_t mac[SESSION_TOKEN_MAC_LENGTH];
+        calculate_session_token_mac(user_id, expiry, user.digest_hash, mac);
+
+        // Constant time comparison
+        uint8_t diff = 0;
+        for (size_t j = 0; j < SESSION_TOKEN_MAC_LENGTH; ++j) {
+            diff |= mac[j] ^ decoded[5 + j];
+        }
+
+        return diff == 0;
+    }
+
+    return false;
+}
+
+void Users::set_session_cookie_HTTPThread(WebServerRequest &req, const HTTPAuthUser &user)
+{
+    uint32_t lifetime = ((micros_t)SESSION_TOKEN_LIFETIME).to<seconds_t>().as<uint32_t>();
+    uint32_t expiry = now_us().to<seconds_t>().as<uint32_t>() + lifetime;
+    uint8_t mac[SESSION_TOKEN_MAC_LENGTH];
+
+    calculate_session_token_mac(user.id, expiry, user.digest_hash, mac);
+
+    size_t written = snprintf(session_cookie, ARRAY_SIZE(session_cookie), SESSION_COOKIE_NAME "=%02x%08" PRIx32, user.id, expiry);
+
+    for (size_t i = 0; i < SESSION_TOKEN_MAC_LENGTH; ++i) {
+        written += snprintf(session_cookie + written, ARRAY_SIZE(session_cookie) - written, "%02x", mac[i]);
+    }
+
+    snprintf(session_cookie + written, ARRAY_SIZE(session_cookie) - written, "; Max-Age=%" PRIu32 "; Path=/; HttpOnly; SameSite=Strict", lifetime);
+
+    req.addResponseHeader("Set-Cookie", session_cookie);
+}
+
 void Users::search_next_free_user()
 {
     uint8_t user_id = config.get("next_user_id")->asUint();
@@ -565,6 +771,9 @@ void Users::register_urls()
 
         API::writeConfig("users/config", &config);
 
+        if (http_auth_active)
+            publish_http_auth_table();
+
         if (display_name_changed || username_changed)
             this->rename_user(user->get("id")->asUint(), user->get("username")->asString(), user->get("display_name")->asString());
 
@@ -590,6 +799,10 @@ void Users::register_urls()
         search_next_free_user();
 
         API::writeConfig("users/config", &config);
+
+        if (http_auth_active)
+            publish_http_auth_table();
+
         this->rename_user(user->get("id")->asUint(), user->get("username")->asString(), user->get("display_name")->asString());
     }, true);
 
@@ -612,6 +825,9 @@ void Users::register_urls()
         config.get("users")->remove(idx);
         API::writeConfig("users/config", &config);
 
+        if (http_auth_active)
+            publish_http_auth_table();
+
 #if MODULE_NFC_AVAILABLE()
         nfc.remove_user(remove.get("id")->asUint());
 #endif
@@ -632,15 +848,22 @@ void Users::register_urls()
     api.addCommand("users/http_auth_update", &http_auth_update, {}, [this](String &/*errmsg*/) {
         bool enable = http_auth_update.get("enabled")->asBool();
         if (!enable) {
-            server.runInHTTPThread([](void *arg) {
-                server.onAuthenticate_HTTPThread([](WebServerRequest req){return true;});
-            }, nullptr);
+            http_auth_active = false;
+            disable_http_auth();
         }
 
         config.get("http_auth_enabled")->updateBool(enable);
         API::writeConfig("users/config", &config);
     }, false);
 
+    api.addCommand("users/session_tokens_update", &session_tokens_update, {}, [this](String &/*errmsg*/) {
+        config.get("http_auth_session_tokens")->updateBool(session_tokens_update.get("enabled")->asBool());
+        API::writeConfig("users/config", &config);
+
+        if (http_auth_active)
+            publish_http_auth_table();
+    }, false);
+
     server.on_HTTPThread("/users/all_usernames", HTTP_GET, [this](WebServerRequest request) {
         //std::lock_guard<std::mutex> lock{records_mutex};
         size_t len = MAX_PASSIVE_USERS * USERNAME_ENTRY_LENGTH;
@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include <memory>
+
 #include "module.h"
 #include "config.h"
+#include "modules/web_server/web_server.h"
 
 #define USERS_AUTH_TYPE_NONE 0
 #define USERS_AUTH_TYPE_LOST 1
@@ -42,6 +45,11 @@
 #define MAX_ACTIVE_USERS 17
 #endif
 
+#define DIGEST_HASH_LENGTH 32
+#define SESSION_COOKIE_NAME "tf_session"
+#define SESSION_TOKEN_LIFETIME 12_h
+#define SESSION_TOKEN_MAC_LENGTH 16
+
 class Users final : public IModule
 {
 public:
@@ -71,11 +79,46 @@ public:
     ConfigRoot remove;
     ConfigRoot http_auth;
     ConfigRoot http_auth_update;
+    ConfigRoot session_tokens_update;
 
     bool start_charging(uint8_t user_id, uint16_t current_limit, uint8_t auth_type, Config::ConfVariant auth_info);
     bool stop_charging(uint8_t user_id, bool force, float meter_abs = 0);
 
     micros_t last_charge_action_triggered = 0_us;
+
+private:
+    struct HTTPAuthUser {
+        uint8_t id;
+        char username[USERNAME_LENGTH + 1];
+        char digest_hash[DIGEST_HASH_LENGTH + 1];
+    };
+
+    // Copy of the users with a password. Built on the main thread whenever
+    // the users config changes, then handed over to the HTTP thread.
+    // The HTTP thread never modifies a published table.
+    struct HTTPAuthTable {
+        bool session_tokens_enabled;
+        size_t count;
+        HTTPAuthUser users[MAX_ACTIVE_USERS];
+    };
+
+    void publish_http_auth_table();
+    void disable_http_auth();
+    bool authenticate_HTTPThread(WebServerRequest &req);
+    bool check_session_token_HTTPThread(WebServerRequest &req, const HTTPAuthTable *table);
+    void set_session_cookie_HTTPThread(WebServerRequest &req, const HTTPAuthUser &user);
+    void calculate_session_token_mac(uint8_t user_id, uint32_t expiry, const char *digest_hash, uint8_t mac[SESSION_TOKEN_MAC_LENGTH]);
+
+    // Set on the main thread if the authentication handler was registered.
+    bool http_auth_active = false;
+    // Only accessed from the HTTP thread once the web server is running.
+    std::unique_ptr<HTTPAuthTable> http_auth_table;
+    // Random key generated on every boot: Rebooting ends all sessions.
+    uint8_t session_key[32];
+    // httpd_resp_set_hdr does not copy the value. The HTTP thread handles
+    // one request at a time, so the cookie can be kept here until the
+    // response is sent.
+    char session_cookie[128];
 };
 
 void set_led(int16_t mode);
@@ -27,6 +27,7 @@
 #include "digest_auth.h"
 #include "cool_string.h"
 #include "esp_httpd_priv.h"
+#include "tools.h"
 
 
 #include "sdkconfig.h"
@@ -142,9 +143,9 @@ void WebServer::pre_reboot() {
     httpd_stop(this->httpd);
 }
 
-void WebServer::runInHTTPThread(void (*fn)(void *arg), void *arg)
+bool WebServer::runInHTTPThread(void (*fn)(void *arg), void *arg)
 {
-    httpd_queue_work(httpd, fn, arg);
+    return httpd_queue_work(httpd, fn, arg) == ESP_OK;
 }
 
 static esp_err_t low_level_handler(httpd_req_t *req)
@@ -629,6 +630,26 @@ String WebServerRequest::header(const char *header_name)
     return result;
 }
 
+String WebServerRequest::query_param(const char *key)
+{
+    auto query_len = httpd_req_get_url_query_len(req) + 1;
+    if (query_len == 1) {
+        return "";
+    }
+
+    auto query = heap_alloc_array<char>(query_len);
+    if (httpd_req_get_url_query_str(req, query.get(), query_len) != ESP_OK) {
+        return "";
+    }
+
+    char value[64];
+    if (httpd_query_key_value(query.get(), key, value, sizeof(value)) != ESP_OK) {
+        return "";
+    }
+
+    return String(value);
+}
+
 size_t WebServerRequest::contentLength()
 {
     return req->content_len;
@@ -51,6 +51,8 @@ public:
 
     String header(const char *header_name);
 
+    String query_param(const char *key);
+
     size_t contentLength();
 
     [[gnu::warn_unused_result]]
@@ -135,7 +137,8 @@ public:
     void post_setup();
     void pre_reboot();
 
-    void runInHTTPThread(void (*fn)(void *arg), void *arg);
+    // Returns false if the work could not be queued. fn is not called then.
+    bool runInHTTPThread(void (*fn)(void *arg), void *arg);
 
     WebServerHandler *on(const char *uri, httpd_method_t method, wshCallback &&callback);
     WebServerHandler *on(const char *uri, httpd_method_t method, wshCallback &&callback, wshUploadCallback &&uploadCallback, wshUploadErrorCallback &&uploadErrorCallback);
@@ -809,13 +809,32 @@ void Wifi::check_for_scan_completion()
 
     logger.printfln("Scan done. %d networks.", network_count);
 
+#if MODULE_WS_AVAILABLE()
+    push_scan_results(network_count);
+#endif
+}
+
+void Wifi::push_scan_results(int16_t network_count)
+{
 #if MODULE_WS_AVAILABLE()
     StringBuilder sb;
 
-    if (ws.pushRawStateUpdateBegin(&sb, MAX_SCAN_RESULT_LENGTH * network_count + 2, "wifi/scan_results")) {
-        get_scan_results(&sb, network_count);
-        ws.pushRawStateUpdateEnd(&sb);
+    if (!ws.pushRawStateUpdateBegin(&sb, MAX_SCAN_RESULT_LENGTH * network_count + 2, "wifi/scan_results")) {
+        return;
+    }
+
+    get_scan_results(&sb, network_count);
+
+    // The websocket backlog of a client is full. Retry unless a new scan was started.
+    if (!ws.pushRawStateUpdateEnd(&sb)) {
+        task_scheduler.scheduleOnce([this, network_count]() {
+            if (WiFi.scanComplete() == network_count) {
+                this->push_scan_results(network_count);
+            }
+        }, 100_ms);
     }
+#else
+    (void)network_count;
 #endif
 }
 
@@ -58,6 +58,7 @@ private:
     void start_scan();
     void check_for_scan_completion();
     void get_scan_results(StringBuilder *sb, int16_t network_count);
+    void push_scan_results(int16_t network_count);
 
     ConfigRoot ap_config;
     ConfigRoot sta_config;
@@ -19,6 +19,8 @@
 
 #include "web_sockets.h"
 
+#include <new>
+
 #include "event_log_prefix.h"
 #include "main_dependencies.h"
 #include "tools.h"
@@ -31,88 +33,269 @@
 static int watchdog_handle = -1;
 #endif
 
-void clear_ws_work_item(ws_work_item *wi)
+WebSocketFrame *ws_frame_create(char *payload, size_t payload_len, httpd_ws_type_t ws_type, uint32_t topic)
 {
-    free(wi->payload);
-    wi->payload = nullptr;
+    WebSocketFrame *frame = static_cast<WebSocketFrame *>(malloc(sizeof(WebSocketFrame)));
+    if (frame == nullptr) {
+        free(payload);
+        return nullptr;
+    }
+
+    new (&frame->refcount) std::atomic<uint32_t>(1);
+    frame->payload = payload;
+    frame->payload_len = payload_len;
+    frame->ws_type = ws_type;
+    frame->topic = topic;
+
+    return frame;
 }
 
-bool WebSockets::haveWork(ws_work_item *item)
+void ws_frame_acquire(WebSocketFrame *frame)
 {
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
+    frame->refcount.fetch_add(1, std::memory_order_relaxed);
+}
 
-    if (work_queue.empty())
+void ws_frame_release(WebSocketFrame *frame)
+{
+    if (frame->refcount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    free(frame->payload);
+    free(frame);
+}
+
+bool WebSockets::haveWork()
+{
+    return !work_queue.empty() || backlog_len.load(std::memory_order_relaxed) > 0;
+}
+
+// Takes ownership of the payload. Fails if the work queue or the backlog of
+// one of the clients is full.
+bool WebSockets::enqueueFrame(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, httpd_ws_type_t ws_type, uint32_t topic)
+{
+    ws_work_item wi;
+    bool have_client = false;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
+
+        for (size_t slot = 0; slot < MAX_WEB_SOCKET_CLIENTS; ++slot) {
+            wi.fds[slot] = -1;
+
+            for (size_t i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+                if (fds[i] != -1 && fds[i] == keep_alive_fds[slot]) {
+                    wi.fds[slot] = fds[i];
+                    have_client = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // All clients were closed in the meantime.
+    if (!have_client) {
+        free(payload);
+        return true;
+    }
+
+    WebSocketFrame *frame = ws_frame_create(payload, payload_len, ws_type, topic);
+    if (frame == nullptr) {
+        return false;
+    }
+
+    for (size_t slot = 0; slot < MAX_WEB_SOCKET_CLIENTS; ++slot) {
+        if (wi.fds[slot] == -1) {
+            continue;
+        }
+
+        if (backlog_reserved[slot].fetch_add(1, std::memory_order_relaxed) >= MAX_WEB_SOCKET_CLIENT_BACKLOG) {
+            backlog_full_count[slot].fetch_add(1, std::memory_order_relaxed);
+            releaseBacklogSpace(wi.fds, slot + 1);
+            ws_frame_release(frame);
+            return false;
+        }
+    }
+
+    wi.frame = frame;
+
+    if (!work_queue.push(wi)) {
+        // Don't log this: Printing to the event log would generate more
+        // websocket messages to fill up the queue.
+        queue_full_count.fetch_add(1, std::memory_order_relaxed);
+        releaseBacklogSpace(wi.fds);
+        ws_frame_release(frame);
         return false;
+    }
 
-    *item = work_queue.front();
-    work_queue.pop_front();
     return true;
 }
 
-void WebSockets::cleanUpQueue()
+// Releases the space reserved for a frame in the backlogs of the slots before end.
+void WebSockets::releaseBacklogSpace(const int fds[MAX_WEB_SOCKET_CLIENTS], size_t end)
 {
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    while (!work_queue.empty()) {
-        ws_work_item *wi = &work_queue.front();
-        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-            if (wi->fds[i] != -1) {
-                return;
-            }
+    for (size_t slot = 0; slot < end; ++slot) {
+        if (fds[slot] != -1) {
+            backlog_reserved[slot].fetch_sub(1, std::memory_order_relaxed);
         }
-        clear_ws_work_item(wi);
-        // Every fd was -1.
-        work_queue.pop_front();
     }
 }
 
-bool WebSockets::queueFull()
+static bool send_ws_frame(WebSockets *ws, int fd, char *payload, size_t payload_len, httpd_ws_type_t ws_type)
 {
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (work_queue.size() < MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+
+    ws_pkt.payload = (uint8_t *)payload;
+    ws_pkt.len = payload_len;
+    ws_pkt.type = payload_len == 0 ? HTTPD_WS_TYPE_PING : ws_type;
+
+    struct httpd_data *hd = (struct httpd_data *)ws->httpd;
+
+    if (httpd_ws_get_fd_info(hd, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        return true;
+    }
+
+    if (httpd_ws_send_frame_async(hd, fd, &ws_pkt) != ESP_OK) {
+        ws->keepAliveCloseDead(fd);
         return false;
     }
 
-    cleanUpQueue();
+    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
+        ws->sent_text_bytes += payload_len;
+    } else if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+        ws->sent_binary_bytes += payload_len;
+    }
 
-    if (work_queue.size() >= MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
-        return true;
+    return true;
+}
+
+void WebSockets::addToBacklog_HTTPThread(size_t client, WebSocketFrame *frame)
+{
+    WebSocketsClientBacklog *backlog = &backlogs[client];
+
+    // Latest value wins: A client that is behind only gets the newest frame of a topic.
+    if (frame->topic != 0) {
+        for (size_t i = 0; i < backlog->count; ++i) {
+            WebSocketFrame **queued = &backlog->frames[(backlog->head + i) % MAX_WEB_SOCKET_CLIENT_BACKLOG];
+
+            if ((*queued)->topic == frame->topic) {
+                ws_frame_release(*queued);
+                ws_frame_acquire(frame);
+                *queued = frame;
+                ++coalesced_frames;
+                backlog_reserved[client].fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+        }
     }
-    // Print only to the console because printing to the event log
-    // would generate more websocket messages to fill up the queue.
-    printf("web_sockets: Work queue was full but %u items were cleaned.\n", MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE - work_queue.size());
 
-    return false;
+    // Not expected: Space was reserved when the frame was queued.
+    if (backlog->count >= MAX_WEB_SOCKET_CLIENT_BACKLOG) {
+        ++dropped_frames[client];
+        backlog_reserved[client].fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ws_frame_acquire(frame);
+    backlog->frames[(backlog->head + backlog->count) % MAX_WEB_SOCKET_CLIENT_BACKLOG] = frame;
+    ++backlog->count;
 }
 
-static bool send_ws_work_item(WebSockets *ws, ws_work_item wi)
+void WebSockets::clearBacklog_HTTPThread(size_t client)
 {
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    WebSocketsClientBacklog *backlog = &backlogs[client];
 
-    ws_pkt.payload = (uint8_t *)wi.payload;
-    ws_pkt.len = wi.payload_len;
-    ws_pkt.type = wi.payload_len == 0 ? HTTPD_WS_TYPE_PING : wi.ws_type;
+    for (size_t i = 0; i < backlog->count; ++i) {
+        ws_frame_release(backlog->frames[(backlog->head + i) % MAX_WEB_SOCKET_CLIENT_BACKLOG]);
+    }
 
-    bool result = true;
+    backlog_reserved[client].fetch_sub(static_cast<uint32_t>(backlog->count), std::memory_order_relaxed);
+    backlog->head = 0;
+    backlog->count = 0;
+}
 
-    struct httpd_data *hd = (struct httpd_data *)ws->httpd;
+// Moves all queued frames into the backlogs of their clients.
+void WebSockets::distributeQueuedFrames_HTTPThread()
+{
+    int fds[MAX_WEB_SOCKET_CLIENTS];
+    {
+        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
+        memcpy(fds, keep_alive_fds, sizeof(fds));
+    }
 
-    for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-        if (wi.fds[i] == -1) {
-            continue;
+    // Drop the backlog of a client that was closed or whose slot was reused.
+    for (size_t client = 0; client < MAX_WEB_SOCKET_CLIENTS; ++client) {
+        if (backlogs[client].fd != fds[client]) {
+            clearBacklog_HTTPThread(client);
+            backlogs[client].fd = fds[client];
+            dropped_frames[client] = 0;
         }
+    }
 
-        if (httpd_ws_get_fd_info(hd, wi.fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) {
-            continue;
+    ws_work_item wi;
+    while (work_queue.pop(&wi)) {
+        for (size_t client = 0; client < MAX_WEB_SOCKET_CLIENTS; ++client) {
+            if (wi.fds[client] == -1) {
+                continue;
+            }
+
+            if (fds[client] == wi.fds[client]) {
+                addToBacklog_HTTPThread(client, wi.frame);
+            }
+            else {
+                // The client was closed after the frame was queued.
+                backlog_reserved[client].fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        ws_frame_release(wi.frame);
+    }
+}
+
+void WebSockets::processQueue_HTTPThread()
+{
+    // Send one frame per client and round, so that a client with a long
+    // backlog does not delay the others. New frames are distributed before
+    // each round to replace outdated frames of slow clients.
+    for (size_t round = 0; round < MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE + MAX_WEB_SOCKET_CLIENT_BACKLOG; ++round) {
+        distributeQueuedFrames_HTTPThread();
+
+        bool sent = false;
+
+        for (size_t client = 0; client < MAX_WEB_SOCKET_CLIENTS; ++client) {
+            WebSocketsClientBacklog *backlog = &backlogs[client];
+
+            if (backlog->count == 0) {
+                continue;
+            }
+
+            WebSocketFrame *frame = backlog->frames[backlog->head];
+            backlog->head = (backlog->head + 1) % MAX_WEB_SOCKET_CLIENT_BACKLOG;
+            --backlog->count;
+            backlog_reserved[client].fetch_sub(1, std::memory_order_relaxed);
+
+            if (!send_ws_frame(this, backlog->fd, frame->payload, frame->payload_len, frame->ws_type)) {
+                // The client was closed. Don't try to send the rest of its backlog.
+                clearBacklog_HTTPThread(client);
+            }
+
+            ws_frame_release(frame);
+            sent = true;
         }
 
-        if (httpd_ws_send_frame_async(hd, wi.fds[i], &ws_pkt) != ESP_OK) {
-            ws->keepAliveCloseDead(wi.fds[i]);
-            result = false;
+        if (!sent) {
+            break;
         }
     }
 
-    return result;
+    size_t len = 0;
+    for (size_t client = 0; client < MAX_WEB_SOCKET_CLIENTS; ++client) {
+        client_backlog_len[client] = backlogs[client].count;
+        len += backlogs[client].count;
+    }
+
+    backlog_len.store(len, std::memory_order_relaxed);
 }
 
 static void work(void *arg)
@@ -120,11 +303,7 @@ static void work(void *arg)
     WebSockets *ws = (WebSockets *)arg;
     ws->worker_active = WEBSOCKET_WORKER_RUNNING;
 
-    ws_work_item wi;
-    while (ws->haveWork(&wi)) {
-        send_ws_work_item(ws, wi);
-        clear_ws_work_item(&wi);
-    }
+    ws->processQueue_HTTPThread();
 
     ws->worker_active = WEBSOCKET_WORKER_DONE;
 #if MODULE_WATCHDOG_AVAILABLE()
@@ -132,6 +311,38 @@ static void work(void *arg)
 #endif
 }
 
+// Sec-WebSocket-Protocol is a comma separated list of the subprotocols the client supports.
+static bool client_requested_subprotocol(httpd_req_t *req, const char *subprotocol)
+{
+    char buf[64];
+
+    if (httpd_req_get_hdr_value_str(req, "Sec-WebSocket-Protocol", buf, sizeof(buf)) != ESP_OK) {
+        return false;
+    }
+
+    size_t subprotocol_len = strlen(subprotocol);
+    const char *p = buf;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == ',') {
+            ++p;
+        }
+
+        const char *end = p;
+        while (*end != '\0' && *end != ' ' && *end != ',') {
+            ++end;
+        }
+
+        if (static_cast<size_t>(end - p) == subprotocol_len && memcmp(p, subprotocol, subprotocol_len) == 0) {
+            return true;
+        }
+
+        p = end;
+    }
+
+    return false;
+}
+
 static esp_err_t ws_handler(httpd_req_t *req)
 {
     if (req->method == HTTP_GET) {
@@ -153,8 +364,12 @@ static esp_err_t ws_handler(httpd_req_t *req)
                 return ESP_FAIL;
             }
 
+            // Only confirm the subprotocol if the client asked for it.
+            // All other clients get the default protocol.
+            bool subprotocol = ws->supported_subprotocol != nullptr && client_requested_subprotocol(req, ws->supported_subprotocol);
+
             struct httpd_data *hd = (struct httpd_data *)ws->httpd;
-            esp_err_t ret = httpd_ws_respond_server_handshake(&hd->hd_req, nullptr);
+            esp_err_t ret = httpd_ws_respond_server_handshake(&hd->hd_req, subprotocol ? ws->supported_subprotocol : nullptr);
             if (ret != ESP_OK) {
                 return ret;
             }
@@ -171,10 +386,10 @@ static esp_err_t ws_handler(httpd_req_t *req)
                 // the keep alive list to ensure that the full state is send by the
                 // callback before any other message with a partial state might
                 // be send to all clients known by the keep alive list
-                ws->on_client_connect_fn(WebSocketsClient{sock, ws});
+                ws->on_client_connect_fn(WebSocketsClient{sock, ws, subprotocol});
             }
 
-            ws->keepAliveAdd(sock);
+            ws->keepAliveAdd(sock, subprotocol);
         } else {
             request.send(200);
         }
@@ -236,7 +451,7 @@ static esp_err_t ws_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-void WebSockets::keepAliveAdd(int fd)
+void WebSockets::keepAliveAdd(int fd, bool subprotocol)
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
@@ -244,6 +459,7 @@ void WebSockets::keepAliveAdd(int fd)
             // fd is alreaedy in the keep alive array. Only update last_pong to prevent instantly closing the new connection.
             // This can happen if web sockets are opened and closed rapidly (so that LWIP "reuses" the fd) and we miss a close frame.
             keep_alive_last_pong[i] = millis();
+            keep_alive_subprotocol[i] = subprotocol;
             return;
         }
     }
@@ -253,30 +469,25 @@ void WebSockets::keepAliveAdd(int fd)
             continue;
         keep_alive_fds[i] = fd;
         keep_alive_last_pong[i] = millis();
+        keep_alive_subprotocol[i] = subprotocol;
         return;
     }
 }
 
 void WebSockets::keepAliveRemove(int fd)
 {
-    {
-        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
-        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-            if (keep_alive_fds[i] != fd)
-                continue;
-            keep_alive_fds[i] = -1;
-            keep_alive_last_pong[i] = 0;
-            break;
-        }
+    std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
+    for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+        if (keep_alive_fds[i] != fd)
+            continue;
+        keep_alive_fds[i] = -1;
+        keep_alive_last_pong[i] = 0;
+        keep_alive_subprotocol[i] = false;
+        break;
     }
 
-    {
-        std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-        for (int i = 0; i < work_queue.size(); ++i)
-            for (int j = 0; j < MAX_WEB_SOCKET_CLIENTS; ++j)
-                if (work_queue[i].fds[j] == fd)
-                    work_queue[i].fds[j] = -1;
-    }
+    // Queued frames and the backlog of the client are dropped by the HTTP thread,
+    // as soon as it notices that the fd was removed.
 }
 
 void WebSockets::keepAliveCloseDead(int fd)
@@ -319,23 +530,12 @@ void WebSockets::keepAliveCloseDead(int fd)
 
 void WebSockets::pingActiveClients()
 {
-    if (!this->haveActiveClient())
-        return;
-
-    // Copy over to not hold both mutexes at the same time.
     int fds[MAX_WEB_SOCKET_CLIENTS];
-    {
-        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
-        memcpy(fds, keep_alive_fds, sizeof(fds));
-    }
-
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
+    if (!this->getActiveClients(fds, WebSocketsClientFilter::All)) {
         return;
     }
 
-    work_queue.push_back({{}, nullptr, 0, HTTPD_WS_TYPE_PING});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
+    enqueueFrame(fds, nullptr, 0, HTTPD_WS_TYPE_PING, 0);
 }
 
 void WebSockets::checkActiveClients()
@@ -364,9 +564,7 @@ void WebSockets::receivedPong(int fd)
 
 bool WebSocketsClient::sendOwnedNoFreeBlocking_HTTPThread(char *payload, size_t payload_len, httpd_ws_type_t ws_type)
 {
-    ws_work_item wi{{this->fd, -1, -1, -1, -1}, payload, payload_len, ws_type};
-    bool result = send_ws_work_item(ws, wi);
-    return result;
+    return send_ws_frame(ws, fd, payload, payload_len, ws_type);
 }
 
 void WebSocketsClient::close_HTTPThread()
@@ -387,14 +585,8 @@ bool WebSockets::sendToClient(const char *payload, size_t payload_len, int fd, h
 
     memcpy(payload_copy, payload, payload_len);
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload_copy);
-        return false;
-    }
-
-    work_queue.push_back({{fd, -1, -1, -1, -1}, payload_copy, payload_len, ws_type});
-    return true;
+    int fds[MAX_WEB_SOCKET_CLIENTS] = {fd, -1, -1, -1, -1};
+    return enqueueFrame(fds, payload_copy, payload_len, ws_type, 0);
 }
 
 bool WebSockets::sendToClientOwned(char *payload, size_t payload_len, int fd, httpd_ws_type_t ws_type)
@@ -404,26 +596,53 @@ bool WebSockets::sendToClientOwned(char *payload, size_t payload_len, int fd, ht
         return true;
     }
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload);
-        return false;
+    int fds[MAX_WEB_SOCKET_CLIENTS] = {fd, -1, -1, -1, -1};
+    return enqueueFrame(fds, payload, payload_len, ws_type, 0);
+}
+
+static bool client_matches(bool subprotocol, WebSocketsClientFilter filter)
+{
+    switch (filter) {
+        case WebSocketsClientFilter::All:
+            return true;
+
+        case WebSocketsClientFilter::WithoutSubprotocol:
+            return !subprotocol;
+
+        case WebSocketsClientFilter::WithSubprotocol:
+            return subprotocol;
     }
 
-    work_queue.push_back({{fd, -1, -1, -1, -1}, payload, payload_len, ws_type});
-    return true;
+    return false;
 }
 
-bool WebSockets::haveActiveClient()
+bool WebSockets::haveActiveClient(WebSocketsClientFilter filter)
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-        if (keep_alive_fds[i] != -1)
+        if (keep_alive_fds[i] != -1 && client_matches(keep_alive_subprotocol[i], filter))
             return true;
     }
     return false;
 }
 
+bool WebSockets::getActiveClients(int fds[MAX_WEB_SOCKET_CLIENTS], WebSocketsClientFilter filter)
+{
+    bool found = false;
+
+    std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
+    for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+        if (keep_alive_fds[i] != -1 && client_matches(keep_alive_subprotocol[i], filter)) {
+            fds[i] = keep_alive_fds[i];
+            found = true;
+        } else {
+            fds[i] = -1;
+        }
+    }
+
+    return found;
+}
+
 bool WebSockets::haveFreeSlot()
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
@@ -434,33 +653,21 @@ bool WebSockets::haveFreeSlot()
     return false;
 }
 
-bool WebSockets::sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type)
+bool WebSockets::sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type, WebSocketsClientFilter filter, uint32_t topic)
 {
-    if (!this->haveActiveClient()) {
+    int fds[MAX_WEB_SOCKET_CLIENTS];
+    if (!this->getActiveClients(fds, filter)) {
         free(payload);
         return true;
     }
 
-    // Copy over to not hold both mutexes at the same time.
-    int fds[MAX_WEB_SOCKET_CLIENTS];
-    {
-        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
-        memcpy(fds, keep_alive_fds, sizeof(fds));
-    }
-
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload);
-        return false;
-    }
-    work_queue.push_back({{}, payload, payload_len, ws_type});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
-    return true;
+    return enqueueFrame(fds, payload, payload_len, ws_type, topic);
 }
 
-bool WebSockets::sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type)
+bool WebSockets::sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type, WebSocketsClientFilter filter, uint32_t topic)
 {
-    if (!this->haveActiveClient())
+    int fds[MAX_WEB_SOCKET_CLIENTS];
+    if (!this->getActiveClients(fds, filter))
         return true;
 
     char *payload_copy = (char *)malloc(payload_len * sizeof(char));
@@ -469,22 +676,7 @@ bool WebSockets::sendToAll(const char *payload, size_t payload_len, httpd_ws_typ
     }
     memcpy(payload_copy, payload, payload_len);
 
-    // Copy over to not hold both mutexes at the same time.
-    int fds[MAX_WEB_SOCKET_CLIENTS];
-    {
-        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
-        memcpy(fds, keep_alive_fds, sizeof(fds));
-    }
-
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload_copy);
-        return false;
-    }
-
-    work_queue.push_back({{}, payload_copy, payload_len, ws_type});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
-    return true;
+    return enqueueFrame(fds, payload_copy, payload_len, ws_type, topic);
 }
 
 void WebSockets::triggerHttpThread()
@@ -512,8 +704,7 @@ void WebSockets::triggerHttpThread()
     if (!deadline_elapsed(last_worker_run + WORKER_WATCHDOG_TIMEOUT / 8))
 #endif
     {
-        std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-        if (work_queue.empty()) {
+        if (!haveWork()) {
             return;
         }
     }
@@ -540,28 +731,57 @@ void WebSockets::pre_setup() {
         {"keep_alive_pongs", Config::Array({},Config::get_prototype_uint32_0(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfUint>())},
         {"worker_active", Config::Uint8(WEBSOCKET_WORKER_DONE)},
         {"last_worker_run", Config::Uint32(0)},
-        {"queue_len", Config::Uint32(0)}
+        {"queue_len", Config::Uint32(0)},
+        {"queue_full", Config::Uint32(0)},
+        {"backlog_len", Config::Array({}, Config::get_prototype_uint32_0(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfUint>())},
+        {"dropped_frames", Config::Array({}, Config::get_prototype_uint32_0(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfUint>())},
+        {"backlog_full", Config::Array({}, Config::get_prototype_uint32_0(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfUint>())},
+        {"coalesced_frames", Config::Uint32(0)},
+        {"keep_alive_subprotocol", Config::Array({}, Config::get_prototype_bool_false(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfBool>())},
+        {"sent_text_bytes", Config::Uint32(0)},
+        {"sent_binary_bytes", Config::Uint32(0)},
     });
 
     Config *state_keep_alive_fds = static_cast<Config *>(state.get("keep_alive_fds"));
     Config *state_keep_alive_pongs = static_cast<Config *>(state.get("keep_alive_pongs"));
+    Config *state_keep_alive_subprotocol = static_cast<Config *>(state.get("keep_alive_subprotocol"));
+    Config *state_backlog_len = static_cast<Config *>(state.get("backlog_len"));
+    Config *state_dropped_frames = static_cast<Config *>(state.get("dropped_frames"));
+    Config *state_backlog_full = static_cast<Config *>(state.get("backlog_full"));
 
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
         state_keep_alive_fds->add()->updateInt(-1); // Override default from shared prototype.
         state_keep_alive_pongs->add();
+        state_keep_alive_subprotocol->add();
+        state_backlog_len->add();
+        state_dropped_frames->add();
+        state_backlog_full->add();
         keep_alive_fds[i] = -1;
         keep_alive_last_pong[i] = 0;
+        keep_alive_subprotocol[i] = false;
     }
 }
 
 void WebSockets::updateDebugState()
 {
-    {
-        std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
+    state.get("worker_active"  )->updateUint(worker_active);
+    state.get("last_worker_run")->updateUint(last_worker_run);
+    state.get("queue_len"      )->updateUint(work_queue.size());
+    state.get("queue_full"     )->updateUint(queue_full_count.load(std::memory_order_relaxed));
+
+    // Counters are only written by the HTTP thread. A torn read is not possible for 32 bit values.
+    state.get("sent_text_bytes"  )->updateUint(sent_text_bytes);
+    state.get("sent_binary_bytes")->updateUint(sent_binary_bytes);
+    state.get("coalesced_frames" )->updateUint(coalesced_frames);
+
+    Config *state_backlog_len    = static_cast<Config *>(state.get("backlog_len"));
+    Config *state_dropped_frames = static_cast<Config *>(state.get("dropped_frames"));
+    Config *state_backlog_full   = static_cast<Config *>(state.get("backlog_full"));
 
-        state.get("worker_active"  )->updateUint(worker_active);
-        state.get("last_worker_run")->updateUint(last_worker_run);
-        state.get("queue_len"      )->updateUint(work_queue.size());
+    for (size_t i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+        state_backlog_len->get(i)->updateUint(client_backlog_len[i]);
+        state_dropped_frames->get(i)->updateUint(dropped_frames[i]);
+        state_backlog_full->get(i)->updateUint(backlog_full_count[i].load(std::memory_order_relaxed));
     }
 
     {
@@ -569,10 +789,12 @@ void WebSockets::updateDebugState()
 
         Config *state_keep_alive_fds   = static_cast<Config *>(state.get("keep_alive_fds"));
         Config *state_keep_alive_pongs = static_cast<Config *>(state.get("keep_alive_pongs"));
+        Config *state_keep_alive_subprotocol = static_cast<Config *>(state.get("keep_alive_subprotocol"));
 
         for (size_t i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
             state_keep_alive_fds->get(i)->updateInt(keep_alive_fds[i]);
             state_keep_alive_pongs->get(i)->updateUint(keep_alive_last_pong[i]);
+            state_keep_alive_subprotocol->get(i)->updateBool(keep_alive_subprotocol[i]);
         }
     }
 }
@@ -580,6 +802,7 @@ void WebSockets::updateDebugState()
 void WebSockets::start(const char *uri, const char *state_path, httpd_handle_t httpd, const char *supported_subprotocol)
 {
     this->httpd = httpd;
+    this->supported_subprotocol = supported_subprotocol;
 
     httpd_uri_t ws = {};
     ws.uri = uri;
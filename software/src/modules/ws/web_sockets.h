@@ -24,31 +24,61 @@
 #include <functional>
 #include <atomic>
 #include <mutex>
-#include <deque>
 
 #include "config.h"
+#include "tools/mpsc_queue.h"
 
 #define MAX_WEB_SOCKET_CLIENTS 5
-#define MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE 32
+#define MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE 32 // must be a power of two
+#define MAX_WEB_SOCKET_CLIENT_BACKLOG 64
 
 class WebSockets;
 
+// Selects clients by the subprotocol negotiated in the handshake.
+enum class WebSocketsClientFilter {
+    All,
+    WithoutSubprotocol,
+    WithSubprotocol,
+};
+
 struct WebSocketsClient {
     int fd;
     WebSockets *ws;
+    bool subprotocol; // the client negotiated the supported subprotocol
 
     bool sendOwnedNoFreeBlocking_HTTPThread(char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
     void close_HTTPThread();
 };
 
-struct ws_work_item {
-    int fds[MAX_WEB_SOCKET_CLIENTS];
+// A frame is allocated once and shared by all clients it is sent to.
+// It is freed when the last client has sent (or dropped) it.
+struct WebSocketFrame {
+    std::atomic<uint32_t> refcount;
     char *payload;
     size_t payload_len;
     httpd_ws_type_t ws_type;
+    // A queued frame is replaced by a newer frame with the same topic, if the
+    // client did not send it yet. 0 if the frame must not be replaced.
+    uint32_t topic;
 };
 
-void clear_ws_work_item(ws_work_item *wi);
+WebSocketFrame *ws_frame_create(char *payload, size_t payload_len, httpd_ws_type_t ws_type, uint32_t topic);
+void ws_frame_acquire(WebSocketFrame *frame);
+void ws_frame_release(WebSocketFrame *frame);
+
+// A frame and the clients it should be sent to, indexed by their keep alive slot.
+struct ws_work_item {
+    int fds[MAX_WEB_SOCKET_CLIENTS];
+    WebSocketFrame *frame;
+};
+
+// Frames waiting to be sent to one client. Only accessed by the HTTP thread.
+struct WebSocketsClientBacklog {
+    int fd = -1;
+    size_t head = 0;
+    size_t count = 0;
+    WebSocketFrame *frames[MAX_WEB_SOCKET_CLIENT_BACKLOG];
+};
 
 #define WEBSOCKET_WORKER_ENQUEUED 0
 #define WEBSOCKET_WORKER_RUNNING 1
@@ -62,27 +92,37 @@ public:
     void pre_setup();
     void start(const char *uri, const char *state_path, httpd_handle_t httpd, const char *supported_subprotocol = nullptr);
 
+    // The send functions only queue the payload. A topic != 0 allows to replace
+    // the payload by a newer one with the same topic while it is still queued.
+    // They return false if the backlog of a client is full. Retry later.
     bool sendToClient(const char *payload, size_t payload_len, int sock, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
     bool sendToClientOwned(char *payload, size_t payload_len, int sock, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
-    bool sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
-    bool sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
+    bool sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT, WebSocketsClientFilter filter = WebSocketsClientFilter::All, uint32_t topic = 0);
+    bool sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT, WebSocketsClientFilter filter = WebSocketsClientFilter::All, uint32_t topic = 0);
 
     bool haveFreeSlot();
-    bool haveActiveClient();
+    bool haveActiveClient(WebSocketsClientFilter filter = WebSocketsClientFilter::All);
+    // Copies the fds of the matching clients, other entries are set to -1. Returns false if there is no matching client.
+    bool getActiveClients(int fds[MAX_WEB_SOCKET_CLIENTS], WebSocketsClientFilter filter);
     void pingActiveClients();
     void checkActiveClients();
     void receivedPong(int fd);
 
-    void cleanUpQueue();
-    bool queueFull();
+    bool enqueueFrame(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, httpd_ws_type_t ws_type, uint32_t topic);
+    void releaseBacklogSpace(const int fds[MAX_WEB_SOCKET_CLIENTS], size_t end = MAX_WEB_SOCKET_CLIENTS);
 
     void onConnect_HTTPThread(std::function<void(WebSocketsClient)> &&fn);
     void onBinaryDataReceived_HTTPThread(std::function<void(const int fd, httpd_ws_frame_t *ws_pkt)> &&fn);
 
     void triggerHttpThread();
-    bool haveWork(ws_work_item *item);
+    bool haveWork();
 
-    void keepAliveAdd(int fd);
+    void processQueue_HTTPThread();
+    void distributeQueuedFrames_HTTPThread();
+    void addToBacklog_HTTPThread(size_t client, WebSocketFrame *frame);
+    void clearBacklog_HTTPThread(size_t client);
+
+    void keepAliveAdd(int fd, bool subprotocol = false);
     void keepAliveRemove(int fd);
     void keepAliveCloseDead(int fd);
 
@@ -94,15 +134,32 @@ public:
     std::recursive_mutex keep_alive_mutex;
     int keep_alive_fds[MAX_WEB_SOCKET_CLIENTS];
     uint32_t keep_alive_last_pong[MAX_WEB_SOCKET_CLIENTS];
+    bool keep_alive_subprotocol[MAX_WEB_SOCKET_CLIENTS];
 
-    std::recursive_mutex work_queue_mutex;
-    std::deque<ws_work_item> work_queue;
+    MPSCQueue<ws_work_item, MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE> work_queue;
+    WebSocketsClientBacklog backlogs[MAX_WEB_SOCKET_CLIENTS];
+    std::atomic<size_t> backlog_len{0}; // sum of all backlogs
+    // Frames that are queued for or in the backlog of each keep alive slot.
+    // Space is reserved when a frame is queued: If a backlog is full, the
+    // frame is rejected, so that the caller can retry it.
+    std::atomic<uint32_t> backlog_reserved[MAX_WEB_SOCKET_CLIENTS] = {};
 
     std::atomic<uint8_t> worker_active;
     uint32_t last_worker_run = 0;
     uint32_t worker_poll_count = 0;
 
+    // Written by the HTTP thread only.
+    uint32_t sent_text_bytes = 0;
+    uint32_t sent_binary_bytes = 0;
+    uint32_t coalesced_frames = 0;
+    uint32_t dropped_frames[MAX_WEB_SOCKET_CLIENTS] = {}; // backlog was full
+    size_t client_backlog_len[MAX_WEB_SOCKET_CLIENTS] = {};
+
+    std::atomic<uint32_t> queue_full_count{0};
+    std::atomic<uint32_t> backlog_full_count[MAX_WEB_SOCKET_CLIENTS] = {};
+
     httpd_handle_t httpd;
+    const char *supported_subprotocol = nullptr;
 
     std::function<void(WebSocketsClient)> on_client_connect_fn;
     std::function<void(const int fd, httpd_ws_frame_t *ws_pkt)> on_binary_data_received_fn;
@@ -24,6 +24,7 @@
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "cool_string.h"
+#include "tools/cbor.h"
 
 static const char *prefix = "{\"topic\":\"";
 static const char *infix = "\",\"payload\":";
@@ -32,6 +33,17 @@ static size_t prefix_len = strlen(prefix);
 static size_t infix_len = strlen(infix);
 static size_t suffix_len = strlen(suffix);
 
+// Clients that request this subprotocol receive state updates as binary
+// frames containing a sequence of CBOR items instead of JSON text:
+// - [id, "path", payload] assigns the ID to the path and sets the state,
+//   this is only sent in the initial state dump.
+// - [id, payload] updates the state with this ID.
+// - null marks the end of the initial state dump.
+// Raw state updates and the keep alive are still sent as JSON text frames.
+#define WS_CBOR_SUBPROTOCOL "tf-cbor-v1"
+
+#define WS_ENCODING_BENCHMARK_ITERATIONS 10
+
 // Also change mqtt.cpp MQTT_RECV_BUFFER_SIZE when changing WS_SEND_BUFFER_SIZE here!
 #if defined(BOARD_HAS_PSRAM)
 #define WS_SEND_BUFFER_SIZE 10240U
@@ -50,9 +62,36 @@ void WS::setup()
     initialized = true;
 }
 
+static size_t cbor_initial_state_length(size_t state_idx, const StateRegistration &reg)
+{
+    return 1 + cbor_head_length(state_idx) + cbor_head_length(reg.path_len) + reg.path_len + reg.config->cbor_length();
+}
+
+static void put_cbor_initial_state(StringWriter *sw, size_t state_idx, const StateRegistration &reg)
+{
+    cbor_put_head(sw, CBOR_MAJOR_ARRAY, 3);
+    cbor_put_head(sw, CBOR_MAJOR_UINT, state_idx);
+    cbor_put_text(sw, reg.path, reg.path_len);
+    reg.config->to_cbor_except(reg.keys_to_censor, reg.keys_to_censor_len, sw);
+}
+
+static size_t cbor_state_update_length(size_t state_idx, const StateRegistration &reg)
+{
+    return 1 + cbor_head_length(state_idx) + reg.config->cbor_length();
+}
+
+static void put_cbor_state_update(StringWriter *sw, size_t state_idx, const StateRegistration &reg)
+{
+    cbor_put_head(sw, CBOR_MAJOR_ARRAY, 2);
+    cbor_put_head(sw, CBOR_MAJOR_UINT, state_idx);
+    reg.config->to_cbor_except(reg.keys_to_censor, reg.keys_to_censor_len, sw);
+}
+
 void WS::register_urls()
 {
     web_sockets.onConnect_HTTPThread([this](WebSocketsClient client) {
+        bool cbor = client.subprotocol;
+
         // Max payload size is WS_SEND_BUFFER_SIZE.
         // The framing needs 10 + 12 + 3 bytes (with the second \n to mark the end of the API dump)
         // API path lengths should probably fit in the 103 bytes left.
@@ -73,13 +112,19 @@ void WS::register_urls()
         bool done = false;
 
         while (!done) {
-            auto result = task_scheduler.await([&i, &done, &sb]() {
+            auto result = task_scheduler.await([&i, &done, &sb, cbor]() {
                 for (; i < api.states.size(); ++i) {
                     auto &reg = api.states[i];
                     auto path = reg.path;
                     auto path_len = reg.path_len;
-                    auto config_len = reg.config->string_length();
-                    int req = prefix_len + path_len + infix_len + config_len + suffix_len + 1; // +1 for the second \n
+                    size_t req;
+
+                    if (cbor) {
+                        req = cbor_initial_state_length(i, reg) + 1; // +1 for the null
+                    }
+                    else {
+                        req = prefix_len + path_len + infix_len + reg.config->string_length() + suffix_len + 1; // +1 for the second \n
+                    }
 
                     if (sb.getRemainingLength() < req) {
                         done = false;
@@ -91,6 +136,11 @@ void WS::register_urls()
                         return;
                     }
 
+                    if (cbor) {
+                        put_cbor_initial_state(&sb, i, reg);
+                        continue;
+                    }
+
                     sb.puts(prefix, prefix_len);
                     sb.puts(path, path_len);
                     sb.puts(infix, infix_len);
@@ -113,10 +163,10 @@ void WS::register_urls()
             }
 
             if (done) {
-                sb.putc('\n');
+                sb.putc(cbor ? static_cast<char>(CBOR_NULL) : '\n');
             }
 
-            if (!client.sendOwnedNoFreeBlocking_HTTPThread(sb.getPtr(), sb.getLength())) {
+            if (!client.sendOwnedNoFreeBlocking_HTTPThread(sb.getPtr(), sb.getLength(), cbor ? HTTPD_WS_TYPE_BINARY : HTTPD_WS_TYPE_TEXT)) {
                 return;
             }
 
@@ -124,7 +174,95 @@ void WS::register_urls()
         }
     });
 
-    web_sockets.start("/ws", "info/ws", server.httpd);
+    web_sockets.start("/ws", "info/ws", server.httpd, WS_CBOR_SUBPROTOCOL);
+
+#ifdef DEBUG_FS_ENABLE
+    // Encodes all states as JSON and as CBOR, to compare the encodings on the actual device and configuration.
+    server.on_HTTPThread("/ws/encoding_benchmark", HTTP_GET, [](WebServerRequest request) {
+        size_t state_count = 0;
+        size_t json_bytes = 0;
+        size_t cbor_bytes = 0;
+        size_t json_message_bytes = 0;
+        size_t cbor_message_bytes = 0;
+        micros_t json_duration = 0_us;
+        micros_t cbor_duration = 0_us;
+
+        // One await per iteration and encoding to not block the main loop for too long.
+        for (size_t iteration = 0; iteration < WS_ENCODING_BENCHMARK_ITERATIONS; ++iteration) {
+            auto result = task_scheduler.await([&]() {
+                StringBuilder sb;
+                micros_t start = now_us();
+
+                json_bytes = 0;
+                json_message_bytes = 0;
+
+                for (size_t i = 0; i < api.states.size(); ++i) {
+                    auto &reg = api.states[i];
+
+                    sb.clear();
+                    if (!sb.setCapacity(reg.config->string_length())) {
+                        continue;
+                    }
+
+                    reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len, &sb);
+                    json_bytes += sb.getLength();
+                    json_message_bytes += prefix_len + reg.path_len + infix_len + sb.getLength() + suffix_len;
+                }
+
+                json_duration = json_duration + (now_us() - start);
+            });
+
+            if (result != TaskScheduler::AwaitResult::Done) {
+                return request.send(500, "text/plain", "Failed to run benchmark");
+            }
+
+            result = task_scheduler.await([&]() {
+                StringBuilder sb;
+                micros_t start = now_us();
+
+                state_count = api.states.size();
+                cbor_bytes = 0;
+                cbor_message_bytes = 0;
+
+                for (size_t i = 0; i < api.states.size(); ++i) {
+                    auto &reg = api.states[i];
+
+                    sb.clear();
+                    if (!sb.setCapacity(cbor_state_update_length(i, reg))) {
+                        continue;
+                    }
+
+                    put_cbor_state_update(&sb, i, reg);
+                    cbor_message_bytes += sb.getLength();
+                    cbor_bytes += sb.getLength() - (1 + cbor_head_length(i));
+                }
+
+                cbor_duration = cbor_duration + (now_us() - start);
+            });
+
+            if (result != TaskScheduler::AwaitResult::Done) {
+                return request.send(500, "text/plain", "Failed to run benchmark");
+            }
+        }
+
+        char buf[384];
+        StringWriter sw(buf, sizeof(buf));
+
+        sw.printf("{\"states\":%u,\"iterations\":%u,"
+                  "\"json\":{\"payload_bytes\":%u,\"message_bytes\":%u,\"encode_us\":%u},"
+                  "\"cbor\":{\"payload_bytes\":%u,\"message_bytes\":%u,\"encode_us\":%u}}",
+                  state_count,
+                  WS_ENCODING_BENCHMARK_ITERATIONS,
+                  json_bytes,
+                  json_message_bytes,
+                  json_duration.as<uint32_t>() / WS_ENCODING_BENCHMARK_ITERATIONS,
+                  cbor_bytes,
+                  cbor_message_bytes,
+                  cbor_duration.as<uint32_t>() / WS_ENCODING_BENCHMARK_ITERATIONS);
+
+        return request.send(200, "application/json; charset=utf-8", sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
+    });
+#endif
 
     task_scheduler.scheduleWithFixedDelay([this](){
         char *payload;
@@ -148,27 +286,67 @@ void WS::addResponse(size_t responseIdx, const ResponseRegistration &reg)
 
 // returns true on success
 bool WS::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
+{
+    bool result = true;
+
+    if (web_sockets.haveActiveClient(WebSocketsClientFilter::WithoutSubprotocol)) {
+        result = pushJSONStateUpdate(payload, path, WebSocketsClientFilter::WithoutSubprotocol, stateIdx + 1);
+    }
+
+    if (web_sockets.haveActiveClient(WebSocketsClientFilter::WithSubprotocol)) {
+        result = pushCBORStateUpdate(stateIdx) && result;
+    }
+
+    return result;
+}
+
+// returns true on success
+bool WS::pushRawStateUpdate(const String &payload, const String &path)
 {
     if (!web_sockets.haveActiveClient()) {
         return true;
     }
 
+    return pushJSONStateUpdate(payload, path, WebSocketsClientFilter::All, 0);
+}
+
+// returns true on success
+// A topic != 0 allows a queued update to be replaced by a newer one with the same topic.
+bool WS::pushJSONStateUpdate(const String &payload, const String &path, WebSocketsClientFilter filter, uint32_t topic)
+{
     StringBuilder sb;
     size_t payload_len = payload.length();
 
-    if (!pushStateUpdateBegin(&sb, stateIdx, payload_len, path.c_str(), path.length())) {
+    if (!pushStateUpdateBegin(&sb, 0, payload_len, path.c_str(), path.length())) {
         return false;
     }
 
     sb.puts(payload.c_str(), payload_len);
+    sb.puts(suffix, suffix_len);
 
-    return pushStateUpdateEnd(&sb);
+    size_t len = sb.getLength();
+    char *buf = sb.take();
+
+    return web_sockets.sendToAllOwned(buf, len, HTTPD_WS_TYPE_TEXT, filter, topic);
 }
 
 // returns true on success
-bool WS::pushRawStateUpdate(const String &payload, const String &path)
+bool WS::pushCBORStateUpdate(size_t stateIdx)
 {
-    return pushStateUpdate(0, payload, path);
+    const auto &reg = api.states[stateIdx];
+    StringBuilder sb;
+
+    if (!sb.setCapacity(cbor_state_update_length(stateIdx, reg))) {
+        return false;
+    }
+
+    put_cbor_state_update(&sb, stateIdx, reg);
+
+    size_t len = sb.getLength();
+    char *buf = sb.take();
+
+    // A CBOR client only receives this state's updates in CBOR, so the topic can be the same as for JSON.
+    return web_sockets.sendToAllOwned(buf, len, HTTPD_WS_TYPE_BINARY, WebSocketsClientFilter::WithSubprotocol, stateIdx + 1);
 }
 
 // returns true if it is okay to call pushStateUpdateEnd
@@ -218,7 +396,12 @@ bool WS::pushRawStateUpdateEnd(StringBuilder *sb)
 
 IAPIBackend::WantsStateUpdate WS::wantsStateUpdate(size_t stateIdx)
 {
-    return web_sockets.haveActiveClient() ?
-           IAPIBackend::WantsStateUpdate::AsString :
+    // CBOR clients are served directly from the config.
+    if (web_sockets.haveActiveClient(WebSocketsClientFilter::WithoutSubprotocol)) {
+        return IAPIBackend::WantsStateUpdate::AsString;
+    }
+
+    return web_sockets.haveActiveClient(WebSocketsClientFilter::WithSubprotocol) ?
+           IAPIBackend::WantsStateUpdate::AsConfig :
            IAPIBackend::WantsStateUpdate::No;
 }
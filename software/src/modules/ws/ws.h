@@ -49,4 +49,8 @@ public:
     bool pushRawStateUpdateEnd(StringBuilder *sb);
 
     WebSockets web_sockets;
+
+private:
+    bool pushJSONStateUpdate(const String &payload, const String &path, WebSocketsClientFilter filter, uint32_t topic);
+    bool pushCBORStateUpdate(size_t stateIdx);
 };
@@ -22,6 +22,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include <type_traits>
 
 template <typename T, size_t SIZE, typename AlignedT, void*(*malloc_fn)(size_t), void(*free_fn)(void*)>
@@ -166,11 +167,129 @@ public:
         return true;
     }
 
+    // Pushes n items at once. Like push(), this overwrites the oldest items if
+    // there is not enough free space left.
+    void push_n(const T *vals, size_t n)
+    {
+        if (n > size()) {
+            vals += n - size();
+            n = size();
+        }
+
+        size_t dropped = n > free() ? n - free() : 0;
+
+        while (n > 0) {
+            size_t to_write = n < SIZE - end ? n : SIZE - end;
+
+            write_span(end, vals, to_write);
+            vals += to_write;
+            n -= to_write;
+            end += to_write;
+
+            if (end >= SIZE) {
+                end = 0;
+            }
+        }
+
+        if (dropped > 0) {
+            start += dropped;
+
+            if (start >= SIZE) {
+                start -= SIZE;
+            }
+        }
+    }
+
+    // Copies up to n items, starting offset items after the oldest item,
+    // without removing them. Returns the number of items copied.
+    size_t peek_n(T *vals, size_t offset, size_t n)
+    {
+        size_t available = used();
+
+        if (offset >= available) {
+            return 0;
+        }
+
+        if (n > available - offset) {
+            n = available - offset;
+        }
+
+        size_t idx = start + offset >= SIZE ? start + offset - SIZE : start + offset;
+        size_t copied = 0;
+
+        while (copied < n) {
+            size_t to_read = n - copied < SIZE - idx ? n - copied : SIZE - idx;
+
+            read_span(idx, vals + copied, to_read);
+            copied += to_read;
+            idx += to_read;
+
+            if (idx >= SIZE) {
+                idx = 0;
+            }
+        }
+
+        return n;
+    }
+
     // index of first valid elemnt
     size_t start;
     // index of first invalid element
     size_t end;
     AlignedT *buffer;
+
+private:
+    // The buffer might only support aligned access. Copy whole AlignedT slots
+    // where possible and fall back to read/write_aligned at the edges. The
+    // memcpy matches the item order of read/write_aligned on little-endian.
+    void write_span(size_t idx, const T *vals, size_t n)
+    {
+        constexpr size_t items_per_slot = sizeof(AlignedT) / sizeof(T);
+
+        while (n > 0 && idx % items_per_slot != 0) {
+            write_aligned(idx++, *vals++);
+            --n;
+        }
+
+        while (n >= items_per_slot) {
+            AlignedT slot;
+
+            memcpy(&slot, vals, sizeof(slot));
+            buffer[idx / items_per_slot] = slot;
+            idx += items_per_slot;
+            vals += items_per_slot;
+            n -= items_per_slot;
+        }
+
+        while (n > 0) {
+            write_aligned(idx++, *vals++);
+            --n;
+        }
+    }
+
+    void read_span(size_t idx, T *vals, size_t n)
+    {
+        constexpr size_t items_per_slot = sizeof(AlignedT) / sizeof(T);
+
+        while (n > 0 && idx % items_per_slot != 0) {
+            *vals++ = read_aligned(idx++);
+            --n;
+        }
+
+        while (n >= items_per_slot) {
+            AlignedT slot = buffer[idx / items_per_slot];
+
+            memcpy(vals, &slot, sizeof(slot));
+            idx += items_per_slot;
+            vals += items_per_slot;
+            n -= items_per_slot;
+        }
+
+        while (n > 0) {
+            *vals++ = read_aligned(idx++);
+            --n;
+        }
+    }
 };
 
 
@@ -292,6 +411,15 @@ public:
         }
     }
 
+    void drop_n(size_t n)
+    {
+        if (n > used()) {
+            n = used();
+        }
+
+        start = mod_size(start + n);
+    }
+
     void pop_until(T needle)
     {
         while (!empty()) {
@@ -0,0 +1,157 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "string_builder.h"
+
+// Minimal CBOR (RFC 8949) encoder, used by the binary web socket protocol.
+// Only definite lengths and values up to 32 bit are supported.
+// Floats that are integers are encoded as integers, NaN and infinity as null
+// (like ArduinoJson does), all other floats as single precision.
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NINT 1
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT32 0xFA
+
+static inline size_t cbor_head_length(uint32_t value)
+{
+    return value < 24 ? 1 : value <= 0xFF ? 2 : value <= 0xFFFF ? 3 : 5;
+}
+
+static inline void cbor_put_head(StringWriter *sw, uint8_t major, uint32_t value)
+{
+    char buf[5];
+    size_t len;
+
+    if (value < 24) {
+        buf[0] = static_cast<char>((major << 5) | value);
+        len = 1;
+    }
+    else if (value <= 0xFF) {
+        buf[0] = static_cast<char>((major << 5) | 24);
+        buf[1] = static_cast<char>(value);
+        len = 2;
+    }
+    else if (value <= 0xFFFF) {
+        buf[0] = static_cast<char>((major << 5) | 25);
+        buf[1] = static_cast<char>(value >> 8);
+        buf[2] = static_cast<char>(value);
+        len = 3;
+    }
+    else {
+        buf[0] = static_cast<char>((major << 5) | 26);
+        buf[1] = static_cast<char>(value >> 24);
+        buf[2] = static_cast<char>(value >> 16);
+        buf[3] = static_cast<char>(value >> 8);
+        buf[4] = static_cast<char>(value);
+        len = 5;
+    }
+
+    sw->puts(buf, static_cast<ssize_t>(len));
+}
+
+static inline void cbor_put_int(StringWriter *sw, int32_t value)
+{
+    if (value >= 0) {
+        cbor_put_head(sw, CBOR_MAJOR_UINT, static_cast<uint32_t>(value));
+    }
+    else {
+        cbor_put_head(sw, CBOR_MAJOR_NINT, static_cast<uint32_t>(-1 - value));
+    }
+}
+
+static inline void cbor_put_text(StringWriter *sw, const char *text, size_t text_len)
+{
+    cbor_put_head(sw, CBOR_MAJOR_TEXT, static_cast<uint32_t>(text_len));
+    sw->puts(text, static_cast<ssize_t>(text_len));
+}
+
+static inline size_t cbor_int_length(int32_t value)
+{
+    return cbor_head_length(value >= 0 ? static_cast<uint32_t>(value) : static_cast<uint32_t>(-1 - value));
+}
+
+// Returns true if the float is an integer that fits into an int32_t.
+static inline bool cbor_float_is_int(float value, int32_t *result)
+{
+    if (!(value >= -2147483648.0f && value < 2147483648.0f)) {
+        return false;
+    }
+
+    int32_t i = static_cast<int32_t>(value);
+    if (static_cast<float>(i) != value) {
+        return false;
+    }
+
+    *result = i;
+    return true;
+}
+
+static inline size_t cbor_float_length(float value)
+{
+    int32_t i;
+
+    if (!isfinite(value)) {
+        return 1;
+    }
+
+    if (cbor_float_is_int(value, &i)) {
+        return cbor_int_length(i);
+    }
+
+    return 5;
+}
+
+static inline void cbor_put_float(StringWriter *sw, float value)
+{
+    int32_t i;
+
+    if (!isfinite(value)) {
+        sw->putc(static_cast<char>(CBOR_NULL));
+        return;
+    }
+
+    if (cbor_float_is_int(value, &i)) {
+        cbor_put_int(sw, i);
+        return;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    char buf[5] = {
+        static_cast<char>(CBOR_FLOAT32),
+        static_cast<char>(bits >> 24),
+        static_cast<char>(bits >> 16),
+        static_cast<char>(bits >> 8),
+        static_cast<char>(bits),
+    };
+    sw->puts(buf, sizeof(buf));
+}
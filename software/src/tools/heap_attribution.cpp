@@ -0,0 +1,551 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HEAP_ATTRIBUTION
+
+#include "heap_attribution.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+extern TaskHandle_t mainTaskHandle;
+
+static portMUX_TYPE heap_attribution_mux = portMUX_INITIALIZER_UNLOCKED;
+#define HEAP_ATTRIBUTION_LOCK() portENTER_CRITICAL_SAFE(&heap_attribution_mux)
+#define HEAP_ATTRIBUTION_UNLOCK() portEXIT_CRITICAL_SAFE(&heap_attribution_mux)
+
+// Tasks other than the main task are tagged with their name.
+#define HEAP_ATTRIBUTION_MAX_TASKS 24
+#else
+#include <mutex>
+#include <stdlib.h>
+
+static std::mutex heap_attribution_mutex;
+#define HEAP_ATTRIBUTION_LOCK() heap_attribution_mutex.lock()
+#define HEAP_ATTRIBUTION_UNLOCK() heap_attribution_mutex.unlock()
+#endif
+
+// Twice as many slots as tracked blocks keep the probe sequences short.
+#define BLOCK_SLOTS (2 * HEAP_ATTRIBUTION_MAX_TRACKED_BLOCKS)
+#define BLOCK_SIZE_BITS 24
+#define BLOCK_SIZE_MASK ((1u << BLOCK_SIZE_BITS) - 1)
+#define MAX_FILE_TAGS 64
+
+static_assert((BLOCK_SLOTS & (BLOCK_SLOTS - 1)) == 0, "BLOCK_SLOTS must be a power of two");
+static_assert(HEAP_ATTRIBUTION_MAX_TAGS <= 256, "Tags must fit into the upper byte of size_and_tag");
+
+struct BlockSlot {
+    uintptr_t addr; // 0 if the slot is empty
+    uint32_t size_and_tag;
+};
+
+struct FileTag {
+    const char *file;
+    uint8_t tag;
+};
+
+static BlockSlot *blocks = nullptr;
+static HeapAttributionStats *tags = nullptr;
+static size_t tag_count = 0;
+static HeapAttributionSummary summary = {};
+
+static FileTag file_tags[MAX_FILE_TAGS];
+static size_t file_tag_count = 0;
+
+#ifdef ESP_PLATFORM
+struct TaskTag {
+    TaskHandle_t handle;
+    uint8_t tag;
+};
+
+static TaskTag task_tags[HEAP_ATTRIBUTION_MAX_TASKS];
+static size_t task_tag_count = 0;
+static uint8_t other_tasks_tag = HEAP_ATTRIBUTION_TAG_UNTAGGED;
+#endif
+
+static uint8_t main_task_tag = HEAP_ATTRIBUTION_TAG_UNTAGGED;
+
+static size_t hash_addr(uintptr_t addr)
+{
+    // Heap blocks are at least 4 byte aligned.
+    uint32_t key = static_cast<uint32_t>(addr >> 2);
+    return (key * 2654435761u) & (BLOCK_SLOTS - 1);
+}
+
+static size_t size_bucket(size_t size)
+{
+    if (size <= 16) {
+        return 0;
+    }
+
+    // ceil(log2(size)) - 4
+    size_t bucket = 32 - __builtin_clz(static_cast<uint32_t>(size - 1)) - 4;
+
+    return bucket < HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS ? bucket : HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS - 1;
+}
+
+bool heap_attribution_init()
+{
+    if (blocks != nullptr) {
+        return true;
+    }
+
+    size_t blocks_size = BLOCK_SLOTS * sizeof(BlockSlot);
+    size_t tags_size = HEAP_ATTRIBUTION_MAX_TAGS * sizeof(HeapAttributionStats);
+
+#ifdef ESP_PLATFORM
+#if defined(BOARD_HAS_PSRAM)
+    uint32_t caps = MALLOC_CAP_SPIRAM;
+#else
+    uint32_t caps = MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL;
+#endif
+    // heap_caps functions are not wrapped: The tables don't track themselves.
+    void *new_tags = heap_caps_calloc(1, tags_size, caps);
+    void *new_blocks = heap_caps_calloc(1, blocks_size, caps);
+#else
+    void *new_tags = calloc(1, tags_size);
+    void *new_blocks = calloc(1, blocks_size);
+#endif
+
+    if (new_tags == nullptr || new_blocks == nullptr) {
+#ifdef ESP_PLATFORM
+        heap_caps_free(new_tags);
+        heap_caps_free(new_blocks);
+#else
+        free(new_tags);
+        free(new_blocks);
+#endif
+        return false;
+    }
+
+    tags = static_cast<HeapAttributionStats *>(new_tags);
+    strcpy(tags[HEAP_ATTRIBUTION_TAG_UNTAGGED].tag, "main");
+    tag_count = 1;
+
+#ifdef ESP_PLATFORM
+    other_tasks_tag = heap_attribution_get_tag("other tasks");
+#endif
+
+    HEAP_ATTRIBUTION_LOCK();
+    blocks = static_cast<BlockSlot *>(new_blocks);
+    HEAP_ATTRIBUTION_UNLOCK();
+
+    return true;
+}
+
+bool heap_attribution_is_initialized()
+{
+    return blocks != nullptr;
+}
+
+// Must be called with the lock held.
+static uint8_t get_tag_locked(const char *name, size_t name_len)
+{
+    if (name_len > HEAP_ATTRIBUTION_MAX_TAG_LENGTH) {
+        name_len = HEAP_ATTRIBUTION_MAX_TAG_LENGTH;
+    }
+
+    for (size_t i = 0; i < tag_count; ++i) {
+        if (strncmp(tags[i].tag, name, name_len) == 0 && tags[i].tag[name_len] == '\0') {
+            return static_cast<uint8_t>(i);
+        }
+    }
+
+    if (tag_count >= HEAP_ATTRIBUTION_MAX_TAGS) {
+        return HEAP_ATTRIBUTION_TAG_UNTAGGED;
+    }
+
+    HeapAttributionStats *stats = &tags[tag_count];
+    memset(stats, 0, sizeof(*stats));
+    memcpy(stats->tag, name, name_len);
+    stats->tag[name_len] = '\0';
+
+    return static_cast<uint8_t>(tag_count++);
+}
+
+uint8_t heap_attribution_get_tag(const char *name)
+{
+    if (tags == nullptr) {
+        return HEAP_ATTRIBUTION_TAG_UNTAGGED;
+    }
+
+    HEAP_ATTRIBUTION_LOCK();
+    uint8_t tag = get_tag_locked(name, strlen(name));
+    HEAP_ATTRIBUTION_UNLOCK();
+
+    return tag;
+}
+
+uint8_t heap_attribution_get_tag_for_file(const char *file)
+{
+    if (file == nullptr || tags == nullptr) {
+        return HEAP_ATTRIBUTION_TAG_UNTAGGED;
+    }
+
+    // File names are string literals: Comparing the pointers is enough.
+    for (size_t i = 0; i < file_tag_count; ++i) {
+        if (file_tags[i].file == file) {
+            return file_tags[i].tag;
+        }
+    }
+
+    const char *name = file;
+    size_t name_len = strlen(file);
+    const char *modules_dir = strstr(file, "modules/");
+
+    if (modules_dir != nullptr) {
+        name = modules_dir + strlen("modules/");
+        const char *slash = strchr(name, '/');
+        name_len = slash == nullptr ? strlen(name) : static_cast<size_t>(slash - name);
+    }
+    else {
+        const char *slash = strrchr(file, '/');
+
+        if (slash != nullptr) {
+            name = slash + 1;
+        }
+
+        const char *dot = strrchr(name, '.');
+        name_len = dot == nullptr ? strlen(name) : static_cast<size_t>(dot - name);
+    }
+
+    HEAP_ATTRIBUTION_LOCK();
+    uint8_t tag = get_tag_locked(name, name_len);
+
+    if (file_tag_count < MAX_FILE_TAGS) {
+        file_tags[file_tag_count].file = file;
+        file_tags[file_tag_count].tag = tag;
+        ++file_tag_count;
+    }
+
+    HEAP_ATTRIBUTION_UNLOCK();
+
+    return tag;
+}
+
+uint8_t heap_attribution_set_current_tag(uint8_t tag)
+{
+#ifdef ESP_PLATFORM
+    if (xTaskGetCurrentTaskHandle() != mainTaskHandle) {
+        return tag;
+    }
+#endif
+
+    uint8_t previous_tag = main_task_tag;
+    main_task_tag = tag;
+
+    return previous_tag;
+}
+
+// Must be called with the lock held.
+static uint8_t get_current_tag_locked()
+{
+#ifdef ESP_PLATFORM
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+
+    if (handle == mainTaskHandle) {
+        return main_task_tag;
+    }
+
+    for (size_t i = 0; i < task_tag_count; ++i) {
+        if (task_tags[i].handle == handle) {
+            return task_tags[i].tag;
+        }
+    }
+
+    if (task_tag_count >= HEAP_ATTRIBUTION_MAX_TASKS) {
+        return other_tasks_tag;
+    }
+
+    const char *task_name = pcTaskGetName(handle);
+    uint8_t tag = task_name == nullptr ? other_tasks_tag : get_tag_locked(task_name, strlen(task_name));
+
+    task_tags[task_tag_count].handle = handle;
+    task_tags[task_tag_count].tag = tag;
+    ++task_tag_count;
+
+    return tag;
+#else
+    return main_task_tag;
+#endif
+}
+
+// Must be called with the lock held.
+static void account_free_locked(uint32_t size_and_tag)
+{
+    uint32_t size = size_and_tag & BLOCK_SIZE_MASK;
+    HeapAttributionStats *stats = &tags[size_and_tag >> BLOCK_SIZE_BITS];
+
+    stats->live_bytes -= size;
+    --stats->live_blocks;
+    ++stats->frees;
+    --stats->live_histogram[size_bucket(size)];
+    --summary.tracked_blocks;
+}
+
+// Must be called with the lock held. Returns the slot of addr or the empty slot where it would be inserted.
+static size_t find_slot_locked(uintptr_t addr)
+{
+    size_t slot = hash_addr(addr);
+
+    while (blocks[slot].addr != 0 && blocks[slot].addr != addr) {
+        slot = (slot + 1) & (BLOCK_SLOTS - 1);
+    }
+
+    return slot;
+}
+
+// Must be called with the lock held. Removes the block in slot by moving
+// later blocks of the probe sequence forward (backward shift deletion).
+static void remove_slot_locked(size_t slot)
+{
+    size_t next = slot;
+
+    while (true) {
+        next = (next + 1) & (BLOCK_SLOTS - 1);
+
+        if (blocks[next].addr == 0) {
+            break;
+        }
+
+        size_t home = hash_addr(blocks[next].addr);
+
+        // Move the block if its home slot is not in (slot, next].
+        bool in_range = slot <= next ? (home > slot && home <= next) : (home > slot || home <= next);
+
+        if (!in_range) {
+            blocks[slot] = blocks[next];
+            slot = next;
+        }
+    }
+
+    blocks[slot].addr = 0;
+    blocks[slot].size_and_tag = 0;
+}
+
+void heap_attribution_on_alloc(void *ptr, size_t size)
+{
+    if (ptr == nullptr || blocks == nullptr) {
+        return;
+    }
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    if (size > BLOCK_SIZE_MASK) {
+        size = BLOCK_SIZE_MASK;
+    }
+
+    HEAP_ATTRIBUTION_LOCK();
+
+    uint8_t tag = get_current_tag_locked();
+    size_t slot = find_slot_locked(addr);
+
+    if (blocks[slot].addr == addr) {
+        // The block was freed without passing through heap_attribution_on_free.
+        account_free_locked(blocks[slot].size_and_tag);
+    }
+    else if (summary.tracked_blocks >= HEAP_ATTRIBUTION_MAX_TRACKED_BLOCKS) {
+        ++summary.untracked_allocations;
+        HEAP_ATTRIBUTION_UNLOCK();
+        return;
+    }
+
+    blocks[slot].addr = addr;
+    blocks[slot].size_and_tag = static_cast<uint32_t>(size) | (static_cast<uint32_t>(tag) << BLOCK_SIZE_BITS);
+
+    HeapAttributionStats *stats = &tags[tag];
+
+    stats->live_bytes += size;
+    ++stats->live_blocks;
+    ++stats->allocations;
+    stats->allocated_bytes += size;
+    ++stats->live_histogram[size_bucket(size)];
+
+    if (stats->live_bytes > stats->peak_live_bytes) {
+        stats->peak_live_bytes = stats->live_bytes;
+    }
+
+    if (size > stats->largest_block) {
+        stats->largest_block = size;
+    }
+
+    ++summary.tracked_blocks;
+
+    HEAP_ATTRIBUTION_UNLOCK();
+}
+
+void heap_attribution_on_free(void *ptr)
+{
+    if (ptr == nullptr || blocks == nullptr) {
+        return;
+    }
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+
+    HEAP_ATTRIBUTION_LOCK();
+
+    size_t slot = find_slot_locked(addr);
+
+    if (blocks[slot].addr == addr) {
+        account_free_locked(blocks[slot].size_and_tag);
+        remove_slot_locked(slot);
+    }
+    else {
+        ++summary.unknown_frees;
+    }
+
+    HEAP_ATTRIBUTION_UNLOCK();
+}
+
+size_t heap_attribution_get_stats(HeapAttributionStats *stats, size_t max_stats, HeapAttributionSummary *summary_out)
+{
+    if (blocks == nullptr) {
+        return 0;
+    }
+
+    HEAP_ATTRIBUTION_LOCK();
+
+    size_t count = tag_count < max_stats ? tag_count : max_stats;
+    memcpy(stats, tags, count * sizeof(HeapAttributionStats));
+
+    if (summary_out != nullptr) {
+        *summary_out = summary;
+    }
+
+    HEAP_ATTRIBUTION_UNLOCK();
+
+    return count;
+}
+
+#ifdef ESP_PLATFORM
+// Removes a block like heap_attribution_on_free, but without counting it as
+// freed. Returns the block's size and tag or 0 if it was not tracked.
+static uint32_t take_block(void *ptr)
+{
+    if (ptr == nullptr || blocks == nullptr) {
+        return 0;
+    }
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uint32_t size_and_tag = 0;
+
+    HEAP_ATTRIBUTION_LOCK();
+
+    size_t slot = find_slot_locked(addr);
+
+    if (blocks[slot].addr == addr) {
+        size_and_tag = blocks[slot].size_and_tag;
+        uint32_t size = size_and_tag & BLOCK_SIZE_MASK;
+        HeapAttributionStats *stats = &tags[size_and_tag >> BLOCK_SIZE_BITS];
+
+        stats->live_bytes -= size;
+        --stats->live_blocks;
+        --stats->live_histogram[size_bucket(size)];
+        --summary.tracked_blocks;
+
+        remove_slot_locked(slot);
+    }
+
+    HEAP_ATTRIBUTION_UNLOCK();
+
+    return size_and_tag;
+}
+
+// Undoes take_block if realloc failed.
+static void restore_block(void *ptr, uint32_t size_and_tag)
+{
+    if (size_and_tag == 0) {
+        return;
+    }
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uint32_t size = size_and_tag & BLOCK_SIZE_MASK;
+
+    HEAP_ATTRIBUTION_LOCK();
+
+    size_t slot = find_slot_locked(addr);
+
+    if (blocks[slot].addr != addr) {
+        blocks[slot].addr = addr;
+        blocks[slot].size_and_tag = size_and_tag;
+
+        HeapAttributionStats *stats = &tags[size_and_tag >> BLOCK_SIZE_BITS];
+
+        stats->live_bytes += size;
+        ++stats->live_blocks;
+        ++stats->live_histogram[size_bucket(size)];
+        ++summary.tracked_blocks;
+    }
+
+    HEAP_ATTRIBUTION_UNLOCK();
+}
+
+// Linked with -Wl,--wrap=malloc etc., see heap_attribution.h.
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    heap_attribution_on_alloc(ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    void *ptr = __real_calloc(count, size);
+    // calloc returned nullptr if count * size overflowed.
+    heap_attribution_on_alloc(ptr, count * size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    // Forget the old block before it is released: Another task could get the same address.
+    uint32_t old_size_and_tag = take_block(ptr);
+
+    void *new_ptr = __real_realloc(ptr, size);
+
+    if (new_ptr != nullptr) {
+        heap_attribution_on_alloc(new_ptr, size);
+    }
+    else if (size != 0) {
+        // The old block is still allocated.
+        restore_block(ptr, old_size_and_tag);
+    }
+
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    heap_attribution_on_free(ptr);
+    __real_free(ptr);
+}
+}
+#endif
+
+#endif
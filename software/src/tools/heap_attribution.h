@@ -0,0 +1,108 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Attributes heap allocations to the module (or task) that made them.
+//
+// Enable by adding these build flags to a custom environment:
+//     -DHEAP_ATTRIBUTION
+//     -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -Wl,--wrap=free
+// The linker then routes all malloc calls (including operator new and the
+// precompiled IDF libraries) through the wrappers in heap_attribution.cpp.
+// heap_caps allocations made by the helpers in malloc.h are reported by the
+// helpers themselves; other direct heap_caps calls are not attributed.
+//
+// Allocations in the main task are attributed to the tag set with
+// HeapAttributionScope: main.cpp sets the module for each setup stage and
+// loop call, the task scheduler derives the module from the file that
+// scheduled the task. Allocations of other tasks are attributed to the task.
+//
+// The live blocks are tracked in a hash table with a fixed size. If it is
+// full, new blocks are counted as untracked.
+//
+// All functions are only available if HEAP_ATTRIBUTION is defined.
+
+#define HEAP_ATTRIBUTION_MAX_TAGS 96
+#define HEAP_ATTRIBUTION_MAX_TAG_LENGTH 23
+#define HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS 12 // <= 16 B, <= 32 B, ..., <= 16 KiB, larger
+
+#if defined(BOARD_HAS_PSRAM) || !defined(ESP_PLATFORM)
+#define HEAP_ATTRIBUTION_MAX_TRACKED_BLOCKS 16384
+#else
+#define HEAP_ATTRIBUTION_MAX_TRACKED_BLOCKS 2048
+#endif
+
+#define HEAP_ATTRIBUTION_TAG_UNTAGGED 0
+
+struct HeapAttributionStats {
+    char tag[HEAP_ATTRIBUTION_MAX_TAG_LENGTH + 1];
+    uint32_t live_bytes;
+    uint32_t live_blocks;
+    uint32_t peak_live_bytes;
+    uint32_t allocations;
+    uint32_t allocated_bytes; // total, wraps around
+    uint32_t frees;
+    uint32_t largest_block;
+    uint32_t live_histogram[HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS]; // live blocks per size class
+};
+
+struct HeapAttributionSummary {
+    uint32_t tracked_blocks;
+    uint32_t untracked_allocations; // table was full
+    uint32_t unknown_frees;         // block was allocated before init or not tracked
+};
+
+// Allocates the block table. Allocations before are not tracked.
+bool heap_attribution_init();
+bool heap_attribution_is_initialized();
+
+// Returns the tag with this name, registering it if necessary.
+// Returns HEAP_ATTRIBUTION_TAG_UNTAGGED if all tags are in use.
+uint8_t heap_attribution_get_tag(const char *name);
+
+// Returns the tag of the module that contains the source file,
+// e.g. "ocpp" for "src/modules/ocpp/ocpp.cpp", otherwise the file name.
+uint8_t heap_attribution_get_tag_for_file(const char *file);
+
+// Sets the tag of the calling task. Returns the previous tag.
+// Only the main task can select its tag, other tasks are always tagged with their name.
+uint8_t heap_attribution_set_current_tag(uint8_t tag);
+
+void heap_attribution_on_alloc(void *ptr, size_t size);
+void heap_attribution_on_free(void *ptr);
+
+// Copies the statistics of all registered tags. Returns the number of tags.
+size_t heap_attribution_get_stats(HeapAttributionStats *stats, size_t max_stats, HeapAttributionSummary *summary);
+
+class HeapAttributionScope final
+{
+public:
+    explicit HeapAttributionScope(uint8_t tag) : previous_tag(heap_attribution_set_current_tag(tag)) {}
+    ~HeapAttributionScope() { heap_attribution_set_current_tag(previous_tag); }
+
+    HeapAttributionScope(const HeapAttributionScope &) = delete;
+    HeapAttributionScope &operator=(const HeapAttributionScope &) = delete;
+
+private:
+    uint8_t previous_tag;
+};
@@ -0,0 +1,171 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "loop_profiler.h"
+
+#include <string.h>
+
+#include "malloc.h"
+
+static_assert((LOOP_PROFILER_TASK_SLOTS & (LOOP_PROFILER_TASK_SLOTS - 1)) == 0, "LOOP_PROFILER_TASK_SLOTS must be a power of two");
+
+LoopProfiler loop_profiler;
+
+static size_t histogram_bucket(uint32_t runtime_us)
+{
+    size_t bucket = 0;
+    uint32_t limit = 16;
+
+    while (runtime_us > limit && bucket < LOOP_PROFILER_HISTOGRAM_BUCKETS - 1) {
+        limit *= 4;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+void LoopProfiler::set_module_names(const char *const *names, size_t count)
+{
+    module_names = names;
+    module_count = count;
+}
+
+bool LoopProfiler::set_enabled(bool enable)
+{
+    if (enable == enabled) {
+        return true;
+    }
+
+    if (enable) {
+        if (tasks == nullptr) {
+            tasks = static_cast<LoopProfilerEntry *>(calloc_psram_or_dram(LOOP_PROFILER_TASK_SLOTS + 1, sizeof(LoopProfilerEntry)));
+            modules = static_cast<LoopProfilerEntry *>(calloc_psram_or_dram(module_count + 1, sizeof(LoopProfilerEntry)));
+
+            if (tasks == nullptr || modules == nullptr) {
+                free_any(tasks);
+                free_any(modules);
+                tasks = nullptr;
+                modules = nullptr;
+                return false;
+            }
+
+            reset();
+        }
+
+        sampling_start = now_us();
+    }
+    else {
+        sampling_duration = sampling_duration + (now_us() - sampling_start);
+    }
+
+    enabled = enable;
+    return true;
+}
+
+void LoopProfiler::reset()
+{
+    if (tasks == nullptr) {
+        return;
+    }
+
+    memset(tasks, 0, sizeof(LoopProfilerEntry) * (LOOP_PROFILER_TASK_SLOTS + 1));
+    memset(modules, 0, sizeof(LoopProfilerEntry) * (module_count + 1));
+
+    for (size_t i = 0; i < module_count; ++i) {
+        modules[i].file = module_names[i];
+        modules[i].line = -1;
+    }
+
+    sampling_start = now_us();
+    sampling_duration = 0_us;
+}
+
+micros_t LoopProfiler::get_sampling_duration() const
+{
+    if (enabled) {
+        return sampling_duration + (now_us() - sampling_start);
+    }
+
+    return sampling_duration;
+}
+
+void LoopProfiler::record(LoopProfilerEntry *entry, uint32_t runtime_us)
+{
+    ++entry->calls;
+    entry->total_us += runtime_us;
+
+    if (runtime_us > entry->max_us) {
+        entry->max_us = runtime_us;
+    }
+
+    ++entry->histogram[histogram_bucket(runtime_us)];
+}
+
+void LoopProfiler::record_module(size_t index, micros_t start)
+{
+    // Sampling might have been enabled by the module itself.
+    if (!enabled || start == 0_us || index >= module_count) {
+        return;
+    }
+
+    record(&modules[index], (now_us() - start).as<uint32_t>());
+}
+
+LoopProfilerEntry *LoopProfiler::find_task(const char *file, int line)
+{
+    // file points to a string literal, so comparing the pointers is enough.
+    size_t slot = ((reinterpret_cast<uintptr_t>(file) >> 2) * 31 + static_cast<uint32_t>(line)) & (LOOP_PROFILER_TASK_SLOTS - 1);
+
+    for (size_t i = 0; i < LOOP_PROFILER_TASK_SLOTS; ++i) {
+        LoopProfilerEntry *entry = &tasks[slot];
+
+        if (entry->file == file && entry->line == line) {
+            return entry;
+        }
+
+        if (entry->file == nullptr) {
+            entry->file = file;
+            entry->line = line;
+            return entry;
+        }
+
+        slot = (slot + 1) & (LOOP_PROFILER_TASK_SLOTS - 1);
+    }
+
+    return &tasks[LOOP_PROFILER_TASK_SLOTS];
+}
+
+void LoopProfiler::record_task(const char *file, int line, micros_t deadline, micros_t start)
+{
+    if (!enabled || start == 0_us) {
+        return;
+    }
+
+    uint32_t runtime_us = (now_us() - start).as<uint32_t>();
+    LoopProfilerEntry *entry = find_task(file, line);
+
+    record(entry, runtime_us);
+
+    if (start > deadline) {
+        uint32_t lateness_us = (start - deadline).as<uint32_t>();
+        if (lateness_us > entry->max_lateness_us) {
+            entry->max_lateness_us = lateness_us;
+        }
+    }
+}
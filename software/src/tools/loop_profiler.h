@@ -0,0 +1,113 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TFTools/Micros.h>
+
+// Measures the execution time of the module loop functions and of the tasks
+// run by the task scheduler. Tasks are identified by the file and line that
+// scheduled them. Everything runs in the main task, so no locking is done:
+// Other tasks must access the profiler via task_scheduler.await.
+//
+// Sampling is disabled by default. Then the only cost is one check per call.
+// The statistics are allocated when sampling is enabled for the first time.
+
+#define LOOP_PROFILER_HISTOGRAM_BUCKETS 10 // <= 16 us, <= 64 us, <= 256 us, ..., <= 1 s, longer
+
+#if defined(BOARD_HAS_PSRAM)
+#define LOOP_PROFILER_TASK_SLOTS 256
+#else
+#define LOOP_PROFILER_TASK_SLOTS 128
+#endif
+
+struct LoopProfilerEntry {
+    // Module loop: file is the module name and line is -1.
+    // Task: file and line of the scheduling call.
+    // Tasks that don't fit into the table are collected in an entry with file == nullptr.
+    const char *file;
+    int line;
+    uint32_t calls;
+    uint32_t max_us;
+    uint32_t max_lateness_us; // tasks only: time between the deadline and the start of the task
+    uint64_t total_us;
+    uint32_t histogram[LOOP_PROFILER_HISTOGRAM_BUCKETS];
+};
+
+class LoopProfiler final
+{
+public:
+    LoopProfiler() {}
+
+    // Module loops are recorded by index. Must be called before sampling is enabled.
+    void set_module_names(const char *const *names, size_t count);
+
+    // Returns false if the statistics could not be allocated.
+    bool set_enabled(bool enable);
+    bool is_enabled() const { return enabled; }
+    void reset();
+
+    // Returns the start timestamp to pass to the record functions,
+    // or 0 if sampling is disabled.
+    inline micros_t begin() const { return enabled ? now_us() : 0_us; }
+
+    void record_module(size_t index, micros_t start);
+    void record_task(const char *file, int line, micros_t deadline, micros_t start);
+
+    micros_t get_sampling_duration() const;
+
+    // Calls the callback for each entry that was called at least once.
+    template<typename F>
+    void for_each(F &&callback) const
+    {
+        if (modules == nullptr) {
+            return;
+        }
+
+        for (size_t i = 0; i < module_count; ++i) {
+            if (modules[i].calls > 0) {
+                callback(modules[i], true);
+            }
+        }
+
+        for (size_t i = 0; i < LOOP_PROFILER_TASK_SLOTS + 1; ++i) {
+            if (tasks[i].calls > 0) {
+                callback(tasks[i], false);
+            }
+        }
+    }
+
+private:
+    void record(LoopProfilerEntry *entry, uint32_t runtime_us);
+    LoopProfilerEntry *find_task(const char *file, int line);
+
+    const char *const *module_names = nullptr;
+    size_t module_count = 0;
+
+    LoopProfilerEntry *modules = nullptr;
+    LoopProfilerEntry *tasks = nullptr; // LOOP_PROFILER_TASK_SLOTS + overflow entry
+    micros_t sampling_start = 0_us;
+    micros_t sampling_duration = 0_us; // of previous enabled periods since the last reset
+    bool enabled = false;
+};
+
+extern LoopProfiler loop_profiler;
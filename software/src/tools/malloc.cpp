@@ -21,19 +21,33 @@
 
 #include <esp_heap_caps.h>
 
+#include "heap_attribution.h"
+
+// Reports the allocation if built with HEAP_ATTRIBUTION.
+// heap_caps functions are not covered by the malloc wrappers.
+static inline void *attributed(void *ptr, size_t size)
+{
+#ifdef HEAP_ATTRIBUTION
+    heap_attribution_on_alloc(ptr, size);
+#else
+    (void)size;
+#endif
+    return ptr;
+}
+
 void *malloc_32bit_addressed(size_t size)
 {
-    return heap_caps_malloc(size, MALLOC_CAP_32BIT);
+    return attributed(heap_caps_malloc(size, MALLOC_CAP_32BIT), size);
 }
 
 void *malloc_psram(size_t size)
 {
-    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    return attributed(heap_caps_malloc(size, MALLOC_CAP_SPIRAM), size);
 }
 
 void *malloc_psram_or_dram(size_t size)
 {
-    return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    return attributed(heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL), size);
 }
 
 void *malloc_aligned_psram_or_dram(size_t alignment, size_t size)
@@ -49,25 +63,28 @@ void *malloc_aligned_psram_or_dram(size_t alignment, size_t size)
         ptr = heap_caps_aligned_alloc(alignment, size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
     }
 
-    return ptr;
+    return attributed(ptr, size);
 }
 
 void *calloc_32bit_addressed(size_t count, size_t size)
 {
-    return heap_caps_calloc(count, size, MALLOC_CAP_32BIT);
+    return attributed(heap_caps_calloc(count, size, MALLOC_CAP_32BIT), count * size);
 }
 
 void *calloc_psram_or_dram(size_t count, size_t size)
 {
-    return heap_caps_calloc_prefer(count, size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    return attributed(heap_caps_calloc_prefer(count, size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL), count * size);
 }
 
 void *calloc_dram(size_t count, size_t size)
 {
-    return heap_caps_calloc(count, size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    return attributed(heap_caps_calloc(count, size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL), count * size);
 }
 
 void free_any(void *ptr)
 {
+#ifdef HEAP_ATTRIBUTION
+    heap_attribution_on_free(ptr);
+#endif
     heap_caps_free(ptr);
 }
@@ -0,0 +1,123 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free queue for multiple producers and a single consumer.
+//
+// Every cell carries a sequence number that tells producers and the consumer
+// whether the cell is free or filled for the current lap (see Dmitry Vyukov's
+// bounded MPMC queue). Producers reserve a cell with one compare-exchange,
+// so they never block each other or the consumer. push fails if the queue is full.
+template <typename T, size_t SIZE>
+class MPSCQueue
+{
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "MPSCQueue: SIZE must be a power of two");
+
+public:
+    MPSCQueue()
+    {
+        for (size_t i = 0; i < SIZE; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+    // Can be called by any task.
+    bool push(const T &value)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        for (;;) {
+            cell = &cells[pos & (SIZE - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Must only be called by the consumer.
+    bool pop(T *value)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell *cell = &cells[pos & (SIZE - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+
+        *value = cell->value;
+        cell->sequence.store(pos + SIZE, std::memory_order_release);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Only a snapshot if producers or the consumer are active.
+    size_t size() const
+    {
+        size_t enqueued = enqueue_pos.load(std::memory_order_relaxed);
+        size_t dequeued = dequeue_pos.load(std::memory_order_relaxed);
+
+        return enqueued - dequeued;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    static constexpr size_t capacity()
+    {
+        return SIZE;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells[SIZE];
+    std::atomic<size_t> enqueue_pos{0};
+    std::atomic<size_t> dequeue_pos{0};
+};
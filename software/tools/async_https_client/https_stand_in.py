@@ -0,0 +1,222 @@
+#!/usr/bin/python3 -u
+
+# Local stand-in for the day ahead price API, used to test connection reuse,
+# TLS session resumption and conditional GETs of the AsyncHTTPSClient.
+#
+# Upload the printed certificate to the certs module, then set the day ahead
+# price API URL to https://<this host>:<port>/ and select the certificate.
+# The server reports how many TLS handshakes (full and resumed) it performed
+# and how many requests were answered with 200 and 304.
+#
+# Run with --self-test to check the server itself with Python's HTTPS client.
+
+import argparse
+import email.utils
+import hashlib
+import http.client
+import http.server
+import os
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+
+DEFAULT_DATA = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'json_stream_parser', 'testdata', 'day_ahead_prices.json')
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.handshakes = 0
+        self.resumed = 0
+        self.requests = 0
+        self.ok = 0
+        self.not_modified = 0
+
+    def snapshot(self):
+        with self.lock:
+            return self.handshakes, self.resumed, self.requests, self.ok, self.not_modified
+
+stats = Stats()
+args = None
+resource = None
+
+class Resource:
+    def __init__(self, body):
+        self.lock = threading.Lock()
+        self.set(body)
+
+    def set(self, body):
+        with self.lock:
+            self.body = body
+            self.etag = '"' + hashlib.sha1(body).hexdigest()[:16] + '"'
+            self.last_modified = email.utils.formatdate(usegmt=True)
+
+    def get(self):
+        with self.lock:
+            return self.body, self.etag, self.last_modified
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        super().setup()
+
+        with stats.lock:
+            stats.handshakes += 1
+
+            if self.request.session_reused:
+                stats.resumed += 1
+
+    def do_GET(self):
+        body, etag, last_modified = resource.get()
+
+        with stats.lock:
+            stats.requests += 1
+
+        if not self.path.startswith('/v1/day_ahead_prices/'):
+            self.send_response(404)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+
+        if_none_match = self.headers.get('If-None-Match')
+        if_modified_since = self.headers.get('If-Modified-Since')
+
+        if (if_none_match is not None and if_none_match == etag) or (if_none_match is None and if_modified_since == last_modified):
+            with stats.lock:
+                stats.not_modified += 1
+
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.send_header('Last-Modified', last_modified)
+            self.end_headers()
+            return
+
+        with stats.lock:
+            stats.ok += 1
+
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.send_header('ETag', etag)
+        self.send_header('Last-Modified', last_modified)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *log_args):
+        if args.verbose:
+            super().log_message(format, *log_args)
+
+def create_certificate(directory, host):
+    cert = os.path.join(directory, 'cert.pem')
+    key = os.path.join(directory, 'key.pem')
+
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'ec', '-pkeyopt', 'ec_paramgen_curve:prime256v1',
+                    '-nodes', '-days', '30', '-subj', f'/CN={host}', '-addext', f'subjectAltName=DNS:{host},DNS:localhost,IP:127.0.0.1',
+                    '-keyout', key, '-out', cert], check=True, capture_output=True)
+
+    return cert, key
+
+def create_server(cert, key):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(cert, key)
+
+    server = http.server.ThreadingHTTPServer((args.host, args.port), Handler)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    server.daemon_threads = True
+
+    return server
+
+def report():
+    while True:
+        time.sleep(args.report_interval)
+        handshakes, resumed, requests, ok, not_modified = stats.snapshot()
+        print(f'{handshakes} handshakes ({resumed} resumed), {requests} requests, {ok} × 200, {not_modified} × 304')
+
+def change_resource():
+    body = resource.get()[0]
+
+    while True:
+        time.sleep(args.change_interval)
+        # Trailing whitespace changes the ETag but not the content
+        body = body.rstrip() if body.endswith(b' ') else body + b' '
+        resource.set(body)
+        print('Resource changed')
+
+def self_test(cert):
+    context = ssl.create_default_context(cafile=cert)
+    path = '/v1/day_ahead_prices/de/60min'
+
+    connection = http.client.HTTPSConnection('localhost', args.port, context=context)
+    connection.request('GET', path)
+    response = connection.getresponse()
+    body = response.read()
+    etag = response.getheader('ETag')
+    assert response.status == 200 and len(body) > 0 and etag is not None
+
+    # Same connection, validator matches
+    connection.request('GET', path, headers={'If-None-Match': etag})
+    response = connection.getresponse()
+    assert response.status == 304 and response.read() == b''
+
+    session = connection.sock.session
+    connection.close()
+
+    # New connection, resumes the TLS session, resource changed
+    resource.set(body + b' ')
+    connection = http.client.HTTPSConnection('localhost', args.port, context=context)
+    connection.sock = context.wrap_socket(socket.create_connection(('localhost', args.port)), server_hostname='localhost', session=session)
+    connection.request('GET', path, headers={'If-None-Match': etag})
+    response = connection.getresponse()
+    assert response.status == 200 and response.read() == body + b' '
+    connection.close()
+
+    time.sleep(0.2)
+
+    handshakes, resumed, requests, ok, not_modified = stats.snapshot()
+    print(f'{handshakes} handshakes ({resumed} resumed), {requests} requests, {ok} × 200, {not_modified} × 304')
+    assert (handshakes, resumed, requests, ok, not_modified) == (2, 1, 3, 2, 1)
+    print('Self test passed')
+
+def main():
+    global args, resource
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8443)
+    parser.add_argument('--common-name', default='localhost', help='host name or IP address the ESP uses to connect to this server')
+    parser.add_argument('--data', default=DEFAULT_DATA)
+    parser.add_argument('--change-interval', type=float, default=0, help='change the resource every N seconds to test 200 after 304')
+    parser.add_argument('--report-interval', type=float, default=10.0)
+    parser.add_argument('--self-test', action='store_true')
+    parser.add_argument('--verbose', action='store_true')
+
+    args = parser.parse_args()
+
+    with open(args.data, 'rb') as f:
+        resource = Resource(f.read())
+
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = create_certificate(directory, args.common_name)
+        server = create_server(cert, key)
+
+        if args.self_test:
+            threading.Thread(target=server.serve_forever, daemon=True).start()
+            self_test(cert)
+            return
+
+        with open(cert) as f:
+            print(f.read())
+
+        threading.Thread(target=report, daemon=True).start()
+
+        if args.change_interval > 0:
+            threading.Thread(target=change_resource, daemon=True).start()
+
+        print(f'Listening on {args.host}:{args.port}')
+        server.serve_forever()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,159 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Compares the cost of text trace buffers (format when tracing) with binary
+// trace buffers (store arguments, format when /trace_log is read) for the
+// trace lines written by meters_modbus_tcp. The ringbuffer is emulated by a
+// memcpy into a flat buffer, the timestamp by a fixed value.
+
+#include <chrono>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "binary_trace.h"
+
+#define EVENT_LOG_TIMESTAMP_LENGTH 23
+#define ITERATIONS 2000000
+#define RING_SIZE (1 << 20)
+
+static char ring[RING_SIZE];
+static size_t ring_end = 0;
+
+static void ring_push(const void *data, size_t len)
+{
+    if (ring_end + len > RING_SIZE) {
+        ring_end = 0;
+    }
+
+    memcpy(ring + ring_end, data, len);
+    ring_end += len;
+}
+
+static const char *prefix = "meters_mbtcp";
+static const size_t prefix_len = 12;
+
+static size_t trace_text(const char *fmt, ...)
+{
+    char buf[EVENT_LOG_TIMESTAMP_LENGTH + 256];
+    size_t written = 0;
+
+    written += snprintf(buf, sizeof(buf), "%*u,%03u | ", EVENT_LOG_TIMESTAMP_LENGTH - 4, 12345u, 678u);
+    written += snprintf(buf + written, sizeof(buf) - written, "%-*.*s | ", 20, static_cast<int>(prefix_len), prefix);
+
+    va_list args;
+    va_start(args, fmt);
+    written += vsnprintf(buf + written, sizeof(buf) - written, fmt, args);
+    va_end(args);
+
+    buf[written++] = '\n';
+    ring_push(buf, written);
+
+    return written;
+}
+
+static size_t trace_binary(const char *fmt, ...)
+{
+    uint8_t payload[BINARY_TRACE_MAX_RECORD_LENGTH - sizeof(BinaryTraceRecordHeader)];
+
+    va_list args;
+    va_start(args, fmt);
+    size_t payload_len = binary_trace_encode_args(payload, sizeof(payload), fmt, args);
+    va_end(args);
+
+    BinaryTraceRecordHeader header;
+    header.length       = static_cast<uint16_t>(sizeof(header) + payload_len);
+    header.type         = BinaryTraceRecordType::Prefixed;
+    header.prefix_len   = static_cast<uint8_t>(prefix_len);
+    header.clock_synced = 0;
+    header.millis       = 678;
+    header.secs         = 12345;
+    header.prefix       = prefix;
+    header.fmt          = fmt;
+
+    ring_push(&header, sizeof(header));
+    ring_push(payload, payload_len);
+
+    return header.length;
+}
+
+template<typename Fn>
+static void run(const char *name, Fn &&fn)
+{
+    size_t bytes = 0;
+    ring_end = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+        bytes += fn(i);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    printf("%-28s %12.0f traces/s %8.1f bytes/record\n", name, ITERATIONS / secs, static_cast<double>(bytes) / ITERATIONS);
+}
+
+int main()
+{
+    run("text u16", [](uint32_t i) {
+        return trace_text("m%u t%u i%zu u16 a%zu r%u v%u", 1u, 7u, static_cast<size_t>(i & 31), static_cast<size_t>(30000 + (i & 31)), i & 0xFFFF, i & 0xFFFF);
+    });
+
+    run("binary u16", [](uint32_t i) {
+        return trace_binary("m%u t%u i%zu u16 a%zu r%u v%u", 1u, 7u, static_cast<size_t>(i & 31), static_cast<size_t>(30000 + (i & 31)), i & 0xFFFF, i & 0xFFFF);
+    });
+
+    run("text f32", [](uint32_t i) {
+        return trace_text("m%u t%u i%zu f32 a%zu r%u,%u c%u,%u v%f", 1u, 7u, static_cast<size_t>(i & 31), static_cast<size_t>(30000 + (i & 31)), i & 0xFFFF, 0x4321u, i & 0xFFFF, 0x4321u, static_cast<double>(i) * 0.1);
+    });
+
+    run("binary f32", [](uint32_t i) {
+        return trace_binary("m%u t%u i%zu f32 a%zu r%u,%u c%u,%u v%f", 1u, 7u, static_cast<size_t>(i & 31), static_cast<size_t>(30000 + (i & 31)), i & 0xFFFF, 0x4321u, i & 0xFFFF, 0x4321u, static_cast<double>(i) * 0.1);
+    });
+
+    // Formatting happens only when /trace_log is read, measure it for completeness.
+    size_t records = 0;
+    char line[EVENT_LOG_TIMESTAMP_LENGTH + 256];
+
+    ring_end = 0;
+    for (uint32_t i = 0; i < 10000; ++i) {
+        trace_binary("m%u t%u i%zu u16 a%zu r%u v%u", 1u, 7u, static_cast<size_t>(i & 31), static_cast<size_t>(30000 + (i & 31)), i & 0xFFFF, i & 0xFFFF);
+    }
+
+    size_t used = ring_end;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t round = 0; round < 100; ++round) {
+        for (size_t offset = 0; offset < used;) {
+            BinaryTraceRecordHeader header;
+            memcpy(&header, ring + offset, sizeof(header));
+            binary_trace_format(line, sizeof(line), header.fmt, reinterpret_cast<const uint8_t *>(ring + offset + sizeof(header)), header.length - sizeof(header));
+            offset += header.length;
+            ++records;
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    printf("%-28s %12.0f records/s (last: %s)\n", "binary decode u16", records / std::chrono::duration<double>(end - start).count(), line);
+
+    return 0;
+}
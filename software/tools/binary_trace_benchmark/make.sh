@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -std=c++17 -I../../src/modules/event_log -o binary_trace_benchmark main.cpp ../../src/modules/event_log/binary_trace.cpp
@@ -190,17 +190,17 @@ bool send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_
     struct cm_command_packet command_pkt;
     memset(&command_pkt, 0, sizeof(command_pkt));
     command_pkt.header.magic = CM_PACKET_MAGIC;
-    command_pkt.header.length = CM_COMMAND_PACKET_LENGTH;
+    command_pkt.header.length = CM_COMMAND_CHARGER_PACKET_LENGTH;
     command_pkt.header.seq_num = next_seq_num;
     ++next_seq_num;
-    command_pkt.header.version = CM_COMMAND_VERSION;
+    command_pkt.header.version = CM_COMMAND_VERSION_CHARGER;
 
     command_pkt.v1.allocated_current = allocated_current;
     command_pkt.v1.command_flags = cp_disconnect_requested << CM_COMMAND_FLAGS_CPDISC_BIT_POS;
 
     command_pkt.v2.allocated_phases = allocated_phases;
 
-    int err = sendto(manager_sock, &command_pkt, sizeof(command_pkt), MSG_DONTWAIT, (sockaddr *)&dest_addrs[client_id], sizeof(dest_addrs[client_id]));
+    int err = sendto(manager_sock, &command_pkt, CM_COMMAND_CHARGER_PACKET_LENGTH, MSG_DONTWAIT, (sockaddr *)&dest_addrs[client_id], sizeof(dest_addrs[client_id]));
 
     if (err < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -214,8 +214,8 @@ bool send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_
         logger.printfln("Failed to send command: %s (%d)", strerror(errno), errno);
         return true;
     }
-    if (err != CM_COMMAND_PACKET_LENGTH) {
-        logger.printfln("Failed to send command: sendto truncated packet (of %u bytes) to %d bytes.", CM_COMMAND_PACKET_LENGTH, err);
+    if (err != CM_COMMAND_CHARGER_PACKET_LENGTH) {
+        logger.printfln("Failed to send command: sendto truncated packet (of %u bytes) to %d bytes.", CM_COMMAND_CHARGER_PACKET_LENGTH, err);
         return true;
     }
     return true;
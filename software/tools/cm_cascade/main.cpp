@@ -0,0 +1,349 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+// Simulates cascaded charge management with 256 chargers behind 4 sub-managers
+// and checks the invariants of the budget distribution in cascade.cpp:
+// - The grants of all sub-managers never exceed the upstream limits.
+// - The currents of a sub-manager's chargers never exceed its grant.
+// - Every active charger keeps its minimum current if the limits allow it.
+//
+// The firmware's current allocator can't be built on the host, so every
+// sub-manager distributes its grant with a simplified allocator: Activate
+// chargers while their minimum current fits, then raise all active chargers
+// evenly up to their requested current.
+//
+// Usage: ./cm_cascade [steps] [seed]
+
+#include <inttypes.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "cascade.h"
+
+#define SUB_MANAGERS 4
+#define CHARGERS_PER_SUB_MANAGER 64
+#define MINIMUM_CURRENT_3P 6000
+#define MINIMUM_CURRENT_1P 6000
+#define RAISE_STEP 100
+
+struct SimCharger {
+    Cost phase_factors;
+    int32_t supported_current;
+    int32_t requested_current;
+    bool wants_to_charge;
+    int32_t allocated_current; // 0 if not active
+};
+
+struct SimSubManager {
+    std::vector<SimCharger> chargers;
+    CascadeDemand demand;
+    CurrentLimits grant;
+};
+
+static Cost get_phase_factors(bool three_phase, int rotation)
+{
+    if (three_phase)
+        return Cost{3, 1, 1, 1};
+
+    // Unknown rotation: The charger could use any phase.
+    if (rotation == 0)
+        return Cost{1, 1, 1, 1};
+
+    Cost result{1, 0, 0, 0};
+    result[rotation] = 1;
+    return result;
+}
+
+static int32_t get_minimum_current(const SimCharger &charger)
+{
+    return charger.phase_factors.pv == 3 ? MINIMUM_CURRENT_3P : MINIMUM_CURRENT_1P;
+}
+
+static bool fits(const Cost &cost, const Cost &budget)
+{
+    for (size_t c = 0; c < 4; ++c) {
+        if (cost[c] > 0 && cost[c] > budget[c])
+            return false;
+    }
+
+    return true;
+}
+
+static void aggregate(SimSubManager &sm)
+{
+    sm.demand = CascadeDemand{};
+
+    for (const SimCharger &charger : sm.chargers) {
+        bool active = charger.allocated_current > 0 && charger.wants_to_charge;
+        cascade_add_charger(&sm.demand, charger.phase_factors, get_minimum_current(charger), charger.requested_current, charger.supported_current, active, charger.wants_to_charge);
+    }
+}
+
+// Returns the number of chargers that lost their minimum current.
+static int allocate_locally(SimSubManager &sm)
+{
+    Cost budget = sm.grant.raw;
+    int lost_minimum = 0;
+
+    // Keep the active chargers first, then activate new ones.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (SimCharger &charger : sm.chargers) {
+            bool was_active = charger.allocated_current > 0;
+
+            if (pass == 0)
+                charger.allocated_current = was_active && charger.wants_to_charge ? -1 : 0;
+
+            bool candidate = pass == 0 ? charger.allocated_current == -1 : (charger.allocated_current == 0 && charger.wants_to_charge);
+
+            if (!candidate)
+                continue;
+
+            Cost cost = charger.phase_factors * static_cast<int>(get_minimum_current(charger));
+
+            if (fits(cost, budget)) {
+                budget -= cost;
+                charger.allocated_current = get_minimum_current(charger);
+            } else {
+                if (pass == 0)
+                    ++lost_minimum;
+
+                charger.allocated_current = 0;
+            }
+        }
+    }
+
+    // Raise all active chargers evenly.
+    bool raised = true;
+
+    while (raised) {
+        raised = false;
+
+        for (SimCharger &charger : sm.chargers) {
+            if (charger.allocated_current == 0 || charger.allocated_current >= charger.requested_current)
+                continue;
+
+            int32_t step = std::min(RAISE_STEP, charger.requested_current - charger.allocated_current);
+            Cost cost = charger.phase_factors * static_cast<int>(step);
+
+            if (!fits(cost, budget))
+                continue;
+
+            budget -= cost;
+            charger.allocated_current += step;
+            raised = true;
+        }
+    }
+
+    return lost_minimum;
+}
+
+static void randomize_charger(SimCharger &charger, std::mt19937 &rng, bool initial)
+{
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    if (initial) {
+        charger.phase_factors = get_phase_factors(percent(rng) < 70, percent(rng) % 4);
+        charger.supported_current = percent(rng) < 50 ? 16000 : 32000;
+        charger.allocated_current = 0;
+        charger.wants_to_charge = false;
+    }
+
+    // A vehicle arrives or leaves.
+    if (percent(rng) < (initial ? 60 : 3))
+        charger.wants_to_charge = !charger.wants_to_charge;
+
+    if (!charger.wants_to_charge) {
+        charger.requested_current = 0;
+        charger.allocated_current = 0;
+        return;
+    }
+
+    // Requested current follows the line currents of the vehicle.
+    std::uniform_int_distribution<int32_t> requested(6000, charger.supported_current);
+    if (initial || percent(rng) < 10)
+        charger.requested_current = requested(rng);
+}
+
+static CurrentLimits random_limits(std::mt19937 &rng, const CascadeDemand &total)
+{
+    std::uniform_int_distribution<int> percent(0, 99);
+    CurrentLimits limits;
+
+    // Between far too little for the minimum and more than the maximum.
+    for (size_t c = 1; c < 4; ++c) {
+        int reference = std::max(total.max[c], 1);
+        limits.raw[c] = static_cast<int>(static_cast<int64_t>(reference) * (5 + percent(rng) * 2) / 100);
+    }
+
+    // Most installations don't limit PV, sometimes the excess is small.
+    limits.raw.pv = percent(rng) < 70 ? limits.raw.l1 + limits.raw.l2 + limits.raw.l3 : total.max.pv * percent(rng) / 100;
+
+    // Occasionally a phase is overloaded already.
+    if (percent(rng) < 3)
+        limits.raw[1 + percent(rng) % 3] = -10000;
+
+    for (size_t c = 0; c < 4; ++c) {
+        limits.min[c] = limits.raw[c] - 1000;
+        limits.spread[c] = limits.raw[c] + 2000;
+    }
+    limits.max_pv = limits.raw.pv;
+
+    return limits;
+}
+
+int main(int argc, char **argv)
+{
+    int steps = argc > 1 ? atoi(argv[1]) : 10000;
+    unsigned seed = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 1;
+
+    std::mt19937 rng(seed);
+    std::vector<SimSubManager> sub_managers(SUB_MANAGERS);
+
+    for (SimSubManager &sm : sub_managers) {
+        sm.chargers.resize(CHARGERS_PER_SUB_MANAGER);
+
+        for (SimCharger &charger : sm.chargers)
+            randomize_charger(charger, rng, true);
+    }
+
+    // The upstream manager has no chargers of its own: Slot 0 stays empty.
+    CascadeDemand demands[SUB_MANAGERS + 1];
+    CurrentLimits grants[SUB_MANAGERS + 1];
+
+    int violations = 0;
+    int lost_minimum_feasible = 0;
+    int lost_minimum_infeasible = 0;
+    int feasible_steps = 0;
+    int64_t allocated_sum = 0;
+    int64_t usable_sum = 0;
+    CurrentLimits limits;
+
+    for (int step = 0; step < steps; ++step) {
+        for (SimSubManager &sm : sub_managers) {
+            for (SimCharger &charger : sm.chargers)
+                randomize_charger(charger, rng, false);
+
+            aggregate(sm);
+        }
+
+        CascadeDemand total;
+        demands[0] = CascadeDemand{};
+        for (size_t i = 0; i < SUB_MANAGERS; ++i) {
+            demands[1 + i] = sub_managers[i].demand;
+            total.min += sub_managers[i].demand.min;
+            total.max += sub_managers[i].demand.max;
+            total.requested += sub_managers[i].demand.requested;
+        }
+
+        // The limits change every 10 steps, similar to a slowly changing grid load.
+        if (step % 10 == 0)
+            limits = random_limits(rng, total);
+
+        cascade_distribute(&limits, demands, SUB_MANAGERS + 1, grants);
+
+        bool feasible = true;
+        for (size_t c = 0; c < 4; ++c)
+            feasible &= total.min[c] <= limits.raw[c];
+
+        feasible_steps += feasible;
+
+        // Sum of grants <= limits
+        CurrentLimits granted;
+        granted.max_pv = 0;
+        for (size_t i = 0; i < SUB_MANAGERS + 1; ++i) {
+            granted.raw += grants[i].raw;
+            granted.min += grants[i].min;
+            granted.spread += grants[i].spread;
+            granted.max_pv += grants[i].max_pv;
+        }
+
+        for (size_t c = 0; c < 4; ++c) {
+            if (limits.raw[c] >= 0 && (granted.raw[c] > limits.raw[c] || (limits.min[c] >= 0 && granted.min[c] > limits.min[c]) || granted.spread[c] > limits.spread[c])) {
+                printf("step %d: grants exceed limits on phase %zu: %d > %d\n", step, c, granted.raw[c], limits.raw[c]);
+                ++violations;
+            }
+        }
+
+        if (limits.max_pv >= 0 && granted.max_pv > limits.max_pv) {
+            printf("step %d: grants exceed max_pv: %d > %d\n", step, granted.max_pv, limits.max_pv);
+            ++violations;
+        }
+
+        for (size_t i = 0; i < SUB_MANAGERS; ++i) {
+            SimSubManager &sm = sub_managers[i];
+            sm.grant = grants[1 + i];
+
+            for (size_t c = 0; c < 4; ++c) {
+                // Minimum guaranteed if the limits allow it
+                if (feasible && sm.grant.raw[c] < sm.demand.min[c]) {
+                    printf("step %d: sub-manager %zu got %d mA on phase %zu, less than its minimum of %d mA\n", step, i, sm.grant.raw[c], c, sm.demand.min[c]);
+                    ++violations;
+                }
+
+                // Current is not wasted on sub-managers that can't use it.
+                if (sm.grant.raw[c] > std::max(sm.demand.max[c], 0)) {
+                    printf("step %d: sub-manager %zu got %d mA on phase %zu, more than its maximum of %d mA\n", step, i, sm.grant.raw[c], c, sm.demand.max[c]);
+                    ++violations;
+                }
+            }
+
+            int lost_minimum = allocate_locally(sm);
+            if (feasible)
+                lost_minimum_feasible += lost_minimum;
+            else
+                lost_minimum_infeasible += lost_minimum;
+
+            // Charger currents <= grant
+            Cost used;
+            for (const SimCharger &charger : sm.chargers) {
+                used += charger.phase_factors * static_cast<int>(charger.allocated_current);
+
+                if (charger.allocated_current > charger.supported_current) {
+                    printf("step %d: charger exceeds its supported current\n", step);
+                    ++violations;
+                }
+            }
+
+            for (size_t c = 0; c < 4; ++c) {
+                if (used[c] > std::max(sm.grant.raw[c], 0)) {
+                    printf("step %d: chargers of sub-manager %zu use %d mA on phase %zu, grant is %d mA\n", step, i, used[c], c, sm.grant.raw[c]);
+                    ++violations;
+                }
+            }
+
+            for (size_t c = 1; c < 4; ++c)
+                allocated_sum += used[c];
+        }
+
+        for (size_t c = 1; c < 4; ++c)
+            usable_sum += std::max(0, std::min(limits.raw[c], total.requested[c]));
+    }
+
+    printf("%d steps, %d sub-managers with %d chargers each, seed %u\n", steps, SUB_MANAGERS, CHARGERS_PER_SUB_MANAGER, seed);
+    printf("feasible steps (limits cover all minimum currents): %d\n", feasible_steps);
+    printf("chargers that lost their minimum current: %d in feasible steps, %d in overloaded steps\n", lost_minimum_feasible, lost_minimum_infeasible);
+    printf("allocated %.1f %% of min(limit, requested) on L1 to L3\n", usable_sum > 0 ? 100.0 * allocated_sum / usable_sum : 0.0);
+    printf("upstream manager peers: %d instead of %d\n", SUB_MANAGERS, SUB_MANAGERS * CHARGERS_PER_SUB_MANAGER);
+    printf("invariant violations: %d\n", violations);
+
+    return violations == 0 ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -std=c++17 -I../../src/modules/charge_manager -o cm_cascade main.cpp ../../src/modules/charge_manager/cascade.cpp
@@ -0,0 +1,175 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Measures log throughput and the worst-case logger stall while a slow
+// client downloads /event_log, using the event log's ring buffer.
+//
+// "byte-wise" is the old implementation: Lines are pushed and the log is
+// copied one byte at a time, and the mutex is held while the chunks are
+// sent. "span" is the current implementation: Lines are pushed with push_n,
+// /event_log copies a snapshot with peek_n and sends it without the mutex.
+// Sending a chunk to the slow client is emulated by a sleep.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// Used by ringbuffer.h
+[[noreturn]] static void esp_system_abort(const char *details)
+{
+    fprintf(stderr, "%s\n", details);
+    abort();
+}
+
+#include "ringbuffer.h"
+
+#define LINE_LENGTH 80
+#define CHUNK_SIZE 1024
+#define CHUNK_SEND_TIME std::chrono::milliseconds(5)
+#define RUN_TIME std::chrono::seconds(2)
+
+using Clock = std::chrono::steady_clock;
+
+static void free_fn(void *ptr)
+{
+    free(ptr);
+}
+
+static TF_PackedRingbuffer<char, 10000, uint32_t, malloc, free_fn> event_buf;
+static std::mutex event_buf_mutex;
+static std::atomic<bool> running;
+
+struct LoggerStats {
+    size_t lines = 0;
+    double max_stall_us = 0;
+};
+
+static void log_lines(bool span, LoggerStats *stats)
+{
+    char line[LINE_LENGTH];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+
+    while (running) {
+        auto start = Clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock{event_buf_mutex};
+
+            if (span) {
+                event_buf.push_n(line, sizeof(line));
+            }
+            else {
+                for (size_t i = 0; i < sizeof(line); ++i) {
+                    event_buf.push(line[i]);
+                }
+            }
+        }
+
+        double stall_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        stats->max_stall_us = std::max(stats->max_stall_us, stall_us);
+        ++stats->lines;
+
+        // Other threads also need the CPU.
+        std::this_thread::yield();
+    }
+}
+
+static void download_log(bool span, size_t *downloads)
+{
+    static char snapshot[10000];
+
+    while (running) {
+        if (span) {
+            size_t len;
+
+            {
+                std::lock_guard<std::mutex> lock{event_buf_mutex};
+                len = event_buf.peek_n(snapshot, 0, event_buf.used());
+            }
+
+            for (size_t index = 0; index < len; index += CHUNK_SIZE) {
+                std::this_thread::sleep_for(CHUNK_SEND_TIME);
+            }
+        }
+        else {
+            std::lock_guard<std::mutex> lock{event_buf_mutex};
+            size_t used = event_buf.used();
+
+            for (size_t index = 0; index < used; index += CHUNK_SIZE) {
+                size_t to_copy = std::min(static_cast<size_t>(CHUNK_SIZE), used - index);
+
+                for (size_t i = 0; i < to_copy; ++i) {
+                    event_buf.peek_offset(snapshot + i, index + i);
+                }
+
+                std::this_thread::sleep_for(CHUNK_SEND_TIME);
+            }
+        }
+
+        ++*downloads;
+    }
+}
+
+static void run(const char *name, bool span, bool with_client)
+{
+    event_buf.clear();
+
+    LoggerStats stats;
+    size_t downloads = 0;
+
+    running = true;
+
+    std::thread logger(log_lines, span, &stats);
+    std::thread client;
+
+    if (with_client) {
+        client = std::thread(download_log, span, &downloads);
+    }
+
+    std::this_thread::sleep_for(RUN_TIME);
+    running = false;
+
+    logger.join();
+
+    if (with_client) {
+        client.join();
+    }
+
+    double secs = std::chrono::duration<double>(RUN_TIME).count();
+
+    printf("%-28s %12.0f lines/s %10.1f us max stall %4zu downloads\n", name, stats.lines / secs, stats.max_stall_us, downloads);
+}
+
+int main()
+{
+    event_buf.setup();
+
+    run("byte-wise, no client", false, false);
+    run("byte-wise, slow client", false, true);
+    run("span, no client", true, false);
+    run("span, slow client", true, true);
+
+    return 0;
+}
@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -std=c++17 -Wall -Wextra -pthread -I../../src -o event_log_stall main.cpp
@@ -0,0 +1,450 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Host test for InflateStream and FirmwareContainerDecoder:
+//
+//   ./firmware_container test                  Compresses generated data with zlib in all
+//                                              levels, strategies and window sizes and checks
+//                                              that the streaming decoder does not depend on
+//                                              chunk boundaries and rejects corrupted streams.
+//                                              Build with sanitizers.
+//   ./firmware_container check <container> <firmware>
+//                                              Decodes a container built by make_container.py
+//                                              in 1460 byte chunks and compares it with the
+//                                              uncompressed firmware.
+//   ./firmware_container bench <container>     Reports decoding throughput.
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+#include "modules/firmware_update/firmware_container.h"
+#include "modules/firmware_update/inflate_stream.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static std::mt19937 rng(1234);
+
+static Bytes read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (f == nullptr) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+
+    Bytes result;
+    uint8_t buf[4096];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        result.insert(result.end(), buf, buf + n);
+    }
+
+    fclose(f);
+    return result;
+}
+
+static Bytes compress(const Bytes &data, int level, int window_bits, int strategy)
+{
+    z_stream zs = {};
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 9, strategy) != Z_OK) {
+        fprintf(stderr, "deflateInit2 failed\n");
+        exit(1);
+    }
+
+    Bytes result(deflateBound(&zs, data.size()) + 64);
+
+    zs.next_in = const_cast<uint8_t *>(data.data());
+    zs.avail_in = data.size();
+    zs.next_out = result.data();
+    zs.avail_out = result.size();
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "deflate failed\n");
+        exit(1);
+    }
+
+    result.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return result;
+}
+
+// Text-like data with repetitions of all distances, runs and incompressible parts.
+static Bytes generate(size_t len)
+{
+    Bytes result;
+    static const char *words[] = {"charge", "manager", "firmware", "update", "signature", "\n", " ", "{\"a\":1}"};
+
+    while (result.size() < len) {
+        switch (rng() % 4) {
+            case 0: {
+                const char *w = words[rng() % 8];
+                result.insert(result.end(), w, w + strlen(w));
+                break;
+            }
+
+            case 1: {
+                size_t n = rng() % 300;
+                result.insert(result.end(), n, static_cast<uint8_t>(rng()));
+                break;
+            }
+
+            case 2: {
+                size_t n = rng() % 64;
+                for (size_t i = 0; i < n; ++i)
+                    result.push_back(static_cast<uint8_t>(rng()));
+                break;
+            }
+
+            case 3: {
+                if (result.size() < 2)
+                    break;
+
+                size_t dist = 1 + rng() % std::min<size_t>(result.size() - 1, 40000);
+                size_t n = 3 + rng() % 300;
+                size_t start = result.size() - dist;
+                for (size_t i = 0; i < n; ++i)
+                    result.push_back(result[start + i]);
+                break;
+            }
+        }
+    }
+
+    result.resize(len);
+    return result;
+}
+
+// Feeds the stream in random chunks. Returns false if the decoder rejected it.
+static bool inflate_chunked(const Bytes &stream, size_t window_size, size_t max_chunk, Bytes *out, const char **error)
+{
+    out->clear();
+
+    InflateStream inflate([out](const uint8_t *data, size_t data_len) {
+        out->insert(out->end(), data, data + data_len);
+        return true;
+    });
+
+    Bytes window(window_size);
+    inflate.begin(window.data(), window.size());
+
+    size_t offset = 0;
+    bool ok = true;
+
+    while (ok && offset < stream.size()) {
+        size_t n = std::min<size_t>(stream.size() - offset, 1 + rng() % max_chunk);
+
+        // Copy to detect reads past the chunk with sanitizers.
+        Bytes chunk(stream.begin() + offset, stream.begin() + offset + n);
+        ok = inflate.feed(chunk.data(), chunk.size());
+        offset += n;
+    }
+
+    ok = ok && inflate.finish();
+    *error = inflate.get_error();
+
+    return ok;
+}
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            ++failures; \
+            printf("FAILED %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+static void test_roundtrip()
+{
+    static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+    static const size_t chunk_sizes[] = {1, 7, 1460, 65536};
+    size_t checked = 0;
+
+    for (size_t len : {0, 1, 100, 70000, 300000}) {
+        Bytes data = generate(len);
+
+        for (int level = 0; level <= 9; ++level) {
+            for (int strategy : strategies) {
+                for (int window_bits = 9; window_bits <= 15; window_bits += 3) {
+                    Bytes stream = compress(data, level, window_bits, strategy);
+
+                    for (size_t max_chunk : chunk_sizes) {
+                        Bytes out;
+                        const char *error = nullptr;
+                        bool ok = inflate_chunked(stream, 1u << window_bits, max_chunk, &out, &error);
+
+                        CHECK(ok, "len %zu level %d strategy %d window %d chunk %zu: %s", len, level, strategy, window_bits, max_chunk, error);
+                        CHECK(out == data, "len %zu level %d strategy %d window %d chunk %zu: output differs", len, level, strategy, window_bits, max_chunk);
+                        ++checked;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("roundtrip: %zu streams checked\n", checked);
+}
+
+static void test_corruption()
+{
+    Bytes data = generate(50000);
+    Bytes stream = compress(data, 9, 15, Z_DEFAULT_STRATEGY);
+    size_t rejected = 0;
+    size_t checked = 0;
+
+    for (size_t i = 0; i < 2000; ++i) {
+        Bytes corrupted = stream;
+        size_t pos = rng() % corrupted.size();
+        corrupted[pos] ^= 1 << (rng() % 8);
+
+        Bytes out;
+        const char *error = nullptr;
+
+        // The adler32 checksum of the trailer has to catch every corruption
+        // that still results in a valid stream.
+        if (!inflate_chunked(corrupted, 1u << 15, 1460, &out, &error))
+            ++rejected;
+        else
+            CHECK(out == data, "corruption at %zu not detected", pos);
+
+        ++checked;
+    }
+
+    // Truncated streams
+    for (size_t len : {size_t{0}, size_t{1}, size_t{2}, stream.size() / 2, stream.size() - 1}) {
+        Bytes truncated(stream.begin(), stream.begin() + len);
+        Bytes out;
+        const char *error = nullptr;
+        CHECK(!inflate_chunked(truncated, 1u << 15, 1460, &out, &error), "truncated stream of %zu bytes accepted", len);
+    }
+
+    // Trailing data
+    {
+        Bytes trailing = stream;
+        trailing.push_back(0);
+        Bytes out;
+        const char *error = nullptr;
+        CHECK(!inflate_chunked(trailing, 1u << 15, 1460, &out, &error), "trailing data accepted");
+    }
+
+    // Window too small for the stream
+    {
+        Bytes out;
+        const char *error = nullptr;
+        CHECK(!inflate_chunked(stream, 1u << 14, 1460, &out, &error), "too small window accepted");
+    }
+
+    printf("corruption: %zu of %zu corrupted streams rejected, others decoded correctly\n", rejected, checked);
+}
+
+static Bytes make_container(const Bytes &image, int window_bits)
+{
+    Bytes stream = compress(image, 9, window_bits, Z_DEFAULT_STRATEGY);
+    uint32_t len = image.size();
+
+    Bytes result = {
+        FIRMWARE_CONTAINER_MAGIC & 0xFF, (FIRMWARE_CONTAINER_MAGIC >> 8) & 0xFF, (FIRMWARE_CONTAINER_MAGIC >> 16) & 0xFF, FIRMWARE_CONTAINER_MAGIC >> 24,
+        FIRMWARE_CONTAINER_VERSION, static_cast<uint8_t>(window_bits), 0, 0,
+        static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len >> 16), static_cast<uint8_t>(len >> 24),
+    };
+
+    result.insert(result.end(), stream.begin(), stream.end());
+    return result;
+}
+
+static bool decode_container(const Bytes &container, size_t max_chunk, Bytes *out, const char **error)
+{
+    out->clear();
+
+    FirmwareContainerDecoder decoder(
+        [](size_t size) { return malloc(size); },
+        [out](size_t image_offset, const uint8_t *data, size_t data_len) {
+            if (image_offset != out->size())
+                return false;
+
+            out->insert(out->end(), data, data + data_len);
+            return true;
+        });
+
+    size_t offset = 0;
+    bool ok = true;
+
+    while (ok && offset < container.size()) {
+        size_t n = max_chunk == 0 ? container.size() : std::min<size_t>(container.size() - offset, 1 + rng() % max_chunk);
+        Bytes chunk(container.begin() + offset, container.begin() + offset + n);
+        ok = decoder.feed(chunk.data(), chunk.size());
+        offset += n;
+    }
+
+    ok = ok && decoder.finish();
+    *error = decoder.get_error();
+
+    return ok;
+}
+
+static void test_container()
+{
+    Bytes image = generate(200000);
+    image[0] = 0xE9;
+
+    CHECK(!firmware_container_detect(image.data(), image.size()), "uncompressed image detected as container");
+
+    for (int window_bits = 9; window_bits <= 15; ++window_bits) {
+        Bytes container = make_container(image, window_bits);
+        CHECK(firmware_container_detect(container.data(), container.size()), "container not detected");
+
+        for (size_t max_chunk : {1, 5, 1460}) {
+            Bytes out;
+            const char *error = nullptr;
+            CHECK(decode_container(container, max_chunk, &out, &error), "window %d chunk %zu: %s", window_bits, max_chunk, error);
+            CHECK(out == image, "window %d chunk %zu: image differs", window_bits, max_chunk);
+        }
+    }
+
+    Bytes container = make_container(image, 15);
+    Bytes out;
+    const char *error = nullptr;
+
+    // Announced length does not match
+    Bytes wrong_len = container;
+    wrong_len[8] ^= 1;
+    CHECK(!decode_container(wrong_len, 1460, &out, &error), "wrong length accepted");
+
+    wrong_len = container;
+    wrong_len[10] ^= 1;
+    CHECK(!decode_container(wrong_len, 1460, &out, &error), "wrong length accepted");
+
+    Bytes wrong_version = container;
+    wrong_version[4] = 2;
+    CHECK(!decode_container(wrong_version, 1460, &out, &error), "unknown version accepted");
+
+    // Smaller window announced than the stream needs
+    Bytes small_window = container;
+    small_window[5] = 12;
+    CHECK(!decode_container(small_window, 1460, &out, &error), "too small window accepted");
+
+    Bytes truncated(container.begin(), container.begin() + 6);
+    CHECK(!decode_container(truncated, 1460, &out, &error), "truncated header accepted");
+
+    // The firmware falls back to the uncompressed file if the window can't be allocated.
+    FirmwareContainerDecoder no_memory(
+        [](size_t size) { (void)size; return static_cast<void *>(nullptr); },
+        [](size_t image_offset, const uint8_t *data, size_t data_len) { (void)image_offset; (void)data; (void)data_len; return true; });
+    CHECK(!no_memory.feed(container.data(), container.size()), "missing window accepted");
+    CHECK(no_memory.is_out_of_memory(), "missing window not reported");
+    no_memory.reset();
+    CHECK(!no_memory.is_out_of_memory(), "out of memory not reset");
+
+    printf("container: done\n");
+}
+
+static int run_tests()
+{
+    test_roundtrip();
+    test_corruption();
+    test_container();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
+
+static int run_check(const char *container_path, const char *firmware_path)
+{
+    Bytes container = read_file(container_path);
+    Bytes firmware = read_file(firmware_path);
+    Bytes out;
+    const char *error = nullptr;
+
+    if (!decode_container(container, 1460, &out, &error)) {
+        printf("Decoding failed: %s\n", error);
+        return 1;
+    }
+
+    if (out != firmware) {
+        printf("Decoded image differs from %s\n", firmware_path);
+        return 1;
+    }
+
+    printf("%s: %zu -> %zu bytes OK\n", container_path, container.size(), out.size());
+    return 0;
+}
+
+static int run_bench(const char *container_path)
+{
+    Bytes container = read_file(container_path);
+    size_t image_len = 0;
+
+    FirmwareContainerDecoder decoder(
+        [](size_t size) { return malloc(size); },
+        [&image_len](size_t, const uint8_t *, size_t data_len) {
+            image_len += data_len;
+            return true;
+        });
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Same chunk size as a TCP segment.
+    for (size_t offset = 0; offset < container.size(); offset += 1460) {
+        if (!decoder.feed(container.data() + offset, std::min<size_t>(1460, container.size() - offset))) {
+            printf("Decoding failed: %s\n", decoder.get_error());
+            return 1;
+        }
+    }
+
+    if (!decoder.finish()) {
+        printf("Decoding failed: %s\n", decoder.get_error());
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%zu -> %zu bytes in %.1f ms (%.1f MB/s decompressed)\n", container.size(), image_len, seconds * 1000, image_len / seconds / 1e6);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "test") == 0)
+        return run_tests();
+
+    if (argc == 4 && strcmp(argv[1], "check") == 0)
+        return run_check(argv[2], argv[3]);
+
+    if (argc == 3 && strcmp(argv[1], "bench") == 0)
+        return run_bench(argv[2]);
+
+    fprintf(stderr, "Usage: %s test | check <container> <firmware> | bench <container>\n", argv[0]);
+    return 1;
+}
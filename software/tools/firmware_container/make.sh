@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -g -std=c++17 -fsanitize=address,undefined -I../../src -o firmware_container main.cpp ../../src/modules/firmware_update/inflate_stream.cpp ../../src/modules/firmware_update/firmware_container.cpp -lz
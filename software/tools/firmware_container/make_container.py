@@ -0,0 +1,69 @@
+#!/usr/bin/python3 -u
+
+# Builds a compressed firmware container from a merged (and signed) firmware
+# file. The container can be uploaded via /flash_firmware or served by the
+# update server next to the uncompressed file:
+#
+#   <name>_firmware_<version>_merged.bin -> <name>_firmware_<version>_merged.tfz
+#
+# The image is compressed as is. Signature and firmware info pages are checked
+# by the device on the decompressed data, so signing stays unchanged.
+#
+# Layout (little endian), see src/modules/firmware_update/firmware_container.h:
+#   uint32 magic, uint8 version, uint8 window bits, uint16 reserved,
+#   uint32 length of the decompressed image, zlib stream
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+FIRMWARE_CONTAINER_MAGIC = 0x5A314654
+FIRMWARE_CONTAINER_VERSION = 1
+
+def build_container(image, level, window_bits):
+    compressor = zlib.compressobj(level, zlib.DEFLATED, window_bits, 9)
+    stream = compressor.compress(image) + compressor.flush()
+
+    header = struct.pack('<IBBHI', FIRMWARE_CONTAINER_MAGIC, FIRMWARE_CONTAINER_VERSION, window_bits, 0, len(image))
+
+    return header + stream
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('firmware', help='merged firmware file')
+    parser.add_argument('-o', '--output', help='container file, default: firmware file with .tfz suffix')
+    parser.add_argument('--level', type=int, default=9, choices=range(0, 10))
+    parser.add_argument('--window-bits', type=int, default=15, choices=range(9, 16),
+                        help='the device allocates a window of 2^bits bytes while decompressing')
+    args = parser.parse_args()
+
+    with open(args.firmware, 'rb') as f:
+        image = f.read()
+
+    if len(image) == 0 or image[0] != 0xE9:
+        print('{} is not a merged firmware file'.format(args.firmware))
+        sys.exit(1)
+
+    output = args.output
+
+    if output is None:
+        output = os.path.splitext(args.firmware)[0] + '.tfz'
+
+    container = build_container(image, args.level, args.window_bits)
+
+    # Check the container before writing it.
+    decompressed = zlib.decompress(container[12:], args.window_bits)
+
+    if decompressed != image:
+        print('Container check failed')
+        sys.exit(1)
+
+    with open(output, 'wb') as f:
+        f.write(container)
+
+    print('{}: {} -> {} bytes ({:.1f} %)'.format(output, len(image), len(container), len(container) * 100 / len(image)))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,332 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+// Runs setup code of modules that build on the host under the heap
+// attribution and prints the per-module statistics, like the
+// debug/heap_by_module state of a firmware built with HEAP_ATTRIBUTION.
+//
+// operator new and delete are replaced to report to the attribution, because
+// the linker wrapping of malloc used on the ESP is not available here.
+//
+// Afterwards the modules are torn down again and the statistics are checked
+// for consistency: Every tag has to return to zero live bytes.
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "tools/heap_attribution.h"
+#include "json_stream_parser.h"
+#include "ocpp_journal.h"
+
+void *operator new(size_t size)
+{
+    void *ptr = malloc(size);
+
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    heap_attribution_on_alloc(ptr, size);
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    heap_attribution_on_free(ptr);
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+class MemoryJournalStorage final : public IOcppJournalStorage
+{
+public:
+    bool list_segments(std::vector<uint32_t> *ids) override
+    {
+        for (const auto &segment : segments) {
+            ids->push_back(segment.first);
+        }
+
+        return true;
+    }
+
+    size_t segment_size(uint32_t id) override
+    {
+        auto it = segments.find(id);
+        return it == segments.end() ? 0 : it->second.size();
+    }
+
+    size_t read(uint32_t id, size_t offset, uint8_t *buf, size_t len) override
+    {
+        auto it = segments.find(id);
+
+        if (it == segments.end() || offset >= it->second.size()) {
+            return 0;
+        }
+
+        len = std::min(len, it->second.size() - offset);
+        memcpy(buf, it->second.data() + offset, len);
+        return len;
+    }
+
+    bool write_segment(uint32_t id, const uint8_t *buf, size_t len) override
+    {
+        segments[id].assign(buf, buf + len);
+        return true;
+    }
+
+    bool remove_segment(uint32_t id) override
+    {
+        segments.erase(id);
+        return true;
+    }
+
+private:
+    std::map<uint32_t, std::vector<uint8_t>> segments;
+};
+
+struct HostModule {
+    const char *name;
+    std::function<void(void)> setup;
+    std::function<void(void)> teardown;
+    uint8_t tag;
+};
+
+static MemoryJournalStorage *journal_storage = nullptr;
+static OcppJournal *journal = nullptr;
+
+static JsonStreamParser *price_parser = nullptr;
+static std::vector<int32_t> *prices = nullptr;
+
+static std::vector<std::string> *scratch = nullptr;
+
+static void ocpp_setup()
+{
+    journal_storage = new MemoryJournalStorage();
+    journal = new OcppJournal(journal_storage);
+    journal->load();
+
+    uint8_t buf[300];
+    memset(buf, 'x', sizeof(buf));
+
+    for (int i = 0; i < 50; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "tx/%d", i);
+        journal->write(name, buf, sizeof(buf));
+        journal->sync();
+
+        if (i % 2 == 0) {
+            journal->remove(name);
+        }
+    }
+
+    journal->sync();
+}
+
+static void ocpp_teardown()
+{
+    delete journal;
+    delete journal_storage;
+}
+
+static void day_ahead_prices_setup()
+{
+    prices = new std::vector<int32_t>();
+    price_parser = new JsonStreamParser([](const JsonStreamParser &parser, JsonStreamValueType type, const char *value, size_t value_len) {
+        (void)value_len;
+        int32_t price;
+        if (type == JsonStreamValueType::Number && parser.path_is({"prices", nullptr}) && JsonStreamParser::to_int32(value, &price)) {
+            prices->push_back(price);
+        }
+    });
+
+    std::string json = "{\"first_date\":1700000000,\"prices\":[";
+    for (int i = 0; i < 96; ++i) {
+        json += std::to_string(i * 37 % 500) + (i == 95 ? "" : ",");
+    }
+    json += "]}";
+
+    // Feed in chunks, like the HTTP client does.
+    for (size_t i = 0; i < json.size(); i += 64) {
+        price_parser->parse(json.data() + i, std::min<size_t>(64, json.size() - i));
+    }
+    price_parser->finish();
+}
+
+static void day_ahead_prices_teardown()
+{
+    delete price_parser;
+    delete prices;
+}
+
+// Allocates a lot of short-lived blocks, but keeps only a few of them.
+static void scratch_setup()
+{
+    scratch = new std::vector<std::string>();
+
+    for (int i = 0; i < 1000; ++i) {
+        std::string s(static_cast<size_t>(100 + i % 4000), 'y');
+        if (i % 100 == 0) {
+            scratch->push_back(std::move(s));
+        }
+    }
+}
+
+static void scratch_teardown()
+{
+    delete scratch;
+}
+
+static size_t print_stats(bool check)
+{
+    static HeapAttributionStats stats[HEAP_ATTRIBUTION_MAX_TAGS];
+    HeapAttributionSummary summary;
+    size_t count = heap_attribution_get_stats(stats, HEAP_ATTRIBUTION_MAX_TAGS, &summary);
+    size_t errors = 0;
+
+    printf("%-18s %10s %8s %10s %8s %8s %10s  live blocks <=16 B ... >16 KiB\n", "tag", "live B", "blocks", "peak B", "allocs", "frees", "largest");
+
+    for (size_t i = 0; i < count; ++i) {
+        const HeapAttributionStats &s = stats[i];
+        printf("%-18s %10u %8u %10u %8u %8u %10u ", s.tag, s.live_bytes, s.live_blocks, s.peak_live_bytes, s.allocations, s.frees, s.largest_block);
+
+        uint32_t histogram_sum = 0;
+        for (size_t bucket = 0; bucket < HEAP_ATTRIBUTION_HISTOGRAM_BUCKETS; ++bucket) {
+            printf(" %u", s.live_histogram[bucket]);
+            histogram_sum += s.live_histogram[bucket];
+        }
+        printf("\n");
+
+        if (histogram_sum != s.live_blocks) {
+            printf("  ERROR: histogram has %u blocks, expected %u\n", histogram_sum, s.live_blocks);
+            ++errors;
+        }
+
+        if (s.allocations - s.frees != s.live_blocks) {
+            printf("  ERROR: %u allocations and %u frees, but %u live blocks\n", s.allocations, s.frees, s.live_blocks);
+            ++errors;
+        }
+
+        if (check && (s.live_bytes != 0 || s.live_blocks != 0)) {
+            printf("  ERROR: %u bytes still live after teardown\n", s.live_bytes);
+            ++errors;
+        }
+    }
+
+    printf("tracked blocks: %u, untracked allocations: %u, unknown frees: %u\n\n", summary.tracked_blocks, summary.untracked_allocations, summary.unknown_frees);
+
+    if (summary.untracked_allocations != 0 || summary.unknown_frees != 0) {
+        printf("ERROR: allocations were lost\n");
+        ++errors;
+    }
+
+    return errors;
+}
+
+int main()
+{
+    size_t errors = 0;
+
+    if (!heap_attribution_init()) {
+        printf("Failed to initialize heap attribution\n");
+        return 1;
+    }
+
+    const char *file_tags[][2] = {
+        {"src/modules/ocpp/ocpp.cpp", "ocpp"},
+        {"/home/user/esp32-firmware/software/src/modules/meters/meters.cpp", "meters"},
+        {"src/tools/malloc.cpp", "malloc"},
+        {"web_server.cpp", "web_server"},
+    };
+
+    for (const auto &file_tag : file_tags) {
+        HeapAttributionStats stats[HEAP_ATTRIBUTION_MAX_TAGS];
+        uint8_t tag = heap_attribution_get_tag_for_file(file_tag[0]);
+        size_t count = heap_attribution_get_stats(stats, HEAP_ATTRIBUTION_MAX_TAGS, nullptr);
+
+        if (tag >= count || strcmp(stats[tag].tag, file_tag[1]) != 0) {
+            printf("ERROR: %s is not tagged as %s\n", file_tag[0], file_tag[1]);
+            ++errors;
+        }
+    }
+
+    std::vector<HostModule> modules = {
+        {"ocpp", ocpp_setup, ocpp_teardown, 0},
+        {"day_ahead_prices", day_ahead_prices_setup, day_ahead_prices_teardown, 0},
+        {"scratch", scratch_setup, scratch_teardown, 0},
+    };
+
+    for (HostModule &module : modules) {
+        module.tag = heap_attribution_get_tag(module.name);
+    }
+
+    for (HostModule &module : modules) {
+        HeapAttributionScope scope{module.tag};
+        module.setup();
+    }
+
+    printf("After setup:\n");
+    errors += print_stats(false);
+
+    for (HostModule &module : modules) {
+        HeapAttributionScope scope{module.tag};
+        module.teardown();
+    }
+
+    // The vector was allocated untagged.
+    modules.clear();
+    modules.shrink_to_fit();
+
+    printf("After teardown:\n");
+    errors += print_stats(true);
+
+    if (errors != 0) {
+        printf("%zu errors\n", errors);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
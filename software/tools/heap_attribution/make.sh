@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -g -std=c++17 -Wall -Wextra -fsanitize=address,undefined -DHEAP_ATTRIBUTION -I../../src -I../../src/modules/ocpp -I../ocpp_journal -o heap_attribution main.cpp ../../src/tools/heap_attribution.cpp ../../src/modules/ocpp/ocpp_journal.cpp ../../src/json_stream_parser.cpp
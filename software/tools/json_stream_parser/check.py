@@ -0,0 +1,98 @@
+#!/usr/bin/python3 -u
+
+# Compares the values reported by the JsonStreamParser against Python's json
+# module for the recorded API responses and for randomly generated documents.
+
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+BINARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'json_stream_parser')
+
+def flatten(value, path, out):
+    if isinstance(value, dict):
+        for key, child in value.items():
+            flatten(child, path + [key[:32]], out)
+    elif isinstance(value, list):
+        for index, child in enumerate(value):
+            flatten(child, path + [str(index)], out)
+    elif value is None:
+        out.append(('\x1f'.join(path), 'null', 'null'))
+    elif isinstance(value, bool):
+        out.append(('\x1f'.join(path), 'bool', 'true' if value else 'false'))
+    elif isinstance(value, (int, float)):
+        out.append(('\x1f'.join(path), 'number', float(value)))
+    else:
+        out.append(('\x1f'.join(path), 'string', value))
+
+def parser_events(path):
+    output = subprocess.run([BINARY, 'events', path], capture_output=True, check=True).stdout.decode('utf-8')
+    records = output.split('\x1d')
+    events = []
+
+    for record in records[:-1]:
+        value_path, type_, value = record.split('\x1e', 2)
+        events.append((value_path, type_, float(value) if type_ == 'number' else value))
+
+    return records[-1] == 'ok', events
+
+def random_string():
+    return ''.join(random.choice('abc "\\/\n\tä€😀') for _ in range(random.randint(0, 10)))
+
+def random_value(depth):
+    kind = random.randint(0, 7 if depth < 6 else 4)
+
+    if kind == 0:
+        return None
+    elif kind == 1:
+        return random.choice([True, False])
+    elif kind == 2:
+        return random.randint(-2**31, 2**31 - 1)
+    elif kind == 3:
+        return random.uniform(-1e6, 1e6)
+    elif kind == 4:
+        return random_string()
+    elif kind == 5 or kind == 6:
+        return [random_value(depth + 1) for _ in range(random.randint(0, 5))]
+    else:
+        return {random_string(): random_value(depth + 1) for _ in range(random.randint(0, 5))}
+
+def check(path, doc):
+    expected = []
+    flatten(doc, [], expected)
+    ok, actual = parser_events(path)
+
+    if not ok or actual != expected:
+        print(f'Mismatch for {path}')
+        return False
+
+    return True
+
+def main():
+    failures = 0
+
+    for path in sys.argv[1:]:
+        with open(path, 'rb') as f:
+            failures += 0 if check(path, json.load(f)) else 1
+
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'doc.json')
+
+        for i in range(2000):
+            doc = random_value(0)
+
+            with open(path, 'w', encoding='utf-8') as f:
+                json.dump(doc, f, ensure_ascii=random.choice([True, False]), indent=random.choice([None, 1]))
+
+            if not check(path, doc):
+                failures += 1
+                os.rename(path, f'mismatch_{i}.json')
+
+    print(f'{failures} mismatches')
+    sys.exit(1 if failures > 0 else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,303 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Host test for JsonStreamParser:
+//
+//   ./json_stream_parser fuzz <file>...    Splits and mutates the files randomly and
+//                                          checks that the parser does not depend on
+//                                          chunk boundaries. Build with sanitizers.
+//   ./json_stream_parser events <file>     Prints one record per value, used by check.py
+//                                          to compare against Python's json module.
+//   ./json_stream_parser bench <file>...   Parses the files in 1024 byte chunks like
+//                                          AsyncHTTPSClient and reports time and heap.
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "json_stream_parser.h"
+
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+
+void *operator new(size_t size)
+{
+    size_t *p = static_cast<size_t *>(malloc(size + sizeof(size_t)));
+
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    *p = size;
+    heap_current += size;
+
+    if (heap_current > heap_peak) {
+        heap_peak = heap_current;
+    }
+
+    return p + 1;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    size_t *p = static_cast<size_t *>(ptr) - 1;
+    heap_current -= *p;
+    free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+static std::string read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (f == nullptr) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+
+    std::string result;
+    char buf[4096];
+    size_t len;
+
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        result.append(buf, len);
+    }
+
+    fclose(f);
+
+    return result;
+}
+
+static std::string format_event(const JsonStreamParser &parser, JsonStreamValueType type, const char *value, size_t value_len)
+{
+    std::string line;
+
+    for (size_t level = 0; level < parser.get_depth(); ++level) {
+        if (level > 0) {
+            line += '\x1f';
+        }
+
+        if (parser.is_array(level)) {
+            line += std::to_string(parser.get_index(level));
+        }
+        else {
+            line += parser.get_key(level);
+        }
+    }
+
+    static const char *type_names[] = {"string", "number", "bool", "null"};
+
+    line += '\x1e';
+    line += type_names[static_cast<size_t>(type)];
+    line += '\x1e';
+    line.append(value, value_len);
+
+    return line;
+}
+
+struct Result {
+    bool ok;
+    std::vector<std::string> events;
+};
+
+static Result parse_split(const std::string &data, const std::vector<size_t> &splits)
+{
+    Result result;
+    JsonStreamParser parser{[&result](const JsonStreamParser &p, JsonStreamValueType type, const char *value, size_t value_len) {
+        result.events.push_back(format_event(p, type, value, value_len));
+    }};
+
+    size_t start = 0;
+    result.ok = true;
+
+    for (size_t split : splits) {
+        result.ok = parser.parse(data.data() + start, split - start);
+        start = split;
+
+        if (!result.ok) {
+            break;
+        }
+    }
+
+    if (result.ok) {
+        result.ok = parser.parse(data.data() + start, data.size() - start) && parser.finish();
+    }
+
+    return result;
+}
+
+static std::vector<size_t> random_splits(std::mt19937 &rng, size_t len)
+{
+    std::vector<size_t> splits;
+
+    if (len == 0) {
+        return splits;
+    }
+
+    size_t count = rng() % 16;
+
+    for (size_t i = 0; i < count; ++i) {
+        splits.push_back(rng() % (len + 1));
+    }
+
+    std::sort(splits.begin(), splits.end());
+
+    return splits;
+}
+
+static std::string mutate(std::mt19937 &rng, std::string data)
+{
+    static const char interesting[] = "{}[]\",:\\u0123456789-+.eEtrufalsn \x01\xc3\xa4\xff";
+    size_t count = 1 + rng() % 4;
+
+    for (size_t i = 0; i < count && !data.empty(); ++i) {
+        size_t pos = rng() % data.size();
+        char c = interesting[rng() % (sizeof(interesting) - 1)];
+
+        switch (rng() % 3) {
+        case 0: data[pos] = c; break;
+        case 1: data.insert(pos, 1, c); break;
+        case 2: data.erase(pos, 1 + rng() % 8); break;
+        }
+    }
+
+    return data;
+}
+
+static int fuzz(int argc, char **argv)
+{
+    std::mt19937 rng(12345);
+    size_t mismatches = 0;
+    size_t accepted = 0;
+    size_t iterations = 0;
+
+    for (int i = 2; i < argc; ++i) {
+        std::string original = read_file(argv[i]);
+
+        for (size_t round = 0; round < 20000; ++round) {
+            std::string data = round == 0 ? original : mutate(rng, original);
+            Result whole = parse_split(data, {});
+
+            if (round == 0 && !whole.ok) {
+                fprintf(stderr, "%s: Failed to parse unmodified file\n", argv[i]);
+                return 1;
+            }
+
+            for (size_t split_round = 0; split_round < 8; ++split_round) {
+                Result split = parse_split(data, random_splits(rng, data.size()));
+
+                if (split.ok != whole.ok || (whole.ok && split.events != whole.events)) {
+                    ++mismatches;
+                }
+            }
+
+            accepted += whole.ok ? 1 : 0;
+            ++iterations;
+        }
+    }
+
+    printf("%zu documents, %zu accepted, %zu chunk boundary mismatches\n", iterations, accepted, mismatches);
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+static int events(const char *path)
+{
+    Result result = parse_split(read_file(path), {});
+
+    for (const std::string &line : result.events) {
+        printf("%s\x1d", line.c_str());
+    }
+
+    printf("%s", result.ok ? "ok" : "error");
+
+    return 0;
+}
+
+static int bench(int argc, char **argv)
+{
+    for (int i = 2; i < argc; ++i) {
+        std::string data = read_file(argv[i]);
+        const size_t iterations = 20000;
+        size_t values = 0;
+
+        heap_current = 0;
+        heap_peak = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t round = 0; round < iterations; ++round) {
+            JsonStreamParser parser{[&values](const JsonStreamParser &/*p*/, JsonStreamValueType type, const char *value, size_t /*value_len*/) {
+                if (type == JsonStreamValueType::Number) {
+                    int32_t v;
+                    values += JsonStreamParser::to_int32(value, &v) ? 1 : 0;
+                }
+            }};
+
+            for (size_t offset = 0; offset < data.size(); offset += 1024) {
+                parser.parse(data.data() + offset, std::min<size_t>(1024, data.size() - offset));
+            }
+
+            if (!parser.finish()) {
+                fprintf(stderr, "%s: %s\n", argv[i], parser.get_error());
+                return 1;
+            }
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        double us = std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+
+        printf("%-40s %6zu bytes %8.1f us/document %6zu bytes peak heap, parser object %zu bytes\n",
+               argv[i], data.size(), us, heap_peak, sizeof(JsonStreamParser));
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "fuzz") == 0) {
+        return fuzz(argc, argv);
+    }
+
+    if (argc == 3 && strcmp(argv[1], "events") == 0) {
+        return events(argv[2]);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc, argv);
+    }
+
+    fprintf(stderr, "Usage: %s fuzz|events|bench <file>...\n", argv[0]);
+
+    return 1;
+}
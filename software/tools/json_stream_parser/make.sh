@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -g -std=c++17 -Wall -Wextra -fsanitize=address,undefined -I../../src -o json_stream_parser main.cpp ../../src/json_stream_parser.cpp
@@ -0,0 +1,161 @@
+#!/usr/bin/python3 -u
+
+# TCP proxy between a device and a local MQTT broker that emulates a slow
+# broker link, to measure how long publishing stalls the device.
+#
+# Point the device's broker host to this machine and the port to --listen-port.
+# Data from the device is delayed by --latency-ms and read with at most
+# --rate bytes per second. The small receive buffer makes the device's TCP
+# send buffer fill up, so that a blocking publish has to wait for the link.
+#
+# If --device is given, the device's mqtt/publish_queue state is polled:
+# enqueue_max_us is the longest time a publish blocked the caller (the main
+# loop for state updates), publish_avg_us and publish_max_us is the time the
+# publish task needed to write a message to the link.
+
+import argparse
+import asyncio
+import json
+import socket
+import time
+import urllib.request
+
+class TokenBucket:
+    def __init__(self, rate):
+        self.rate = rate
+        self.tokens = rate
+        self.last = time.monotonic()
+
+    async def take(self, n):
+        if self.rate <= 0:
+            return
+
+        while True:
+            now = time.monotonic()
+            self.tokens = min(self.rate, self.tokens + (now - self.last) * self.rate)
+            self.last = now
+
+            if self.tokens >= n:
+                self.tokens -= n
+                return
+
+            await asyncio.sleep((n - self.tokens) / self.rate)
+
+async def pipe(reader, writer, latency, bucket, chunk_size):
+    # Every chunk is delayed by the latency, independent of the chunks before.
+    queue = asyncio.Queue()
+
+    async def read():
+        try:
+            while True:
+                if bucket is not None:
+                    await bucket.take(chunk_size)
+
+                data = await reader.read(chunk_size)
+                await queue.put((time.monotonic() + latency, data))
+
+                if len(data) == 0:
+                    break
+        except ConnectionError:
+            await queue.put((0, b''))
+
+    async def write():
+        try:
+            while True:
+                due, data = await queue.get()
+
+                if len(data) == 0:
+                    break
+
+                delay = due - time.monotonic()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+
+                writer.write(data)
+                await writer.drain()
+        except ConnectionError:
+            pass
+        finally:
+            writer.close()
+
+    await asyncio.gather(read(), write())
+
+async def handle_client(device_reader, device_writer, args):
+    sock = device_writer.get_extra_info('socket')
+
+    if sock is not None:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 2048)
+
+    peer = device_writer.get_extra_info('peername')
+    print('Connection from {}'.format(peer))
+
+    try:
+        broker_reader, broker_writer = await asyncio.open_connection(args.broker_host, args.broker_port)
+    except OSError as e:
+        print('Could not connect to broker: {}'.format(e))
+        device_writer.close()
+        return
+
+    # Only the device to broker direction is throttled: That is where publishes wait.
+    chunk_size = 256 if args.rate > 0 else 65536
+    bucket = TokenBucket(args.rate) if args.rate > 0 else None
+
+    await asyncio.gather(
+        pipe(device_reader, broker_writer, args.latency_ms / 1000, bucket, chunk_size),
+        pipe(broker_reader, device_writer, args.latency_ms / 1000, None, 65536),
+    )
+
+    print('Connection from {} closed'.format(peer))
+
+def fetch_state(device):
+    with urllib.request.urlopen('http://{}/mqtt/publish_queue'.format(device), timeout=10) as response:
+        return json.loads(response.read())
+
+async def poll_device(args):
+    loop = asyncio.get_running_loop()
+    last = None
+
+    while True:
+        await asyncio.sleep(args.poll_interval)
+
+        try:
+            state = await loop.run_in_executor(None, fetch_state, args.device)
+        except Exception as e:
+            print('Could not fetch publish queue state: {}'.format(e))
+            continue
+
+        published = state['published'] - (last['published'] if last is not None else 0)
+        last = state
+
+        print('published {:4} (+{:3}) failed {:3} coalesced {:5} queue full {:3} | queued: {:3} states {:2} messages | publish avg {:7} us max {:8} us | enqueue max {:5} us'.format(
+            state['published'], published, state['publish_failed'], state['coalesced'], state['queue_full'],
+            state['queued_states'], state['queued_messages'],
+            state['publish_avg_us'], state['publish_max_us'], state['enqueue_max_us']))
+
+async def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--listen-host', default='0.0.0.0')
+    parser.add_argument('--listen-port', type=int, default=1884)
+    parser.add_argument('--broker-host', default='127.0.0.1')
+    parser.add_argument('--broker-port', type=int, default=1883)
+    parser.add_argument('--latency-ms', type=float, default=200, help='delay added in both directions')
+    parser.add_argument('--rate', type=int, default=2000, help='bytes per second from the device, 0 for unlimited')
+    parser.add_argument('--device', help='host name or IP of the device to poll')
+    parser.add_argument('--poll-interval', type=float, default=5)
+    args = parser.parse_args()
+
+    server = await asyncio.start_server(lambda r, w: handle_client(r, w, args), args.listen_host, args.listen_port)
+    print('Forwarding {}:{} to {}:{} with {} ms latency and {} B/s'.format(args.listen_host, args.listen_port, args.broker_host, args.broker_port, args.latency_ms, args.rate if args.rate > 0 else 'unlimited'))
+
+    tasks = [server.serve_forever()]
+
+    if args.device is not None:
+        tasks.append(poll_device(args))
+
+    await asyncio.gather(*tasks)
+
+if __name__ == '__main__':
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
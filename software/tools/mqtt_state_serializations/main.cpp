@@ -0,0 +1,191 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Counts how often the API serializes a state per MQTT publish if MQTT has
+// a send interval. Models API::update_state with the websocket backend and
+// the MQTT backend:
+//
+// - "retry": pushStateUpdate rejects the update until the interval elapsed
+//   and the API retries on every tick (before user-042).
+// - "pending": wantsStateUpdate marks the state as pending, but keeps its
+//   updated flag (first version of user-042).
+// - "pending, flag cleared": wantsStateUpdate also clears MQTT's updated
+//   flag, flush_pending_states sets it again at the deadline.
+//
+// A connected web interface wants every state as string, like
+// WS::wantsStateUpdate does while a client is connected.
+
+#include <initializer_list>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TICK_MS 250
+#define SEND_INTERVAL_MS 10000
+#define RUN_TIME_MS (3600 * 1000)
+
+#define WS_BIT 1
+#define MQTT_BIT 2
+
+enum class Mode {
+    Retry,
+    Pending,
+    PendingFlagCleared,
+};
+
+enum class Wants {
+    No,
+    AsString,
+};
+
+struct Model {
+    Mode mode;
+    bool ws_connected;
+
+    uint8_t updated = 0;
+    uint32_t last_send_ms = 0;
+    bool pending = false;
+
+    uint32_t serializations = 0;
+    uint32_t publishes = 0;
+
+    Wants ws_wants()
+    {
+        return ws_connected ? Wants::AsString : Wants::No;
+    }
+
+    Wants mqtt_wants(uint32_t now)
+    {
+        if ((updated & MQTT_BIT) == 0) {
+            return Wants::No;
+        }
+
+        if (mode == Mode::Retry || now - last_send_ms >= SEND_INTERVAL_MS) {
+            return Wants::AsString;
+        }
+
+        pending = true;
+
+        if (mode == Mode::PendingFlagCleared) {
+            updated &= ~MQTT_BIT;
+        }
+
+        return Wants::No;
+    }
+
+    bool mqtt_push(uint32_t now)
+    {
+        if (now - last_send_ms < SEND_INTERVAL_MS) {
+            return false;
+        }
+
+        pending = false;
+        last_send_ms = now;
+        ++publishes;
+        return true;
+    }
+
+    void flush_pending(uint32_t now)
+    {
+        if (pending && now - last_send_ms >= SEND_INTERVAL_MS) {
+            pending = false;
+            updated |= MQTT_BIT;
+        }
+    }
+
+    void update_state(uint32_t now)
+    {
+        uint8_t to_send = updated;
+
+        if (to_send == 0) {
+            return;
+        }
+
+        Wants ws = ws_wants();
+        Wants mqtt = mqtt_wants(now);
+
+        if (ws == Wants::No && mqtt == Wants::No) {
+            updated = 0;
+            return;
+        }
+
+        if (mode == Mode::PendingFlagCleared) {
+            to_send &= updated;
+
+            if (to_send == 0) {
+                return;
+            }
+        }
+
+        ++serializations;
+
+        uint8_t sent = 0;
+
+        if ((to_send & WS_BIT) != 0) {
+            sent |= WS_BIT;
+        }
+
+        if ((to_send & MQTT_BIT) != 0 && mqtt_push(now)) {
+            sent |= MQTT_BIT;
+        }
+
+        updated &= ~sent;
+    }
+};
+
+static void run(const char *name, Mode mode, bool ws_connected, uint32_t change_interval_ms)
+{
+    Model model;
+    model.mode = mode;
+    model.ws_connected = ws_connected;
+
+    for (uint32_t now = TICK_MS; now <= RUN_TIME_MS; now += TICK_MS) {
+        if (now % change_interval_ms == 0) {
+            model.updated = WS_BIT | MQTT_BIT;
+        }
+
+        model.flush_pending(now);
+        model.update_state(now);
+    }
+
+    // With a web interface, every change has to be serialized once for the websocket anyway.
+    uint32_t changes = RUN_TIME_MS / change_interval_ms;
+    uint32_t for_mqtt = ws_connected ? model.serializations - changes : model.serializations;
+
+    printf("%-24s %-6s change every %5u ms: %6.2f serializations per publish, %5.2f of them only for MQTT\n",
+           name,
+           ws_connected ? "ws" : "no ws",
+           change_interval_ms,
+           static_cast<double>(model.serializations) / model.publishes,
+           static_cast<double>(for_mqtt) / model.publishes);
+}
+
+int main()
+{
+    const uint32_t change_intervals[] = {1000, 5000};
+
+    for (uint32_t change_interval_ms : change_intervals) {
+        for (bool ws_connected : {false, true}) {
+            run("retry", Mode::Retry, ws_connected, change_interval_ms);
+            run("pending", Mode::Pending, ws_connected, change_interval_ms);
+            run("pending, flag cleared", Mode::PendingFlagCleared, ws_connected, change_interval_ms);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -std=c++17 -Wall -Wextra -o mqtt_state_serializations main.cpp
@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stand-in for the ROM CRC of the ESP32. Matches esp_rom_crc32_le:
+// The CRC is inverted before and after processing the buffer.
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+
+    for (uint32_t i = 0; i < len; ++i) {
+        crc ^= buf[i];
+
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
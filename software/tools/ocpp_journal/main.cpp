@@ -0,0 +1,506 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Compares the flash writes caused by the OCPP persistence with one LittleFS
+// file per OCPP file against the append-only journal. Two workloads are run:
+// - online: Messages are queued in bursts (for example StopTransaction +
+//   MeterValues) and confirmed by the central system before the journal is
+//   synced.
+// - offline: The central system is unreachable. Bursts of messages accumulate
+//   until the connection is back, then all messages are sent and removed.
+//   While offline, the platform syncs the journal only after several bursts.
+// In both workloads the configuration is rewritten every few messages, mostly
+// without changes.
+//
+// The filesystems are faked. Flash cost is estimated with a simple model of
+// LittleFS:
+// - Every metadata commit (close after write, remove, fsync) appends
+//   METADATA_COMMIT bytes to the metadata log of the directory.
+// - Files up to INLINE_MAX bytes are stored inline in the metadata commit.
+//   Larger files program their data into new blocks.
+// - A full metadata log is compacted: The live metadata (including inline
+//   files) is programmed into a freshly erased block. Directories with more
+//   metadata than half a block are split, so at most half a block is copied.
+// - Each journal segment is a new file, that is written and synced once.
+//
+// Also checks that the journal contains the same files as the file storage
+// after each workload and survives a torn tail and a corrupted record.
+
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ocpp_journal.h"
+
+#define BLOCK_SIZE 4096
+#define METADATA_COMMIT 64
+#define INLINE_MAX 512
+
+#define MESSAGES 10000
+#define MESSAGE_SIZE 300
+#define BURST_SIZE 4
+#define OFFLINE_QUEUE_LENGTH 200
+#define CONFIRMATIONS_PER_SYNC 10 // when sending the offline queue
+#define OFFLINE_BURSTS_PER_SYNC 4 // bursts queued within the offline sync delay of the platform
+#define CONFIG_SIZE 2048
+#define CONFIG_REWRITE_INTERVAL 20
+#define CONFIG_CHANGE_INTERVAL 5 // every fifth config rewrite contains a change
+
+struct FlashCost {
+    size_t payload_bytes = 0;
+    size_t programmed_bytes = 0;
+    size_t erases = 0;
+    size_t commits = 0;
+
+    size_t metadata_log_fill = 0;
+
+    // live_metadata is the size of the metadata (and inline data) that a compaction has to copy.
+    void commit(size_t inline_bytes, size_t live_metadata)
+    {
+        programmed_bytes += METADATA_COMMIT + inline_bytes;
+        metadata_log_fill += METADATA_COMMIT + inline_bytes;
+        ++commits;
+
+        if (metadata_log_fill > BLOCK_SIZE) {
+            live_metadata = std::min(live_metadata, static_cast<size_t>(BLOCK_SIZE / 2));
+            programmed_bytes += live_metadata;
+            metadata_log_fill = live_metadata;
+            ++erases;
+        }
+    }
+
+    void program_blocks(size_t len)
+    {
+        programmed_bytes += len;
+        erases += (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+};
+
+template<typename Key>
+static size_t live_metadata(const std::map<Key, std::vector<uint8_t>> &files)
+{
+    size_t result = 0;
+
+    for (const auto &file : files) {
+        result += METADATA_COMMIT + (file.second.size() > INLINE_MAX ? 0 : file.second.size());
+    }
+
+    return result;
+}
+
+// One LittleFS file per OCPP file, as written by platform_write_file before the journal.
+class FileStorage
+{
+public:
+    void write_file(const std::string &name, const std::vector<uint8_t> &data)
+    {
+        files[name] = data;
+        cost.payload_bytes += data.size();
+
+        if (data.size() > INLINE_MAX) {
+            cost.program_blocks(data.size());
+            cost.commit(0, live_metadata(files));
+        }
+        else {
+            cost.commit(data.size(), live_metadata(files));
+        }
+    }
+
+    void remove_file(const std::string &name)
+    {
+        files.erase(name);
+        cost.commit(0, live_metadata(files));
+    }
+
+    std::map<std::string, std::vector<uint8_t>> files;
+    FlashCost cost;
+};
+
+class FakeJournalStorage final : public IOcppJournalStorage
+{
+public:
+    bool list_segments(std::vector<uint32_t> *ids) override
+    {
+        for (const auto &segment : segments) {
+            ids->push_back(segment.first);
+        }
+
+        return true;
+    }
+
+    size_t segment_size(uint32_t id) override
+    {
+        auto it = segments.find(id);
+        return it == segments.end() ? 0 : it->second.size();
+    }
+
+    size_t read(uint32_t id, size_t offset, uint8_t *buf, size_t len) override
+    {
+        auto it = segments.find(id);
+
+        if (it == segments.end() || offset >= it->second.size()) {
+            return 0;
+        }
+
+        size_t to_read = std::min(len, it->second.size() - offset);
+        memcpy(buf, it->second.data() + offset, to_read);
+        return to_read;
+    }
+
+    bool write_segment(uint32_t id, const uint8_t *buf, size_t len) override
+    {
+        segments[id].assign(buf, buf + len);
+        cost.payload_bytes += len;
+        ++segments_written;
+
+        if (len > INLINE_MAX) {
+            cost.program_blocks(len);
+            cost.commit(0, live_metadata(segments));
+        }
+        else {
+            cost.commit(len, live_metadata(segments));
+        }
+
+        return true;
+    }
+
+    bool remove_segment(uint32_t id) override
+    {
+        segments.erase(id);
+        cost.commit(0, live_metadata(segments));
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t result = 0;
+
+        for (const auto &segment : segments) {
+            result += segment.second.size();
+        }
+
+        return result;
+    }
+
+    std::map<uint32_t, std::vector<uint8_t>> segments;
+    FlashCost cost;
+    size_t segments_written = 0;
+};
+
+static std::vector<uint8_t> make_data(size_t len, uint32_t seed)
+{
+    std::vector<uint8_t> data(len);
+
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = static_cast<uint8_t>(' ' + (seed >> 16) % 95);
+    }
+
+    return data;
+}
+
+// end_of_burst is called whenever writes stopped for the sync delay. Its
+// parameter tells whether the central system is reachable.
+template<typename WriteFn, typename RemoveFn, typename SyncFn>
+static void run_workload(bool online, WriteFn &&write_file, RemoveFn &&remove_file, SyncFn &&end_of_burst)
+{
+    std::vector<uint8_t> config = make_data(CONFIG_SIZE, 1);
+    size_t config_rewrites = 0;
+    size_t first_queued = 0;
+
+    for (size_t msg = 0; msg < MESSAGES; msg += BURST_SIZE) {
+        for (size_t i = msg; i < msg + BURST_SIZE; ++i) {
+            write_file("queue/" + std::to_string(i), make_data(MESSAGE_SIZE, static_cast<uint32_t>(i)));
+        }
+
+        if (msg % CONFIG_REWRITE_INTERVAL == 0) {
+            if (config_rewrites % CONFIG_CHANGE_INTERVAL == 0) {
+                config[config_rewrites % CONFIG_SIZE] ^= 1;
+            }
+
+            ++config_rewrites;
+            write_file("config.json", config);
+        }
+
+        const size_t queued = msg + BURST_SIZE;
+
+        if (online) {
+            for (; first_queued < queued; ++first_queued) {
+                remove_file("queue/" + std::to_string(first_queued));
+            }
+
+            end_of_burst(true);
+            continue;
+        }
+
+        end_of_burst(false);
+
+        if (queued - first_queued < OFFLINE_QUEUE_LENGTH && queued < MESSAGES) {
+            continue;
+        }
+
+        // Connection is back: Each message is removed when its confirmation arrives.
+        while (first_queued < queued) {
+            for (size_t i = 0; i < CONFIRMATIONS_PER_SYNC && first_queued < queued; ++i, ++first_queued) {
+                remove_file("queue/" + std::to_string(first_queued));
+            }
+
+            end_of_burst(true);
+        }
+    }
+}
+
+static void print_cost(const char *name, const FlashCost &cost)
+{
+    printf("  %-8s payload %6.1f B/msg, programmed %6.1f B/msg, %5.2f commits/msg, %6.3f erases/msg\n",
+           name,
+           static_cast<double>(cost.payload_bytes) / MESSAGES,
+           static_cast<double>(cost.programmed_bytes) / MESSAGES,
+           static_cast<double>(cost.commits) / MESSAGES,
+           static_cast<double>(cost.erases) / MESSAGES);
+}
+
+static bool same_files(const FileStorage &files, OcppJournal *journal)
+{
+    if (files.files.size() != journal->get_file_count()) {
+        return false;
+    }
+
+    std::vector<uint8_t> buf;
+
+    for (const auto &file : files.files) {
+        buf.resize(file.second.size());
+
+        if (journal->read(file.first.c_str(), buf.data(), buf.size()) != buf.size() || buf != file.second) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool compare(bool online)
+{
+    FileStorage files;
+
+    run_workload(online,
+        [&files](const std::string &name, const std::vector<uint8_t> &data) { files.write_file(name, data); },
+        [&files](const std::string &name) { files.remove_file(name); },
+        [](bool /*connected*/) {});
+
+    FakeJournalStorage storage;
+    OcppJournal journal{&storage};
+    size_t offline_bursts = 0;
+    size_t compactions = 0;
+
+    journal.load();
+
+    run_workload(online,
+        [&journal](const std::string &name, const std::vector<uint8_t> &data) { journal.write(name.c_str(), data.data(), data.size()); },
+        [&journal](const std::string &name) { journal.remove(name.c_str()); },
+        [&journal, &offline_bursts, &compactions](bool connected) {
+            // The platform syncs after each burst, while offline only after
+            // several bursts. It compacts if necessary.
+            if (!connected && ++offline_bursts % OFFLINE_BURSTS_PER_SYNC != 0) {
+                return;
+            }
+
+            journal.sync();
+
+            if (journal.needs_compaction()) {
+                journal.compact();
+                ++compactions;
+            }
+        });
+
+    journal.sync();
+
+    printf("%s:\n", online ? "online" : "offline");
+    print_cost("files", files.cost);
+    print_cost("journal", storage.cost);
+    printf("  journal: %zu segments written, %zu compactions, final size %zu bytes in %zu segments\n",
+           storage.segments_written, compactions, storage.size(), storage.segments.size());
+
+    OcppJournal reloaded{&storage};
+
+    if (!same_files(files, &journal) || !reloaded.load() || !same_files(files, &reloaded)) {
+        printf("journal does not contain the written files\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool check_recovery()
+{
+    FakeJournalStorage storage;
+    OcppJournal journal{&storage};
+
+    std::vector<uint8_t> a = make_data(100, 1);
+    std::vector<uint8_t> b = make_data(200, 2);
+    std::vector<uint8_t> c = make_data(50, 3);
+
+    // Written and removed before the sync: Must not reach the storage.
+    journal.write("tmp", a.data(), a.size());
+    journal.write("a", a.data(), a.size());
+    journal.remove("tmp");
+    journal.write("dir/b", c.data(), c.size());
+    journal.write("dir/b", b.data(), b.size());
+    journal.sync();
+
+    if (storage.size() != 2 * sizeof(OcppJournalRecordHeader) + strlen("a") + a.size() + strlen("dir/b") + b.size()) {
+        printf("pending records were not dropped\n");
+        return false;
+    }
+
+    journal.write("dir/c", c.data(), c.size());
+    journal.remove("a");
+    journal.sync();
+
+    // Reload unchanged journal
+    OcppJournal reloaded{&storage};
+    uint8_t buf[256];
+
+    if (!reloaded.load() || reloaded.exists("a") || reloaded.read("dir/b", buf, sizeof(buf)) != b.size() || memcmp(buf, b.data(), b.size()) != 0
+     || reloaded.read("dir/c", buf, sizeof(buf)) != c.size()) {
+        printf("reload failed\n");
+        return false;
+    }
+
+    // Flip a bit in dir/c: dir/c and the removal of a must be dropped.
+    storage.segments.rbegin()->second[sizeof(OcppJournalRecordHeader) + 7] ^= 0x10;
+
+    OcppJournal corrupted{&storage};
+
+    if (!corrupted.load() || !corrupted.exists("a") || corrupted.exists("dir/c") || corrupted.read("dir/b", buf, sizeof(buf)) != b.size()
+     || storage.size() != corrupted.get_live_size() || storage.segments.size() != 1) {
+        printf("corruption recovery failed\n");
+        return false;
+    }
+
+    // Torn tail
+    corrupted.write("dir/c", c.data(), c.size());
+    corrupted.sync();
+    storage.segments.rbegin()->second.resize(storage.segments.rbegin()->second.size() - 10);
+
+    OcppJournal torn{&storage};
+
+    if (!torn.load() || torn.exists("dir/c") || !torn.exists("a")) {
+        printf("torn tail recovery failed\n");
+        return false;
+    }
+
+    size_t dirs = 0;
+    size_t files = 0;
+
+    torn.list("", [&dirs, &files](const char * /*name*/, bool is_dir) {
+        if (is_dir) {
+            ++dirs;
+        }
+        else {
+            ++files;
+        }
+    });
+
+    if (dirs != 1 || files != 1) {
+        printf("list failed\n");
+        return false;
+    }
+
+    // Only removal records are left, all segments are obsolete.
+    torn.remove("a");
+    torn.remove("dir/b");
+    torn.sync();
+
+    if (!storage.segments.empty() || torn.get_journal_size() != 0) {
+        printf("obsolete segments were not removed\n");
+        return false;
+    }
+
+    return true;
+}
+
+// The removal records in the segments after the one with "keep" can only go
+// away after "keep" was moved into a newer segment.
+static bool check_compaction()
+{
+    FakeJournalStorage storage;
+    OcppJournal journal{&storage};
+    std::vector<uint8_t> keep = make_data(100, 1);
+    size_t compactions = 0;
+
+    journal.write("keep", keep.data(), keep.size());
+    journal.sync();
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        std::vector<uint8_t> data = make_data(MESSAGE_SIZE, i);
+
+        journal.write(("tmp/" + std::to_string(i)).c_str(), data.data(), data.size());
+
+        if (i > 0) {
+            journal.remove(("tmp/" + std::to_string(i - 1)).c_str());
+        }
+
+        journal.sync();
+
+        if (journal.needs_compaction()) {
+            if (!journal.compact()) {
+                printf("compaction failed\n");
+                return false;
+            }
+
+            ++compactions;
+        }
+
+        if (journal.get_journal_size() > OCPP_JOURNAL_COMPACTION_MIN_SIZE + MESSAGE_SIZE + 100) {
+            printf("journal was not compacted\n");
+            return false;
+        }
+    }
+
+    OcppJournal reloaded{&storage};
+    uint8_t buf[128];
+
+    if (compactions == 0 || !reloaded.load() || reloaded.get_file_count() != 2 || reloaded.read("keep", buf, sizeof(buf)) != keep.size()
+     || memcmp(buf, keep.data(), keep.size()) != 0 || !reloaded.exists("tmp/499")) {
+        printf("compacted journal is broken\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    printf("%d messages of %d bytes in bursts of %d, %d byte config rewritten every %d messages\n",
+           MESSAGES, MESSAGE_SIZE, BURST_SIZE, CONFIG_SIZE, CONFIG_REWRITE_INTERVAL);
+
+    if (!compare(true) || !compare(false) || !check_recovery() || !check_compaction()) {
+        return 1;
+    }
+
+    printf("recovery and compaction checks passed\n");
+
+    return 0;
+}
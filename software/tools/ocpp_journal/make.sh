@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -g -std=c++17 -Wall -Wextra -fsanitize=address,undefined -I. -I../../src/modules/ocpp -o ocpp_journal main.cpp ../../src/modules/ocpp/ocpp_journal.cpp
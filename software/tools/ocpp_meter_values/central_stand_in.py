@@ -0,0 +1,360 @@
+#!/usr/bin/python3 -u
+
+# Local stand-in for an OCPP 1.6 central system, used to measure how much time
+# the charger spends sampling meter values.
+#
+# Set the OCPP URL of the charger to ws://<this host>:<port>/ and build the
+# firmware with OCPP_DEBUG, so that it exposes ocpp/meter_value_stats. After
+# the BootNotification, the stand-in configures the charger to send all
+# supported measurands every --interval seconds as clock-aligned data. If
+# --device is given, the stand-in polls the sampling statistics and reports
+# the sampling cost per MeterValues message.
+#
+# Run with --self-test to check the stand-in with a fake charge point.
+
+import argparse
+import base64
+import datetime
+import hashlib
+import json
+import os
+import socket
+import socketserver
+import struct
+import threading
+import time
+import urllib.request
+
+WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+
+OP_TEXT = 0x1
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+CALL = 2
+CALL_RESULT = 3
+CALL_ERROR = 4
+
+ALL_MEASURANDS = [
+    'Energy.Active.Export.Register',
+    'Energy.Active.Import.Register',
+    'Energy.Reactive.Export.Register',
+    'Energy.Reactive.Import.Register',
+    'Power.Active.Export',
+    'Power.Active.Import',
+    'Power.Offered',
+    'Power.Reactive.Export',
+    'Power.Reactive.Import',
+    'Power.Factor',
+    'Current.Import',
+    'Current.Export',
+    'Current.Offered',
+    'Voltage',
+    'Frequency',
+]
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.messages = 0
+        self.values = 0
+
+    def add(self, values):
+        with self.lock:
+            self.messages += 1
+            self.values += values
+
+    def snapshot(self):
+        with self.lock:
+            return self.messages, self.values
+
+stats = Stats()
+args = None
+
+def recv_exactly(sock, length):
+    buf = b''
+
+    while len(buf) < length:
+        chunk = sock.recv(length - len(buf))
+
+        if not chunk:
+            raise ConnectionError('connection closed')
+
+        buf += chunk
+
+    return buf
+
+def recv_frame(sock):
+    b0, b1 = recv_exactly(sock, 2)
+    opcode = b0 & 0x0F
+    masked = b1 & 0x80
+    length = b1 & 0x7F
+
+    if length == 126:
+        length = struct.unpack('>H', recv_exactly(sock, 2))[0]
+    elif length == 127:
+        length = struct.unpack('>Q', recv_exactly(sock, 8))[0]
+
+    mask = recv_exactly(sock, 4) if masked else None
+    payload = recv_exactly(sock, length)
+
+    if mask is not None:
+        payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+
+    return b0 & 0x80, opcode, payload
+
+def send_frame(sock, opcode, payload, mask=False):
+    header = bytes([0x80 | opcode])
+    mask_bit = 0x80 if mask else 0
+
+    if len(payload) < 126:
+        header += bytes([mask_bit | len(payload)])
+    elif len(payload) < (1 << 16):
+        header += bytes([mask_bit | 126]) + struct.pack('>H', len(payload))
+    else:
+        header += bytes([mask_bit | 127]) + struct.pack('>Q', len(payload))
+
+    if mask:
+        key = os.urandom(4)
+        header += key
+        payload = bytes(b ^ key[i % 4] for i, b in enumerate(payload))
+
+    sock.sendall(header + payload)
+
+# Returns the text of the next complete message, answering pings on the way.
+def recv_message(sock, mask=False):
+    message = b''
+
+    while True:
+        fin, opcode, payload = recv_frame(sock)
+
+        if opcode == OP_PING:
+            send_frame(sock, OP_PONG, payload, mask)
+            continue
+
+        if opcode == OP_CLOSE:
+            raise ConnectionError('connection closed by peer')
+
+        if opcode == OP_PONG:
+            continue
+
+        message += payload
+
+        if fin:
+            return message.decode('utf-8')
+
+def now():
+    return datetime.datetime.now(datetime.timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        request = b''
+
+        while b'\r\n\r\n' not in request:
+            chunk = self.request.recv(4096)
+
+            if not chunk:
+                return
+
+            request += chunk
+
+        lines = request.split(b'\r\n\r\n', 1)[0].decode('latin-1').split('\r\n')
+        headers = {}
+
+        for line in lines[1:]:
+            key, _, value = line.partition(':')
+            headers[key.strip().lower()] = value.strip()
+
+        accept = base64.b64encode(hashlib.sha1((headers.get('sec-websocket-key', '') + WS_GUID).encode()).digest()).decode()
+        response = 'HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: {}\r\n'.format(accept)
+
+        if 'ocpp1.6' in headers.get('sec-websocket-protocol', ''):
+            response += 'Sec-WebSocket-Protocol: ocpp1.6\r\n'
+
+        self.request.sendall((response + '\r\n').encode())
+
+        print('Charge point {} connected from {}'.format(lines[0].split(' ')[1], self.client_address[0]))
+
+        self.next_call_id = 0
+        self.send_lock = threading.Lock()
+
+        try:
+            while True:
+                self.handle_message(json.loads(recv_message(self.request)))
+        except (ConnectionError, OSError) as e:
+            print('Charge point disconnected:', e)
+
+    def send(self, message):
+        with self.send_lock:
+            send_frame(self.request, OP_TEXT, json.dumps(message).encode())
+
+    def call(self, action, payload):
+        self.next_call_id += 1
+        self.send([CALL, 'cs-{}'.format(self.next_call_id), action, payload])
+
+    def configure(self):
+        interval = str(args.interval)
+        measurands = ','.join(args.measurands)
+
+        self.call('ChangeConfiguration', {'key': 'ClockAlignedDataInterval', 'value': interval})
+        self.call('ChangeConfiguration', {'key': 'MeterValuesAlignedData', 'value': measurands})
+        self.call('ChangeConfiguration', {'key': 'MeterValueSampleInterval', 'value': interval})
+        self.call('ChangeConfiguration', {'key': 'MeterValuesSampledData', 'value': measurands})
+
+    def handle_message(self, message):
+        if message[0] == CALL_RESULT:
+            if args.verbose:
+                print('Result', message[1], message[2])
+            return
+
+        if message[0] == CALL_ERROR:
+            print('Error', message[1:])
+            return
+
+        call_id, action, payload = message[1], message[2], message[3]
+        result = {}
+
+        if action == 'BootNotification':
+            result = {'status': 'Accepted', 'currentTime': now(), 'interval': 300}
+        elif action == 'Heartbeat':
+            result = {'currentTime': now()}
+        elif action == 'Authorize':
+            result = {'idTagInfo': {'status': 'Accepted'}}
+        elif action == 'StartTransaction':
+            result = {'transactionId': int(time.time()) & 0x7FFFFFFF, 'idTagInfo': {'status': 'Accepted'}}
+        elif action == 'StopTransaction':
+            result = {'idTagInfo': {'status': 'Accepted'}}
+        elif action == 'MeterValues':
+            values = sum(len(meter_value.get('sampledValue', [])) for meter_value in payload.get('meterValue', []))
+            stats.add(values)
+
+            if args.verbose:
+                print('MeterValues with {} sampled values'.format(values))
+
+        self.send([CALL_RESULT, call_id, result])
+
+        if action == 'BootNotification':
+            self.configure()
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+def get_device_stats():
+    with urllib.request.urlopen(args.device.rstrip('/') + '/ocpp/meter_value_stats', timeout=5) as response:
+        return json.loads(response.read())
+
+def report():
+    last_messages, last_values = stats.snapshot()
+    last_device = None
+
+    while True:
+        time.sleep(args.report_interval)
+
+        messages, values = stats.snapshot()
+        new_messages = messages - last_messages
+        new_values = values - last_values
+        line = '{} MeterValues messages, {} sampled values'.format(new_messages, new_values)
+
+        if args.device is not None:
+            try:
+                device = get_device_stats()
+            except OSError as e:
+                print('Failed to get stats from device:', e)
+                continue
+
+            if last_device is not None and new_messages > 0:
+                sample_us = (device['sample_us'] - last_device['sample_us']) & 0xFFFFFFFF
+                snapshot_us = (device['snapshot_us'] - last_device['snapshot_us']) & 0xFFFFFFFF
+                samples = (device['samples'] - last_device['samples']) & 0xFFFFFFFF
+                snapshots = (device['snapshots'] - last_device['snapshots']) & 0xFFFFFFFF
+
+                line += ', sampling {:.1f} us per message ({:.1f} us in {:.1f} sampling passes), {:.2f} us per sampled value'.format(
+                    sample_us / new_messages,
+                    snapshot_us / new_messages,
+                    snapshots / new_messages,
+                    sample_us / samples if samples > 0 else 0)
+
+            last_device = device
+
+        print(line)
+        last_messages, last_values = messages, values
+
+def self_test(port):
+    sock = socket.create_connection(('127.0.0.1', port))
+    key = base64.b64encode(os.urandom(16)).decode()
+
+    sock.sendall('GET /self-test HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Protocol: ocpp1.6\r\n\r\n'.format(key).encode())
+
+    response = b''
+
+    while b'\r\n\r\n' not in response:
+        response += sock.recv(4096)
+
+    expected_accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+    assert expected_accept in response.decode(), response
+
+    def call(call_id, action, payload):
+        send_frame(sock, OP_TEXT, json.dumps([CALL, call_id, action, payload]).encode(), mask=True)
+
+    call('1', 'BootNotification', {'chargePointVendor': 'Test', 'chargePointModel': 'Test'})
+
+    changed_keys = []
+
+    while len(changed_keys) < 4:
+        message = json.loads(recv_message(sock, mask=True))
+
+        if message[0] == CALL:
+            assert message[2] == 'ChangeConfiguration', message
+            changed_keys.append(message[3]['key'])
+            send_frame(sock, OP_TEXT, json.dumps([CALL_RESULT, message[1], {'status': 'Accepted'}]).encode(), mask=True)
+        else:
+            assert message[0] == CALL_RESULT and message[2]['status'] == 'Accepted', message
+
+    sampled = [{'value': '1.0', 'measurand': m} for m in args.measurands]
+    call('2', 'MeterValues', {'connectorId': 1, 'meterValue': [{'timestamp': now(), 'sampledValue': sampled}]})
+
+    # Larger than 125 bytes to exercise the extended length.
+    assert len(json.dumps(sampled)) > 125
+
+    message = json.loads(recv_message(sock, mask=True))
+    assert message == [CALL_RESULT, '2', {}], message
+
+    send_frame(sock, OP_CLOSE, b'', mask=True)
+    sock.close()
+
+    messages, values = stats.snapshot()
+    assert messages == 1 and values == len(args.measurands), (messages, values)
+    assert 'MeterValuesAlignedData' in changed_keys and 'ClockAlignedDataInterval' in changed_keys, changed_keys
+
+    print('Self-test passed')
+
+def main():
+    global args
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8180)
+    parser.add_argument('--interval', type=int, default=10, help='sample interval in seconds')
+    parser.add_argument('--measurands', type=lambda s: s.split(','), default=ALL_MEASURANDS, help='comma separated list of measurands to sample')
+    parser.add_argument('--device', help='http://<charger>, to read ocpp/meter_value_stats (requires OCPP_DEBUG)')
+    parser.add_argument('--report-interval', type=float, default=60.0)
+    parser.add_argument('--self-test', action='store_true')
+    parser.add_argument('--verbose', action='store_true')
+    args = parser.parse_args()
+
+    server = Server((args.host, 0 if args.self_test else args.port), Handler)
+
+    if args.self_test:
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        self_test(server.server_address[1])
+        server.shutdown()
+        return
+
+    print('Listening on ws://{}:{}/'.format(args.host, args.port))
+    threading.Thread(target=report, daemon=True).start()
+    server.serve_forever()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,188 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Compares the state update loop of the API module with and without the
+// per-state dirty bits (ConfigRoot::track_updates).
+//
+// config.cpp does not build on the host, so the Config trees are modelled:
+// Every node has an updated byte and a tag, objects and arrays reference
+// their children in a shared node buffer like the slot buffers do.
+// Without dirty bits, every tick calls was_updated on every due state,
+// which walks the whole tree. With dirty bits, only states that were
+// updated since the last tick are walked.
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Roughly a WARP charger: ~150 registered states with ~4000 Configs.
+#define STATE_COUNT 150
+#define TICKS 200000
+
+enum class Tag : uint8_t {
+    Leaf,
+    Container,
+};
+
+struct Node {
+    Tag tag;
+    uint8_t updated;
+    uint16_t children_len;
+    uint32_t children_start;
+};
+
+struct State {
+    uint32_t root;
+    bool low_latency;
+    bool dirty;
+};
+
+static std::vector<Node> nodes;
+static std::vector<State> states;
+
+static uint32_t add_tree(uint32_t seed)
+{
+    uint32_t root = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({Tag::Container, 0, 0, 0});
+
+    // Between 4 and 36 members, a quarter of the states has nested objects.
+    uint16_t members = static_cast<uint16_t>(4 + seed % 33);
+    uint32_t start = static_cast<uint32_t>(nodes.size());
+
+    nodes[root].children_len = members;
+    nodes[root].children_start = start;
+
+    for (uint16_t i = 0; i < members; ++i) {
+        nodes.push_back({Tag::Leaf, 0, 0, 0});
+    }
+
+    if (seed % 4 == 0) {
+        for (uint16_t i = 0; i < members; i += 4) {
+            uint32_t child_start = static_cast<uint32_t>(nodes.size());
+
+            for (uint16_t k = 0; k < 4; ++k) {
+                nodes.push_back({Tag::Leaf, 0, 0, 0});
+            }
+
+            nodes[start + i] = {Tag::Container, 0, 4, child_start};
+        }
+    }
+
+    return root;
+}
+
+static uint8_t is_updated(uint32_t idx, uint8_t api_backend_flag, size_t &visits)
+{
+    const Node &node = nodes[idx];
+    uint8_t result = node.updated & api_backend_flag;
+    ++visits;
+
+    if (node.tag == Tag::Container) {
+        for (uint32_t i = 0; i < node.children_len; ++i) {
+            result |= is_updated(node.children_start + i, api_backend_flag, visits);
+        }
+    }
+
+    return result;
+}
+
+static void clear_updated(uint32_t idx)
+{
+    Node &node = nodes[idx];
+    node.updated = 0;
+
+    if (node.tag == Tag::Container) {
+        for (uint32_t i = 0; i < node.children_len; ++i) {
+            clear_updated(node.children_start + i);
+        }
+    }
+}
+
+static void update_leaf(size_t state_idx, uint32_t tick)
+{
+    State &state = states[state_idx];
+    const Node &root = nodes[state.root];
+
+    nodes[root.children_start + tick % root.children_len].updated = 0xFF;
+    state.dirty = true;
+}
+
+// Returns the number of visited Configs.
+static size_t tick(bool use_dirty_bits, bool skip_high_latency_states)
+{
+    size_t visits = 0;
+
+    for (State &state : states) {
+        if (skip_high_latency_states && !state.low_latency) {
+            continue;
+        }
+
+        if (use_dirty_bits && !state.dirty) {
+            continue;
+        }
+
+        if (is_updated(state.root, 0x0F, visits) != 0) {
+            clear_updated(state.root);
+        }
+
+        state.dirty = false;
+    }
+
+    return visits;
+}
+
+static void run(const char *name, bool use_dirty_bits, size_t updates_per_tick)
+{
+    size_t visits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < TICKS; ++i) {
+        for (size_t k = 0; k < updates_per_tick; ++k) {
+            update_leaf((i * 7 + k * 13) % states.size(), i);
+        }
+
+        visits += tick(use_dirty_bits, i % 4 != 0);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printf("%-32s %10.1f ns/tick %8.1f Configs visited/tick\n", name, ns / TICKS, static_cast<double>(visits) / TICKS);
+}
+
+int main()
+{
+    for (uint32_t i = 0; i < STATE_COUNT; ++i) {
+        uint32_t seed = i * 2654435761u >> 7;
+        states.push_back({add_tree(seed), seed % 3 != 0, true});
+    }
+
+    printf("%u states, %zu Configs\n", STATE_COUNT, nodes.size());
+
+    run("idle, walk all", false, 0);
+    run("idle, dirty bits", true, 0);
+    run("5 updates/tick, walk all", false, 5);
+    run("5 updates/tick, dirty bits", true, 5);
+    run("20 updates/tick, walk all", false, 20);
+    run("20 updates/tick, dirty bits", true, 20);
+
+    return 0;
+}
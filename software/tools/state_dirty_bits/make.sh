@@ -0,0 +1,2 @@
+#!/bin/sh
+clang++ -O2 -std=c++17 -Wall -Wextra -o state_dirty_bits main.cpp
@@ -0,0 +1,395 @@
+#!/usr/bin/python3 -u
+
+# Compares the JSON and the CBOR web socket state protocol of a device.
+#
+# Opens one web socket with the default JSON protocol and one with the
+# tf-cbor-v1 subprotocol, checks that both initial state dumps contain the
+# same states and then counts the bytes both connections receive per second.
+# Finally the encoding benchmark of the device is fetched, which reports the
+# encode time of all states in both encodings. It is only available if the
+# firmware was built with DEBUG_FS_ENABLE.
+#
+# Only the Python standard library is used. Authentication is not supported.
+#
+# Run with --self-test to check the CBOR decoder against RFC 8949 examples.
+
+import argparse
+import base64
+import http.client
+import json
+import math
+import os
+import socket
+import struct
+import time
+
+SUBPROTOCOL = 'tf-cbor-v1'
+
+class CBORError(Exception):
+    pass
+
+def cbor_decode(buf, offset=0):
+    if offset >= len(buf):
+        raise CBORError('truncated item')
+
+    initial = buf[offset]
+    major = initial >> 5
+    info = initial & 0x1F
+    offset += 1
+
+    if major == 7:
+        if info == 20:
+            return False, offset
+        if info == 21:
+            return True, offset
+        if info == 22:
+            return None, offset
+        if info == 25:
+            return struct.unpack('>e', buf[offset:offset + 2])[0], offset + 2
+        if info == 26:
+            return struct.unpack('>f', buf[offset:offset + 4])[0], offset + 4
+        if info == 27:
+            return struct.unpack('>d', buf[offset:offset + 8])[0], offset + 8
+
+        raise CBORError('unsupported simple value {}'.format(info))
+
+    if info < 24:
+        value = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+
+        if offset + size > len(buf):
+            raise CBORError('truncated head')
+
+        value = int.from_bytes(buf[offset:offset + size], 'big')
+        offset += size
+    else:
+        raise CBORError('indefinite lengths are not supported')
+
+    if major == 0:
+        return value, offset
+    if major == 1:
+        return -1 - value, offset
+    if major in (2, 3):
+        if offset + value > len(buf):
+            raise CBORError('truncated string')
+
+        data = bytes(buf[offset:offset + value])
+        return (data if major == 2 else data.decode('utf-8')), offset + value
+    if major == 4:
+        result = []
+
+        for _ in range(value):
+            item, offset = cbor_decode(buf, offset)
+            result.append(item)
+
+        return result, offset
+    if major == 5:
+        result = {}
+
+        for _ in range(value):
+            key, offset = cbor_decode(buf, offset)
+            item, offset = cbor_decode(buf, offset)
+            result[key] = item
+
+        return result, offset
+
+    raise CBORError('unsupported major type {}'.format(major))
+
+def cbor_decode_sequence(buf):
+    offset = 0
+
+    while offset < len(buf):
+        item, offset = cbor_decode(buf, offset)
+        yield item
+
+class WebSocket:
+    def __init__(self, host, port, path, subprotocol=None, timeout=10):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.buf = b''
+        self.received_bytes = 0
+
+        key = base64.b64encode(os.urandom(16)).decode('ascii')
+        request = 'GET {} HTTP/1.1\r\nHost: {}\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\n'.format(path, host, key)
+
+        if subprotocol is not None:
+            request += 'Sec-WebSocket-Protocol: {}\r\n'.format(subprotocol)
+
+        self.sock.sendall((request + '\r\n').encode('ascii'))
+
+        while b'\r\n\r\n' not in self.buf:
+            self._recv()
+
+        header, self.buf = self.buf.split(b'\r\n\r\n', 1)
+        lines = header.decode('latin-1').split('\r\n')
+
+        if ' 101 ' not in lines[0]:
+            raise Exception('Handshake failed: {}'.format(lines[0]))
+
+        self.subprotocol = None
+
+        for line in lines[1:]:
+            name, _, value = line.partition(':')
+
+            if name.strip().lower() == 'sec-websocket-protocol':
+                self.subprotocol = value.strip()
+
+    def _recv(self):
+        data = self.sock.recv(65536)
+
+        if len(data) == 0:
+            raise Exception('Connection closed')
+
+        self.received_bytes += len(data)
+        self.buf += data
+
+    def _read(self, n):
+        while len(self.buf) < n:
+            self._recv()
+
+        data, self.buf = self.buf[:n], self.buf[n:]
+        return data
+
+    def _send(self, opcode, payload):
+        mask = os.urandom(4)
+        header = bytes([0x80 | opcode])
+
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        elif len(payload) < 65536:
+            header += bytes([0x80 | 126]) + struct.pack('>H', len(payload))
+        else:
+            header += bytes([0x80 | 127]) + struct.pack('>Q', len(payload))
+
+        self.sock.sendall(header + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload)))
+
+    # Returns (opcode, payload) of the next data frame. Pings are answered.
+    def recv_frame(self):
+        while True:
+            b0, b1 = self._read(2)
+            opcode = b0 & 0x0F
+            length = b1 & 0x7F
+
+            if length == 126:
+                length = struct.unpack('>H', self._read(2))[0]
+            elif length == 127:
+                length = struct.unpack('>Q', self._read(8))[0]
+
+            payload = self._read(length)
+
+            if opcode == 0x9:
+                self._send(0xA, payload)
+                continue
+
+            if opcode == 0x8:
+                raise Exception('Connection closed by device')
+
+            if opcode in (0x1, 0x2):
+                return opcode, payload
+
+    def close(self):
+        self.sock.close()
+
+def read_json_initial_state(ws):
+    states = {}
+    data = ''
+
+    while True:
+        opcode, payload = ws.recv_frame()
+
+        if opcode != 0x1:
+            raise Exception('Unexpected binary frame on JSON connection')
+
+        data += payload.decode('utf-8')
+
+        for line in payload.decode('utf-8').split('\n'):
+            if len(line) > 0:
+                msg = json.loads(line)
+                states[msg['topic']] = msg['payload']
+
+        if data.endswith('\n\n'):
+            return states
+
+def read_cbor_initial_state(ws):
+    paths = {}
+    states = {}
+
+    while True:
+        opcode, payload = ws.recv_frame()
+
+        if opcode == 0x1:
+            # Raw state updates and the keep alive are JSON text frames.
+            for line in payload.decode('utf-8').split('\n'):
+                if len(line) > 0:
+                    msg = json.loads(line)
+                    states[msg['topic']] = msg['payload']
+
+            continue
+
+        for item in cbor_decode_sequence(payload):
+            if item is None:
+                return paths, states
+
+            state_id, path, state = item
+            paths[state_id] = path
+            states[path] = state
+
+def values_equal(a, b):
+    # CBOR floats are single precision, JSON floats are printed with limited precision.
+    if isinstance(a, (int, float)) and isinstance(b, (int, float)) and not isinstance(a, bool) and not isinstance(b, bool):
+        return math.isclose(a, b, rel_tol=1e-5, abs_tol=1e-5)
+
+    if isinstance(a, list) and isinstance(b, list):
+        return len(a) == len(b) and all(values_equal(x, y) for x, y in zip(a, b))
+
+    if isinstance(a, dict) and isinstance(b, dict):
+        return a.keys() == b.keys() and all(values_equal(a[k], b[k]) for k in a)
+
+    return a == b
+
+def compare_states(json_states, cbor_states):
+    mismatches = 0
+
+    for path in sorted(set(json_states) | set(cbor_states)):
+        if path not in cbor_states:
+            print('Missing in CBOR: {}'.format(path))
+            mismatches += 1
+        elif path not in json_states:
+            print('Missing in JSON: {}'.format(path))
+            mismatches += 1
+        elif not values_equal(json_states[path], cbor_states[path]):
+            # States can change between both dumps.
+            print('Differs: {}'.format(path))
+            mismatches += 1
+
+    return mismatches
+
+def measure(json_ws, cbor_ws, duration):
+    json_ws.sock.settimeout(0.05)
+    cbor_ws.sock.settimeout(0.05)
+
+    json_start = json_ws.received_bytes
+    cbor_start = cbor_ws.received_bytes
+    json_messages = 0
+    cbor_messages = 0
+    end = time.monotonic() + duration
+
+    while time.monotonic() < end:
+        for ws in (json_ws, cbor_ws):
+            try:
+                opcode, payload = ws.recv_frame()
+            except socket.timeout:
+                continue
+
+            if ws is json_ws:
+                json_messages += payload.count(b'\n')
+            elif opcode == 0x2:
+                cbor_messages += sum(1 for _ in cbor_decode_sequence(payload))
+            else:
+                cbor_messages += payload.count(b'\n')
+
+    json_bytes = json_ws.received_bytes - json_start
+    cbor_bytes = cbor_ws.received_bytes - cbor_start
+
+    print('JSON: {:8.1f} B/s, {:6.1f} messages/s'.format(json_bytes / duration, json_messages / duration))
+    print('CBOR: {:8.1f} B/s, {:6.1f} messages/s'.format(cbor_bytes / duration, cbor_messages / duration))
+
+    if json_bytes > 0:
+        print('CBOR/JSON: {:.1f} %'.format(100 * cbor_bytes / json_bytes))
+
+def fetch_benchmark(host, port):
+    conn = http.client.HTTPConnection(host, port, timeout=60)
+    conn.request('GET', '/ws/encoding_benchmark')
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+
+    if response.status == 404:
+        print('Encoding benchmark not available: The firmware has to be built with DEBUG_FS_ENABLE')
+        return
+
+    if response.status != 200:
+        print('Encoding benchmark failed: {} {}'.format(response.status, body.decode('utf-8', 'replace')))
+        return
+
+    result = json.loads(body)
+
+    print('Encoding benchmark ({} states, {} iterations):'.format(result['states'], result['iterations']))
+
+    for name in ('json', 'cbor'):
+        r = result[name]
+        print('    {}: {:6} payload bytes, {:6} message bytes, {:6} us'.format(name.upper(), r['payload_bytes'], r['message_bytes'], r['encode_us']))
+
+def self_test():
+    vectors = [
+        ('00', 0),
+        ('17', 23),
+        ('1818', 24),
+        ('1903e8', 1000),
+        ('1a000f4240', 1000000),
+        ('20', -1),
+        ('3903e7', -1000),
+        ('fa47c35000', 100000.0),
+        ('fa3fc00000', 1.5),
+        ('f4', False),
+        ('f5', True),
+        ('f6', None),
+        ('6161', 'a'),
+        ('83010203', [1, 2, 3]),
+        ('a201020304', {1: 2, 3: 4}),
+        ('a26161016162820203', {'a': 1, 'b': [2, 3]}),
+    ]
+
+    for data, expected in vectors:
+        value, offset = cbor_decode(bytes.fromhex(data))
+
+        assert offset == len(data) // 2, data
+        assert value == expected and type(value) == type(expected), (data, value)
+
+    assert list(cbor_decode_sequence(bytes.fromhex('8301647061746801f6'))) == [[1, 'path', 1], None]
+
+    print('Self test passed')
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host', nargs='?')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--duration', type=float, default=30, help='measurement duration in seconds')
+    parser.add_argument('--self-test', action='store_true')
+    args = parser.parse_args()
+
+    if args.self_test:
+        self_test()
+        return
+
+    if args.host is None:
+        parser.error('host is required')
+
+    json_ws = WebSocket(args.host, args.port, '/ws')
+    cbor_ws = WebSocket(args.host, args.port, '/ws', SUBPROTOCOL)
+
+    if cbor_ws.subprotocol != SUBPROTOCOL:
+        print('Device did not accept the {} subprotocol'.format(SUBPROTOCOL))
+        return
+
+    json_dump_start = json_ws.received_bytes
+    json_states = read_json_initial_state(json_ws)
+    json_dump_bytes = json_ws.received_bytes - json_dump_start
+
+    cbor_dump_start = cbor_ws.received_bytes
+    paths, cbor_states = read_cbor_initial_state(cbor_ws)
+    cbor_dump_bytes = cbor_ws.received_bytes - cbor_dump_start
+
+    print('Initial state: JSON {} states, {} bytes; CBOR {} states, {} bytes'.format(len(json_states), json_dump_bytes, len(cbor_states), cbor_dump_bytes))
+    print('{} states differ'.format(compare_states(json_states, cbor_states)))
+
+    print('Measuring for {} seconds...'.format(args.duration))
+    measure(json_ws, cbor_ws, args.duration)
+
+    json_ws.close()
+    cbor_ws.close()
+
+    fetch_benchmark(args.host, args.port)
+
+if __name__ == '__main__':
+    main()
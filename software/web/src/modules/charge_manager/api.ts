@@ -34,12 +34,14 @@ export interface state {
 interface ChargerConfig {
     host: string,
     name: string,
-    rot: number
+    rot: number,
+    sub_manager: boolean
 }
 
 export interface config {
     enable_charge_manager: boolean,
     enable_watchdog: boolean,
+    enable_sub_manager: boolean,
     verbose: boolean,
     default_available_current: number,
     maximum_available_current: number,
@@ -72,6 +74,9 @@ interface ChargerLowLevelState {
 
 export interface low_level_state {
     last_hyst_reset: number,
+    alloc_us: number,
+    alloc_max_us: number,
+    alloc_skipped: number,
     wnd_min: number[],
     wnd_max: number[],
     chargers: ChargerLowLevelState[]
@@ -35,6 +35,7 @@ import { Table } from "../../ts/components/table";
 import type { ChargeManagerStatus } from "./main";
 import { CMPhaseRotation } from "./cm_phase_rotation.enum";
 import { InputFloat } from "../../ts/components/input_float";
+import { Switch } from "../../ts/components/switch";
 
 type ChargeManagerConfig = API.getType["charge_manager/config"];
 type ChargerConfig = ChargeManagerConfig["chargers"][0];
@@ -68,8 +69,8 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
         super('charge_manager/config',
               () => __("charge_manager.script.save_failed"),
               () => __("charge_manager.script.reboot_content_changed"), {
-                  addCharger: {host: "", name: "", rot: -1},
-                  editCharger: {host: "", name: "", rot: -1},
+                  addCharger: {host: "", name: "", rot: -1, sub_manager: false},
+                  editCharger: {host: "", name: "", rot: -1, sub_manager: false},
                   managementEnabled: false,
                   showExpert: false,
                   scanResult: []
@@ -260,7 +261,8 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
         c.unshift({
             host: "127.0.0.1",
             name: name.display_name,
-            rot: CMPhaseRotation.Unknown
+            rot: CMPhaseRotation.Unknown,
+            sub_manager: false
         });
         this.setState({chargers: c})
     }
@@ -429,6 +431,10 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
                                             placeholder={__("select")}
                                             required
                                             />
+                                    <FormRow label={__("charge_manager.content.charger_sub_manager")}>
+                                        <Switch desc={__("charge_manager.content.charger_sub_manager_desc")}
+                                            checked={state.editCharger.sub_manager}
+                                            onClick={() => this.setState({editCharger: {...state.editCharger, sub_manager: !state.editCharger.sub_manager}})}/>
                                     </FormRow>
                                 </>],
                                 onEditSubmit: async () => {
@@ -445,7 +451,7 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
                         addTitle={__("charge_manager.content.add_charger_title")}
                         addMessage={__("charge_manager.content.add_charger_count")(state.chargers.length, MAX_CONTROLLED_CHARGERS)}
                         onAddShow={async () => {
-                            this.setState({addCharger: {name: "", host: "", rot: -1}});
+                            this.setState({addCharger: {name: "", host: "", rot: -1, sub_manager: false}});
                             this.scan_services();
                             this.intervalID = window.setInterval(this.scan_services, 3000);
                         }}
@@ -473,7 +479,7 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
                                             <ListGroupItem key={c.hostname}
                                                         action type="button"
                                                         onClick={c.error != 0 ? undefined : () => {
-                                                            this.setState({addCharger: {host: c.hostname + ".local", name: c.display_name, rot: CMPhaseRotation.Unknown}})
+                                                            this.setState({addCharger: {host: c.hostname + ".local", name: c.display_name, rot: CMPhaseRotation.Unknown, sub_manager: false}})
                                                         }}
                                                         style={c.error == 0 ? "" : "cursor: default; background-color: #eeeeee !important;"}>
                                                 <div class="d-flex w-100 justify-content-between">
@@ -506,6 +512,10 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
                                     placeholder={__("select")}
                                     required
                                     />
+                            <FormRow label={__("charge_manager.content.charger_sub_manager")}>
+                                <Switch desc={__("charge_manager.content.charger_sub_manager_desc")}
+                                    checked={state.addCharger.sub_manager}
+                                    onClick={() => this.setState({addCharger: {...state.addCharger, sub_manager: !state.addCharger.sub_manager}})}/>
                             </FormRow>
                         </>]}
                         onAddSubmit={async () => {
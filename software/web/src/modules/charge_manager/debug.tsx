@@ -195,6 +195,10 @@ export function ChargeManagerDebug(props: {dynamicLoadConfig: API.getType['power
                 <InputText value={(ll_state.last_hyst_reset == 0 ? 0 : util.format_timespan_ms(uptime - ll_state.last_hyst_reset)) + " / " + util.format_timespan(ll_cfg.global_hysteresis)}/>
             </CMDFormRow>
 
+            <CMDFormRow label="Allocation" labelColClasses="col-lg-2" contentColClasses="col-lg-10">
+                <InputText value={ll_state.alloc_us + " µs (max " + ll_state.alloc_max_us + " µs); " + ll_state.alloc_skipped + " skipped"}/>
+            </CMDFormRow>
+
             <CMDFormRow label="">
                 <div class="row d-none d-lg-flex">
                     <div class="col">
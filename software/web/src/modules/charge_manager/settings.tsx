@@ -146,6 +146,12 @@ export class ChargeManagerSettings extends ConfigComponent<'charge_manager/confi
                         onClick={this.toggle("enable_watchdog")}/>
             </FormRow>;
 
+        let sub_manager = <FormRow label={__("charge_manager.content.enable_sub_manager")} label_muted={__("charge_manager.content.enable_sub_manager_muted")}>
+                <Switch desc={__("charge_manager.content.enable_sub_manager_desc")}
+                        checked={state.enable_sub_manager}
+                        onClick={this.toggle("enable_sub_manager")}/>
+            </FormRow>;
+
         let default_available_current = <FormRow label={__("charge_manager.content.default_available_current")} label_muted={__("charge_manager.content.default_available_current_muted")}>
                 <InputFloat
                     unit="A"
@@ -254,6 +260,7 @@ export class ChargeManagerSettings extends ConfigComponent<'charge_manager/confi
                         <div>
                             {verbose}
                             {watchdog}
+                            {sub_manager}
                             {default_available_current}
                             {requested_current_threshold}
                             {requested_current_margin}
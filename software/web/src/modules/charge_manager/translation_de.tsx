@@ -22,6 +22,9 @@ let x = {
             "enable_watchdog": "Watchdog aktiviert",
             "enable_watchdog_muted": "nur bei API-Benutzung aktivieren (für den normalen Lastmanagement-Betrieb nicht notwendig!)",
             "enable_watchdog_desc": "Setzt den verfügbaren Strom auf die Voreinstellung, wenn er nicht spätestens alle 30 Sekunden aktualisiert wurde",
+            "enable_sub_manager": "Unter-Lastmanager",
+            "enable_sub_manager_muted": "für Installationen mit mehr Wallboxen, als ein Lastmanager steuern kann",
+            "enable_sub_manager_desc": "Meldet den Bedarf der gesteuerten Wallboxen an einen übergeordneten Lastmanager und verteilt nur den von diesem zugeteilten Strom. Laden wird blockiert, wenn der übergeordnete Lastmanager 30 Sekunden lang keinen Strom zuteilt.",
             "verbose": "Stromverteilungsprotokoll aktiviert",
             "verbose_desc": "Erzeugt Einträge im Ereignis-Log, wenn Strom umverteilt wird",
             "default_available_current": "Voreingestellt verfügbarer Strom",
@@ -57,6 +60,8 @@ let x = {
             "add_charger_found": "Gefundene Wallboxen",
             "add_charger_count": /*SFN*/(x: number, max: number) => x + " von " + max + " Wallboxen konfiguriert"/*NF*/,
             "add_charger_rotation": "Phasenrotation",
+            "charger_sub_manager": "Unter-Lastmanager",
+            "charger_sub_manager_desc": "Dieses Gerät ist ein Lastmanager im Unter-Lastmanager-Modus, der eigene Wallboxen steuert",
             "charger_rotation_help": <>
                 <p>Gibt an, wie die Wallbox in Relation zum Netzanschluss- bzw. PV-Überschuss-Zähler oder zu den anderen Wallboxen angeschlossen ist. Typischerweise werden nur rechtsdrehende Phasenrotationen verwendet.</p>
                 <p>Eine Wallbox, die, wenn sie einphasig lädt, die Netzanschlussphase L2 belastet, ist dann beispielsweise mit der Phasenrotation L231 angeschlossen.</p>
@@ -22,6 +22,9 @@ let x = {
             "enable_watchdog": "Watchdog enabled",
             "enable_watchdog_muted": "only enable if using the API (not required for normal charge manager use!)",
             "enable_watchdog_desc": "Sets the available current to the default value if it is not updated every 30 seconds",
+            "enable_sub_manager": "Sub-manager",
+            "enable_sub_manager_muted": "for installations with more chargers than one charge manager can control",
+            "enable_sub_manager_desc": "Reports the demand of the managed chargers to an upstream charge manager and only distributes the current granted by it. Charging is blocked if the upstream charge manager does not grant current for 30 seconds.",
             "verbose": "Current distribution log enabled",
             "verbose_desc": "Creates log entries whenever current is redistributed",
             "default_available_current": "Default available current",
@@ -57,6 +60,8 @@ let x = {
             "add_charger_found": "Discovered chargers",
             "add_charger_count": /*SFN*/(x: number, max: number) => x + " of " + max + " chargers configured"/*NF*/,
             "add_charger_rotation": "Phase rotation",
+            "charger_sub_manager": "Sub-manager",
+            "charger_sub_manager_desc": "This device is a charge manager with enabled sub-manager mode that controls its own chargers",
             "charger_rotation_help": <>
                 <p>The chargers connection from the perspective of the grid or PV meter or the other chargers. Usually only positive sequence rotations are used.</p>
                 <p>A charger that only uses the grid phase L2 is then connected with the phase rotation L231.</p>
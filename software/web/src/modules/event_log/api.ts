@@ -3,3 +3,10 @@ export type message = string;
 export interface boot_id {
     boot_id: number;
 }
+
+export interface sinks {
+    serial_lag: number;
+    serial_dropped: number;
+    ws_lag: number;
+    ws_dropped: number;
+}
@@ -46,6 +46,12 @@ const LOG_CHUNK_LEN_DROPPED_WHEN_FULL = 1024 * 1024;
 
 export class EventLog extends Component<{}, EventLogState> {
     last_boot_id = -1;
+    // Device log offset up to which the log is known and the length of the
+    // local log at that point. Lines received via the event_log/message
+    // websocket event are appended after synced_len, but not accounted for in
+    // synced_offset. They are replaced on the next incremental load.
+    synced_offset: string = null;
+    synced_len = 0;
 
     constructor() {
         super();
@@ -65,10 +71,23 @@ export class EventLog extends Component<{}, EventLogState> {
     }
 
     set_log(log: string) {
-        if (log.length > LOG_MAX_LEN)
-            log = log.slice(log.indexOf("\n", LOG_CHUNK_LEN_DROPPED_WHEN_FULL) + 1)
+        if (log.length > LOG_MAX_LEN) {
+            let dropped = log.indexOf("\n", LOG_CHUNK_LEN_DROPPED_WHEN_FULL) + 1;
+            log = log.slice(dropped);
+            this.synced_len -= dropped;
+
+            if (this.synced_len < 0)
+                this.synced_offset = null;
+        }
 
         this.setState({log: log});
+        return log;
+    }
+
+    set_synced_log(log: string, end_offset: string) {
+        log = this.set_log(log);
+        this.synced_offset = end_offset;
+        this.synced_len = log.length;
     }
 
     get_line_date(line: string) {
@@ -87,16 +106,24 @@ export class EventLog extends Component<{}, EventLogState> {
     }
 
     load_event_log(reboot: boolean) {
-        util.download("/event_log")
-            .then(blob => blob.text())
-            .then(text => {
+        let since = reboot || !this.state.log ? null : this.synced_offset;
+
+        util.download_response(since === null ? "/event_log" : "/event_log?since=" + since)
+            .then(async response => [await response.text(), response.headers.get("X-Event-Log-Start"), response.headers.get("X-Event-Log-End")])
+            .then(([text, start_offset, end_offset]) => {
                 util.remove_alert("event_log_load_failed");
 
+                // The device returned exactly the bytes logged since the last load.
+                if (since !== null && start_offset === since) {
+                    this.set_synced_log(this.state.log.slice(0, this.synced_len) + text, end_offset);
+                    return;
+                }
+
                 if (!text || text.length == 0)
                     return;
 
                 if (!this.state.log) {
-                    this.set_log(text);
+                    this.set_synced_log(text, end_offset);
                     return;
                 }
 
@@ -105,7 +132,7 @@ export class EventLog extends Component<{}, EventLogState> {
                 let first_new_date = null;
 
                 if (new_lines.length == 0) {
-                    this.set_log(text);
+                    this.set_synced_log(text, end_offset);
                     return;
                 } else {
                     first_new_line = new_lines[0];
@@ -113,7 +140,7 @@ export class EventLog extends Component<{}, EventLogState> {
                 }
 
                 if (first_new_date == null) {
-                    this.set_log(text);
+                    this.set_synced_log(text, end_offset);
                     return;
                 }
 
@@ -122,7 +149,7 @@ export class EventLog extends Component<{}, EventLogState> {
                 const log = this.state.log.endsWith("\n") ? this.state.log.slice(0, -1) : this.state.log;
 
                 if (reboot) {
-                    this.set_log(log + "\n" + "-".repeat(TIMESTAMP_LEN - 2) + "  [Reboot]\n" + text);
+                    this.set_synced_log(log + "\n" + "-".repeat(TIMESTAMP_LEN - 2) + "  [Reboot]\n" + text, end_offset);
                     return;
                 }
 
@@ -150,7 +177,7 @@ export class EventLog extends Component<{}, EventLogState> {
                 }
 
                 if (i < 0) {
-                    this.set_log(text);
+                    this.set_synced_log(text, end_offset);
                     return;
                 }
 
@@ -161,7 +188,7 @@ export class EventLog extends Component<{}, EventLogState> {
                     new_log += "-".repeat(TIMESTAMP_LEN - 2) + "  [WebSocket reconnect]\n";
                 new_log += text;
 
-                this.set_log(new_log);
+                this.set_synced_log(new_log, end_offset);
             })
             .catch(e => util.add_alert("event_log_load_failed", "danger", () => __("event_log.script.load_event_log_error"), () => e.message))
     }
@@ -33,6 +33,10 @@ import { Upload } from "react-feather";
 import { CheckState } from "./check_state.enum";
 import { InstallState } from "./install_state.enum";
 
+// See src/modules/firmware_update/firmware_container.h
+const FIRMWARE_CONTAINER_MAGIC = 0x5A314654;
+const FIRMWARE_CONTAINER_HEADER_LENGTH = 12;
+
 export function FirmwareUpdateNavbar() {
     return <NavbarItem name="firmware_update" module="firmware_update" title={__("firmware_update.navbar.firmware_update")} symbol={<Upload />} />;
 }
@@ -91,9 +95,46 @@ export class FirmwareUpdate extends Component<{}, FirmwareUpdateState> {
         });
     }
 
+    // Compressed firmware files (see tools/firmware_container) contain the
+    // merged firmware as zlib stream after a 12 byte header. Only the start of
+    // the firmware up to the info page has to be decompressed.
+    async readInfoPage(f: File) {
+        let header = new DataView(await f.slice(0, FIRMWARE_CONTAINER_HEADER_LENGTH).arrayBuffer());
+
+        if (header.byteLength < FIRMWARE_CONTAINER_HEADER_LENGTH || header.getUint32(0, true) != FIRMWARE_CONTAINER_MAGIC) {
+            return f.slice(0xd000 - 0x1000, 0xd000);
+        }
+
+        let image = new Uint8Array(0xd000);
+        let image_len = 0;
+
+        try {
+            let reader = f.slice(FIRMWARE_CONTAINER_HEADER_LENGTH).stream().pipeThrough(new DecompressionStream("deflate")).getReader();
+
+            while (image_len < image.length) {
+                let {done, value} = await reader.read();
+
+                if (done) {
+                    break;
+                }
+
+                let len = Math.min(value.length, image.length - image_len);
+                image.set(value.subarray(0, len), image_len);
+                image_len += len;
+            }
+
+            reader.cancel();
+        }
+        catch {
+            throw __("firmware_update.script.install_state_28");
+        }
+
+        return new Blob([image.subarray(Math.min(0xd000 - 0x1000, image_len), image_len)]);
+    }
+
     async checkFirmware(f: File) {
         try {
-            await util.upload(f.slice(0xd000 - 0x1000, 0xd000), "check_firmware", () => {})
+            await util.upload(await this.readInfoPage(f), "check_firmware", () => {})
         }
         catch (error) {
             let message = "";
@@ -184,7 +225,7 @@ export class FirmwareUpdate extends Component<{}, FirmwareUpdateState> {
                         upload={__("firmware_update.content.install_update")}
                         uploading={__("firmware_update.content.installing_update")}
                         url="/flash_firmware"
-                        accept=".bin"
+                        accept=".bin,.tfz"
                         timeout_ms={120 * 1000}
                         onUploadStart={async (f) => {
                             this.setState({manual_install_in_progress: true});
@@ -11,6 +11,7 @@ export interface config {
     users: User[];
     next_user_id: number;
     http_auth_enabled: boolean;
+    http_auth_session_tokens: boolean;
 }
 
 export interface add {
@@ -38,3 +39,7 @@ export interface modify {
 export interface http_auth {
     enabled: boolean;
 }
+
+export interface session_tokens {
+    enabled: boolean;
+}
@@ -165,11 +165,16 @@ export class Users extends ConfigComponent<'users/config', {}, UsersState> {
         return save_allowed;
     }
 
-    async save_authentication_config(enabled: boolean) {
+    async save_authentication_config(enabled: boolean, session_tokens: boolean) {
         await API.call_unchecked('users/http_auth_update', {
             "enabled": enabled
         },
         () => __("users.script.save_failed"));
+
+        await API.call_unchecked('users/session_tokens_update', {
+            "enabled": session_tokens
+        },
+        () => __("users.script.save_failed"));
     }
 
     user_has_password(u: User) {
@@ -204,7 +209,7 @@ export class Users extends ConfigComponent<'users/config', {}, UsersState> {
             // If we want to disable authentication, do this first,
             // to make sure authentication is never enabled
             // while no user without password is configured.
-            await this.save_authentication_config(new_config.http_auth_enabled);
+            await this.save_authentication_config(new_config.http_auth_enabled, new_config.http_auth_session_tokens);
         }
 
         if (new_config.users[0].display_name == __("charge_tracker.script.unknown_user"))
@@ -254,7 +259,7 @@ export class Users extends ConfigComponent<'users/config', {}, UsersState> {
             next_user_id = Math.max(1, (next_user_id + 1) % 256);
         }
 
-        await this.save_authentication_config(new_config.http_auth_enabled);
+        await this.save_authentication_config(new_config.http_auth_enabled, new_config.http_auth_session_tokens);
 
         await API.save('evse/user_enabled', {"enabled": this.state.userSlotEnabled}, () => __("evse.script.save_failed"), () => __("users.script.reboot_content_changed"));
     }
@@ -271,7 +276,7 @@ export class Users extends ConfigComponent<'users/config', {}, UsersState> {
         let new_users = this.state.users.slice(0);
         new_users = [new_users[0]];
         new_users[0].display_name = "";
-        let new_state = {...this.state, users: [new_users[0]], userSlotEnabled: false, http_auth_enabled: false};
+        let new_state = {...this.state, users: [new_users[0]], userSlotEnabled: false, http_auth_enabled: false, http_auth_session_tokens: false};
 
         this.setState(new_state, this.save);
     }
@@ -357,6 +362,14 @@ export class Users extends ConfigComponent<'users/config', {}, UsersState> {
                         <div class="invalid-feedback">{__("users.content.enable_authentication_invalid")}</div>
                     </FormRow>
 
+                    <FormRow label={__("users.content.session_tokens")}>
+                        <Switch desc={__("users.content.session_tokens_desc")}
+                                checked={state.http_auth_session_tokens}
+                                onClick={this.toggle("http_auth_session_tokens")}
+                                disabled={!(auth_allowed && state.http_auth_enabled)}
+                        />
+                    </FormRow>
+
                     <FormRow label={__("users.content.evse_user_description")} label_muted={__("users.content.evse_user_description_muted")}>
                         <Switch desc={__("users.content.evse_user_enable")}
                                 checked={user_slot_allowed && state.userSlotEnabled}
@@ -14,6 +14,9 @@ let x = {
             "enable_authentication_desc": "Beim Aufrufen des Webinterfaces oder bei Verwendung der HTTP-API muss eine Anmeldung als einer der konfigurieren Benutzer durchgeführt werden",
             "enable_authentication_invalid": "Damit die Anmeldung aktiviert sein kann, muss mindestens ein Benutzer mit einem konfigurierten Passwort vorhanden sein.",
 
+            "session_tokens": "Anmeldung merken",
+            "session_tokens_desc": "Nach einer erfolgreichen Anmeldung erhält der Browser ein für 12 Stunden gültiges Sitzungs-Cookie. Bei Anfragen mit gültigem Cookie muss das Passwort nicht erneut geprüft werden. Alle Sitzungen enden bei einem Neustart oder wenn das Passwort des Benutzers geändert wird.",
+
             "authorized_users": "Berechtigte Benutzer",
 
             "unknown_username": "Anzeigename des unbekannten Benutzers",
@@ -14,6 +14,9 @@ let x = {
             "enable_authentication_desc": "A successful login as one of the configured users is required to open the Web interface or call the HTTP API",
             "enable_authentication_invalid": "To enable the login at least one user with a configured password is required.",
 
+            "session_tokens": "Remember login",
+            "session_tokens_desc": "After a successful login, the browser receives a session cookie valid for 12 hours. Requests with a valid cookie don't have to check the password again. All sessions end on reboot or when the user's password is changed.",
+
             "authorized_users": "Authorized users",
 
             "unknown_username": "Unknown user display name",
@@ -612,6 +612,11 @@ export function upload(data: Blob, url: string, progress: (i: number) => void =
 }
 
 export async function download(url: string) {
+    return await (await download_response(url)).blob();
+}
+
+// Like download, but returns the response to also give access to its headers.
+export async function download_response(url: string) {
     let timeout_ms;
     if (remoteAccessMode) {
         timeout_ms = 10000;
@@ -636,7 +641,7 @@ export async function download(url: string) {
         throw new Error(`${response.status}(${response.statusText}) ${await response.text()}`)
     }
 
-    return await response.blob();
+    return response;
 }
 
 export async function put(url: string, payload: any, timeout_ms: number = 5000) {